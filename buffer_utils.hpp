@@ -1,3 +1,7 @@
+#include <cstdint>
+#include <deque>
+#include <utility>
+
 #include "vulkan/vulkan.h"
 
 #ifndef KLINGON__BUFFER_UTILS_HPP
@@ -48,6 +52,124 @@ namespace vu {
 
 		endSingleTimeCommands(device, commandBuffer, commandPool, queue);
 	}
+
+    // Global memory barrier, enough for everything we do since all of our
+    // resources are buffers
+    void memoryBarrier(VkCommandBuffer commandBuffer,
+        VkPipelineStageFlags srcStage, VkAccessFlags srcAccess,
+        VkPipelineStageFlags dstStage, VkAccessFlags dstAccess) {
+        VkMemoryBarrier barrier{};
+        barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+        barrier.srcAccessMask = srcAccess;
+        barrier.dstAccessMask = dstAccess;
+        vkCmdPipelineBarrier(commandBuffer, srcStage, dstStage, 0, 1, &barrier, 0, nullptr, 0, nullptr);
+    }
+
+    // Barrier for a whole buffer. With different queue families this is one
+    // half of an ownership transfer: record it with the same families on the
+    // releasing queue and again on the acquiring queue.
+    void bufferBarrier(VkCommandBuffer commandBuffer, VkBuffer buffer,
+        uint32_t srcQueueFamily, uint32_t dstQueueFamily,
+        VkPipelineStageFlags srcStage, VkAccessFlags srcAccess,
+        VkPipelineStageFlags dstStage, VkAccessFlags dstAccess) {
+        VkBufferMemoryBarrier barrier{};
+        barrier.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER;
+        barrier.srcAccessMask = srcAccess;
+        barrier.dstAccessMask = dstAccess;
+        barrier.srcQueueFamilyIndex = srcQueueFamily == dstQueueFamily ? VK_QUEUE_FAMILY_IGNORED : srcQueueFamily;
+        barrier.dstQueueFamilyIndex = srcQueueFamily == dstQueueFamily ? VK_QUEUE_FAMILY_IGNORED : dstQueueFamily;
+        barrier.buffer = buffer;
+        barrier.offset = 0;
+        barrier.size = VK_WHOLE_SIZE;
+        vkCmdPipelineBarrier(commandBuffer, srcStage, dstStage, 0, 0, nullptr, 1, &barrier, 0, nullptr);
+    }
+
+    VkDeviceSize alignUp(VkDeviceSize value, VkDeviceSize alignment) {
+        return (value + alignment - 1) / alignment * alignment;
+    }
+
+    // Hands out sub-ranges of a fixed size buffer (e.g. a persistently mapped
+    // staging buffer) in FIFO order. Ranges handed out between two calls to
+    // submit() belong to that submission's serial, and are only recycled once
+    // retire() is called with a serial at least that large.
+    class RingAllocator {
+        public:
+            void reset(VkDeviceSize newCapacity) {
+                capacity = newCapacity;
+                head = 0;
+                tail = 0;
+                used = 0;
+                pendingBytes = 0;
+                inFlight.clear();
+            }
+
+            VkDeviceSize size() const {
+                return capacity;
+            }
+
+            // Returns false if there isn't a contiguous free range big enough,
+            // the caller has to retire some work (or submit what's pending) first
+            bool allocate(VkDeviceSize bytes, VkDeviceSize alignment, VkDeviceSize &offset) {
+                if (bytes == 0 || bytes > capacity) {
+                    return false;
+                }
+                if (used == 0) {
+                    // Nothing live, start from the beginning for the most room
+                    head = 0;
+                    tail = 0;
+                }
+
+                VkDeviceSize start = alignUp(head, alignment);
+                VkDeviceSize consumed;
+                if (head >= tail && used < capacity) {
+                    // Free space is [head, capacity) followed by [0, tail)
+                    if (start + bytes <= capacity) {
+                        consumed = start - head + bytes;
+                    } else if (bytes <= tail) {
+                        // Skip the leftover bit at the end and wrap around
+                        consumed = capacity - head + bytes;
+                        start = 0;
+                    } else {
+                        return false;
+                    }
+                } else if (head < tail && start + bytes <= tail) {
+                    consumed = start - head + bytes;
+                } else {
+                    return false;
+                }
+
+                offset = start;
+                head = start + bytes;
+                used += consumed;
+                pendingBytes += consumed;
+                return true;
+            }
+
+            // Everything allocated since the last submit() is owned by `serial`
+            void submit(uint64_t serial) {
+                if (pendingBytes > 0) {
+                    inFlight.emplace_back(serial, pendingBytes);
+                    pendingBytes = 0;
+                }
+            }
+
+            // Recycle every range owned by a serial <= `completedSerial`
+            void retire(uint64_t completedSerial) {
+                while (!inFlight.empty() && inFlight.front().first <= completedSerial) {
+                    tail = (tail + inFlight.front().second) % capacity;
+                    used -= inFlight.front().second;
+                    inFlight.pop_front();
+                }
+            }
+
+        private:
+            VkDeviceSize capacity = 0;
+            VkDeviceSize head = 0;
+            VkDeviceSize tail = 0;
+            VkDeviceSize used = 0; // Includes alignment padding and wrap waste
+            VkDeviceSize pendingBytes = 0;
+            std::deque<std::pair<uint64_t, VkDeviceSize>> inFlight;
+    };
 } // namespace vu
 
 #endif // KLINGON__BUFFER_UTILS_HPP
\ No newline at end of file
@@ -0,0 +1,41 @@
+# Turns compiled .spv files into a header of constexpr uint32_t arrays plus a
+# table to look them up by name, so the binary doesn't need shaders/ on disk.
+#
+# Run as a script:
+#   cmake -DOUTPUT=<header> -DSHADER_FILES="<a.spv;b.spv>" -P embed_spirv.cmake
+
+set(CONTENT "// Generated by cmake/embed_spirv.cmake, do not edit\n")
+string(APPEND CONTENT "#include <cstddef>\n#include <cstdint>\n\n")
+string(APPEND CONTENT "#ifndef KLINGON__EMBEDDED_SHADERS_HPP\n#define KLINGON__EMBEDDED_SHADERS_HPP\n\n")
+string(APPEND CONTENT "namespace vu {\n")
+string(APPEND CONTENT "    struct EmbeddedShader {\n        const char* name;\n        const uint32_t* code;\n        size_t size; // In bytes\n    };\n\n")
+
+set(TABLE "")
+foreach(SHADER_FILE ${SHADER_FILES})
+    get_filename_component(SHADER_NAME ${SHADER_FILE} NAME_WE)
+
+    file(READ ${SHADER_FILE} HEX HEX)
+    string(LENGTH "${HEX}" HEX_LENGTH)
+    math(EXPR WORD_REMAINDER "${HEX_LENGTH} % 8")
+    if(HEX_LENGTH EQUAL 0 OR NOT WORD_REMAINDER EQUAL 0)
+        message(FATAL_ERROR "${SHADER_FILE} is not a whole number of SPIR-V words")
+    endif()
+
+    # SPIR-V words are little endian on disk, swap each group of four bytes
+    # into a literal, eight to a line (CMake regexes have no {n})
+    string(REGEX REPLACE "(..)(..)(..)(..)" "0x\\4\\3\\2\\1," WORDS "${HEX}")
+    string(REPEAT "0x........," 8 LINE_PATTERN)
+    string(REGEX REPLACE "(${LINE_PATTERN})" "\\1\n        " WORDS "${WORDS}")
+    string(STRIP "${WORDS}" WORDS)
+
+    string(APPEND CONTENT "    constexpr uint32_t ${SHADER_NAME}Spirv[] = {\n        ${WORDS}\n    };\n\n")
+    string(APPEND TABLE "        {\"${SHADER_NAME}\", ${SHADER_NAME}Spirv, sizeof(${SHADER_NAME}Spirv)},\n")
+endforeach()
+
+string(APPEND CONTENT "    constexpr EmbeddedShader embeddedShaders[] = {\n${TABLE}    };\n")
+string(APPEND CONTENT "} // namespace vu\n\n#endif // KLINGON__EMBEDDED_SHADERS_HPP\n")
+
+# Only touch the header when it changes, so main.cpp isn't rebuilt for nothing
+file(WRITE ${OUTPUT}.tmp "${CONTENT}")
+execute_process(COMMAND ${CMAKE_COMMAND} -E copy_if_different ${OUTPUT}.tmp ${OUTPUT})
+file(REMOVE ${OUTPUT}.tmp)
@@ -0,0 +1,408 @@
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <vector>
+
+#include "shape_index_utils.hpp"
+
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+#include <immintrin.h>
+#endif
+
+#ifndef KLINGON__CPU_KERNELS_HPP
+#define KLINGON__CPU_KERNELS_HPP
+
+// The AVX2 paths are compiled with a per function target attribute and only
+// taken if the CPU running us has AVX2, so the binary itself doesn't need it
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+#define KLINGON__CPU_AVX2 1
+#endif
+
+namespace vu {
+    // CPU versions of the grid kernels in shaders/, used by CpuComputeApp.
+    // They do the same float operations in the same order as the shaders
+    // (nothing fused, lights summed in index order) so results can be compared
+    // against the GPU's bit for bit. The one exception is a light right on its
+    // cutoff radius, which rounding can put on either side of a tile's edge.
+    // Every kernel works on a tile of cells, culling primitives for it the
+    // way binning.glsl does, and fills 8 cells of a row at a time with AVX2.
+
+    // One scenario's primitives, laid out like the GPU buffers
+    struct CpuScene {
+        const float* lights;  // (x, y, intensity, attenuation)
+        uint32_t lightCount;
+        const float* circles; // (cx, cy, r)
+        uint32_t circleCount;
+        const float* rects;   // (cx, cy, w, h)
+        uint32_t rectCount;
+        // Binning goes through this instead of looking at every shape if
+        // it's set, see shape_index_utils.hpp
+        const ShapeIndex* index = nullptr;
+    };
+
+    // The cells [x0, x1) x [y0, y1)
+    struct CpuTile {
+        uint32_t x0;
+        uint32_t y0;
+        uint32_t x1;
+        uint32_t y1;
+    };
+
+    // Indices of the primitives that matter to one tile, see binning.glsl
+    struct CpuTileBin {
+        std::vector<uint32_t> lights;
+        std::vector<uint32_t> circles;
+        std::vector<uint32_t> rects;
+    };
+
+    // Same as shaders/common.glsl
+    const float cpuLightCutoff = 1.0f / 256.0f;
+
+    bool cpuHasAvx2() {
+#ifdef KLINGON__CPU_AVX2
+        return __builtin_cpu_supports("avx2");
+#else
+        return false;
+#endif
+    }
+
+    float cpuLightContribution(const float* light, float px, float py) {
+        float dx = light[0] - px;
+        float dy = light[1] - py;
+        return light[2] / (1.0f + light[3] * (dx * dx + dy * dy));
+    }
+
+    float cpuLightRadiusSq(const float* light) {
+        if (light[2] < cpuLightCutoff) {
+            return -1.0f;
+        }
+        if (light[3] <= 0.0f) {
+            return 3.0e38f;
+        }
+        return (light[2] / cpuLightCutoff - 1.0f) / light[3];
+    }
+
+    // The primitives binning.glsl would put in `tile`'s bin, in index order
+    // (shapes in Morton order with a shape index)
+    void cpuBinTile(const CpuScene& scene, CpuTile tile, bool binLights, CpuTileBin& bin) {
+        bin.lights.clear();
+        bin.circles.clear();
+        bin.rects.clear();
+
+        float tileMinX = float(tile.x0);
+        float tileMinY = float(tile.y0);
+        float tileMaxX = float(tile.x1);
+        float tileMaxY = float(tile.y1);
+        float occluderMinX = tileMinX;
+        float occluderMinY = tileMinY;
+        float occluderMaxX = tileMaxX;
+        float occluderMaxY = tileMaxY;
+
+        for (uint32_t i = 0; binLights && i < scene.lightCount; i++) {
+            const float* light = scene.lights + 4 * i;
+            float dx = std::min(std::max(light[0], tileMinX), tileMaxX) - light[0];
+            float dy = std::min(std::max(light[1], tileMinY), tileMaxY) - light[1];
+            if (dx * dx + dy * dy <= cpuLightRadiusSq(light)) {
+                bin.lights.push_back(i);
+                occluderMinX = std::min(occluderMinX, light[0]);
+                occluderMinY = std::min(occluderMinY, light[1]);
+                occluderMaxX = std::max(occluderMaxX, light[0]);
+                occluderMaxY = std::max(occluderMaxY, light[1]);
+            }
+        }
+
+        auto binCircle = [&](uint32_t i) {
+            const float* circle = scene.circles + 3 * i;
+            float dx = std::min(std::max(circle[0], occluderMinX), occluderMaxX) - circle[0];
+            float dy = std::min(std::max(circle[1], occluderMinY), occluderMaxY) - circle[1];
+            if (dx * dx + dy * dy <= circle[2] * circle[2]) {
+                bin.circles.push_back(i);
+            }
+        };
+
+        float boxCentreX = (occluderMinX + occluderMaxX) * 0.5f;
+        float boxCentreY = (occluderMinY + occluderMaxY) * 0.5f;
+        float boxHalfX = (occluderMaxX - occluderMinX) * 0.5f;
+        float boxHalfY = (occluderMaxY - occluderMinY) * 0.5f;
+        auto binRect = [&](uint32_t i) {
+            const float* rect = scene.rects + 4 * i;
+            if (std::fabs(rect[0] - boxCentreX) <= rect[2] * 0.5f + boxHalfX &&
+                    std::fabs(rect[1] - boxCentreY) <= rect[3] * 0.5f + boxHalfY) {
+                bin.rects.push_back(i);
+            }
+        };
+
+        if (scene.index != nullptr) {
+            visitShapeIndex(scene.index->circles, occluderMinX, occluderMinY, occluderMaxX, occluderMaxY, binCircle);
+            visitShapeIndex(scene.index->rects, occluderMinX, occluderMinY, occluderMaxX, occluderMaxY, binRect);
+            return;
+        }
+        for (uint32_t i = 0; i < scene.circleCount; i++) {
+            binCircle(i);
+        }
+        for (uint32_t i = 0; i < scene.rectCount; i++) {
+            binRect(i);
+        }
+    }
+
+    // Scalar versions of the tests in occupancy.glsl and lighting.glsl
+
+    bool cpuCircleOverlapsCell(const float* circle, float cellMinX, float cellMinY) {
+        float dx = std::min(std::max(circle[0], cellMinX), cellMinX + 1.0f) - circle[0];
+        float dy = std::min(std::max(circle[1], cellMinY), cellMinY + 1.0f) - circle[1];
+        return dx * dx + dy * dy < circle[2] * circle[2];
+    }
+
+    bool cpuRectangleOverlapsCell(const float* rect, float cellCentreX, float cellCentreY) {
+        return std::fabs(rect[0] - cellCentreX) < rect[2] * 0.5f + 0.5f &&
+               std::fabs(rect[1] - cellCentreY) < rect[3] * 0.5f + 0.5f;
+    }
+
+    bool cpuSegmentHitsCircle(float px, float py, float dx, float dy, const float* circle) {
+        float toCentreX = circle[0] - px;
+        float toCentreY = circle[1] - py;
+        float t = (toCentreX * dx + toCentreY * dy) / std::max(dx * dx + dy * dy, 1e-12f);
+        t = std::min(std::max(t, 0.0f), 1.0f);
+        float offsetX = toCentreX - t * dx;
+        float offsetY = toCentreY - t * dy;
+        return offsetX * offsetX + offsetY * offsetY < circle[2] * circle[2];
+    }
+
+    bool cpuSegmentHitsRect(float px, float py, float dx, float dy, const float* rect) {
+        float halfX = rect[2] * 0.5f;
+        float halfY = rect[3] * 0.5f;
+        float safeDx = std::fabs(dx) < 1e-12f ? 1e-12f : dx;
+        float safeDy = std::fabs(dy) < 1e-12f ? 1e-12f : dy;
+        float t0x = (rect[0] - halfX - px) / safeDx;
+        float t0y = (rect[1] - halfY - py) / safeDy;
+        float t1x = (rect[0] + halfX - px) / safeDx;
+        float t1y = (rect[1] + halfY - py) / safeDy;
+        float enter = std::max(std::max(std::min(t0x, t1x), std::min(t0y, t1y)), 0.0f);
+        float exit = std::min(std::min(std::max(t0x, t1x), std::max(t0y, t1y)), 1.0f);
+        return enter < exit;
+    }
+
+    bool cpuOccupied(const CpuScene& scene, const CpuTileBin& bin, uint32_t x, uint32_t y) {
+        float cellMinX = float(x);
+        float cellMinY = float(y);
+        for (uint32_t i : bin.circles) {
+            if (cpuCircleOverlapsCell(scene.circles + 3 * i, cellMinX, cellMinY)) {
+                return true;
+            }
+        }
+        for (uint32_t i : bin.rects) {
+            if (cpuRectangleOverlapsCell(scene.rects + 4 * i, cellMinX + 0.5f, cellMinY + 0.5f)) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    float cpuIllumination(const CpuScene& scene, const CpuTileBin& bin, uint32_t x, uint32_t y) {
+        float px = float(x) + 0.5f;
+        float py = float(y) + 0.5f;
+        float illumination = 0.0f;
+        for (uint32_t l : bin.lights) {
+            const float* light = scene.lights + 4 * l;
+            float contribution = cpuLightContribution(light, px, py);
+            if (contribution < cpuLightCutoff) {
+                continue;
+            }
+
+            float dx = light[0] - px;
+            float dy = light[1] - py;
+            bool visible = true;
+            for (size_t s = 0; s < bin.circles.size() && visible; s++) {
+                visible = !cpuSegmentHitsCircle(px, py, dx, dy, scene.circles + 3 * bin.circles[s]);
+            }
+            for (size_t s = 0; s < bin.rects.size() && visible; s++) {
+                visible = !cpuSegmentHitsRect(px, py, dx, dy, scene.rects + 4 * bin.rects[s]);
+            }
+            if (visible) {
+                illumination += contribution;
+            }
+        }
+        return illumination;
+    }
+
+#ifdef KLINGON__CPU_AVX2
+    // 8 wide versions of the above, lane i being cell x + i. Only called when
+    // cpuHasAvx2() says so.
+
+    __attribute__((target("avx2")))
+    __m256 cpuCellXs(uint32_t x) {
+        return _mm256_add_ps(_mm256_set1_ps(float(x)), _mm256_setr_ps(0, 1, 2, 3, 4, 5, 6, 7));
+    }
+
+    __attribute__((target("avx2")))
+    __m256 cpuAbs(__m256 v) {
+        return _mm256_andnot_ps(_mm256_set1_ps(-0.0f), v);
+    }
+
+    __attribute__((target("avx2")))
+    __m256 cpuClamp(__m256 v, __m256 lo, __m256 hi) {
+        return _mm256_min_ps(_mm256_max_ps(v, lo), hi);
+    }
+
+    __attribute__((target("avx2")))
+    __m256 cpuOccupied8(const CpuScene& scene, const CpuTileBin& bin, uint32_t x, uint32_t y) {
+        __m256 cellMinX = cpuCellXs(x);
+        __m256 cellMinY = _mm256_set1_ps(float(y));
+        __m256 one = _mm256_set1_ps(1.0f);
+        __m256 half = _mm256_set1_ps(0.5f);
+        __m256 occupied = _mm256_setzero_ps();
+
+        for (uint32_t i : bin.circles) {
+            const float* circle = scene.circles + 3 * i;
+            __m256 cx = _mm256_set1_ps(circle[0]);
+            __m256 cy = _mm256_set1_ps(circle[1]);
+            __m256 dx = _mm256_sub_ps(cpuClamp(cx, cellMinX, _mm256_add_ps(cellMinX, one)), cx);
+            __m256 dy = _mm256_sub_ps(cpuClamp(cy, cellMinY, _mm256_add_ps(cellMinY, one)), cy);
+            __m256 distSq = _mm256_add_ps(_mm256_mul_ps(dx, dx), _mm256_mul_ps(dy, dy));
+            __m256 r = _mm256_set1_ps(circle[2]);
+            occupied = _mm256_or_ps(occupied, _mm256_cmp_ps(distSq, _mm256_mul_ps(r, r), _CMP_LT_OQ));
+            if (_mm256_movemask_ps(occupied) == 0xFF) {
+                return occupied;
+            }
+        }
+
+        __m256 cellCentreX = _mm256_add_ps(cellMinX, half);
+        __m256 cellCentreY = _mm256_add_ps(cellMinY, half);
+        for (uint32_t i : bin.rects) {
+            const float* rect = scene.rects + 4 * i;
+            __m256 halfX = _mm256_set1_ps(rect[2] * 0.5f + 0.5f);
+            __m256 halfY = _mm256_set1_ps(rect[3] * 0.5f + 0.5f);
+            __m256 insideX = _mm256_cmp_ps(cpuAbs(_mm256_sub_ps(_mm256_set1_ps(rect[0]), cellCentreX)), halfX, _CMP_LT_OQ);
+            __m256 insideY = _mm256_cmp_ps(cpuAbs(_mm256_sub_ps(_mm256_set1_ps(rect[1]), cellCentreY)), halfY, _CMP_LT_OQ);
+            occupied = _mm256_or_ps(occupied, _mm256_and_ps(insideX, insideY));
+            if (_mm256_movemask_ps(occupied) == 0xFF) {
+                return occupied;
+            }
+        }
+        return occupied;
+    }
+
+    __attribute__((target("avx2")))
+    __m256 cpuIllumination8(const CpuScene& scene, const CpuTileBin& bin, uint32_t x, uint32_t y) {
+        __m256 px = _mm256_add_ps(cpuCellXs(x), _mm256_set1_ps(0.5f));
+        __m256 py = _mm256_set1_ps(float(y) + 0.5f);
+        __m256 zero = _mm256_setzero_ps();
+        __m256 one = _mm256_set1_ps(1.0f);
+        __m256 tiny = _mm256_set1_ps(1e-12f);
+        __m256 illumination = zero;
+
+        for (uint32_t l : bin.lights) {
+            const float* light = scene.lights + 4 * l;
+            __m256 dx = _mm256_sub_ps(_mm256_set1_ps(light[0]), px);
+            __m256 dy = _mm256_sub_ps(_mm256_set1_ps(light[1]), py);
+            __m256 dd = _mm256_add_ps(_mm256_mul_ps(dx, dx), _mm256_mul_ps(dy, dy));
+            __m256 contribution = _mm256_div_ps(_mm256_set1_ps(light[2]),
+                _mm256_add_ps(one, _mm256_mul_ps(_mm256_set1_ps(light[3]), dd)));
+            __m256 visible = _mm256_cmp_ps(contribution, _mm256_set1_ps(cpuLightCutoff), _CMP_GE_OQ);
+
+            __m256 safeDd = _mm256_max_ps(dd, tiny);
+            for (size_t s = 0; s < bin.circles.size() && _mm256_movemask_ps(visible) != 0; s++) {
+                const float* circle = scene.circles + 3 * bin.circles[s];
+                __m256 toCentreX = _mm256_sub_ps(_mm256_set1_ps(circle[0]), px);
+                __m256 toCentreY = _mm256_sub_ps(_mm256_set1_ps(circle[1]), py);
+                __m256 t = _mm256_div_ps(_mm256_add_ps(_mm256_mul_ps(toCentreX, dx), _mm256_mul_ps(toCentreY, dy)), safeDd);
+                t = cpuClamp(t, zero, one);
+                __m256 offsetX = _mm256_sub_ps(toCentreX, _mm256_mul_ps(t, dx));
+                __m256 offsetY = _mm256_sub_ps(toCentreY, _mm256_mul_ps(t, dy));
+                __m256 offsetSq = _mm256_add_ps(_mm256_mul_ps(offsetX, offsetX), _mm256_mul_ps(offsetY, offsetY));
+                __m256 r = _mm256_set1_ps(circle[2]);
+                visible = _mm256_andnot_ps(_mm256_cmp_ps(offsetSq, _mm256_mul_ps(r, r), _CMP_LT_OQ), visible);
+            }
+
+            __m256 safeDx = _mm256_blendv_ps(dx, tiny, _mm256_cmp_ps(cpuAbs(dx), tiny, _CMP_LT_OQ));
+            __m256 safeDy = _mm256_blendv_ps(dy, tiny, _mm256_cmp_ps(cpuAbs(dy), tiny, _CMP_LT_OQ));
+            for (size_t s = 0; s < bin.rects.size() && _mm256_movemask_ps(visible) != 0; s++) {
+                const float* rect = scene.rects + 4 * bin.rects[s];
+                float halfX = rect[2] * 0.5f;
+                float halfY = rect[3] * 0.5f;
+                __m256 t0x = _mm256_div_ps(_mm256_sub_ps(_mm256_set1_ps(rect[0] - halfX), px), safeDx);
+                __m256 t0y = _mm256_div_ps(_mm256_sub_ps(_mm256_set1_ps(rect[1] - halfY), py), safeDy);
+                __m256 t1x = _mm256_div_ps(_mm256_sub_ps(_mm256_set1_ps(rect[0] + halfX), px), safeDx);
+                __m256 t1y = _mm256_div_ps(_mm256_sub_ps(_mm256_set1_ps(rect[1] + halfY), py), safeDy);
+                __m256 enter = _mm256_max_ps(_mm256_max_ps(_mm256_min_ps(t0x, t1x), _mm256_min_ps(t0y, t1y)), zero);
+                __m256 exit = _mm256_min_ps(_mm256_min_ps(_mm256_max_ps(t0x, t1x), _mm256_max_ps(t0y, t1y)), one);
+                visible = _mm256_andnot_ps(_mm256_cmp_ps(enter, exit, _CMP_LT_OQ), visible);
+            }
+
+            illumination = _mm256_add_ps(illumination, _mm256_and_ps(contribution, visible));
+        }
+        return illumination;
+    }
+
+    __attribute__((target("avx2")))
+    void cpuOccupancyTileAvx2(const CpuScene& scene, const CpuTileBin& bin, CpuTile tile, float* grid, uint32_t gridWidth) {
+        for (uint32_t y = tile.y0; y < tile.y1; y++) {
+            float* row = grid + size_t(y) * gridWidth;
+            uint32_t x = tile.x0;
+            for (; x + 8 <= tile.x1; x += 8) {
+                _mm256_storeu_ps(row + x, _mm256_and_ps(cpuOccupied8(scene, bin, x, y), _mm256_set1_ps(1.0f)));
+            }
+            for (; x < tile.x1; x++) {
+                row[x] = cpuOccupied(scene, bin, x, y) ? 1.0f : 0.0f;
+            }
+        }
+    }
+
+    __attribute__((target("avx2")))
+    void cpuLightingTileAvx2(const CpuScene& scene, const CpuTileBin& bin, CpuTile tile, float* grid, uint32_t gridWidth) {
+        for (uint32_t y = tile.y0; y < tile.y1; y++) {
+            float* row = grid + size_t(y) * gridWidth;
+            uint32_t x = tile.x0;
+            for (; x + 8 <= tile.x1; x += 8) {
+                _mm256_storeu_ps(row + x, cpuIllumination8(scene, bin, x, y));
+            }
+            for (; x < tile.x1; x++) {
+                row[x] = cpuIllumination(scene, bin, x, y);
+            }
+        }
+    }
+#endif
+
+    // occupancy.glsl for one tile of `grid` (one scenario's layer)
+    void cpuOccupancyTile(const CpuScene& scene, CpuTile tile, float* grid, uint32_t gridWidth,
+                          bool avx2, CpuTileBin& bin) {
+        cpuBinTile(scene, tile, false, bin);
+#ifdef KLINGON__CPU_AVX2
+        if (avx2) {
+            cpuOccupancyTileAvx2(scene, bin, tile, grid, gridWidth);
+            return;
+        }
+#endif
+        for (uint32_t y = tile.y0; y < tile.y1; y++) {
+            for (uint32_t x = tile.x0; x < tile.x1; x++) {
+                grid[x + size_t(y) * gridWidth] = cpuOccupied(scene, bin, x, y) ? 1.0f : 0.0f;
+            }
+        }
+    }
+
+    // lighting.glsl for one tile of `grid` (one scenario's layer)
+    void cpuLightingTile(const CpuScene& scene, CpuTile tile, float* grid, uint32_t gridWidth,
+                         bool avx2, CpuTileBin& bin) {
+        cpuBinTile(scene, tile, true, bin);
+#ifdef KLINGON__CPU_AVX2
+        if (avx2) {
+            cpuLightingTileAvx2(scene, bin, tile, grid, gridWidth);
+            return;
+        }
+#endif
+        for (uint32_t y = tile.y0; y < tile.y1; y++) {
+            for (uint32_t x = tile.x0; x < tile.x1; x++) {
+                grid[x + size_t(y) * gridWidth] = cpuIllumination(scene, bin, x, y);
+            }
+        }
+    }
+
+    // grid.glsl for one tile
+    void cpuFillTile(CpuTile tile, float* grid, uint32_t gridWidth) {
+        for (uint32_t y = tile.y0; y < tile.y1; y++) {
+            std::fill(grid + tile.x0 + size_t(y) * gridWidth, grid + tile.x1 + size_t(y) * gridWidth, 1.0f);
+        }
+    }
+} // namespace vu
+
+#endif // KLINGON__CPU_KERNELS_HPP
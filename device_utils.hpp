@@ -9,11 +9,13 @@
 #define KLINGON__DEVICE_UTILS_HPP
 
 namespace vu {
-    // Holds the locations of each queue family on the device,
-    // for now we just want the compute queue but using this structure
-    // in case we want to expand this later.
+    // Holds the locations of each queue family on the device. Kernels run on
+    // the compute family, and copies go to a transfer-only family (usually a
+    // DMA engine that can run alongside the kernels) if there is one.
     struct QueueFamilyIndices {
         std::optional<uint32_t> computeFamily;
+        uint32_t computeQueueCount = 0;
+        std::optional<uint32_t> transferFamily;
 
         bool isComplete() {
             return computeFamily.has_value();
@@ -31,9 +33,17 @@ namespace vu {
 
         int i = 0;
         for (const auto& queueFamily : queueFamilies) {
-            if (queueFamily.queueFlags & VK_QUEUE_COMPUTE_BIT) {
+            if ((queueFamily.queueFlags & VK_QUEUE_COMPUTE_BIT) && !indicies.computeFamily.has_value()) {
                 indicies.computeFamily = i;
-                break;
+                indicies.computeQueueCount = queueFamily.queueCount;
+            }
+
+            // Compute and graphics queues can copy too, we want the one that
+            // can only copy
+            VkQueueFlags transferOnly = queueFamily.queueFlags &
+                (VK_QUEUE_TRANSFER_BIT | VK_QUEUE_COMPUTE_BIT | VK_QUEUE_GRAPHICS_BIT);
+            if (transferOnly == VK_QUEUE_TRANSFER_BIT && !indicies.transferFamily.has_value()) {
+                indicies.transferFamily = i;
             }
 
             i++;
@@ -42,13 +52,28 @@ namespace vu {
         return indicies;
     }
     
+    // 0 if the queue family can't write timestamps at all
+    uint32_t timestampValidBits(VkPhysicalDevice device, uint32_t queueFamily) {
+        uint32_t queueFamilyCount = 0;
+        vkGetPhysicalDeviceQueueFamilyProperties(device, &queueFamilyCount, nullptr);
+
+        std::vector<VkQueueFamilyProperties> queueFamilies(queueFamilyCount);
+        vkGetPhysicalDeviceQueueFamilyProperties(device, &queueFamilyCount, queueFamilies.data());
+
+        return queueFamilies.at(queueFamily).timestampValidBits;
+    }
+
     // Check if our physical device
     // 1. Can support the correct type of queue structures
     // 2. Can support the selected Vulkan extensions
     bool isDeviceSuitable(VkPhysicalDevice device) {
         QueueFamilyIndices indicies = findQueueFamilies(device);
 
-        return indicies.isComplete();
+        // Timeline semaphores are core (and required) from 1.2
+        VkPhysicalDeviceProperties properties;
+        vkGetPhysicalDeviceProperties(device, &properties);
+
+        return indicies.isComplete() && properties.apiVersion >= VK_API_VERSION_1_2;
     }
 
     uint32_t findMemoryType(uint32_t typeFilter, VkMemoryPropertyFlags properties,
@@ -65,9 +90,26 @@ namespace vu {
 		throw std::runtime_error("failed to find suitable memory type!");
 	}
 
+    bool checkInstanceExtensionSupport(const char* extensionName) {
+        uint32_t extensionCount;
+        vkEnumerateInstanceExtensionProperties(nullptr, &extensionCount, nullptr);
+
+        std::vector<VkExtensionProperties> availableExtensions(extensionCount);
+        vkEnumerateInstanceExtensionProperties(nullptr, &extensionCount, availableExtensions.data());
+
+        for (const auto& extension : availableExtensions) {
+            if (std::string(extension.extensionName) == extensionName) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    // Debug utils is also wanted without validation, for the profiler's
+    // command buffer labels, so take it whenever it's there
     std::vector<const char*> getRequiredExtensions(bool enableValidationLayers) {
         std::vector<const char*> extensions;
-        if (enableValidationLayers) {
+        if (enableValidationLayers || checkInstanceExtensionSupport(VK_EXT_DEBUG_UTILS_EXTENSION_NAME)) {
             extensions.push_back(VK_EXT_DEBUG_UTILS_EXTENSION_NAME);
         }
 
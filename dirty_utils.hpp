@@ -0,0 +1,102 @@
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+#include "cpu_kernels.hpp"
+
+#ifndef KLINGON__DIRTY_UTILS_HPP
+#define KLINGON__DIRTY_UTILS_HPP
+
+namespace vu {
+    // Working out which parts of the grid a change to the shapes or lights
+    // can affect, so only the tiles under them get recomputed. Everything
+    // here is conservative: a box may cover cells that come out the same,
+    // but never misses one that doesn't.
+
+    // [x0, x1] x [y0, y1] in grid units, empty if x1 < x0 or y1 < y0
+    struct GridBox {
+        float x0;
+        float y0;
+        float x1;
+        float y1;
+    };
+
+    GridBox circleBounds(const float* circle) {
+        return {circle[0] - circle[2], circle[1] - circle[2], circle[0] + circle[2], circle[1] + circle[2]};
+    }
+
+    GridBox rectBounds(const float* rect) {
+        float halfX = rect[2] * 0.5f;
+        float halfY = rect[3] * 0.5f;
+        return {rect[0] - halfX, rect[1] - halfY, rect[0] + halfX, rect[1] + halfY};
+    }
+
+    // Everywhere a light gets past lightCutoff, empty for a light too dim to
+    // reach any cell and everything for one that doesn't fall off
+    GridBox lightBounds(const float* light) {
+        float radiusSq = cpuLightRadiusSq(light);
+        if (radiusSq < 0.0f) {
+            return {0.0f, 0.0f, -1.0f, -1.0f};
+        }
+        float radius = std::sqrt(radiusSq);
+        return {light[0] - radius, light[1] - radius, light[0] + radius, light[1] + radius};
+    }
+
+    bool boxesOverlap(const GridBox& a, const GridBox& b) {
+        return a.x0 <= b.x1 && b.x0 <= a.x1 && a.y0 <= b.y1 && b.y0 <= a.y1;
+    }
+
+    // Boxes of entry i of `before` and of `after` for every i where the two
+    // differ, including entries only one of them has
+    template <typename Bounds>
+    void changedEntryBounds(const float* before, uint32_t beforeCount, const float* after, uint32_t afterCount,
+                            uint32_t stride, Bounds bounds, std::vector<GridBox>& boxes) {
+        for (uint32_t i = 0; i < std::max(beforeCount, afterCount); i++) {
+            bool inBefore = i < beforeCount;
+            bool inAfter = i < afterCount;
+            if (inBefore && inAfter && memcmp(before + stride * i, after + stride * i, stride * sizeof(float)) == 0) {
+                continue;
+            }
+            if (inBefore) {
+                boxes.push_back(bounds(before + stride * i));
+            }
+            if (inAfter) {
+                boxes.push_back(bounds(after + stride * i));
+            }
+        }
+    }
+
+    // Where the occupancy kernel's output can differ between the two scenes:
+    // under the old and new position of every circle and rectangle that moved
+    void occupancyChanges(const CpuScene& before, const CpuScene& after, std::vector<GridBox>& boxes) {
+        changedEntryBounds(before.circles, before.circleCount, after.circles, after.circleCount, 3, circleBounds, boxes);
+        changedEntryBounds(before.rects, before.rectCount, after.rects, after.rectCount, 4, rectBounds, boxes);
+    }
+
+    // Same for the lighting kernel. A light that changed affects everything
+    // it reaches (before and after), and a shape that moved can cast or lift
+    // a shadow anywhere a light reaching it reaches.
+    void lightingChanges(const CpuScene& before, const CpuScene& after, std::vector<GridBox>& boxes) {
+        changedEntryBounds(before.lights, before.lightCount, after.lights, after.lightCount, 4, lightBounds, boxes);
+
+        std::vector<GridBox> occluders;
+        occupancyChanges(before, after, occluders);
+        if (occluders.empty()) {
+            return;
+        }
+
+        for (uint32_t i = 0; i < after.lightCount; i++) {
+            GridBox light = lightBounds(after.lights + 4 * i);
+            for (const GridBox& occluder : occluders) {
+                if (boxesOverlap(light, occluder)) {
+                    boxes.push_back(light);
+                    break;
+                }
+            }
+        }
+    }
+} // namespace vu
+
+#endif // KLINGON__DIRTY_UTILS_HPP
@@ -0,0 +1,139 @@
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <stdexcept>
+#include <vector>
+
+#ifndef KLINGON__DISTANCE_UTILS_HPP
+#define KLINGON__DISTANCE_UTILS_HPP
+
+namespace vu {
+    // Signed distance fields by jump flooding, see shaders/distance.glsl.
+    // Every cell tracks two seeds, the nearest obstacle cell it has heard of
+    // and the nearest free cell. The seeding pass points obstacle cells at
+    // themselves for the first and free cells at themselves for the second,
+    // then each flood pass with step k has every cell look at the seeds of
+    // the cells k away (in all 8 directions) and keep whichever are closest.
+    // Steps go N/2, N/4, ..., 1 for the smallest power of two N covering the
+    // grid, plus one more pass with step 1 that fixes most of the cells
+    // plain jump flooding gets slightly wrong.
+    //
+    // The field is the distance (in cells, centre to centre) to the nearest
+    // obstacle minus the distance to the nearest free cell, so positive
+    // outside obstacles and negative inside. Obstacles are cells at 0.5 or
+    // above, i.e. what the occupancy kernel marks.
+
+    // Seeds are packed as x | y << 16, which is what limits the grid size.
+    // Squared distances then fit in 32 bits too.
+    constexpr uint32_t noDistanceSeed = 0xFFFFFFFFu;
+    constexpr uint32_t maxDistanceGridSize = 1u << 15;
+
+    uint32_t packDistanceSeed(uint32_t x, uint32_t y) {
+        return x | (y << 16);
+    }
+
+    // Flood passes after the seeding one
+    uint32_t distanceFloodPasses(uint32_t gridWidth, uint32_t gridHeight) {
+        if (gridWidth > maxDistanceGridSize || gridHeight > maxDistanceGridSize) {
+            throw std::runtime_error("grid is too large for a distance field!");
+        }
+
+        uint32_t halvings = 0;
+        while ((1u << halvings) < std::max(gridWidth, gridHeight)) {
+            halvings++;
+        }
+        return halvings + 1;
+    }
+
+    // Step of flood pass `pass` (1 to `passes`)
+    uint32_t distanceFloodStep(uint32_t pass, uint32_t passes) {
+        return pass < passes ? 1u << (passes - 1 - pass) : 1u;
+    }
+
+    // What a cell with no seed of one kind gets for its distance to it,
+    // further than anything on the grid
+    float missingSeedDistance(uint32_t gridWidth, uint32_t gridHeight) {
+        return float(gridWidth) + float(gridHeight);
+    }
+
+    uint32_t seedDistanceSq(uint32_t seed, uint32_t x, uint32_t y) {
+        uint32_t seedX = seed & 0xFFFFu;
+        uint32_t seedY = seed >> 16;
+        uint32_t dx = seedX > x ? seedX - x : x - seedX;
+        uint32_t dy = seedY > y ? seedY - y : y - seedY;
+        return dx * dx + dy * dy;
+    }
+
+    // Keep `candidate` if it's closer to (x, y) than `best`, ties going to
+    // the smaller seed so the result doesn't depend on the order neighbours
+    // are looked at in
+    void closerSeed(uint32_t candidate, uint32_t x, uint32_t y, uint32_t& best, uint32_t& bestDistanceSq) {
+        if (candidate == noDistanceSeed) {
+            return;
+        }
+        uint32_t distanceSq = seedDistanceSq(candidate, x, y);
+        if (best == noDistanceSeed || distanceSq < bestDistanceSq || (distanceSq == bestDistanceSq && candidate < best)) {
+            best = candidate;
+            bestDistanceSq = distanceSq;
+        }
+    }
+
+    // Replace the occupancy in `layer` with its signed distance field, the
+    // same way distance.glsl does. `seeds` is scratch space.
+    void buildDistanceField(float* layer, uint32_t gridWidth, uint32_t gridHeight, std::vector<uint32_t>& seeds) {
+        uint32_t passes = distanceFloodPasses(gridWidth, gridHeight);
+        size_t cells = size_t(gridWidth) * gridHeight;
+        // Two halves, (obstacle, free) seed pairs, flood passes read one and
+        // write the other
+        seeds.resize(4 * cells);
+
+        for (size_t i = 0; i < cells; i++) {
+            uint32_t self = packDistanceSeed(static_cast<uint32_t>(i % gridWidth), static_cast<uint32_t>(i / gridWidth));
+            bool obstacle = layer[i] >= 0.5f;
+            seeds[2 * i] = obstacle ? self : noDistanceSeed;
+            seeds[2 * i + 1] = obstacle ? noDistanceSeed : self;
+        }
+
+        for (uint32_t pass = 1; pass <= passes; pass++) {
+            const uint32_t* src = seeds.data() + 2 * cells * ((pass - 1) & 1);
+            uint32_t* dst = seeds.data() + 2 * cells * (pass & 1);
+            int64_t step = distanceFloodStep(pass, passes);
+
+            for (uint32_t y = 0; y < gridHeight; y++) {
+                for (uint32_t x = 0; x < gridWidth; x++) {
+                    uint32_t best[2] = {noDistanceSeed, noDistanceSeed};
+                    uint32_t bestDistanceSq[2] = {0, 0};
+                    for (int64_t dy = -step; dy <= step; dy += step) {
+                        for (int64_t dx = -step; dx <= step; dx += step) {
+                            int64_t nx = int64_t(x) + dx;
+                            int64_t ny = int64_t(y) + dy;
+                            if (nx < 0 || ny < 0 || nx >= gridWidth || ny >= gridHeight) {
+                                continue;
+                            }
+                            size_t neighbour = size_t(nx) + size_t(ny) * gridWidth;
+                            closerSeed(src[2 * neighbour], x, y, best[0], bestDistanceSq[0]);
+                            closerSeed(src[2 * neighbour + 1], x, y, best[1], bestDistanceSq[1]);
+                        }
+                    }
+                    size_t i = x + size_t(y) * gridWidth;
+                    dst[2 * i] = best[0];
+                    dst[2 * i + 1] = best[1];
+                }
+            }
+        }
+
+        const uint32_t* result = seeds.data() + 2 * cells * (passes & 1);
+        float missing = missingSeedDistance(gridWidth, gridHeight);
+        for (size_t i = 0; i < cells; i++) {
+            uint32_t x = static_cast<uint32_t>(i % gridWidth);
+            uint32_t y = static_cast<uint32_t>(i / gridWidth);
+            float outside = result[2 * i] == noDistanceSeed ? missing :
+                            std::sqrt(float(seedDistanceSq(result[2 * i], x, y)));
+            float inside = result[2 * i + 1] == noDistanceSeed ? missing :
+                           std::sqrt(float(seedDistanceSq(result[2 * i + 1], x, y)));
+            layer[i] = outside - inside;
+        }
+    }
+} // namespace vu
+
+#endif // KLINGON__DISTANCE_UTILS_HPP
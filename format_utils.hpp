@@ -0,0 +1,185 @@
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+#include <immintrin.h>
+#endif
+
+#ifndef KLINGON__FORMAT_UTILS_HPP
+#define KLINGON__FORMAT_UTILS_HPP
+
+// Like the AVX2 kernels, the F16C paths are per function targets picked at
+// run time
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+#define KLINGON__F16C 1
+#endif
+
+namespace vu {
+    // Host side conversions for the compact grid formats, matching what the
+    // shaders store (see storeCell() in shaders/common.glsl)
+
+    // Largest finite half float, anything further rounds to infinity
+    constexpr float halfMax = 65504.0f;
+    // Above this halves step by more than 1, so whole numbers stop being exact
+    constexpr float halfIntegerMax = 2048.0f;
+
+    // IEEE half float, rounded to nearest even like float16_t()
+    uint16_t floatToHalf(float value) {
+        uint32_t bits;
+        memcpy(&bits, &value, sizeof(bits));
+        uint32_t sign = (bits >> 16) & 0x8000;
+        uint32_t exponent = (bits >> 23) & 0xff;
+        uint32_t mantissa = bits & 0x7fffff;
+
+        // Infinity stays infinity, NaN stays (a quiet) NaN
+        if (exponent == 0xff) {
+            return static_cast<uint16_t>(sign | 0x7c00 | (mantissa != 0 ? 0x200 : 0));
+        }
+
+        int32_t halfExponent = int32_t(exponent) - 127 + 15;
+        if (halfExponent >= 31) {
+            return static_cast<uint16_t>(sign | 0x7c00);
+        }
+
+        // Too small for a normal half, shift the mantissa (with its implicit
+        // bit) down into a subnormal
+        if (halfExponent <= 0) {
+            if (halfExponent < -10) {
+                return static_cast<uint16_t>(sign);
+            }
+            mantissa |= 0x800000;
+            uint32_t shift = static_cast<uint32_t>(14 - halfExponent);
+            uint32_t half = mantissa >> shift;
+            uint32_t remainder = mantissa & ((1u << shift) - 1);
+            uint32_t halfway = 1u << (shift - 1);
+            if (remainder > halfway || (remainder == halfway && (half & 1))) {
+                half++;
+            }
+            return static_cast<uint16_t>(sign | half);
+        }
+
+        // Rounding up can carry into the exponent, which is still right (all
+        // the way up to infinity)
+        uint32_t half = (uint32_t(halfExponent) << 10) | (mantissa >> 13);
+        uint32_t remainder = mantissa & 0x1fff;
+        if (remainder > 0x1000 || (remainder == 0x1000 && (half & 1))) {
+            half++;
+        }
+        return static_cast<uint16_t>(sign | half);
+    }
+
+    float halfToFloat(uint16_t half) {
+        uint32_t sign = uint32_t(half & 0x8000) << 16;
+        uint32_t exponent = (half >> 10) & 0x1f;
+        uint32_t mantissa = half & 0x3ff;
+
+        uint32_t bits;
+        if (exponent == 0x1f) {
+            bits = sign | 0x7f800000 | (mantissa << 13);
+        } else if (exponent != 0) {
+            bits = sign | ((exponent + 112) << 23) | (mantissa << 13);
+        } else if (mantissa == 0) {
+            bits = sign;
+        } else {
+            // Subnormal half, normal float
+            exponent = 113;
+            while (!(mantissa & 0x400)) {
+                mantissa <<= 1;
+                exponent--;
+            }
+            bits = sign | (exponent << 23) | ((mantissa & 0x3ff) << 13);
+        }
+
+        float value;
+        memcpy(&value, &bits, sizeof(value));
+        return value;
+    }
+
+    // [0, 1] in 256 steps, anything outside is clamped
+    uint8_t floatToUnorm8(float value) {
+        return static_cast<uint8_t>(std::floor(std::min(std::max(value, 0.0f), 1.0f) * 255.0f + 0.5f));
+    }
+
+    // A multiply rather than a divide, so loadCell() gets the same bits
+    float unorm8ToFloat(uint8_t value) {
+        return float(value) * (1.0f / 255.0f);
+    }
+
+    bool cpuHasF16c() {
+#ifdef KLINGON__F16C
+        return __builtin_cpu_supports("f16c");
+#else
+        return false;
+#endif
+    }
+
+#ifdef KLINGON__F16C
+    __attribute__((target("avx,f16c")))
+    void floatsToHalvesF16c(const float* src, uint16_t* dst, size_t count) {
+        size_t i = 0;
+        for (; i + 8 <= count; i += 8) {
+            __m128i halves = _mm256_cvtps_ph(_mm256_loadu_ps(src + i), _MM_FROUND_TO_NEAREST_INT);
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i), halves);
+        }
+        for (; i < count; i++) {
+            dst[i] = floatToHalf(src[i]);
+        }
+    }
+
+    __attribute__((target("avx,f16c")))
+    void halvesToFloatsF16c(const uint16_t* src, float* dst, size_t count) {
+        size_t i = 0;
+        for (; i + 8 <= count; i += 8) {
+            __m128i halves = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i));
+            _mm256_storeu_ps(dst + i, _mm256_cvtph_ps(halves));
+        }
+        for (; i < count; i++) {
+            dst[i] = halfToFloat(src[i]);
+        }
+    }
+#endif
+
+    // Whole arrays at a time, 8 values per instruction with F16C. The scalar
+    // and F16C paths give the same bits.
+    void floatsToHalves(const float* src, uint16_t* dst, size_t count) {
+#ifdef KLINGON__F16C
+        static const bool f16c = cpuHasF16c();
+        if (f16c) {
+            floatsToHalvesF16c(src, dst, count);
+            return;
+        }
+#endif
+        for (size_t i = 0; i < count; i++) {
+            dst[i] = floatToHalf(src[i]);
+        }
+    }
+
+    void halvesToFloats(const uint16_t* src, float* dst, size_t count) {
+#ifdef KLINGON__F16C
+        static const bool f16c = cpuHasF16c();
+        if (f16c) {
+            halvesToFloatsF16c(src, dst, count);
+            return;
+        }
+#endif
+        for (size_t i = 0; i < count; i++) {
+            dst[i] = halfToFloat(src[i]);
+        }
+    }
+
+    void floatsToUnorm8s(const float* src, uint8_t* dst, size_t count) {
+        for (size_t i = 0; i < count; i++) {
+            dst[i] = floatToUnorm8(src[i]);
+        }
+    }
+
+    void unorm8sToFloats(const uint8_t* src, float* dst, size_t count) {
+        for (size_t i = 0; i < count; i++) {
+            dst[i] = unorm8ToFloat(src[i]);
+        }
+    }
+} // namespace vu
+
+#endif // KLINGON__FORMAT_UTILS_HPP
@@ -10,10 +10,35 @@
 #include "debug_utils.hpp"
 #include "device_utils.hpp"
 #include "buffer_utils.hpp"
+#include "tuning_utils.hpp"
+#include "pipeline_utils.hpp"
+#include "shader_utils.hpp"
+#include "profiler_utils.hpp"
+#include "thread_utils.hpp"
+#include "cpu_kernels.hpp"
+#include "dirty_utils.hpp"
+#include "format_utils.hpp"
+#include "pyramid_utils.hpp"
+#include "distance_utils.hpp"
+#include "planner_utils.hpp"
+#include "reduce_utils.hpp"
+#include "query_utils.hpp"
+#include "shape_index_utils.hpp"
+#include "shm_ring_utils.hpp"
 #define VMA_IMPLEMENTATION
 #include "vk_mem_alloc.h"
 
-#include <fstream>
+#include <algorithm>
+#include <chrono>
+#include <cstddef>
+#include <cstdlib>
+#include <deque>
+#include <limits>
+#include <map>
+#include <memory>
+#include <optional>
+#include <string>
+#include <thread>
 
 #ifdef NDEBUG
 	const bool enableValidationLayers = false;
@@ -33,471 +58,3707 @@ struct LightSource {
     glm::vec4 light;
 };
 
-struct GridCell {
-    int x;
-    int y;
-    float val;
+// One independent problem in a batch (e.g. one candidate robot pose): its
+// own shapes and lights, evaluated into its own layer of the grid
+struct Scenario {
+    std::vector<Circle> circles;
+    std::vector<Rectangle> rectangles;
+    std::vector<LightSource> lights;
 };
 
+// Where one scenario's primitives sit in the shared shape buffers, must match
+// `Scenario` in shaders/common.glsl
+struct ScenarioRange {
+    uint32_t lightOffset;
+    uint32_t lightCount;
+    uint32_t circleOffset;
+    uint32_t circleCount;
+    uint32_t rectOffset;
+    uint32_t rectCount;
+    // Where the scenario's circle leaves and clusters start in the shape
+    // index, its rectangle ones right after (see shape_index_common.glsl)
+    uint32_t indexLeafOffset;
+    uint32_t indexClusterOffset;
+};
+
+// Lay `scenarios` out back to back in one array per primitive kind, the way
+// the shape buffers hold them, with where each one ended up in `ranges`
+void packScenarios(const std::vector<Scenario>& scenarios, std::vector<Circle>& circles,
+                   std::vector<Rectangle>& rectangles, std::vector<LightSource>& lights,
+                   std::vector<ScenarioRange>& ranges) {
+    uint32_t leaves = 0;
+    uint32_t clusters = 0;
+    for (const Scenario& scenario : scenarios) {
+        ScenarioRange range{};
+        range.lightOffset = static_cast<uint32_t>(lights.size());
+        range.lightCount = static_cast<uint32_t>(scenario.lights.size());
+        range.circleOffset = static_cast<uint32_t>(circles.size());
+        range.circleCount = static_cast<uint32_t>(scenario.circles.size());
+        range.rectOffset = static_cast<uint32_t>(rectangles.size());
+        range.rectCount = static_cast<uint32_t>(scenario.rectangles.size());
+        range.indexLeafOffset = leaves;
+        range.indexClusterOffset = clusters;
+        leaves += vu::shapeIndexLeafCount(range.circleCount) + vu::shapeIndexLeafCount(range.rectCount);
+        clusters += vu::shapeIndexClusterCount(range.circleCount) + vu::shapeIndexClusterCount(range.rectCount);
+        ranges.push_back(range);
+
+        lights.insert(lights.end(), scenario.lights.begin(), scenario.lights.end());
+        circles.insert(circles.end(), scenario.circles.begin(), scenario.circles.end());
+        rectangles.insert(rectangles.end(), scenario.rectangles.begin(), scenario.rectangles.end());
+    }
+}
+
+// One scenario's slice of the packed arrays, as the CPU kernels take it
+vu::CpuScene sceneView(const ScenarioRange& range, const std::vector<Circle>& circles,
+                       const std::vector<Rectangle>& rectangles, const std::vector<LightSource>& lights) {
+    vu::CpuScene scene;
+    scene.lights = reinterpret_cast<const float*>(lights.data()) + 4 * size_t(range.lightOffset);
+    scene.lightCount = range.lightCount;
+    scene.circles = reinterpret_cast<const float*>(circles.data()) + 3 * size_t(range.circleOffset);
+    scene.circleCount = range.circleCount;
+    scene.rects = reinterpret_cast<const float*>(rectangles.data()) + 4 * size_t(range.rectOffset);
+    scene.rectCount = range.rectCount;
+    return scene;
+}
+
+// Push constants shared by every grid kernel, must match `PushConstants` in
+// shaders/common.glsl. Shape counts live in the scenario table instead, so
+// changing them doesn't mean re-recording anything.
+struct GridPushConstants {
+    uint32_t gridWidth;
+    uint32_t gridHeight;
+    uint32_t binLights;
+    uint32_t tileWidth;
+    uint32_t tileHeight;
+    uint32_t scenarioCount;
+    // Reductions only, from ReductionSettings
+    float reduceThreshold;
+    float histogramMin;
+    float histogramScale;
+    uint32_t reduceGroupCount;
+    // Pyramid only, the level being built
+    uint32_t pyramidLevel;
+    // Queries only
+    uint32_t queryCount;
+    uint32_t queryPyramid;
+    // Distance field only, see recordDistanceField()
+    uint32_t distancePasses;
+    uint32_t distancePass;
+    // Cost-to-go only, see recordCostToGo()
+    uint32_t goalX;
+    uint32_t goalY;
+    uint32_t plannerPass;
+    uint32_t plannerIteration;
+    // Binning: whether to go through the shape index. Building it, see
+    // recordShapeIndex(): the pass, the digit being sorted on and how many
+    // entries there are.
+    uint32_t shapeIndex;
+    uint32_t indexPass;
+    uint32_t indexShift;
+    uint32_t indexEntryCount;
+};
+
+// Threads per workgroup of a 2D kernel, which is also the size of the tiles
+// it's dispatched over (and binning.glsl builds lists for)
+struct WorkgroupSize {
+    uint32_t x;
+    uint32_t y;
+};
+
+// What runComputeShader() records into the command buffer
+enum class GridKernel {
+    Fill,      // grid.glsl, sets every cell to 1
+    // The two below run binning.glsl first so each tile only sees nearby shapes
+    Occupancy, // occupancy.glsl, marks cells covered by any circle/rectangle
+    Lighting,  // lighting.glsl, sums visible light from every light source
+    Distance,  // Occupancy, then distance.glsl turns it into a signed
+               // distance field (see distance_utils.hpp)
+    CostToGo,  // Occupancy, then planner.glsl turns it into the cost of
+               // getting to the planner's goal (see setPlanner())
+};
+
+// How the grid is stored on the GPU, and so what gets read back. The host
+// side (GridManager, readbackGrid()) always deals in floats.
+enum class GridFormat {
+    Float32, // Exact
+    Float16, // Half floats, needs storageBuffer16BitAccess
+    Unorm8,  // [0, 1] in 256 steps, clamped. Needs storageBuffer8BitAccess.
+};
+
+size_t gridCellSize(GridFormat format) {
+    switch (format) {
+        case GridFormat::Float16:
+            return sizeof(uint16_t);
+        case GridFormat::Unorm8:
+            return sizeof(uint8_t);
+        default:
+            return sizeof(float);
+    }
+}
+
+// The suffix of the shader builds for `format`, see GRID_FORMAT_SHADERS in
+// CMakeLists.txt
+std::string gridFormatSuffix(GridFormat format) {
+    switch (format) {
+        case GridFormat::Float16:
+            return "_fp16";
+        case GridFormat::Unorm8:
+            return "_unorm8";
+        default:
+            return "";
+    }
+}
+
+// The --format names
+GridFormat parseGridFormat(const std::string& name) {
+    if (name == "fp32") {
+        return GridFormat::Float32;
+    } else if (name == "fp16") {
+        return GridFormat::Float16;
+    } else if (name == "unorm8") {
+        return GridFormat::Unorm8;
+    }
+    throw std::runtime_error("unknown grid format " + name + "!");
+}
+
+// Throw if `kernel` can't store its results as `format` on a `gridWidth` x
+// `gridHeight` grid. Unorm8 clamps to [0, 1], which leaves nothing of
+// distances or costs. Half floats hold costs exactly up to
+// vu::halfIntegerMax, round them to steps of 2 and more above it, and turn
+// anything past vu::halfMax into infinity, i.e. unreachable, so CostToGo only
+// takes them on grids where no path can cost that much.
+void checkKernelFormat(GridKernel kernel, GridFormat format, uint32_t gridWidth, uint32_t gridHeight) {
+    bool outputsDistances = kernel == GridKernel::Distance || kernel == GridKernel::CostToGo;
+    if (outputsDistances && format == GridFormat::Unorm8) {
+        throw std::runtime_error("unorm8 grids can't hold distances or costs!");
+    }
+    if (kernel == GridKernel::CostToGo && format == GridFormat::Float16 &&
+            vu::plannerCostBound(gridWidth, gridHeight) > vu::halfMax) {
+        throw std::runtime_error("grid is too large for fp16 costs-to-go!");
+    }
+}
+
+// `count` floats into `format`, rounded like the shaders round them
+void encodeGridValues(GridFormat format, const float* src, void* dst, size_t count) {
+    switch (format) {
+        case GridFormat::Float32:
+            memcpy(dst, src, count * sizeof(float));
+            break;
+        case GridFormat::Float16:
+            vu::floatsToHalves(src, static_cast<uint16_t*>(dst), count);
+            break;
+        case GridFormat::Unorm8:
+            vu::floatsToUnorm8s(src, static_cast<uint8_t*>(dst), count);
+            break;
+    }
+}
+
+void decodeGridValues(GridFormat format, const void* src, float* dst, size_t count) {
+    switch (format) {
+        case GridFormat::Float32:
+            memcpy(dst, src, count * sizeof(float));
+            break;
+        case GridFormat::Float16:
+            vu::halvesToFloats(static_cast<const uint16_t*>(src), dst, count);
+            break;
+        case GridFormat::Unorm8:
+            vu::unorm8sToFloats(static_cast<const uint8_t*>(src), dst, count);
+            break;
+    }
+}
+
+// What setReduction() asks for. When enabled, every run also boils each
+// scenario's layer down to a GridStats, see readbackStats().
+struct ReductionSettings {
+    bool enabled = false;
+    // countAbove and the bounding box are of the cells above this
+    float threshold = 0.5f;
+    // The histogram splits [histogramMin, histogramMax) into equal bins,
+    // values outside it go in the first or last one
+    float histogramMin = 0.0f;
+    float histogramMax = 1.0f;
+};
+
+// What the CostToGo kernel plans towards, see setPlanner()
+struct PlannerSettings {
+    // Same goal cell for every scenario
+    uint32_t goalX = 0;
+    uint32_t goalY = 0;
+    // Sweeps a run has, the GPU stops early once one changes nothing. 0
+    // picks enough for open maps from the grid size, mazes with long
+    // detours can need more. A run that runs out of sweeps can't be read
+    // back, see readbackPlannerStatus().
+    uint32_t maxIterations = 0;
+};
+
+// How a CostToGo run went, must match `PlannerStatus` in
+// shaders/planner.glsl. Costs of a run that didn't converge are too high in
+// places, but still the cost of a real path.
+struct PlannerStatus {
+    uint32_t iterations; // Sweeps that ran, 0 on the CPU (which runs Dijkstra)
+    uint32_t converged;
+    uint32_t pad0;
+    uint32_t pad1;
+};
+
+// Bins per unit of the histogram, see vu::histogramBin()
+float histogramScale(const ReductionSettings& settings) {
+    if (!(settings.histogramMax > settings.histogramMin)) {
+        throw std::runtime_error("histogram range is empty!");
+    }
+    return float(vu::gridHistogramBins) / (settings.histogramMax - settings.histogramMin);
+}
+
+// Host side copy of the grid values, stored exactly like the GPU buffer: one
+// flat row major float array with cell (x, y) at x + y * gridWidth. Cell
+// coordinates are derived from the index rather than stored, and uploading
+// the whole grid is a single memcpy. The array is page aligned so it can be
+// handed to the driver directly as well.
 class GridManager {
     public:
-        // Grid Info
-        std::vector<GridCell> grid;
-        int gridWidth = 20;
-        int gridHeight = 20;
+        // Grid Info, change these through resize()
+        uint32_t gridWidth = 0;
+        uint32_t gridHeight = 0;
 
-        GridManager(){
-            for (int i = 0; i < gridHeight; i++){
-                for (int j = 0; j < gridWidth; j++){
-                    GridCell cell{i, j, 0.0};
-                    grid.push_back(cell);
-                }
+        static constexpr size_t valueAlignment = 4096;
+
+        GridManager(uint32_t width = 20, uint32_t height = 20){
+            resize(width, height);
+        }
+
+        // Every cell starts out at 0 again after a resize
+        void resize(uint32_t width, uint32_t height){
+            // Kernels index cells with a 32 bit uint
+            if (width == 0 || height == 0 || uint64_t(width) * height > UINT32_MAX) {
+                throw std::runtime_error("unsupported grid dimensions!");
+            }
+            gridWidth = width;
+            gridHeight = height;
+
+            size_t allocationSize = vu::alignUp(sizeBytes(), valueAlignment);
+            values.reset(static_cast<float*>(std::aligned_alloc(valueAlignment, allocationSize)));
+            if (!values) {
+                throw std::runtime_error("failed to allocate grid values!");
             }
+            std::fill_n(values.get(), cellCount(), 0.0f);
         }
-};
 
-class VulkanComputeApp {
-    public:
-        VulkanComputeApp(){
-            initVulkan();
+        size_t cellCount() const {
+            return size_t(gridWidth) * gridHeight;
         }
 
-        ~VulkanComputeApp() {
-            cleanup();
+        VkDeviceSize sizeBytes() const {
+            return cellCount() * sizeof(float);
+        }
+
+        size_t index(uint32_t x, uint32_t y) const {
+            return x + size_t(y) * gridWidth;
+        }
+
+        uint32_t cellX(size_t index) const {
+            return index % gridWidth;
+        }
+
+        uint32_t cellY(size_t index) const {
+            return index / gridWidth;
+        }
+
+        float& at(uint32_t x, uint32_t y) {
+            return values[index(x, y)];
+        }
+
+        float* data() {
+            return values.get();
+        }
+
+        const float* data() const {
+            return values.get();
         }
+
     private:
-        // Grid stuff
-        GridManager gridManager;
+        struct AlignedFree {
+            void operator()(float* p) const {
+                std::free(p);
+            }
+        };
+        std::unique_ptr<float[], AlignedFree> values;
+};
 
-        VkInstance instance;
-        VkDebugUtilsMessengerEXT debugMessenger;
+// Record types of a shape update ring (see vu::ShmRing), which is how
+// another local process (e.g. the sensor stack) feeds us. Each record
+// replaces that kind of primitive of the scenario outright, its payload
+// being the array of them exactly as the shape buffers hold them, so it can
+// be copied to the GPU as is. Only for batches of one scenario, like
+// setCircles() and friends.
+enum class ShapeUpdateType : uint32_t {
+    Circles = 1,
+    Rectangles = 2,
+    Lights = 3,
+};
 
-        // Devices
-        VkPhysicalDevice physicalDevice = VK_NULL_HANDLE;
-        VkDevice device;
+// The newest update of each type waiting in a ring
+struct ShapeUpdates {
+    std::optional<vu::ShmRecord> circles;
+    std::optional<vu::ShmRecord> rectangles;
+    std::optional<vu::ShmRecord> lights;
+};
 
-        // Queues
-        VkQueue computeQueue;
-        VkCommandPool commandPool;
-        VkCommandBuffer commandBuffer;
+// Read everything the producer has committed so far, keeping the newest
+// record of each type since the older ones are replaced anyway. Releasing
+// them is up to the caller, once it's done with the payloads.
+ShapeUpdates readShapeUpdates(vu::ShmRing& ring) {
+    ShapeUpdates updates;
+    vu::ShmRecord record;
+    while (ring.read(record)) {
+        size_t stride;
+        std::optional<vu::ShmRecord>* latest;
+        switch (static_cast<ShapeUpdateType>(record.type)) {
+            case ShapeUpdateType::Circles:
+                stride = sizeof(Circle);
+                latest = &updates.circles;
+                break;
+            case ShapeUpdateType::Rectangles:
+                stride = sizeof(Rectangle);
+                latest = &updates.rectangles;
+                break;
+            case ShapeUpdateType::Lights:
+                stride = sizeof(LightSource);
+                latest = &updates.lights;
+                break;
+            default:
+                throw std::runtime_error("unknown shape update type " + std::to_string(record.type) + "!");
+        }
+        if (record.size % stride != 0) {
+            throw std::runtime_error("shape update payload isn't a whole number of shapes!");
+        }
+        *latest = record;
+    }
+    return updates;
+}
 
-        // Descriptor sets - define resources provided to shaders
-        // See https://docs.vulkan.org/spec/latest/chapters/descriptorsets.html
-        // for more details
-        int num_bindings = 1; // for grid, lights, circles, rectangles
-        VkDescriptorSetLayout descriptorSetLayout;
-        VkDescriptorPool descriptorPool;
-        VkDescriptorSet descriptorSet;
+// Copy a record's payload out of the ring, for the host side copies of the
+// shapes
+template <typename T>
+std::vector<T> shapeUpdatePayload(const vu::ShmRecord& record) {
+    const T* first = static_cast<const T*>(record.payload);
+    return std::vector<T>(first, first + record.size / sizeof(T));
+}
 
-        // Buffers for shapes
-        VkBuffer gridBuffer;
-        VkDeviceMemory gridBufferMemory;
-        VkDeviceSize gridBufferSize;
-        // VkBuffer circleBuffer;
-        // VkDeviceSize circleBufferSize;
-        // VkBuffer rectBuffer;
-        // VkDeviceSize rectBufferSize;
-        // VkBuffer lightBuffer; 
-        // VkDeviceSize lightBufferSize;
+// What main() drives, so it doesn't need to know whether the kernels run on
+// the GPU (VulkanComputeApp) or the CPU (CpuComputeApp). A run is identified
+// by the serial runComputeShader() returns, and its grid can be read back
+// until `framesInFlight` more runs have been started.
+class GridBackend {
+    public:
+        virtual ~GridBackend() = default;
 
-        // VMA
-        VmaAllocator allocator;
-        VmaAllocation gridAllocation;
+        virtual uint64_t runComputeShader() = 0;
+        virtual void waitForCompute() = 0;
+        virtual const float* readbackGrid(uint64_t serial) = 0;
+        // One GridStats per scenario, for runs made with a reduction enabled
+        virtual const vu::GridStats* readbackStats(uint64_t serial) = 0;
+        // For runs of the CostToGo kernel. If `converged` is 0 the run ran
+        // out of sweeps (see PlannerSettings::maxIterations) with some costs
+        // still too high, and readbackGrid() and readbackStats() throw for
+        // it rather than hand them out. Callers planning over maps that may
+        // need more sweeps should check this first.
+        virtual const PlannerStatus* readbackPlannerStatus(uint64_t serial) = 0;
 
-        // Compute pipeline
-        VkPipelineLayout computePipelineLayout;
-        VkPipeline computePipeline;
+        // Evaluate a batch of queries against the grid of run `serial`
+        // (which has to be still available, like for readbackGrid()) without
+        // waiting for them. Returns a ticket for the two below.
+        virtual uint64_t submitQueries(uint64_t serial, const std::vector<vu::GridQuery>& queries) = 0;
+        virtual bool queriesFinished(uint64_t ticket) = 0;
+        // One result per query, in order, waiting for them if need be. Valid
+        // until the next batch against a run of the same frame.
+        virtual const vu::GridQueryResult* readbackQueries(uint64_t ticket) = 0;
 
-        void initVulkan() {
-            createInstance();
-            if (enableValidationLayers){
-                vu::setupDebugMessenger(instance, debugMessenger);
+        virtual void uploadGrid(const float* values) = 0;
+        virtual void resizeGrid(uint32_t width, uint32_t height) = 0;
+        virtual const GridManager& getGridManager() const = 0;
+
+        virtual void setKernel(GridKernel kernel) = 0;
+        virtual void setGridFormat(GridFormat format) = 0;
+        virtual GridFormat getGridFormat() const = 0;
+        virtual void setReduction(const ReductionSettings& settings) = 0;
+        virtual void setPlanner(const PlannerSettings& settings) = 0;
+        // Whether runs finish by building a min/max pyramid over the grid
+        // (see pyramid_utils.hpp) for hierarchical region queries
+        virtual void setPyramid(bool enabled) = 0;
+        // Whether binning finds shapes through a spatial index (see
+        // shape_index_utils.hpp) rather than testing every one of them. Worth
+        // it with lots of shapes, the index is only rebuilt when they change.
+        virtual void setShapeIndex(bool enabled) = 0;
+        // Whether runs copy their grid back for readbackGrid(). Turning it
+        // off for consumers that only need readbackStats() saves copying the
+        // whole grid every run.
+        virtual void setGridReadback(bool enabled) = 0;
+        virtual void setCircles(const std::vector<Circle>& circles) = 0;
+        virtual void setRectangles(const std::vector<Rectangle>& rectangles) = 0;
+        virtual void setLights(const std::vector<LightSource>& lights) = 0;
+        virtual void setScenarios(const std::vector<Scenario>& scenarios) = 0;
+        virtual uint32_t getScenarioCount() const = 0;
+        // Apply whatever updates are waiting in `ring` (see ShapeUpdateType),
+        // as if they'd come through setCircles() and friends, without
+        // waiting for more. The ring has to outlive the backend.
+        virtual void ingestShapeUpdates(vu::ShmRing& ring) = 0;
+};
+
+class VulkanComputeApp : public GridBackend {
+    public:
+        // Up to `framesInFlight` runs can be queued on the GPU at once, each
+        // with its own grid, readback and command buffers
+        VulkanComputeApp(uint32_t gridWidth = 20, uint32_t gridHeight = 20, uint32_t framesInFlight = 2)
+            : gridManager(gridWidth, gridHeight), frames(framesInFlight) {
+            if (framesInFlight == 0) {
+                throw std::runtime_error("need at least one frame in flight!");
             }
-            pickPhysicalDevice();
-            createLogicalDevice();
-            
-            // Create the buffers needed for objects we use in compute pipeline
-            createVmaAllocator();
-            initializeAppBuffers();
-            
-            // Create descriptors we can use to handle these buffers
-            // (See below for a nice reference)
-            // https://vkguide.dev/docs/chapter-4/descriptors/#mental-model
-            createDescriptorSetLayout();
-            createComputePipeline();
-            createDescriptorPool();
-            createDescriptorSets();
-            // Create the command buffers
-            createCommandPool();
-            createCommandBuffer();
+            for (uint32_t i = 0; i < framesInFlight; i++) {
+                frames[i].index = i;
+            }
+            initVulkan();
         }
 
-        void runComputeShader() {
-            return;
+        ~VulkanComputeApp() override {
+            cleanup();
         }
 
-        static std::vector<char> readFile(const std::string& filename) {
-            std::ifstream file(filename, std::ios::ate | std::ios::binary);
+        // Kick off one run of the grid kernel on the next frame. Each frame's
+        // command buffers are recorded once and re-submitted every time its
+        // turn comes round, so the only per-tick host cost is waiting for that
+        // frame's previous run (`framesInFlight` runs ago) and the submits.
+        // A run is up to three submissions: any uploads queued since the last
+        // call on the transfer queue, the kernel on one of the compute queues,
+        // and the copy into the frame's readback buffer back on the transfer
+        // queue, chained together with timeline semaphore waits.
+        uint64_t runComputeShader() override {
+            Frame& frame = frames[nextFrame];
+            nextFrame = (nextFrame + 1) % frames.size();
+            Queue& computeQueue = computeQueues[frame.index % computeQueues.size()];
+
+            // The command buffers can't be resubmitted (or re-recorded) while
+            // they're still pending
+            waitForSerial(frame.serial);
 
-            if (!file.is_open()) {
-                throw std::runtime_error("failed to open file!");
+            bool buildsIndex = shapeIndexEnabled && frame.indexStale;
+            if (buildsIndex) {
+                prepareShapeIndex(frame);
+            }
+            if (!frame.recorded) {
+                recordFrameCommandBuffers(frame);
             }
 
-            // Preallocate a buffer for the size of the opened file
-            size_t fileSize = (size_t) file.tellg();
-            std::vector<char> buffer(fileSize);
+            // Only the tiles something changed in since this frame last ran
+            // get recomputed, the rest of its grid is still right
+            memcpy(frame.dirtyMaskMapped, frame.dirtyMask.data(), frame.dirtyMask.size() * sizeof(uint32_t));
+            vmaFlushAllocation(allocator, frame.dirtyMaskAllocation, 0, VK_WHOLE_SIZE);
+            std::fill(frame.dirtyMask.begin(), frame.dirtyMask.end(), 0u);
 
-            // Now we can read all the bytes at once
-            file.seekg(0);
-            file.read(buffer.data(), fileSize);
+            std::vector<VkCommandBuffer> computeCommandBuffers;
+            std::vector<VkCommandBuffer> profiledCommandBuffers;
+            bool acquires = recordUploadCommandBuffers(frame);
+            if (acquires) {
+                submitUpload(frame);
+                computeCommandBuffers.push_back(frame.acquireCommandBuffer);
+                profiledCommandBuffers.push_back(frame.uploadCommandBuffer);
+            }
+            if (buildsIndex) {
+                computeCommandBuffers.push_back(frame.indexCommandBuffer);
+                profiledCommandBuffers.push_back(frame.indexCommandBuffer);
+                frame.indexStale = false;
+            }
+            computeCommandBuffers.push_back(frame.commandBuffer);
 
-            file.close();
+            // Every kernel waits for the latest upload, whichever run (and so
+            // whichever compute queue) it came with, and for the acquire that
+            // finished handing its buffers over, which only ran on that
+            // run's queue
+            uint64_t computeValue = submitCommandBuffers(computeQueue, computeCommandBuffers,
+                {{&transferQueue, lastUploadValue}, {lastAcquireQueue, lastAcquireValue}},
+                VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT);
+            if (acquires) {
+                lastAcquireQueue = &computeQueue;
+                lastAcquireValue = computeValue;
+            }
+            frame.serial = submitCommandBuffers(transferQueue, {frame.readbackCommandBuffer},
+                {{&computeQueue, computeValue}}, VK_PIPELINE_STAGE_TRANSFER_BIT);
 
-            return buffer;
+            profiledCommandBuffers.push_back(frame.commandBuffer);
+            profiledCommandBuffers.push_back(frame.readbackCommandBuffer);
+            profiler.submitted(frame.serial, profiledCommandBuffers);
+            return frame.serial;
         }
 
-        void createInstance() {
-            if (enableValidationLayers && !vu::checkValidationLayerSupport()){
-                throw std::runtime_error("validation layers requested but not available!");
+        // Block until everything submitted so far, on every queue, has
+        // finished on the GPU
+        void waitForCompute() override {
+            std::vector<VkSemaphore> semaphores;
+            std::vector<uint64_t> values;
+            for (const Queue& queue : computeQueues) {
+                semaphores.push_back(queue.timeline);
+                values.push_back(queue.submittedValue);
             }
-        
-            VkApplicationInfo appInfo{};
-            appInfo.sType = VK_STRUCTURE_TYPE_APPLICATION_INFO;
-            appInfo.pApplicationName = "Grid Intersection App";
-            appInfo.applicationVersion = VK_MAKE_VERSION(1, 0, 0);
-            appInfo.pEngineName = "No Engine";
-            appInfo.engineVersion = VK_MAKE_VERSION(1, 0, 0);
-            appInfo.apiVersion = VK_API_VERSION_1_3;
+            semaphores.push_back(transferQueue.timeline);
+            values.push_back(transferQueue.submittedValue);
 
-            VkInstanceCreateInfo createInfo{};
-            createInfo.sType = VK_STRUCTURE_TYPE_INSTANCE_CREATE_INFO;
-            createInfo.pApplicationInfo = &appInfo;
+            VkSemaphoreWaitInfo waitInfo{};
+            waitInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_WAIT_INFO;
+            waitInfo.semaphoreCount = static_cast<uint32_t>(semaphores.size());
+            waitInfo.pSemaphores = semaphores.data();
+            waitInfo.pValues = values.data();
 
-            std::vector<const char*> reqExtensions;
-            auto extensions = vu::getRequiredExtensions(enableValidationLayers);
-            createInfo.enabledExtensionCount = static_cast<uint32_t>(extensions.size());
-            createInfo.ppEnabledExtensionNames = extensions.data();
+            if (vkWaitSemaphores(device, &waitInfo, UINT64_MAX) != VK_SUCCESS) {
+                throw std::runtime_error("failed to wait for timeline semaphores!");
+            }
+            retireSerials();
+        }
 
-            VkDebugUtilsMessengerCreateInfoEXT debugCreateInfo{};
-            if (enableValidationLayers) {
-                createInfo.enabledLayerCount = static_cast<u_int32_t>(vu::validationLayers.size());
-                createInfo.ppEnabledLayerNames = vu::validationLayers.data();
+        // Block until run (or upload) `serial` has finished on the GPU.
+        // Serials are values of the transfer queue's timeline, since that's
+        // where every run ends.
+        void waitForSerial(uint64_t serial) {
+            if (serial <= completedSerial) {
+                return;
+            }
 
-                vu::populateDebugMessengerCreateInfo(debugCreateInfo);
-                createInfo.pNext = (VkDebugUtilsMessengerCreateInfoEXT*) &debugCreateInfo;
-            } else {
-                createInfo.enabledLayerCount = 0;
+            VkSemaphoreWaitInfo waitInfo{};
+            waitInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_WAIT_INFO;
+            waitInfo.semaphoreCount = 1;
+            waitInfo.pSemaphores = &transferQueue.timeline;
+            waitInfo.pValues = &serial;
 
-                createInfo.pNext = nullptr;
+            if (vkWaitSemaphores(device, &waitInfo, UINT64_MAX) != VK_SUCCESS) {
+                throw std::runtime_error("failed to wait for timeline semaphore!");
             }
+            retireSerials();
+        }
 
-            if (vkCreateInstance(&createInfo, nullptr, &instance) != VK_SUCCESS) {
-                throw std::runtime_error("failed to create instance!");
+        // Returns the grid produced by the submission `serial`, waiting for it
+        // if it's still running. The pointer stays valid until that frame
+        // comes round again, i.e. `framesInFlight` more runs, so the caller
+        // can consume frame N while the GPU is busy with the ones after it.
+        // With a batch of scenarios the layers come one after another,
+        // scenario s starting at s * getGridManager().cellCount(). Compact
+        // grid formats are converted to floats on the first call for each
+        // run, see readbackGridData() to skip that. When the grid is host
+        // visible this is the grid itself, which uploadGrid() overwrites too.
+        const float* readbackGrid(uint64_t serial) override {
+            Frame& frame = readbackFrame(serial);
+            if (gridFormat == GridFormat::Float32) {
+                return static_cast<const float*>(readbackData(frame));
             }
 
+            if (frame.decodedSerial != serial) {
+                frame.decodedValues.resize(gridManager.cellCount() * scenarioCount);
+                decodeGridValues(gridFormat, readbackData(frame), frame.decodedValues.data(), frame.decodedValues.size());
+                frame.decodedSerial = serial;
+            }
+            return frame.decodedValues.data();
         }
 
-        void pickPhysicalDevice() {
-            uint32_t deviceCount = 0;
-            // If output is a nullptr, get the # of physical devices
-            vkEnumeratePhysicalDevices(instance, &deviceCount, nullptr);
+        // Like readbackGrid(), but the values as the GPU stored them, in
+        // getGridFormat()
+        const void* readbackGridData(uint64_t serial) {
+            return readbackData(readbackFrame(serial));
+        }
 
-            if (deviceCount == 0) {
-                throw std::runtime_error("failed to find any GPUs with Vulkan support!");
+        // The GridStats of every scenario of run `serial`, computed on the
+        // GPU, valid for as long as readbackGrid() would be
+        const vu::GridStats* readbackStats(uint64_t serial) override {
+            Frame& frame = finishedFrame(serial);
+            if (!frame.reduces) {
+                throw std::runtime_error("requested run had no reduction enabled!");
             }
+            checkPlannerConverged(frame);
+            vmaInvalidateAllocation(allocator, frame.statsAllocation, 0, VK_WHOLE_SIZE);
+            return static_cast<const vu::GridStats*>(frame.statsMapped);
+        }
 
-            std::vector<VkPhysicalDevice> devices(deviceCount);
-            // // This has different behavior when we call it a second time
-            // // It now allocates pointers to the physical devices into the vector
-            vkEnumeratePhysicalDevices(instance, &deviceCount, devices.data());
+        // Written by the run's last planner pass, valid for as long as
+        // readbackGrid() would be
+        const PlannerStatus* readbackPlannerStatus(uint64_t serial) override {
+            Frame& frame = finishedFrame(serial);
+            if (!frame.plans) {
+                throw std::runtime_error("requested run was not of the cost-to-go kernel!");
+            }
+            vmaInvalidateAllocation(allocator, frame.plannerStatusAllocation, 0, VK_WHOLE_SIZE);
+            return static_cast<const PlannerStatus*>(frame.plannerStatusMapped);
+        }
 
-            for (const auto& device : devices) {
-                // For now, we pick the first device
-                if (vu::isDeviceSuitable(device)) {
-                    physicalDevice = device;
-                    break;
-                }
+        // The batch is written straight into the frame's host visible query
+        // buffer and run on the frame's compute queue right behind its
+        // kernel, so all that waits is a frame's previous batch (and, if the
+        // batch outgrew the query buffers, the run itself). Rectangle,
+        // segment and ray queries go through the pyramid when it's enabled.
+        uint64_t submitQueries(uint64_t serial, const std::vector<vu::GridQuery>& queries) override {
+            auto it = std::find_if(frames.begin(), frames.end(),
+                [&](const Frame& f) { return f.serial != 0 && f.serial == serial; });
+            if (it == frames.end()) {
+                throw std::runtime_error("requested run is not available for queries!");
             }
+            Frame& frame = *it;
+            Queue& computeQueue = computeQueues[frame.index % computeQueues.size()];
 
-            if (physicalDevice == VK_NULL_HANDLE) {
-                throw std::runtime_error("failed to find a suitable GPU!");
+            // The query command buffer and buffers can't be touched while the
+            // previous batch is pending
+            waitForQueue(computeQueue, frame.queryValue);
+            if (queries.size() > frame.queryCapacity) {
+                // The descriptor set can't change under the run either
+                waitForSerial(frame.serial);
+                destroyQueryBuffers(frame);
+                createQueryBuffers(frame, std::max<VkDeviceSize>(queries.size(), frame.queryCapacity * 2));
+                writeQueryDescriptors(frame);
+                frame.recorded = false;
             }
+
+            memcpy(frame.queryMapped, queries.data(), queries.size() * sizeof(vu::GridQuery));
+            vmaFlushAllocation(allocator, frame.queryAllocation, 0, VK_WHOLE_SIZE);
+            recordQueryCommandBuffer(frame, static_cast<uint32_t>(queries.size()));
+
+            // Same queue as the run's kernel, the barrier at the start of
+            // the batch takes care of its writes
+            frame.queryValue = submitCommandBuffers(computeQueue, {frame.queryCommandBuffer});
+            frame.queryTicket = ++lastQueryTicket;
+            return frame.queryTicket;
         }
 
-        void createLogicalDevice(){
-            vu::QueueFamilyIndices indices = vu::findQueueFamilies(physicalDevice);
+        bool queriesFinished(uint64_t ticket) override {
+            Frame& frame = queryFrame(ticket);
+            const Queue& computeQueue = computeQueues[frame.index % computeQueues.size()];
 
-            std::vector<VkDeviceQueueCreateInfo> queueCreateInfos;
-            std::set<uint32_t> uniqueQueueFamilies = {indices.computeFamily.value()};
-            
-            // Double check whether this is needed or not since we're
-            // only using the compute queue
-            float queuePriority = 1.0f;
-            for (uint32_t queueFamily : uniqueQueueFamilies) {
-                VkDeviceQueueCreateInfo queueCreateInfo{};
-                queueCreateInfo.sType = VK_STRUCTURE_TYPE_DEVICE_QUEUE_CREATE_INFO;
-                queueCreateInfo.queueFamilyIndex = indices.computeFamily.value();
-                queueCreateInfo.queueCount = 1;
-                queueCreateInfo.pQueuePriorities = &queuePriority;
-                queueCreateInfos.push_back(queueCreateInfo);
+            uint64_t completed;
+            if (vkGetSemaphoreCounterValue(device, computeQueue.timeline, &completed) != VK_SUCCESS) {
+                throw std::runtime_error("failed to read timeline semaphore!");
             }
+            return completed >= frame.queryValue;
+        }
 
-            VkPhysicalDeviceFeatures deviceFeatures{};
-
-            VkDeviceCreateInfo createInfo{};
-            createInfo.sType = VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO;
-            createInfo.queueCreateInfoCount = static_cast<uint32_t>(queueCreateInfos.size());
-            createInfo.pQueueCreateInfos = queueCreateInfos.data();
+        const vu::GridQueryResult* readbackQueries(uint64_t ticket) override {
+            Frame& frame = queryFrame(ticket);
+            waitForQueue(computeQueues[frame.index % computeQueues.size()], frame.queryValue);
 
-            createInfo.pEnabledFeatures = &deviceFeatures;
+            // Host cached, like the readback
+            vmaInvalidateAllocation(allocator, frame.queryResultAllocation, 0, VK_WHOLE_SIZE);
+            return static_cast<const vu::GridQueryResult*>(frame.queryResultMapped);
+        }
 
-            createInfo.enabledExtensionCount = 0; 
-            createInfo.ppEnabledExtensionNames = nullptr; 
+        // Replace the contents of every frame's grid, every scenario's layer
+        // getting the same `values`. On devices where the grids ended up host
+        // visible (integrated GPUs, lavapipe) this writes them in place,
+        // otherwise the values go through the staging ring and are copied in
+        // at the start of the next submission.
+        void uploadGrid(const float* values) override {
+            VkDeviceSize layerSize = gridLayerSize();
+            std::vector<char> encoded;
+            if (gridFormat != GridFormat::Float32) {
+                encoded.resize(layerSize);
+                encodeGridValues(gridFormat, values, encoded.data(), gridManager.cellCount());
+            }
+            const void* layer = encoded.empty() ? static_cast<const void*>(values) : encoded.data();
 
-            if (enableValidationLayers) {
-                createInfo.enabledLayerCount = static_cast<uint32_t>(vu::validationLayers.size());
-                createInfo.ppEnabledLayerNames = vu::validationLayers.data();
-            } else {
-                createInfo.enabledLayerCount = 0;
+            // The GPU may still be using mapped grids, only touch them when
+            // idle. One wait covers every frame.
+            for (const Frame& frame : frames) {
+                if (frame.gridMapped != nullptr) {
+                    waitForCompute();
+                    break;
+                }
             }
 
-            if (vkCreateDevice(physicalDevice, &createInfo, nullptr, &device) != VK_SUCCESS) {
-                throw std::runtime_error("failed to create logical device!");
+            for (Frame& frame : frames) {
+                for (uint32_t scenario = 0; scenario < scenarioCount; scenario++) {
+                    if (frame.gridMapped != nullptr) {
+                        memcpy(static_cast<char*>(frame.gridMapped) + scenario * layerSize, layer, (size_t) layerSize);
+                    } else {
+                        stageUpload(frame.gridBuffer, scenario * layerSize, layer, layerSize);
+                    }
+                }
+                if (frame.gridMapped != nullptr) {
+                    vmaFlushAllocation(allocator, frame.gridAllocation, 0, VK_WHOLE_SIZE);
+                }
             }
+            markAllDirty();
+        }
 
-            vkGetDeviceQueue(device, indices.computeFamily.value(), 0, &computeQueue);
-        };
+        // Reallocate everything sized by the grid. The values start over from
+        // whatever is in the GridManager (all 0), and readbacks from before
+        // the resize are no longer available.
+        void resizeGrid(uint32_t width, uint32_t height) override {
+            checkKernelFormat(activeKernel, gridFormat, width, height);
+            // Nothing queued or in flight can still reference the old buffers
+            flushUploads();
 
-        void createVmaAllocator(){
-            VmaAllocatorCreateInfo allocatorCreateInfo{};
-            allocatorCreateInfo.flags = VMA_ALLOCATOR_CREATE_EXT_MEMORY_BUDGET_BIT;
-            allocatorCreateInfo.vulkanApiVersion = VK_API_VERSION_1_3;
-            allocatorCreateInfo.physicalDevice = physicalDevice;
-            allocatorCreateInfo.device = device;
-            allocatorCreateInfo.instance = instance;
-            allocatorCreateInfo.pVulkanFunctions = nullptr;
+            destroyGridBuffers();
+            gridManager.resize(width, height);
 
-            vmaCreateAllocator(&allocatorCreateInfo, &allocator);
-        }
+            // Tuned workgroup sizes are per grid size
+            std::map<std::string, WorkgroupSize> previousSizes = workgroupSizes;
+            chooseWorkgroupSizes();
+            for (const auto& shaderName : kernelShaders) {
+                WorkgroupSize size = workgroupSizes.at(shaderName);
+                if (size.x != previousSizes.at(shaderName).x || size.y != previousSizes.at(shaderName).y) {
+                    vkDestroyPipeline(device, pipelines.at(shaderName), nullptr);
+                    pipelines[shaderName] = createComputePipeline(shaderName);
+                }
+            }
 
-        VkShaderModule createShaderModule(const std::vector<char>& code) {
-            VkShaderModuleCreateInfo createInfo{};
-            createInfo.sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO;
-            createInfo.codeSize = code.size();
-            createInfo.pCode = reinterpret_cast<const uint32_t*>(code.data());
+            createGridBuffers();
+            writeGridDescriptors();
 
-            VkShaderModule shaderModule;
-            if (vkCreateShaderModule(device, &createInfo, nullptr, &shaderModule) != VK_SUCCESS) {
-                throw std::runtime_error("failed to create shader module!");
+            // The Morton codes are of cells, which just changed size
+            for (Frame& frame : frames) {
+                frame.indexStale = true;
             }
-
-            return shaderModule;
+            invalidateCommandBuffers();
+            uploadGrid(gridManager.data());
         }
 
-        void createCommandPool(){
-            vu::QueueFamilyIndices queueFamilyIndices = vu::findQueueFamilies(physicalDevice);
+        // Benchmark each candidate workgroup shape for every kernel against the
+        // shapes and lights currently uploaded, switch to the fastest, and save
+        // the results for this device and grid size so later runs pick them up
+        // without tuning again. Upload a representative scene first.
+        void autotuneWorkgroupSizes() {
+            uint32_t validBits = vu::timestampValidBits(physicalDevice, computeQueues[0].family);
+            if (validBits == 0) {
+                std::cerr << "compute queue has no timestamp support, skipping workgroup tuning" << std::endl;
+                return;
+            }
+            uint64_t timestampMask = validBits >= 64 ? UINT64_MAX : (uint64_t(1) << validBits) - 1;
 
-            VkCommandPoolCreateInfo poolInfo{};
-            poolInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
-            poolInfo.flags = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT;
-            poolInfo.queueFamilyIndex = queueFamilyIndices.computeFamily.value();
+            // Get the scene onto the GPU and everything else out of the way
+            flushUploads();
 
-            if (vkCreateCommandPool(device, &poolInfo, nullptr, &commandPool) != VK_SUCCESS) {
-                throw std::runtime_error("failed to create command pool!");
+            VkQueryPoolCreateInfo queryPoolInfo{};
+            queryPoolInfo.sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO;
+            queryPoolInfo.queryType = VK_QUERY_TYPE_TIMESTAMP;
+            queryPoolInfo.queryCount = 2;
+
+            VkQueryPool queryPool;
+            if (vkCreateQueryPool(device, &queryPoolInfo, nullptr, &queryPool) != VK_SUCCESS) {
+                throw std::runtime_error("failed to create timestamp query pool!");
             }
-        }
 
-        void createCommandBuffer(){
-            VkCommandBufferAllocateInfo allocateInfo = {};
+            VkCommandBufferAllocateInfo allocateInfo{};
             allocateInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
             allocateInfo.commandPool = commandPool;
             allocateInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
             allocateInfo.commandBufferCount = 1;
 
-            if (vkAllocateCommandBuffers(device, &allocateInfo, &commandBuffer) != VK_SUCCESS){
+            VkCommandBuffer tuningCommandBuffer;
+            if (vkAllocateCommandBuffers(device, &allocateInfo, &tuningCommandBuffer) != VK_SUCCESS) {
                 throw std::runtime_error("failed to allocate command buffers!");
             }
-        }
 
-        void createComputePipeline(){
-            VkPipelineLayoutCreateInfo pipelineLayoutInfo{};
-            pipelineLayoutInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
-            pipelineLayoutInfo.setLayoutCount = 1;
-            pipelineLayoutInfo.pSetLayouts = &descriptorSetLayout;
+            std::string deviceUuid = vu::uuidToHex(deviceProperties.pipelineCacheUUID);
+            for (GridKernel kernel : {GridKernel::Fill, GridKernel::Occupancy, GridKernel::Lighting}) {
+                std::string shaderName = kernelShaderName(kernel);
 
-            if (vkCreatePipelineLayout(device, &pipelineLayoutInfo, nullptr, &computePipelineLayout) != VK_SUCCESS) {
-                throw std::runtime_error("failed to create compute pipeline layout!");
-            }
+                WorkgroupSize best = workgroupSizes.at(shaderName);
+                double bestTime = std::numeric_limits<double>::max();
+                for (WorkgroupSize candidate : workgroupSizeCandidates) {
+                    if (!workgroupSizeSupported(candidate)) {
+                        continue;
+                    }
 
-            // Create compute shader modules and associate it with the right
-            // stage in the pipeline (the only one)
-            auto computeShaderCode = readFile("shaders/grid.spv");
+                    setWorkgroupSize(shaderName, candidate);
+                    double time = timeKernel(tuningCommandBuffer, queryPool, kernel, timestampMask);
+                    if (time < bestTime) {
+                        bestTime = time;
+                        best = candidate;
+                    }
+                }
 
-            VkShaderModule computeShaderModule = createShaderModule(computeShaderCode);
+                setWorkgroupSize(shaderName, best);
+                std::cout << shaderName << ": " << best.x << "x" << best.y << " ("
+                          << bestTime / 1000.0 << " us)" << std::endl;
 
-            VkPipelineShaderStageCreateInfo computeShaderStageInfo{};
-            computeShaderStageInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
-            computeShaderStageInfo.stage = VK_SHADER_STAGE_COMPUTE_BIT;
-            computeShaderStageInfo.module = computeShaderModule;
-            computeShaderStageInfo.pName = "main";
+                // Replace any older result for the same key
+                vu::TunedWorkgroupSize result{deviceUuid, gridManager.gridWidth, gridManager.gridHeight,
+                                              shaderName, best.x, best.y};
+                tunedWorkgroupSizes.erase(std::remove_if(tunedWorkgroupSizes.begin(), tunedWorkgroupSizes.end(),
+                    [&](const vu::TunedWorkgroupSize& entry) {
+                        return entry.deviceUuid == result.deviceUuid && entry.gridWidth == result.gridWidth &&
+                               entry.gridHeight == result.gridHeight && entry.shaderName == result.shaderName;
+                    }), tunedWorkgroupSizes.end());
+                tunedWorkgroupSizes.push_back(result);
+            }
+            vu::saveWorkgroupTuning(tuningCachePath, tunedWorkgroupSizes);
 
-            // Create the actual pipeline :)
-            VkComputePipelineCreateInfo pipelineInfo{};
-            pipelineInfo.sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO;
-            pipelineInfo.layout = computePipelineLayout;
-            pipelineInfo.stage = computeShaderStageInfo;
+            vkFreeCommandBuffers(device, commandPool, 1, &tuningCommandBuffer);
+            vkDestroyQueryPool(device, queryPool, nullptr);
 
-            if (vkCreateComputePipelines(device, VK_NULL_HANDLE, 1, &pipelineInfo, nullptr, &computePipeline) != VK_SUCCESS) {
-                throw std::runtime_error("failed to create compute pipeline!");
-            }
+            // The tuning runs scribbled over the grid
+            uploadGridFromManager();
+        }
 
-            // Now that we've added the shader to the pipeline we can release it
-            // from memory
-            vkDestroyShaderModule(device, computeShaderModule, nullptr);
+        // Per pass GPU timings of every submission so far
+        const vu::GpuProfiler& getProfiler() const {
+            return profiler;
         }
 
-        void createDescriptorSetLayout(){
-            // Create descriptor set layout for grid
-            VkDescriptorSetLayoutBinding bufferBinding{};
-            bufferBinding.binding = 0; // Matches `layout(binding = 0)` in the shader
-            bufferBinding.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
-            bufferBinding.descriptorCount = 1;
-            bufferBinding.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
-            bufferBinding.pImmutableSamplers = nullptr;
+        const GridManager& getGridManager() const override {
+            return gridManager;
+        }
+
+        // The distance field's and planner's scratch buffers are only there
+        // while their kernel is active, so switching to or from one of them
+        // reallocates the grids like setPyramid() does
+        void setKernel(GridKernel kernel) override {
+            if (kernel == activeKernel) {
+                return;
+            }
+            checkKernelFormat(kernel, gridFormat, gridManager.gridWidth, gridManager.gridHeight);
+
+            bool reallocate = hasScratchBuffers(kernel) || hasScratchBuffers(activeKernel);
+            if (reallocate) {
+                flushUploads();
+                destroyGridBuffers();
+            }
+            activeKernel = kernel;
+            if (reallocate) {
+                createGridBuffers();
+                writeGridDescriptors();
+            }
+
+            invalidateCommandBuffers();
+            if (reallocate) {
+                uploadGridFromManager();
+            }
+        }
+
+        bool gridFormatSupported(GridFormat format) const {
+            switch (format) {
+                case GridFormat::Float16:
+                    return storageBuffer16BitAccess;
+                case GridFormat::Unorm8:
+                    return storageBuffer8BitAccess;
+                default:
+                    return true;
+            }
+        }
+
+        // Store the grids as `format` from now on. Like a resize, this
+        // reallocates the grids (waiting for the GPU), the values start over
+        // from the GridManager and earlier readbacks are gone.
+        void setGridFormat(GridFormat format) override {
+            if (format == gridFormat) {
+                return;
+            }
+            if (!gridFormatSupported(format)) {
+                throw std::runtime_error("grid format not supported by this device!");
+            }
+            checkKernelFormat(activeKernel, format, gridManager.gridWidth, gridManager.gridHeight);
+
+            flushUploads();
+            destroyGridBuffers();
+            gridFormat = format;
+
+            for (const auto& shaderName : gridFormatShaders) {
+                vkDestroyPipeline(device, pipelines.at(shaderName), nullptr);
+                pipelines[shaderName] = createComputePipeline(shaderName);
+            }
+
+            createGridBuffers();
+            writeGridDescriptors();
+
+            invalidateCommandBuffers();
+            uploadGridFromManager();
+        }
+
+        GridFormat getGridFormat() const override {
+            return gridFormat;
+        }
+
+        // Reduce every layer to a GridStats at the end of each run from now
+        // on (or stop). Only the recording changes, the grids stay as they
+        // are.
+        void setReduction(const ReductionSettings& settings) override {
+            if (settings.enabled) {
+                if (!subgroupReductions) {
+                    throw std::runtime_error("device lacks the subgroup operations the reductions need!");
+                }
+                histogramScale(settings);
+            }
+            reduction = settings;
+            for (Frame& frame : frames) {
+                frame.recorded = false;
+            }
+        }
+
+        void setGridReadback(bool enabled) override {
+            gridReadback = enabled;
+            for (Frame& frame : frames) {
+                frame.recorded = false;
+            }
+        }
+
+        // The goal and sweep count are recorded into the command buffers.
+        // Every run plans from scratch, so nothing has to be marked dirty.
+        void setPlanner(const PlannerSettings& settings) override {
+            planner = settings;
+            for (Frame& frame : frames) {
+                frame.recorded = false;
+            }
+        }
+
+        // The pyramid lives in the same allocation as the grid, right after
+        // it, so like setGridFormat() this reallocates the grids (waiting for
+        // the GPU), the values start over from the GridManager and earlier
+        // readbacks are gone
+        void setPyramid(bool enabled) override {
+            if (enabled == pyramidEnabled) {
+                return;
+            }
+
+            flushUploads();
+            destroyGridBuffers();
+            pyramidEnabled = enabled;
+            createGridBuffers();
+            writeGridDescriptors();
+
+            invalidateCommandBuffers();
+            uploadGridFromManager();
+        }
+
+        // Each frame builds its own index on its first run after this and
+        // after every change to the shapes, see recordShapeIndex()
+        void setShapeIndex(bool enabled) override {
+            shapeIndexEnabled = enabled;
+            for (Frame& frame : frames) {
+                frame.indexStale = true;
+                frame.recorded = false;
+            }
+        }
+
+        // Shapes are in grid units, i.e. cell (x, y) covers [x, x + 1) x [y, y + 1).
+        // The new shapes are uploaded with the next submission. These set up
+        // the one scenario of a batch of one, see setScenarios() for more.
+        void setCircles(const std::vector<Circle>& circles) override {
+            ScenarioRange range = singleScenarioRange();
+            range.circleCount = static_cast<uint32_t>(circles.size());
+            markChangedTiles(circles, rectangles, lights, {range});
+
+            updateShapeBuffer(circleBuffer, 2, circles.data(), circles.size(), sizeof(Circle));
+            this->circles = circles;
+            scenarioRanges = {range};
+            uploadScenarioTable();
+        }
+
+        void setRectangles(const std::vector<Rectangle>& rectangles) override {
+            ScenarioRange range = singleScenarioRange();
+            range.rectCount = static_cast<uint32_t>(rectangles.size());
+            markChangedTiles(circles, rectangles, lights, {range});
+
+            updateShapeBuffer(rectBuffer, 3, rectangles.data(), rectangles.size(), sizeof(Rectangle));
+            this->rectangles = rectangles;
+            scenarioRanges = {range};
+            uploadScenarioTable();
+        }
+
+        // Each light is (x, y, intensity, attenuation), see lightContribution()
+        // in shaders/common.glsl for the falloff
+        void setLights(const std::vector<LightSource>& lights) override {
+            ScenarioRange range = singleScenarioRange();
+            range.lightCount = static_cast<uint32_t>(lights.size());
+            markChangedTiles(circles, rectangles, lights, {range});
+
+            updateShapeBuffer(lightBuffer, 1, lights.data(), lights.size(), sizeof(LightSource));
+            this->lights = lights;
+            scenarioRanges = {range};
+            uploadScenarioTable();
+        }
+
+        // Evaluate every scenario in one dispatch per pass, scenario s going
+        // into layer s of the grid (see readbackGrid()). All of them share the
+        // grid size and kernel. The shapes of every scenario are packed into
+        // the same buffers, so a batch of small grids costs about as much to
+        // submit as one. Changing the number of scenarios reallocates the
+        // grids, which waits for the GPU.
+        void setScenarios(const std::vector<Scenario>& scenarios) override {
+            std::vector<Circle> circles;
+            std::vector<Rectangle> rectangles;
+            std::vector<LightSource> lights;
+            std::vector<ScenarioRange> ranges;
+            packScenarios(scenarios, circles, rectangles, lights, ranges);
+
+            // A new number of scenarios starts every grid over anyway
+            setScenarioCount(static_cast<uint32_t>(scenarios.size()));
+            if (ranges.size() == scenarioRanges.size()) {
+                markChangedTiles(circles, rectangles, lights, ranges);
+            }
+
+            updateShapeBuffer(circleBuffer, 2, circles.data(), circles.size(), sizeof(Circle));
+            updateShapeBuffer(rectBuffer, 3, rectangles.data(), rectangles.size(), sizeof(Rectangle));
+            updateShapeBuffer(lightBuffer, 1, lights.data(), lights.size(), sizeof(LightSource));
+            this->circles = std::move(circles);
+            this->rectangles = std::move(rectangles);
+            this->lights = std::move(lights);
+            scenarioRanges = ranges;
+            uploadScenarioTable();
+        }
+
+        uint32_t getScenarioCount() const override {
+            return scenarioCount;
+        }
+
+        // Like setCircles() and friends, but only the newest update of each
+        // kind gets uploaded, and from an imported ring without copying it
+        // anywhere first (the host keeps its own copy of the shapes for
+        // working out which tiles changed, like the setters do)
+        void ingestShapeUpdates(vu::ShmRing& ring) override {
+            if (&ring != shapeRing) {
+                attachShapeRing(ring);
+            }
+
+            // Should growing a shape buffer push some of the copies through
+            // early, that frees up to here at most
+            if (!shapeRingUploadsPending) {
+                shapeRingPendingRelease = ring.position();
+            }
+            ShapeUpdates updates = readShapeUpdates(ring);
+            if (updates.circles || updates.rectangles || updates.lights) {
+                ScenarioRange range = singleScenarioRange();
+                std::vector<Circle> newCircles;
+                std::vector<Rectangle> newRectangles;
+                std::vector<LightSource> newLights;
+                if (updates.circles) {
+                    newCircles = shapeUpdatePayload<Circle>(*updates.circles);
+                    range.circleCount = static_cast<uint32_t>(newCircles.size());
+                }
+                if (updates.rectangles) {
+                    newRectangles = shapeUpdatePayload<Rectangle>(*updates.rectangles);
+                    range.rectCount = static_cast<uint32_t>(newRectangles.size());
+                }
+                if (updates.lights) {
+                    newLights = shapeUpdatePayload<LightSource>(*updates.lights);
+                    range.lightCount = static_cast<uint32_t>(newLights.size());
+                }
+                markChangedTiles(updates.circles ? newCircles : circles, updates.rectangles ? newRectangles : rectangles,
+                                 updates.lights ? newLights : lights, {range});
+
+                if (updates.circles) {
+                    uploadShapeUpdate(circleBuffer, 2, *updates.circles);
+                    circles = std::move(newCircles);
+                }
+                if (updates.rectangles) {
+                    uploadShapeUpdate(rectBuffer, 3, *updates.rectangles);
+                    rectangles = std::move(newRectangles);
+                }
+                if (updates.lights) {
+                    uploadShapeUpdate(lightBuffer, 1, *updates.lights);
+                    lights = std::move(newLights);
+                }
+                scenarioRanges = {range};
+                uploadScenarioTable();
+            }
+
+            // Everything read so far, superseded updates included, is free
+            // once the copies out of the ring (if any) are done, and they
+            // finish in order
+            if (shapeRingUploadsPending) {
+                shapeRingPendingRelease = ring.position();
+            } else if (!shapeRingReleases.empty()) {
+                shapeRingReleases.emplace_back(shapeRingReleases.back().first, ring.position());
+            } else {
+                ring.release(ring.position());
+            }
+        }
+
+        // Push any queued uploads to the GPU now instead of waiting for the
+        // next runComputeShader()
+        void flushUploads() {
+            // Everything is idle after this, so any frame's upload command
+            // buffers will do
+            waitForCompute();
+            if (recordUploadCommandBuffers(frames[0])) {
+                submitUpload(frames[0]);
+                profiler.submitted(lastUploadValue, {frames[0].uploadCommandBuffer});
+
+                // Finish the ownership transfer, later kernels on any compute
+                // queue can use the buffers once this is done
+                lastAcquireQueue = &computeQueues[0];
+                lastAcquireValue = submitCommandBuffers(computeQueues[0], {frames[0].acquireCommandBuffer},
+                    {{&transferQueue, lastUploadValue}}, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT);
+                waitForCompute();
+            }
+        }
+    private:
+        // Grid stuff
+        GridManager gridManager;
+
+        VkInstance instance;
+        VkDebugUtilsMessengerEXT debugMessenger;
+        bool debugUtilsEnabled = false;
+
+        // Devices
+        VkPhysicalDevice physicalDevice = VK_NULL_HANDLE;
+        VkPhysicalDeviceProperties deviceProperties;
+        VkDevice device;
+        // Optional features, enabled when the device has them
+        bool storageBuffer16BitAccess = false;
+        bool storageBuffer8BitAccess = false;
+        // Subgroup arithmetic in compute shaders, for the reductions
+        bool subgroupReductions = false;
+        // VK_EXT_external_memory_host, for uploading straight out of a
+        // shared memory ring
+        bool externalMemoryHost = false;
+        VkDeviceSize hostPointerAlignment = 0;
+
+        // Queues
+        // Kernels go round robin over the compute queues (frame i uses queue
+        // i % count), uploads and readbacks go through the transfer queue.
+        // Without a transfer-only family that's just another queue of the
+        // compute family, or even the same queue. Every queue signals its own
+        // timeline semaphore with the value of each submission, since values
+        // on one semaphore have to be signalled in increasing order.
+        struct Queue {
+            VkQueue queue;
+            uint32_t family;
+            VkSemaphore timeline;
+            uint64_t submittedValue = 0;
+        };
+        static constexpr uint32_t maxComputeQueues = 4;
+        std::vector<Queue> computeQueues;
+        Queue transferQueue;
+        VkCommandPool commandPool;         // Compute family
+        VkCommandPool transferCommandPool; // Transfer family
+
+        // Serials are transfer queue timeline values: staging ranges are
+        // done with once their upload is, and a run once its readback is
+        uint64_t completedSerial = 0;
+        // Every kernel waits for the transfer queue to reach this
+        uint64_t lastUploadValue = 0;
+        // And for the compute queue that ran the latest upload's acquire to
+        // reach this, no kernel may touch the buffers before they're owned
+        const Queue* lastAcquireQueue = nullptr;
+        uint64_t lastAcquireValue = 0;
+
+        // Everything one run of the kernel writes, so consecutive runs can be
+        // in flight at the same time. Shapes, lights and the staging ring are
+        // shared: uploads wait for every earlier kernel through the compute
+        // queues' timelines, and the staging ring already retires ranges per
+        // upload.
+        struct Frame {
+            uint32_t index;
+            // Last run that used this frame, 0 if none since the grid buffers
+            // were (re)created
+            uint64_t serial = 0;
+
+            // The kernel over the frame's dirty tiles. Resubmitted as is until
+            // something invalidates it.
+            VkCommandBuffer commandBuffer;
+            bool recorded = false;
+            // What the recording does besides the kernel, i.e. which
+            // readbacks the frame's runs have
+            bool readsBackGrid = false;
+            bool reduces = false;
+            bool plans = false;
+            // Transfer family: copies the grid into `readbackBuffer`, unless
+            // the grid is host visible. Recorded along with `commandBuffer`.
+            VkCommandBuffer readbackCommandBuffer;
+            // Transfer family: the staging copies, which release their
+            // buffers to the compute family. The compute family side of that
+            // goes in `acquireCommandBuffer`.
+            VkCommandBuffer uploadCommandBuffer;
+            VkCommandBuffer acquireCommandBuffer;
+            VkDescriptorSet descriptorSet;
+
+            // Shared by the compute and transfer families rather than handed
+            // back and forth, since runs only rewrite part of it. With the
+            // pyramid enabled, it follows the grid at `pyramidOffset`.
+            VkBuffer gridBuffer;
+            VmaAllocation gridAllocation;
+            // Only set if VMA put the grid in host visible memory (zero-copy)
+            void* gridMapped = nullptr;
+
+            // Host cached, the host reads one frame while later ones run.
+            // Not there when `gridMapped` is, the host reads the grid itself.
+            VkBuffer readbackBuffer = VK_NULL_HANDLE;
+            VmaAllocation readbackAllocation = VK_NULL_HANDLE;
+            void* readbackMapped = nullptr;
+            // The readback as floats, for compact grid formats. Converted on
+            // demand, `decodedSerial` is the run it's from.
+            std::vector<float> decodedValues;
+            uint64_t decodedSerial = 0;
+
+            VkBuffer tileBinBuffer;
+            VmaAllocation tileBinAllocation;
+            VkBuffer tileIndexBuffer;
+            VmaAllocation tileIndexAllocation;
+
+            // One bit per tile (numbered like the tile bins) that has to be
+            // recomputed next time this frame runs. Every change marks the
+            // tiles it touches in every frame, since each frame's grid is as
+            // old as its last run. Copied into `dirtyMaskBuffer` right before
+            // submitting, dirty_tiles.glsl turns that into `dirtyTileBuffer`.
+            std::vector<uint32_t> dirtyMask;
+            VkBuffer dirtyMaskBuffer;
+            VmaAllocation dirtyMaskAllocation;
+            void* dirtyMaskMapped;
+            VkBuffer dirtyTileBuffer;
+            VmaAllocation dirtyTileAllocation;
+
+            // Reductions: the histogram counters and per workgroup partials
+            // reduce.glsl leaves for reduce_finish.glsl, and the GridStats
+            // it writes for the host (host cached, like the readback)
+            VkBuffer reduceHistogramBuffer;
+            VmaAllocation reduceHistogramAllocation;
+            VkBuffer reducePartialBuffer;
+            VmaAllocation reducePartialAllocation;
+            VkBuffer statsBuffer;
+            VmaAllocation statsAllocation;
+            void* statsMapped;
+
+            // Jump flooding seeds for the distance field, see distance.glsl.
+            // They outlive the run, it's how the next one knows where the
+            // obstacles in tiles it doesn't recompute are.
+            VkBuffer distanceSeedBuffer;
+            VmaAllocation distanceSeedAllocation;
+
+            // The planner's cost field and sweep bookkeeping, see
+            // planner.glsl. The costs keep the obstacles between runs like
+            // the seeds above. The status is for the host.
+            VkBuffer plannerCostBuffer;
+            VmaAllocation plannerCostAllocation;
+            VkBuffer plannerStateBuffer;
+            VmaAllocation plannerStateAllocation;
+            VkBuffer plannerStatusBuffer;
+            VmaAllocation plannerStatusAllocation;
+            void* plannerStatusMapped;
+
+            // Query batches against the frame's runs, see submitQueries().
+            // The query buffer is written by the host and the results read
+            // back straight from where query.glsl wrote them. Not sized by
+            // the grid, so these live as long as the frame.
+            VkCommandBuffer queryCommandBuffer;
+            uint64_t queryTicket = 0;
+            uint64_t queryValue = 0; // On the frame's compute queue
+            VkDeviceSize queryCapacity = 0;
+            VkBuffer queryBuffer;
+            VmaAllocation queryAllocation;
+            void* queryMapped;
+            VkBuffer queryResultBuffer;
+            VmaAllocation queryResultAllocation;
+            void* queryResultMapped;
+
+            // The shape index binning walks with it enabled, see
+            // recordShapeIndex(). Built by its own command buffer, submitted
+            // ahead of `commandBuffer` only on runs where the shapes changed
+            // since the frame last built it. Grows like the shape buffers.
+            VkCommandBuffer indexCommandBuffer;
+            bool indexStale = true;
+            VkDeviceSize indexEntryCapacity = 0; // In shapes
+            VkDeviceSize indexLeafCapacity = 0;
+            VkDeviceSize indexClusterCapacity = 0;
+            VkBuffer indexEntryBuffer;
+            VmaAllocation indexEntryAllocation;
+            VkBuffer indexCountBuffer;
+            VmaAllocation indexCountAllocation;
+            VkBuffer indexLeafBuffer;
+            VmaAllocation indexLeafAllocation;
+            VkBuffer indexClusterBuffer;
+            VmaAllocation indexClusterAllocation;
+        };
+        std::vector<Frame> frames;
+        uint32_t nextFrame = 0;
+
+        // Timestamps and debug labels around each pass. Each command buffer
+        // we time gets its own region of the profiler's query pool.
+        vu::GpuProfiler profiler;
+        // Transfer queues can't always write timestamps, those passes just
+        // aren't timed then
+        static constexpr uint32_t uploadProfileRegion = 0;   // + 4 * frame
+        static constexpr uint32_t computeProfileRegion = 1;  // + 4 * frame
+        static constexpr uint32_t readbackProfileRegion = 2; // + 4 * frame
+        static constexpr uint32_t indexProfileRegion = 3;    // + 4 * frame
+        static constexpr uint32_t profileRegionsPerFrame = 4;
+        bool transferTimestamps = false;
+        static constexpr uint32_t noProfileRegion = UINT32_MAX;
+        static constexpr uint32_t scopesPerProfileRegion = 8;
+
+        // Descriptor sets - define resources provided to shaders
+        // See https://docs.vulkan.org/spec/latest/chapters/descriptorsets.html
+        // for more details
+        // Binding numbers, each matches a `layout(binding = N)` in
+        // shaders/common.glsl, or from 9 on in the shader (or include) that
+        // uses it
+        const std::vector<uint32_t> storageBindings = {
+            0, // grid
+            1, // lights
+            2, // circles
+            3, // rectangles
+            4, // tile bins
+            5, // tile index pool
+            6, // scenario table
+            7, // dirty tile mask
+            8, // dirty tile list
+            9, // reduction histograms
+            10, // reduction partials
+            11, // grid stats
+            12, // min/max pyramid
+            13, // queries
+            14, // query results
+            15, // distance field seeds
+            16, // planner costs
+            17, // planner state
+            18, // planner status
+            19, // shape index entries
+            20, // shape index sort counts
+            21, // shape index leaves
+            22, // shape index clusters
+        };
+        VkDescriptorSetLayout descriptorSetLayout;
+        VkDescriptorPool descriptorPool;
+
+        // Buffers for shapes
+        GridFormat gridFormat = GridFormat::Float32;
+        VkDeviceSize gridBufferSize; // Of each frame's grid, every layer
+
+        // Min/max pyramid over every layer of the grid, one (min, max) float
+        // pair per node, laid out like vu::pyramidLayout() one scenario after
+        // another. Rebuilt from scratch at the end of every run.
+        bool pyramidEnabled = false;
+        std::vector<vu::PyramidLevel> pyramidLevels;
+        VkDeviceSize pyramidOffset; // In the grid buffer
+        VkDeviceSize pyramidSize;   // 0 when disabled
+        static constexpr uint32_t pyramidGroupSize = 16; // Matches pyramid.glsl
+        static constexpr uint32_t distanceGroupSize = 16; // Matches distance.glsl
+
+        // Distance field seeds, four uints per cell of every layer while
+        // the Distance kernel is active and a token pair otherwise
+        VkDeviceSize distanceSeedSize;
+        uint32_t distanceFloodPasses = 0;
+
+        // Cost-to-go planner, see planner.glsl. Like the seeds, the cost and
+        // state buffers only get their real size while CostToGo is active.
+        PlannerSettings planner;
+        VkDeviceSize plannerCostSize;
+        VkDeviceSize plannerStateSize;
+        static constexpr uint32_t plannerTileSize = 16; // Matches planner.glsl
+        static constexpr VkDeviceSize plannerStateHeaderSize = 8 * sizeof(uint32_t);
+
+        // Query batches, see submitQueries()
+        static constexpr VkDeviceSize initialQueryCapacity = 1024;
+        static constexpr uint32_t queryGroupSize = 64; // Matches query.glsl
+        uint64_t lastQueryTicket = 0;
+
+        // Shape index for binning, see setShapeIndex()
+        bool shapeIndexEnabled = false;
+        static constexpr uint32_t shapeIndexBlockSize = 256; // Matches shape_index.glsl
+        // Shape buffers grow (by reallocating) when they run out of room
+        struct ShapeBuffer {
+            VkBuffer buffer;
+            VmaAllocation allocation;
+            VkDeviceSize capacity;
+        };
+        static constexpr VkDeviceSize initialShapeBufferSize = 64 * 1024;
+        ShapeBuffer circleBuffer;
+        ShapeBuffer rectBuffer;
+        ShapeBuffer lightBuffer;
+
+        // Scenarios in the current batch. Each gets a layer of every grid
+        // buffer and tile bin buffer, and its slice of the shape buffers is
+        // described by its entry in the scenario table (a ShapeBuffer too,
+        // since it's uploaded the same way).
+        uint32_t scenarioCount = 1;
+        std::vector<ScenarioRange> scenarioRanges = {ScenarioRange{}};
+        ShapeBuffer scenarioBuffer;
+
+        // What's in the shape buffers, packed the same way, to work out what
+        // changed when new shapes come in
+        std::vector<Circle> circles;
+        std::vector<Rectangle> rectangles;
+        std::vector<LightSource> lights;
+
+        // Per tile primitive lists built by binning.glsl (one set per frame),
+        // one tile per workgroup of the tiled kernels. The index pool is shared
+        // by all tiles of all scenarios, a tile that doesn't fit falls back to
+        // looking at every primitive of its scenario. The dirty tile mask and
+        // list are sized the same way.
+        static constexpr VkDeviceSize tileIndicesPerTile = 1024; // On average
+        uint32_t tileBinCapacity; // In tiles per scenario
+        VkDeviceSize dirtyMaskSize; // Of each frame's mask, in bytes
+
+        // Reductions run reduceGroupCount workgroups of reduce.glsl per
+        // scenario, each covering a fixed share of the layer. Picked per grid
+        // size in createGridBuffers().
+        ReductionSettings reduction;
+        bool gridReadback = true;
+        static constexpr uint32_t reduceGroupSize = 256; // Matches reduce_common.glsl
+        static constexpr VkDeviceSize reducePartialSize = 32; // sizeof(ReducePartial)
+        static constexpr uint32_t cellsPerReduceInvocation = 16;
+        static constexpr uint32_t maxReduceGroupCount = 1024;
+        uint32_t reduceGroupCount;
+
+        // VMA
+        VmaAllocator allocator;
+
+        // Transfers
+        // Uploads are written into a persistently mapped staging ring and
+        // copied into their destination on the transfer queue by the
+        // submitting frame's `uploadCommandBuffer`, which is re-recorded only
+        // on ticks that actually have something to upload.
+        struct PendingUpload {
+            VkBuffer srcBuffer; // The staging buffer, or an imported shape ring
+            VkBuffer dstBuffer;
+            VkDeviceSize srcOffset;
+            VkDeviceSize dstOffset;
+            VkDeviceSize size;
+        };
+        static constexpr VkDeviceSize stagingRingSize = 64 * 1024 * 1024;
+        VkBuffer stagingBuffer;
+        VmaAllocation stagingAllocation;
+        void* stagingMapped;
+        vu::RingAllocator stagingRing;
+        std::vector<PendingUpload> pendingUploads;
+
+        // Shape update ring being ingested, see ingestShapeUpdates(). With
+        // VK_EXT_external_memory_host its whole mapping is imported as a
+        // buffer and updates are copied to the GPU straight out of it,
+        // otherwise they go through the staging ring like everything else.
+        // Ring space goes back to the producer once nothing reads it any
+        // more: right away after the staging copy, or once the upload that
+        // copies out of it is done.
+        vu::ShmRing* shapeRing = nullptr;
+        VkBuffer shapeRingBuffer = VK_NULL_HANDLE;
+        VkDeviceMemory shapeRingMemory = VK_NULL_HANDLE;
+        bool shapeRingUploadsPending = false; // In pendingUploads
+        uint64_t shapeRingPendingRelease = 0; // How far those free up the ring
+        std::deque<std::pair<uint64_t, uint64_t>> shapeRingReleases; // (upload value, ring position)
+
+        // Compute pipelines, one per kernel in shaders/, all sharing the same
+        // layout (descriptor set + push constants)
+        VkPipelineLayout computePipelineLayout;
+        std::map<std::string, VkPipeline> pipelines;
+
+        // Every pipeline goes through this, and it's kept on disk between runs
+        // so a restart doesn't recompile every kernel from scratch
+        const std::string pipelineCachePath = "pipeline.cache";
+        VkPipelineCache pipelineCache;
+        const std::vector<std::string> kernelShaders = {
+            "grid",
+            "occupancy",
+            "lighting",
+            "binning",
+            "dirty_tiles",
+            "reduce",
+            "reduce_finish",
+            "pyramid",
+            "query",
+            "distance",
+            "planner",
+            "shape_index",
+        };
+        // Kernels that run over tiles the size of their workgroups, i.e.
+        // everything but the helper passes
+        const std::vector<std::string> tiledKernels = {
+            "grid",
+            "occupancy",
+            "lighting",
+        };
+        // Kernels that read or write the grid, which have a build per
+        // GridFormat
+        const std::vector<std::string> gridFormatShaders = {
+            "grid",
+            "occupancy",
+            "lighting",
+            "reduce",
+            "pyramid",
+            "query",
+            "distance",
+            "planner",
+        };
+        GridKernel activeKernel = GridKernel::Fill;
+        // Passed to each kernel as specialization constants 0 and 1, which
+        // set `local_size_x`/`local_size_y`
+        std::map<std::string, WorkgroupSize> workgroupSizes;
+
+        // Workgroup sizes autotuneWorkgroupSizes() tries, and where it keeps
+        // what it found
+        const std::vector<WorkgroupSize> workgroupSizeCandidates = {
+            {32, 32},
+            {16, 16},
+            {8, 8},
+            {32, 8},
+            {64, 4},
+        };
+        const std::string tuningCachePath = "workgroup_sizes.cache";
+        std::vector<vu::TunedWorkgroupSize> tunedWorkgroupSizes;
+
+        void initVulkan() {
+            createInstance();
+            if (enableValidationLayers){
+                vu::setupDebugMessenger(instance, debugMessenger);
+            }
+            pickPhysicalDevice();
+            createLogicalDevice();
+            tunedWorkgroupSizes = vu::loadWorkgroupTuning(tuningCachePath);
+            chooseWorkgroupSizes();
+            
+            // Create the buffers needed for objects we use in compute pipeline
+            createVmaAllocator();
+            initializeAppBuffers();
+            
+            // Create descriptors we can use to handle these buffers
+            // (See below for a nice reference)
+            // https://vkguide.dev/docs/chapter-4/descriptors/#mental-model
+            createDescriptorSetLayout();
+            createComputePipelines();
+            createDescriptorPool();
+            createDescriptorSets();
+            // Create the command buffers
+            createCommandPool();
+            createCommandBuffer();
+            createSyncObjects();
+            createProfiler();
+
+            uploadGridFromManager();
+        }
+
+        void createInstance() {
+            if (enableValidationLayers && !vu::checkValidationLayerSupport()){
+                throw std::runtime_error("validation layers requested but not available!");
+            }
+        
+            VkApplicationInfo appInfo{};
+            appInfo.sType = VK_STRUCTURE_TYPE_APPLICATION_INFO;
+            appInfo.pApplicationName = "Grid Intersection App";
+            appInfo.applicationVersion = VK_MAKE_VERSION(1, 0, 0);
+            appInfo.pEngineName = "No Engine";
+            appInfo.engineVersion = VK_MAKE_VERSION(1, 0, 0);
+            appInfo.apiVersion = VK_API_VERSION_1_3;
+
+            VkInstanceCreateInfo createInfo{};
+            createInfo.sType = VK_STRUCTURE_TYPE_INSTANCE_CREATE_INFO;
+            createInfo.pApplicationInfo = &appInfo;
+
+            std::vector<const char*> reqExtensions;
+            auto extensions = vu::getRequiredExtensions(enableValidationLayers);
+            for (const char* extension : extensions) {
+                debugUtilsEnabled |= std::string(extension) == VK_EXT_DEBUG_UTILS_EXTENSION_NAME;
+            }
+            createInfo.enabledExtensionCount = static_cast<uint32_t>(extensions.size());
+            createInfo.ppEnabledExtensionNames = extensions.data();
+
+            VkDebugUtilsMessengerCreateInfoEXT debugCreateInfo{};
+            if (enableValidationLayers) {
+                createInfo.enabledLayerCount = static_cast<u_int32_t>(vu::validationLayers.size());
+                createInfo.ppEnabledLayerNames = vu::validationLayers.data();
+
+                vu::populateDebugMessengerCreateInfo(debugCreateInfo);
+                createInfo.pNext = (VkDebugUtilsMessengerCreateInfoEXT*) &debugCreateInfo;
+            } else {
+                createInfo.enabledLayerCount = 0;
+
+                createInfo.pNext = nullptr;
+            }
+
+            if (vkCreateInstance(&createInfo, nullptr, &instance) != VK_SUCCESS) {
+                throw std::runtime_error("failed to create instance!");
+            }
+
+        }
+
+        void pickPhysicalDevice() {
+            uint32_t deviceCount = 0;
+            // If output is a nullptr, get the # of physical devices
+            vkEnumeratePhysicalDevices(instance, &deviceCount, nullptr);
+
+            if (deviceCount == 0) {
+                throw std::runtime_error("failed to find any GPUs with Vulkan support!");
+            }
+
+            std::vector<VkPhysicalDevice> devices(deviceCount);
+            // // This has different behavior when we call it a second time
+            // // It now allocates pointers to the physical devices into the vector
+            vkEnumeratePhysicalDevices(instance, &deviceCount, devices.data());
+
+            for (const auto& device : devices) {
+                // For now, we pick the first device
+                if (vu::isDeviceSuitable(device)) {
+                    physicalDevice = device;
+                    break;
+                }
+            }
+
+            if (physicalDevice == VK_NULL_HANDLE) {
+                throw std::runtime_error("failed to find a suitable GPU!");
+            }
+
+            vkGetPhysicalDeviceProperties(physicalDevice, &deviceProperties);
+
+            externalMemoryHost = vu::checkDeviceExtensionSupport(physicalDevice, {VK_EXT_EXTERNAL_MEMORY_HOST_EXTENSION_NAME});
+            VkPhysicalDeviceExternalMemoryHostPropertiesEXT hostMemoryProperties{};
+            hostMemoryProperties.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_EXTERNAL_MEMORY_HOST_PROPERTIES_EXT;
+            VkPhysicalDeviceSubgroupProperties subgroupProperties{};
+            subgroupProperties.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_SUBGROUP_PROPERTIES;
+            subgroupProperties.pNext = externalMemoryHost ? &hostMemoryProperties : nullptr;
+            VkPhysicalDeviceProperties2 properties2{};
+            properties2.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PROPERTIES_2;
+            properties2.pNext = &subgroupProperties;
+            vkGetPhysicalDeviceProperties2(physicalDevice, &properties2);
+            VkSubgroupFeatureFlags neededOperations = VK_SUBGROUP_FEATURE_BASIC_BIT | VK_SUBGROUP_FEATURE_ARITHMETIC_BIT;
+            subgroupReductions = (subgroupProperties.supportedStages & VK_SHADER_STAGE_COMPUTE_BIT) &&
+                                 (subgroupProperties.supportedOperations & neededOperations) == neededOperations;
+            hostPointerAlignment = hostMemoryProperties.minImportedHostPointerAlignment;
+        }
+
+        void createLogicalDevice(){
+            vu::QueueFamilyIndices indices = vu::findQueueFamilies(physicalDevice);
+            uint32_t computeFamily = indices.computeFamily.value();
+            uint32_t transferFamily = indices.transferFamily.value_or(computeFamily);
+
+            // With no transfer-only family, keep a queue of the compute family
+            // back for copies if there are any to spare
+            bool dedicatedTransferFamily = indices.transferFamily.has_value();
+            bool spareTransferQueue = !dedicatedTransferFamily && indices.computeQueueCount > 1;
+            uint32_t computeQueueCount = std::min(indices.computeQueueCount - (spareTransferQueue ? 1 : 0), maxComputeQueues);
+            uint32_t transferQueueIndex = spareTransferQueue ? computeQueueCount : 0;
+
+            std::vector<float> computePriorities(computeQueueCount + (spareTransferQueue ? 1 : 0), 1.0f);
+            float transferPriority = 1.0f;
+
+            std::vector<VkDeviceQueueCreateInfo> queueCreateInfos;
+            VkDeviceQueueCreateInfo queueCreateInfo{};
+            queueCreateInfo.sType = VK_STRUCTURE_TYPE_DEVICE_QUEUE_CREATE_INFO;
+            queueCreateInfo.queueFamilyIndex = computeFamily;
+            queueCreateInfo.queueCount = static_cast<uint32_t>(computePriorities.size());
+            queueCreateInfo.pQueuePriorities = computePriorities.data();
+            queueCreateInfos.push_back(queueCreateInfo);
+
+            if (dedicatedTransferFamily) {
+                queueCreateInfo.queueFamilyIndex = transferFamily;
+                queueCreateInfo.queueCount = 1;
+                queueCreateInfo.pQueuePriorities = &transferPriority;
+                queueCreateInfos.push_back(queueCreateInfo);
+            }
+
+            VkPhysicalDeviceFeatures deviceFeatures{};
+
+            // 16 and 8 bit storage are only needed for the compact grid
+            // formats, so take them if they're there
+            VkPhysicalDeviceVulkan11Features supported11{};
+            supported11.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_1_FEATURES;
+            VkPhysicalDeviceVulkan12Features supported12{};
+            supported12.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_2_FEATURES;
+            supported12.pNext = &supported11;
+            VkPhysicalDeviceFeatures2 supportedFeatures{};
+            supportedFeatures.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2;
+            supportedFeatures.pNext = &supported12;
+            vkGetPhysicalDeviceFeatures2(physicalDevice, &supportedFeatures);
+            storageBuffer16BitAccess = supported11.storageBuffer16BitAccess == VK_TRUE;
+            storageBuffer8BitAccess = supported12.storageBuffer8BitAccess == VK_TRUE;
+
+            VkPhysicalDeviceVulkan11Features vulkan11Features{};
+            vulkan11Features.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_1_FEATURES;
+            vulkan11Features.storageBuffer16BitAccess = supported11.storageBuffer16BitAccess;
+
+            VkPhysicalDeviceVulkan12Features vulkan12Features{};
+            vulkan12Features.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_2_FEATURES;
+            vulkan12Features.pNext = &vulkan11Features;
+            vulkan12Features.timelineSemaphore = VK_TRUE;
+            vulkan12Features.hostQueryReset = VK_TRUE; // For the profiler
+            vulkan12Features.storageBuffer8BitAccess = supported12.storageBuffer8BitAccess;
+
+            VkDeviceCreateInfo createInfo{};
+            createInfo.sType = VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO;
+            createInfo.pNext = &vulkan12Features;
+            createInfo.queueCreateInfoCount = static_cast<uint32_t>(queueCreateInfos.size());
+            createInfo.pQueueCreateInfos = queueCreateInfos.data();
+
+            createInfo.pEnabledFeatures = &deviceFeatures;
+
+            // Only optional ones so far
+            std::vector<const char*> deviceExtensions;
+            if (externalMemoryHost) {
+                deviceExtensions.push_back(VK_EXT_EXTERNAL_MEMORY_HOST_EXTENSION_NAME);
+            }
+            createInfo.enabledExtensionCount = static_cast<uint32_t>(deviceExtensions.size());
+            createInfo.ppEnabledExtensionNames = deviceExtensions.data();
+
+            if (enableValidationLayers) {
+                createInfo.enabledLayerCount = static_cast<uint32_t>(vu::validationLayers.size());
+                createInfo.ppEnabledLayerNames = vu::validationLayers.data();
+            } else {
+                createInfo.enabledLayerCount = 0;
+            }
+
+            if (vkCreateDevice(physicalDevice, &createInfo, nullptr, &device) != VK_SUCCESS) {
+                throw std::runtime_error("failed to create logical device!");
+            }
+
+            computeQueues.resize(computeQueueCount);
+            for (uint32_t i = 0; i < computeQueueCount; i++) {
+                computeQueues[i].family = computeFamily;
+                vkGetDeviceQueue(device, computeFamily, i, &computeQueues[i].queue);
+            }
+            transferQueue.family = transferFamily;
+            vkGetDeviceQueue(device, transferFamily, transferQueueIndex, &transferQueue.queue);
+        };
+
+        void createVmaAllocator(){
+            VmaAllocatorCreateInfo allocatorCreateInfo{};
+            allocatorCreateInfo.flags = VMA_ALLOCATOR_CREATE_EXT_MEMORY_BUDGET_BIT;
+            allocatorCreateInfo.vulkanApiVersion = VK_API_VERSION_1_3;
+            allocatorCreateInfo.physicalDevice = physicalDevice;
+            allocatorCreateInfo.device = device;
+            allocatorCreateInfo.instance = instance;
+            allocatorCreateInfo.pVulkanFunctions = nullptr;
+
+            vmaCreateAllocator(&allocatorCreateInfo, &allocator);
+        }
+
+        void createCommandPool(){
+            VkCommandPoolCreateInfo poolInfo{};
+            poolInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+            poolInfo.flags = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT;
+            poolInfo.queueFamilyIndex = computeQueues[0].family;
+
+            if (vkCreateCommandPool(device, &poolInfo, nullptr, &commandPool) != VK_SUCCESS) {
+                throw std::runtime_error("failed to create command pool!");
+            }
+
+            poolInfo.queueFamilyIndex = transferQueue.family;
+            if (vkCreateCommandPool(device, &poolInfo, nullptr, &transferCommandPool) != VK_SUCCESS) {
+                throw std::runtime_error("failed to create command pool!");
+            }
+        }
+
+        void createCommandBuffer(){
+            VkCommandBufferAllocateInfo allocateInfo = {};
+            allocateInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+            allocateInfo.commandPool = commandPool;
+            allocateInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+            allocateInfo.commandBufferCount = 1;
+
+            VkCommandBufferAllocateInfo transferAllocateInfo = allocateInfo;
+            transferAllocateInfo.commandPool = transferCommandPool;
+
+            for (Frame& frame : frames) {
+                if (vkAllocateCommandBuffers(device, &allocateInfo, &frame.commandBuffer) != VK_SUCCESS ||
+                        vkAllocateCommandBuffers(device, &allocateInfo, &frame.acquireCommandBuffer) != VK_SUCCESS ||
+                        vkAllocateCommandBuffers(device, &allocateInfo, &frame.queryCommandBuffer) != VK_SUCCESS ||
+                        vkAllocateCommandBuffers(device, &allocateInfo, &frame.indexCommandBuffer) != VK_SUCCESS ||
+                        vkAllocateCommandBuffers(device, &transferAllocateInfo, &frame.readbackCommandBuffer) != VK_SUCCESS ||
+                        vkAllocateCommandBuffers(device, &transferAllocateInfo, &frame.uploadCommandBuffer) != VK_SUCCESS){
+                    throw std::runtime_error("failed to allocate command buffers!");
+                }
+            }
+        }
+
+        void createProfiler(){
+            uint32_t validBits = vu::timestampValidBits(physicalDevice, computeQueues[0].family);
+            uint32_t transferValidBits = vu::timestampValidBits(physicalDevice, transferQueue.family);
+            transferTimestamps = transferValidBits > 0;
+            if (transferTimestamps) {
+                validBits = std::min(validBits, transferValidBits);
+            }
+
+            profiler.init(instance, device, deviceProperties, validBits, debugUtilsEnabled,
+                profileRegionsPerFrame * static_cast<uint32_t>(frames.size()), scopesPerProfileRegion);
+        }
+
+        void createSyncObjects(){
+            // Starts at 0, which every wait for "no submission yet" passes
+            VkSemaphoreTypeCreateInfo timelineInfo{};
+            timelineInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_TYPE_CREATE_INFO;
+            timelineInfo.semaphoreType = VK_SEMAPHORE_TYPE_TIMELINE;
+            timelineInfo.initialValue = 0;
+
+            VkSemaphoreCreateInfo semaphoreInfo{};
+            semaphoreInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
+            semaphoreInfo.pNext = &timelineInfo;
+
+            for (Queue* queue : allQueues()) {
+                if (vkCreateSemaphore(device, &semaphoreInfo, nullptr, &queue->timeline) != VK_SUCCESS) {
+                    throw std::runtime_error("failed to create timeline semaphore!");
+                }
+            }
+        }
+
+        std::vector<Queue*> allQueues(){
+            std::vector<Queue*> queues;
+            for (Queue& queue : computeQueues) {
+                queues.push_back(&queue);
+            }
+            queues.push_back(&transferQueue);
+            return queues;
+        }
+
+        // Catch up with whatever the transfer queue has finished
+        void retireSerials(){
+            if (vkGetSemaphoreCounterValue(device, transferQueue.timeline, &completedSerial) != VK_SUCCESS) {
+                throw std::runtime_error("failed to read timeline semaphore!");
+            }
+            stagingRing.retire(completedSerial);
+            while (!shapeRingReleases.empty() && shapeRingReleases.front().first <= completedSerial) {
+                shapeRing->release(shapeRingReleases.front().second);
+                shapeRingReleases.pop_front();
+            }
+            profiler.collect(completedSerial);
+        }
+
+        // Block until `queue` has finished its submission `value`
+        // (a compute queue, see waitForSerial() for the transfer queue)
+        void waitForQueue(const Queue& queue, uint64_t value){
+            VkSemaphoreWaitInfo waitInfo{};
+            waitInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_WAIT_INFO;
+            waitInfo.semaphoreCount = 1;
+            waitInfo.pSemaphores = &queue.timeline;
+            waitInfo.pValues = &value;
+
+            if (vkWaitSemaphores(device, &waitInfo, UINT64_MAX) != VK_SUCCESS) {
+                throw std::runtime_error("failed to wait for timeline semaphore!");
+            }
+        }
+
+        // Something the pre-recorded command buffers depend on changed, every
+        // frame re-records before its next submission. Tiles may be numbered
+        // differently now too, so every grid is recomputed from scratch.
+        void invalidateCommandBuffers(){
+            for (Frame& frame : frames) {
+                frame.recorded = false;
+            }
+            markAllDirty();
+        }
+
+        // Recompute every tile of every grid on each frame's next run
+        void markAllDirty(){
+            size_t tiles = size_t(tileCount(workgroupSizes.at(kernelShaderName(activeKernel)))) * scenarioCount;
+            for (Frame& frame : frames) {
+                frame.dirtyMask.assign((tiles + 31) / 32, ~0u);
+            }
+        }
+
+        // Mark the tiles of `scenario` under `box` (grid units) dirty in
+        // every frame
+        void markDirty(uint32_t scenario, const vu::GridBox& box){
+            WorkgroupSize tile = workgroupSizes.at(kernelShaderName(activeKernel));
+            uint32_t tilesX = (gridManager.gridWidth + tile.x - 1) / tile.x;
+            uint32_t tilesY = (gridManager.gridHeight + tile.y - 1) / tile.y;
+
+            // A cell of slack on every side for rounding at the edges. Boxes
+            // can be empty, infinite or entirely off the grid.
+            double x0 = std::max(double(box.x0) - 1.0, 0.0);
+            double y0 = std::max(double(box.y0) - 1.0, 0.0);
+            double x1 = std::min(double(box.x1) + 1.0, double(gridManager.gridWidth - 1));
+            double y1 = std::min(double(box.y1) + 1.0, double(gridManager.gridHeight - 1));
+            if (!(x0 <= x1 && y0 <= y1)) {
+                return;
+            }
+
+            uint32_t tileX0 = static_cast<uint32_t>(x0) / tile.x;
+            uint32_t tileY0 = static_cast<uint32_t>(y0) / tile.y;
+            uint32_t tileX1 = std::min(static_cast<uint32_t>(x1) / tile.x, tilesX - 1);
+            uint32_t tileY1 = std::min(static_cast<uint32_t>(y1) / tile.y, tilesY - 1);
+            for (uint32_t y = tileY0; y <= tileY1; y++) {
+                for (uint32_t x = tileX0; x <= tileX1; x++) {
+                    size_t index = x + size_t(y) * tilesX + size_t(scenario) * tilesX * tilesY;
+                    for (Frame& frame : frames) {
+                        frame.dirtyMask[index / 32] |= 1u << (index % 32);
+                    }
+                }
+            }
+        }
+
+        // Mark whatever the active kernel computes differently with the new
+        // shapes than with the ones uploaded now, scenario by scenario. The
+        // number of scenarios can't change here.
+        void markChangedTiles(const std::vector<Circle>& newCircles, const std::vector<Rectangle>& newRectangles,
+                              const std::vector<LightSource>& newLights, const std::vector<ScenarioRange>& newRanges){
+            std::vector<vu::GridBox> boxes;
+            for (uint32_t scenario = 0; scenario < scenarioCount; scenario++) {
+                vu::CpuScene before = sceneView(scenarioRanges[scenario], circles, rectangles, lights);
+                vu::CpuScene after = sceneView(newRanges[scenario], newCircles, newRectangles, newLights);
+
+                boxes.clear();
+                switch (activeKernel) {
+                    case GridKernel::Fill:
+                        break;
+                    // Distance fields and costs are rebuilt everywhere every
+                    // run, only the occupancy under them is kept per tile
+                    case GridKernel::Occupancy:
+                    case GridKernel::Distance:
+                    case GridKernel::CostToGo:
+                        vu::occupancyChanges(before, after, boxes);
+                        break;
+                    case GridKernel::Lighting:
+                        vu::lightingChanges(before, after, boxes);
+                        break;
+                }
+
+                for (const vu::GridBox& box : boxes) {
+                    markDirty(scenario, box);
+                }
+            }
+        }
+
+        // Record bind -> dispatch -> barrier into the frame's command buffer
+        // and the readback copy into its readback command buffer once. Nothing
+        // in here changes between ticks (which tiles get dispatched is up to
+        // the dirty mask), so it's safe to resubmit as is.
+        void recordFrameCommandBuffers(Frame& frame){
+            VkCommandBuffer cmd = frame.commandBuffer;
+            uint32_t profileRegion = computeProfileRegion + profileRegionsPerFrame * frame.index;
+
+            VkCommandBufferBeginInfo beginInfo{};
+            beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+            beginInfo.flags = 0; // Not one-time, we resubmit this every tick
+
+            if (vkBeginCommandBuffer(cmd, &beginInfo) != VK_SUCCESS) {
+                throw std::runtime_error("failed to begin recording compute command buffer!");
+            }
+
+            profiler.beginRegion(cmd, profileRegion);
+            recordKernel(cmd, frame, activeKernel, profileRegion);
+
+            // Make the grid writes visible to whatever reads it next, whether
+            // that's the next resubmission of this kernel, a reduction, a copy
+            // or the host
+            vu::memoryBarrier(cmd,
+                VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_ACCESS_SHADER_WRITE_BIT,
+                VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT | VK_PIPELINE_STAGE_TRANSFER_BIT | VK_PIPELINE_STAGE_HOST_BIT,
+                VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT | VK_ACCESS_TRANSFER_READ_BIT | VK_ACCESS_HOST_READ_BIT);
+
+            if (pyramidEnabled) {
+                recordPyramid(cmd, frame, profileRegion);
+            }
+
+            frame.reduces = reduction.enabled;
+            if (frame.reduces) {
+                recordReduction(cmd, frame, profileRegion);
+            }
+            frame.plans = activeKernel == GridKernel::CostToGo;
+
+            if (vkEndCommandBuffer(cmd) != VK_SUCCESS) {
+                throw std::runtime_error("failed to record compute command buffer!");
+            }
+
+            frame.readsBackGrid = gridReadback;
+            recordReadbackCommandBuffer(frame);
+            frame.recorded = true;
+        }
+
+        // Run the `count` queries in the frame's query buffer against its
+        // grid (and pyramid)
+        void recordQueryCommandBuffer(Frame& frame, uint32_t count){
+            VkCommandBuffer cmd = frame.queryCommandBuffer;
+
+            VkCommandBufferBeginInfo beginInfo{};
+            beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+            beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+
+            if (vkBeginCommandBuffer(cmd, &beginInfo) != VK_SUCCESS) {
+                throw std::runtime_error("failed to begin recording query command buffer!");
+            }
+
+            vu::memoryBarrier(cmd,
+                VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_ACCESS_SHADER_WRITE_BIT,
+                VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_ACCESS_SHADER_READ_BIT);
+
+            vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_COMPUTE,
+                computePipelineLayout, 0, 1, &frame.descriptorSet, 0, nullptr);
+            GridPushConstants pushConstants{};
+            pushConstants.gridWidth = gridManager.gridWidth;
+            pushConstants.gridHeight = gridManager.gridHeight;
+            pushConstants.scenarioCount = scenarioCount;
+            pushConstants.queryCount = count;
+            pushConstants.queryPyramid = pyramidEnabled ? 1 : 0;
+            recordPushConstants(cmd, pushConstants);
+
+            // query.glsl loops over whatever doesn't fit
+            uint32_t groups = std::min((count + queryGroupSize - 1) / queryGroupSize,
+                                       deviceProperties.limits.maxComputeWorkGroupCount[0]);
+            vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_COMPUTE, pipelines.at("query"));
+            vkCmdDispatch(cmd, groups, 1, 1);
+
+            // Results to the host, and the frame's next kernel, which goes on
+            // this queue too, mustn't start rewriting the grid and pyramid
+            // before the batch is done reading them
+            vu::memoryBarrier(cmd,
+                VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_ACCESS_SHADER_WRITE_BIT,
+                VK_PIPELINE_STAGE_HOST_BIT | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_ACCESS_HOST_READ_BIT);
+
+            if (vkEndCommandBuffer(cmd) != VK_SUCCESS) {
+                throw std::runtime_error("failed to record query command buffer!");
+            }
+        }
+
+        // Make room in the frame's shape index buffers for the shapes there
+        // are now and record the build into its index command buffer. The
+        // frame's runs have to be done already.
+        void prepareShapeIndex(Frame& frame){
+            const ScenarioRange& last = scenarioRanges.back();
+            VkDeviceSize shapes = circles.size() + rectangles.size();
+            VkDeviceSize leaves = last.indexLeafOffset + vu::shapeIndexLeafCount(last.circleCount) +
+                                  vu::shapeIndexLeafCount(last.rectCount);
+            VkDeviceSize clusters = last.indexClusterOffset + vu::shapeIndexClusterCount(last.circleCount) +
+                                    vu::shapeIndexClusterCount(last.rectCount);
+
+            if (shapes > frame.indexEntryCapacity || leaves > frame.indexLeafCapacity ||
+                    clusters > frame.indexClusterCapacity) {
+                // Query batches use the descriptor set too
+                waitForQueue(computeQueues[frame.index % computeQueues.size()], frame.queryValue);
+                destroyShapeIndexBuffers(frame);
+                createShapeIndexBuffers(frame, std::max(shapes, frame.indexEntryCapacity * 2),
+                    std::max(leaves, frame.indexLeafCapacity * 2), std::max(clusters, frame.indexClusterCapacity * 2));
+                writeShapeIndexDescriptors(frame);
+                frame.recorded = false;
+            }
+            recordShapeIndex(frame, static_cast<uint32_t>(shapes));
+        }
+
+        // Build every scenario's shape index from the shape buffers, see
+        // shape_index.glsl: sort keys, the radix sort a digit at a time, then
+        // the leaf and cluster boxes bottom up
+        void recordShapeIndex(Frame& frame, uint32_t shapes){
+            VkCommandBuffer cmd = frame.indexCommandBuffer;
+            uint32_t profileRegion = indexProfileRegion + profileRegionsPerFrame * frame.index;
+            const VkPhysicalDeviceLimits& limits = deviceProperties.limits;
+            uint32_t blocks = (shapes + shapeIndexBlockSize - 1) / shapeIndexBlockSize;
+            if (blocks > limits.maxComputeWorkGroupCount[0]) {
+                throw std::runtime_error("too many shapes for the shape index!");
+            }
+            if (scenarioCount > limits.maxComputeWorkGroupCount[2]) {
+                throw std::runtime_error("too many scenarios to index in one dispatch!");
+            }
+
+            VkCommandBufferBeginInfo beginInfo{};
+            beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+            beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+
+            if (vkBeginCommandBuffer(cmd, &beginInfo) != VK_SUCCESS) {
+                throw std::runtime_error("failed to begin recording shape index command buffer!");
+            }
+
+            profiler.beginRegion(cmd, profileRegion);
+            if (shapes > 0) {
+                vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_COMPUTE,
+                    computePipelineLayout, 0, 1, &frame.descriptorSet, 0, nullptr);
+                GridPushConstants pushConstants{};
+                pushConstants.gridWidth = gridManager.gridWidth;
+                pushConstants.gridHeight = gridManager.gridHeight;
+                pushConstants.scenarioCount = scenarioCount;
+                pushConstants.indexEntryCount = shapes;
+                recordPushConstants(cmd, pushConstants);
+                vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_COMPUTE, pipelines.at("shape_index"));
+
+                auto setPass = [&](uint32_t pass, uint32_t shift) {
+                    uint32_t values[] = {pass, shift};
+                    vkCmdPushConstants(cmd, computePipelineLayout, VK_SHADER_STAGE_COMPUTE_BIT,
+                        offsetof(GridPushConstants, indexPass), sizeof(values), values);
+                };
+                auto passBarrier = [&]() {
+                    vu::memoryBarrier(cmd,
+                        VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_ACCESS_SHADER_WRITE_BIT,
+                        VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT);
+                };
+
+                // The per scenario passes are sized for the biggest scenario
+                // and loop over whatever doesn't fit. The shape buffers were
+                // made visible by the acquire (or the semaphore wait on the
+                // upload).
+                uint32_t largest = 0;
+                uint32_t largestLeaves = 0;
+                for (const ScenarioRange& range : scenarioRanges) {
+                    largest = std::max(largest, range.circleCount + range.rectCount);
+                    largestLeaves = std::max(largestLeaves,
+                        vu::shapeIndexLeafCount(range.circleCount) + vu::shapeIndexLeafCount(range.rectCount));
+                }
+                uint32_t keyGroups = (largest + shapeIndexBlockSize - 1) / shapeIndexBlockSize;
+                uint32_t leafGroups = (largestLeaves + shapeIndexBlockSize - 1) / shapeIndexBlockSize;
+                beginPass(cmd, profileRegion, "shape_index_keys");
+                setPass(0, 0);
+                vkCmdDispatch(cmd, keyGroups, 1, scenarioCount);
+                passBarrier();
+                endPass(cmd, profileRegion);
+
+                beginPass(cmd, profileRegion, "shape_index_sort");
+                uint32_t passes = vu::shapeIndexSortPasses(scenarioCount);
+                for (uint32_t pass = 0; pass < passes; pass++) {
+                    uint32_t shift = pass * vu::shapeIndexDigitBits;
+                    setPass(1, shift);
+                    vkCmdDispatch(cmd, blocks, 1, 1);
+                    passBarrier();
+                    setPass(2, shift);
+                    vkCmdDispatch(cmd, 1, 1, 1);
+                    passBarrier();
+                    setPass(3, shift);
+                    vkCmdDispatch(cmd, blocks, 1, 1);
+                    passBarrier();
+                }
+                endPass(cmd, profileRegion);
+
+                beginPass(cmd, profileRegion, "shape_index_bounds");
+                setPass(4, 0);
+                vkCmdDispatch(cmd, leafGroups, 1, scenarioCount);
+                passBarrier();
+                setPass(5, 0);
+                vkCmdDispatch(cmd, 1, 1, scenarioCount);
+                endPass(cmd, profileRegion);
+
+                // Binning, in the frame's command buffer right after this
+                vu::memoryBarrier(cmd,
+                    VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_ACCESS_SHADER_WRITE_BIT,
+                    VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_ACCESS_SHADER_READ_BIT);
+            }
+
+            if (vkEndCommandBuffer(cmd) != VK_SUCCESS) {
+                throw std::runtime_error("failed to record shape index command buffer!");
+            }
+        }
+
+        // Build the frame's pyramid bottom up, a dispatch per level, each
+        // level's writes made visible to the next. Every other push constant
+        // is whatever recordKernel() left.
+        void recordPyramid(VkCommandBuffer cmd, const Frame& frame, uint32_t profileRegion){
+            const VkPhysicalDeviceLimits& limits = deviceProperties.limits;
+            if (scenarioCount > limits.maxComputeWorkGroupCount[2]) {
+                throw std::runtime_error("too many scenarios to build pyramids in one dispatch!");
+            }
+
+            beginPass(cmd, profileRegion, "pyramid");
+            vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_COMPUTE, pipelines.at("pyramid"));
+            for (uint32_t level = 1; level <= pyramidLevels.size(); level++) {
+                vkCmdPushConstants(cmd, computePipelineLayout, VK_SHADER_STAGE_COMPUTE_BIT,
+                    offsetof(GridPushConstants, pyramidLevel), sizeof(uint32_t), &level);
+
+                // pyramid.glsl loops over whatever doesn't fit
+                const vu::PyramidLevel& size = pyramidLevels[level - 1];
+                uint32_t groupsX = std::min((size.width + pyramidGroupSize - 1) / pyramidGroupSize, limits.maxComputeWorkGroupCount[0]);
+                uint32_t groupsY = std::min((size.height + pyramidGroupSize - 1) / pyramidGroupSize, limits.maxComputeWorkGroupCount[1]);
+                vkCmdDispatch(cmd, groupsX, groupsY, scenarioCount);
+
+                vu::memoryBarrier(cmd,
+                    VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_ACCESS_SHADER_WRITE_BIT,
+                    VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT);
+            }
+            endPass(cmd, profileRegion);
+        }
+
+        // Reduce every layer of the frame's grid into its stats buffer, with
+        // the push constants recordKernel() left. reduce.glsl covers each
+        // layer with reduceGroupCount workgroups, then reduce_finish.glsl
+        // combines their partials with one workgroup per scenario.
+        void recordReduction(VkCommandBuffer cmd, const Frame& frame, uint32_t profileRegion){
+            if (scenarioCount > deviceProperties.limits.maxComputeWorkGroupCount[1]) {
+                throw std::runtime_error("too many scenarios to reduce in one dispatch!");
+            }
+
+            beginPass(cmd, profileRegion, "reduce");
+            vkCmdFillBuffer(cmd, frame.reduceHistogramBuffer, 0, VK_WHOLE_SIZE, 0);
+            vu::memoryBarrier(cmd,
+                VK_PIPELINE_STAGE_TRANSFER_BIT, VK_ACCESS_TRANSFER_WRITE_BIT,
+                VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT);
+
+            vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_COMPUTE, pipelines.at("reduce"));
+            vkCmdDispatch(cmd, reduceGroupCount, scenarioCount, 1);
+            endPass(cmd, profileRegion);
+
+            vu::memoryBarrier(cmd,
+                VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_ACCESS_SHADER_WRITE_BIT,
+                VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_ACCESS_SHADER_READ_BIT);
+
+            beginPass(cmd, profileRegion, "reduce_finish");
+            vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_COMPUTE, pipelines.at("reduce_finish"));
+            vkCmdDispatch(cmd, 1, scenarioCount, 1);
+            endPass(cmd, profileRegion);
+
+            // The next run's fill and partials have to wait for this one too
+            vu::memoryBarrier(cmd,
+                VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_ACCESS_SHADER_WRITE_BIT,
+                VK_PIPELINE_STAGE_TRANSFER_BIT | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT | VK_PIPELINE_STAGE_HOST_BIT,
+                VK_ACCESS_TRANSFER_WRITE_BIT | VK_ACCESS_SHADER_WRITE_BIT | VK_ACCESS_HOST_READ_BIT);
+        }
+
+        void recordReadbackCommandBuffer(Frame& frame){
+            VkCommandBuffer cmd = frame.readbackCommandBuffer;
+            uint32_t profileRegion = transferTimestamps ?
+                readbackProfileRegion + profileRegionsPerFrame * frame.index : noProfileRegion;
+
+            VkCommandBufferBeginInfo beginInfo{};
+            beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+            beginInfo.flags = 0;
+
+            if (vkBeginCommandBuffer(cmd, &beginInfo) != VK_SUCCESS) {
+                throw std::runtime_error("failed to begin recording readback command buffer!");
+            }
+
+            if (profileRegion != noProfileRegion) {
+                profiler.beginRegion(cmd, profileRegion);
+            }
+
+            // The grid is shared by both families and the semaphore wait
+            // already covers the kernel's writes, so no barrier needed here.
+            // A host visible grid is read in place (the kernel's command
+            // buffer already made its writes visible to the host), so there's
+            // nothing to copy. Without the copy this is still submitted, it's
+            // what signals the run's serial.
+            if (frame.readsBackGrid && frame.gridMapped == nullptr) {
+                beginPass(cmd, profileRegion, "readback");
+                VkBufferCopy copyRegion{};
+                copyRegion.size = gridBufferSize;
+                vkCmdCopyBuffer(cmd, frame.gridBuffer, frame.readbackBuffer, 1, &copyRegion);
+                endPass(cmd, profileRegion);
+
+                vu::memoryBarrier(cmd,
+                    VK_PIPELINE_STAGE_TRANSFER_BIT, VK_ACCESS_TRANSFER_WRITE_BIT,
+                    VK_PIPELINE_STAGE_HOST_BIT, VK_ACCESS_HOST_READ_BIT);
+            }
+
+            if (vkEndCommandBuffer(cmd) != VK_SUCCESS) {
+                throw std::runtime_error("failed to record readback command buffer!");
+            }
+        }
+
+        // Every pass `kernel` needs on `frame`'s buffers, without the trailing
+        // barrier. Passes are timed when `profileRegion` is given.
+        void recordKernel(VkCommandBuffer cmd, const Frame& frame, GridKernel kernel, uint32_t profileRegion = noProfileRegion){
+            vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_COMPUTE,
+                computePipelineLayout, 0, 1, &frame.descriptorSet, 0, nullptr);
+
+            // Every pass works in tiles of the kernel's workgroup size
+            WorkgroupSize tile = workgroupSizes.at(kernelShaderName(kernel));
+            GridPushConstants pushConstants{};
+            pushConstants.gridWidth = gridManager.gridWidth;
+            pushConstants.gridHeight = gridManager.gridHeight;
+            // Lights don't affect occupancy, keep them out of the bins
+            pushConstants.binLights = kernel == GridKernel::Lighting ? 1 : 0;
+            pushConstants.tileWidth = tile.x;
+            pushConstants.tileHeight = tile.y;
+            pushConstants.scenarioCount = scenarioCount;
+            // Left for recordReduction(), should it run after this
+            if (reduction.enabled) {
+                pushConstants.reduceThreshold = reduction.threshold;
+                pushConstants.histogramMin = reduction.histogramMin;
+                pushConstants.histogramScale = histogramScale(reduction);
+            }
+            pushConstants.reduceGroupCount = reduceGroupCount;
+            pushConstants.distancePasses = distanceFloodPasses;
+            pushConstants.goalX = planner.goalX;
+            pushConstants.goalY = planner.goalY;
+            pushConstants.shapeIndex = shapeIndexEnabled ? 1 : 0;
+            recordPushConstants(cmd, pushConstants);
+
+            beginPass(cmd, profileRegion, "dirty_tiles");
+            recordDirtyTiles(cmd, frame);
+            endPass(cmd, profileRegion);
+
+            switch (kernel) {
+                case GridKernel::Fill:
+                    beginPass(cmd, profileRegion, "grid");
+                    recordDispatch(cmd, frame, "grid");
+                    endPass(cmd, profileRegion);
+                    break;
+                case GridKernel::Occupancy:
+                    beginPass(cmd, profileRegion, "binning");
+                    recordBinning(cmd, frame);
+                    endPass(cmd, profileRegion);
+                    beginPass(cmd, profileRegion, "occupancy");
+                    recordDispatch(cmd, frame, "occupancy");
+                    endPass(cmd, profileRegion);
+                    break;
+                case GridKernel::Lighting:
+                    beginPass(cmd, profileRegion, "binning");
+                    recordBinning(cmd, frame);
+                    endPass(cmd, profileRegion);
+                    beginPass(cmd, profileRegion, "lighting");
+                    recordDispatch(cmd, frame, "lighting");
+                    endPass(cmd, profileRegion);
+                    break;
+                case GridKernel::Distance:
+                    beginPass(cmd, profileRegion, "binning");
+                    recordBinning(cmd, frame);
+                    endPass(cmd, profileRegion);
+                    beginPass(cmd, profileRegion, "occupancy");
+                    recordDispatch(cmd, frame, "occupancy");
+                    endPass(cmd, profileRegion);
+                    recordDistanceField(cmd, profileRegion);
+                    break;
+                case GridKernel::CostToGo:
+                    beginPass(cmd, profileRegion, "binning");
+                    recordBinning(cmd, frame);
+                    endPass(cmd, profileRegion);
+                    beginPass(cmd, profileRegion, "occupancy");
+                    recordDispatch(cmd, frame, "occupancy");
+                    endPass(cmd, profileRegion);
+                    recordCostToGo(cmd, frame, profileRegion);
+                    break;
+            }
+        }
+
+        // Plan from scratch over the occupancy recordKernel() just left in
+        // the grid, see planner.glsl: seed, then plannerIterations() sweeps
+        // each followed by a convergence check, then write the costs into the
+        // grid. The sweeps are dispatched indirectly from the state buffer,
+        // which is how the checks skip whatever's left once the costs settle.
+        void recordCostToGo(VkCommandBuffer cmd, const Frame& frame, uint32_t profileRegion){
+            const VkPhysicalDeviceLimits& limits = deviceProperties.limits;
+            uint32_t tilesX = (gridManager.gridWidth + plannerTileSize - 1) / plannerTileSize;
+            uint32_t tilesY = (gridManager.gridHeight + plannerTileSize - 1) / plannerTileSize;
+            if (tilesX > limits.maxComputeWorkGroupCount[0] || tilesY > limits.maxComputeWorkGroupCount[1] ||
+                    scenarioCount > limits.maxComputeWorkGroupCount[2]) {
+                throw std::runtime_error("grid is too large to plan over in one dispatch!");
+            }
+
+            vu::memoryBarrier(cmd,
+                VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_ACCESS_SHADER_WRITE_BIT,
+                VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT);
+
+            // Seeding and writing the costs back loop over whatever doesn't fit
+            uint32_t groupsX = std::min(tilesX, limits.maxComputeWorkGroupCount[0]);
+            uint32_t groupsY = std::min(tilesY, limits.maxComputeWorkGroupCount[1]);
+            auto setPass = [&](uint32_t pass, uint32_t iteration) {
+                uint32_t values[] = {pass, iteration};
+                vkCmdPushConstants(cmd, computePipelineLayout, VK_SHADER_STAGE_COMPUTE_BIT,
+                    offsetof(GridPushConstants, plannerPass), sizeof(values), values);
+            };
+            // Sweeps read what the check before them wrote, dispatch size
+            // included
+            auto sweepBarrier = [&]() {
+                vu::memoryBarrier(cmd,
+                    VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_ACCESS_SHADER_WRITE_BIT,
+                    VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT | VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT,
+                    VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT | VK_ACCESS_INDIRECT_COMMAND_READ_BIT);
+            };
+
+            beginPass(cmd, profileRegion, "planner");
+            vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_COMPUTE, pipelines.at("planner"));
+            setPass(0, 0);
+            vkCmdDispatch(cmd, groupsX, groupsY, scenarioCount);
+            sweepBarrier();
+
+            for (uint32_t iteration = 0; iteration < plannerIterations(); iteration++) {
+                setPass(1, iteration);
+                vkCmdDispatchIndirect(cmd, frame.plannerStateBuffer, 0);
+                sweepBarrier();
+                setPass(2, iteration);
+                vkCmdDispatch(cmd, 1, 1, 1);
+                sweepBarrier();
+            }
+
+            setPass(3, 0);
+            vkCmdDispatch(cmd, groupsX, groupsY, scenarioCount);
+            endPass(cmd, profileRegion);
+
+            vu::memoryBarrier(cmd,
+                VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_ACCESS_SHADER_WRITE_BIT,
+                VK_PIPELINE_STAGE_HOST_BIT, VK_ACCESS_HOST_READ_BIT);
+        }
+
+        // A sweep gets the costs at least one tile further from the goal, so
+        // this is enough for maps without long detours. Runs that need more
+        // say so in their PlannerStatus and can't be read back.
+        uint32_t plannerIterations() const {
+            if (planner.maxIterations > 0) {
+                return planner.maxIterations;
+            }
+            uint32_t tilesX = (gridManager.gridWidth + plannerTileSize - 1) / plannerTileSize;
+            uint32_t tilesY = (gridManager.gridHeight + plannerTileSize - 1) / plannerTileSize;
+            return 2 * (tilesX + tilesY) + 2;
+        }
+
+        // Kernels with scratch buffers the size of the grid, which are only
+        // allocated while the kernel is active
+        static bool hasScratchBuffers(GridKernel kernel){
+            return kernel == GridKernel::Distance || kernel == GridKernel::CostToGo;
+        }
+
+        // Jump flood the occupancy recordKernel() just left in the grid into
+        // a signed distance field, see distance.glsl. Every pass covers the
+        // whole grid, since one obstacle moving can change distances anywhere.
+        void recordDistanceField(VkCommandBuffer cmd, uint32_t profileRegion){
+            const VkPhysicalDeviceLimits& limits = deviceProperties.limits;
+            if (scenarioCount > limits.maxComputeWorkGroupCount[2]) {
+                throw std::runtime_error("too many scenarios to build distance fields in one dispatch!");
+            }
+
+            vu::memoryBarrier(cmd,
+                VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_ACCESS_SHADER_WRITE_BIT,
+                VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT);
+
+            // distance.glsl loops over whatever doesn't fit
+            uint32_t groupsX = std::min((gridManager.gridWidth + distanceGroupSize - 1) / distanceGroupSize, limits.maxComputeWorkGroupCount[0]);
+            uint32_t groupsY = std::min((gridManager.gridHeight + distanceGroupSize - 1) / distanceGroupSize, limits.maxComputeWorkGroupCount[1]);
+
+            beginPass(cmd, profileRegion, "distance");
+            vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_COMPUTE, pipelines.at("distance"));
+            for (uint32_t pass = 0; pass <= distanceFloodPasses + 1; pass++) {
+                vkCmdPushConstants(cmd, computePipelineLayout, VK_SHADER_STAGE_COMPUTE_BIT,
+                    offsetof(GridPushConstants, distancePass), sizeof(uint32_t), &pass);
+                vkCmdDispatch(cmd, groupsX, groupsY, scenarioCount);
+
+                if (pass <= distanceFloodPasses) {
+                    vu::memoryBarrier(cmd,
+                        VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_ACCESS_SHADER_WRITE_BIT,
+                        VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT);
+                }
+            }
+            endPass(cmd, profileRegion);
+        }
+
+        void beginPass(VkCommandBuffer cmd, uint32_t profileRegion, const std::string& name){
+            if (profileRegion != noProfileRegion) {
+                profiler.beginScope(cmd, profileRegion, name);
+            }
+        }
+
+        void endPass(VkCommandBuffer cmd, uint32_t profileRegion){
+            if (profileRegion != noProfileRegion) {
+                profiler.endScope(cmd, profileRegion);
+            }
+        }
+
+        // The shader whose workgroup size matters for `kernel`
+        static std::string kernelShaderName(GridKernel kernel){
+            switch (kernel) {
+                case GridKernel::Occupancy:
+                case GridKernel::Distance:
+                case GridKernel::CostToGo:
+                    return "occupancy";
+                case GridKernel::Lighting:
+                    return "lighting";
+                default:
+                    return "grid";
+            }
+        }
+
+        void recordPushConstants(VkCommandBuffer cmd, const GridPushConstants& pushConstants){
+            vkCmdPushConstants(cmd, computePipelineLayout, VK_SHADER_STAGE_COMPUTE_BIT,
+                0, sizeof(pushConstants), &pushConstants);
+        }
+
+        // One workgroup per dirty tile, as many as dirty_tiles.glsl found
+        void recordDispatch(VkCommandBuffer cmd, const Frame& frame, const std::string& shaderName){
+            vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_COMPUTE, pipelines.at(shaderName));
+            vkCmdDispatchIndirect(cmd, frame.dirtyTileBuffer, 0);
+        }
+
+        // Turn the frame's dirty tile mask into the list (and indirect
+        // dispatch size) the passes after it run over
+        void recordDirtyTiles(VkCommandBuffer cmd, const Frame& frame){
+            vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_COMPUTE, pipelines.at("dirty_tiles"));
+            vkCmdDispatch(cmd, 1, 1, 1);
+
+            vu::memoryBarrier(cmd,
+                VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_ACCESS_SHADER_WRITE_BIT,
+                VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT | VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT,
+                VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_INDIRECT_COMMAND_READ_BIT);
+        }
+
+        uint32_t tileCount(WorkgroupSize tile){
+            return ((gridManager.gridWidth + tile.x - 1) / tile.x) * ((gridManager.gridHeight + tile.y - 1) / tile.y);
+        }
+
+        // Rebuild the bins of the dirty tiles for the shapes/lights currently
+        // uploaded, with the tile size in the push constants
+        void recordBinning(VkCommandBuffer cmd, const Frame& frame){
+            // The index pool is allocated from scratch every time
+            vkCmdFillBuffer(cmd, frame.tileBinBuffer, 0, sizeof(uint32_t), 0);
+            vu::memoryBarrier(cmd,
+                VK_PIPELINE_STAGE_TRANSFER_BIT, VK_ACCESS_TRANSFER_WRITE_BIT,
+                VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT);
+
+            // One workgroup per tile
+            recordDispatch(cmd, frame, "binning");
+
+            vu::memoryBarrier(cmd,
+                VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_ACCESS_SHADER_WRITE_BIT,
+                VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_ACCESS_SHADER_READ_BIT);
+        }
+
+        // Record the copies queued by stageUpload() into the frame's upload
+        // command buffer, and the ownership transfer of everything they wrote
+        // into its acquire command buffer. Returns false if there was nothing
+        // to upload, in which case the command buffers are untouched.
+        bool recordUploadCommandBuffers(Frame& frame){
+            if (pendingUploads.empty()) {
+                return false;
+            }
+
+            VkCommandBuffer uploadCommandBuffer = frame.uploadCommandBuffer;
+            uint32_t profileRegion = transferTimestamps ?
+                uploadProfileRegion + profileRegionsPerFrame * frame.index : noProfileRegion;
+
+            // Grids are shared by both families, everything else changes hands
+            std::vector<VkBuffer> dstBuffers;
+            for (const auto& upload : pendingUploads) {
+                bool grid = std::any_of(frames.begin(), frames.end(),
+                    [&](const Frame& f) { return f.gridBuffer == upload.dstBuffer; });
+                if (!grid && std::find(dstBuffers.begin(), dstBuffers.end(), upload.dstBuffer) == dstBuffers.end()) {
+                    dstBuffers.push_back(upload.dstBuffer);
+                }
+            }
+
+            VkCommandBufferBeginInfo beginInfo{};
+            beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+            beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+
+            if (vkBeginCommandBuffer(uploadCommandBuffer, &beginInfo) != VK_SUCCESS) {
+                throw std::runtime_error("failed to begin recording upload command buffer!");
+            }
+
+            if (profileRegion != noProfileRegion) {
+                profiler.beginRegion(uploadCommandBuffer, profileRegion);
+            }
+            beginPass(uploadCommandBuffer, profileRegion, "upload");
+
+            // Don't overwrite a grid an earlier readback is still copying.
+            // Earlier kernels are taken care of by waiting on their queues.
+            vu::memoryBarrier(uploadCommandBuffer,
+                VK_PIPELINE_STAGE_TRANSFER_BIT, VK_ACCESS_TRANSFER_READ_BIT,
+                VK_PIPELINE_STAGE_TRANSFER_BIT, VK_ACCESS_TRANSFER_WRITE_BIT);
+
+            for (const auto& upload : pendingUploads) {
+                VkBufferCopy copyRegion{};
+                copyRegion.srcOffset = upload.srcOffset;
+                copyRegion.dstOffset = upload.dstOffset;
+                copyRegion.size = upload.size;
+                vkCmdCopyBuffer(uploadCommandBuffer, upload.srcBuffer, upload.dstBuffer, 1, &copyRegion);
+            }
+            pendingUploads.clear();
+            endPass(uploadCommandBuffer, profileRegion);
+
+            // Release everything we wrote to the compute family. The transfer
+            // side never needs to acquire anything back, since it only ever
+            // overwrites these buffers.
+            for (VkBuffer buffer : dstBuffers) {
+                vu::bufferBarrier(uploadCommandBuffer, buffer, transferQueue.family, computeQueues[0].family,
+                    VK_PIPELINE_STAGE_TRANSFER_BIT, VK_ACCESS_TRANSFER_WRITE_BIT,
+                    VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, 0);
+            }
+
+            if (vkEndCommandBuffer(uploadCommandBuffer) != VK_SUCCESS) {
+                throw std::runtime_error("failed to record upload command buffer!");
+            }
+
+            VkCommandBuffer acquireCommandBuffer = frame.acquireCommandBuffer;
+            if (vkBeginCommandBuffer(acquireCommandBuffer, &beginInfo) != VK_SUCCESS) {
+                throw std::runtime_error("failed to begin recording acquire command buffer!");
+            }
+
+            for (VkBuffer buffer : dstBuffers) {
+                vu::bufferBarrier(acquireCommandBuffer, buffer, transferQueue.family, computeQueues[0].family,
+                    VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0,
+                    VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT);
+            }
+
+            if (vkEndCommandBuffer(acquireCommandBuffer) != VK_SUCCESS) {
+                throw std::runtime_error("failed to record acquire command buffer!");
+            }
+
+            return true;
+        }
+
+        // Submit the frame's upload command buffer on the transfer queue once
+        // every kernel submitted so far is done reading what it overwrites
+        void submitUpload(Frame& frame){
+            std::vector<std::pair<const Queue*, uint64_t>> waits;
+            for (const Queue& queue : computeQueues) {
+                waits.push_back({&queue, queue.submittedValue});
+            }
+
+            lastUploadValue = submitCommandBuffers(transferQueue, {frame.uploadCommandBuffer},
+                waits, VK_PIPELINE_STAGE_TRANSFER_BIT);
+            stagingRing.submit(lastUploadValue);
+            if (shapeRingUploadsPending) {
+                shapeRingReleases.emplace_back(lastUploadValue, shapeRingPendingRelease);
+                shapeRingUploadsPending = false;
+            }
+        }
+
+        // Submit to `queue` once each of `waits` has reached its value (0
+        // means don't wait), blocking `waitStage`. Returns the value
+        // `queue`'s timeline is set to when the submission completes.
+        uint64_t submitCommandBuffers(Queue& queue, const std::vector<VkCommandBuffer>& commandBuffers,
+                                      const std::vector<std::pair<const Queue*, uint64_t>>& waits = {},
+                                      VkPipelineStageFlags waitStage = 0){
+            std::vector<VkSemaphore> waitSemaphores;
+            std::vector<uint64_t> waitValues;
+            std::vector<VkPipelineStageFlags> waitStages;
+            for (const auto& [waitQueue, value] : waits) {
+                if (value > 0 && waitQueue != &queue) {
+                    waitSemaphores.push_back(waitQueue->timeline);
+                    waitValues.push_back(value);
+                    waitStages.push_back(waitStage);
+                }
+            }
+            uint64_t value = queue.submittedValue + 1;
+
+            VkTimelineSemaphoreSubmitInfo timelineInfo{};
+            timelineInfo.sType = VK_STRUCTURE_TYPE_TIMELINE_SEMAPHORE_SUBMIT_INFO;
+            timelineInfo.waitSemaphoreValueCount = static_cast<uint32_t>(waitValues.size());
+            timelineInfo.pWaitSemaphoreValues = waitValues.data();
+            timelineInfo.signalSemaphoreValueCount = 1;
+            timelineInfo.pSignalSemaphoreValues = &value;
+
+            VkSubmitInfo submitInfo{};
+            submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+            submitInfo.pNext = &timelineInfo;
+            submitInfo.waitSemaphoreCount = static_cast<uint32_t>(waitSemaphores.size());
+            submitInfo.pWaitSemaphores = waitSemaphores.data();
+            submitInfo.pWaitDstStageMask = waitStages.data();
+            submitInfo.commandBufferCount = static_cast<uint32_t>(commandBuffers.size());
+            submitInfo.pCommandBuffers = commandBuffers.data();
+            submitInfo.signalSemaphoreCount = 1;
+            submitInfo.pSignalSemaphores = &queue.timeline;
+
+            profiler.reset(commandBuffers);
+            if (vkQueueSubmit(queue.queue, 1, &submitInfo, VK_NULL_HANDLE) != VK_SUCCESS) {
+                throw std::runtime_error("failed to submit command buffer!");
+            }
+
+            queue.submittedValue = value;
+            return value;
+        }
+
+        // Copy `data` into the staging ring and queue a copy into `dstBuffer`.
+        // Anything bigger than the ring is split up, and if the ring is full
+        // we have to push what's queued through the GPU before continuing.
+        void stageUpload(VkBuffer dstBuffer, VkDeviceSize dstOffset, const void* data, VkDeviceSize size){
+            const char* src = static_cast<const char*>(data);
+            while (size > 0) {
+                VkDeviceSize chunkSize = std::min(size, stagingRing.size());
+                VkDeviceSize srcOffset;
+                if (!stagingRing.allocate(chunkSize, 16, srcOffset)) {
+                    flushUploads();
+                    if (!stagingRing.allocate(chunkSize, 16, srcOffset)) {
+                        throw std::runtime_error("failed to allocate from staging ring!");
+                    }
+                }
+
+                memcpy(static_cast<char*>(stagingMapped) + srcOffset, src, (size_t) chunkSize);
+                vmaFlushAllocation(allocator, stagingAllocation, srcOffset, chunkSize);
+                pendingUploads.push_back({stagingBuffer, dstBuffer, srcOffset, dstOffset, chunkSize});
+
+                src += chunkSize;
+                dstOffset += chunkSize;
+                size -= chunkSize;
+            }
+        }
+
+        void createShapeBuffer(ShapeBuffer& shapes, VkDeviceSize capacity){
+            VkBufferCreateInfo bufferInfo{};
+            bufferInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+            bufferInfo.size = capacity;
+            bufferInfo.usage = VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT;
+            bufferInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+
+            // Only ever written through the staging ring
+            VmaAllocationCreateInfo allocInfo{};
+            allocInfo.usage = VMA_MEMORY_USAGE_AUTO_PREFER_DEVICE;
+
+            if (vmaCreateBuffer(allocator, &bufferInfo, &allocInfo, &shapes.buffer, &shapes.allocation, nullptr) != VK_SUCCESS) {
+                throw std::runtime_error("failed to create shape buffer!");
+            }
+            shapes.capacity = capacity;
+        }
+
+        void updateShapeBuffer(ShapeBuffer& shapes, uint32_t binding, const void* data, size_t count, size_t stride){
+            VkDeviceSize size = count * stride;
+            reserveShapeBuffer(shapes, binding, size);
+            if (size > 0) {
+                stageUpload(shapes.buffer, 0, data, size);
+            }
+        }
+
+        // Grow `shapes` to hold at least `size` bytes if need be
+        void reserveShapeBuffer(ShapeBuffer& shapes, uint32_t binding, VkDeviceSize size){
+            if (size > shapes.capacity) {
+                // Pending uploads and in flight work may still reference the
+                // old buffer, and the descriptor set can't change under them
+                flushUploads();
+                vmaDestroyBuffer(allocator, shapes.buffer, shapes.allocation);
+                createShapeBuffer(shapes, std::max(size, shapes.capacity * 2));
+                for (Frame& frame : frames) {
+                    writeStorageDescriptor(frame.descriptorSet, binding, shapes.buffer, VK_WHOLE_SIZE);
+                }
+                invalidateCommandBuffers();
+            }
+        }
+
+        // Upload the shapes in `record` into `shapes`, copying straight out
+        // of the imported ring if there is one
+        void uploadShapeUpdate(ShapeBuffer& shapes, uint32_t binding, const vu::ShmRecord& record){
+            if (shapeRingBuffer == VK_NULL_HANDLE) {
+                updateShapeBuffer(shapes, binding, record.payload, record.size, 1);
+                return;
+            }
+
+            reserveShapeBuffer(shapes, binding, record.size);
+            if (record.size > 0) {
+                pendingUploads.push_back({shapeRingBuffer, shapes.buffer, record.offset, 0, record.size});
+                shapeRingUploadsPending = true;
+            }
+        }
+
+        // Start ingesting from `ring`, importing it if the device can
+        void attachShapeRing(vu::ShmRing& ring){
+            if (shapeRing != nullptr) {
+                // Copies still to come out of the old ring go first, which
+                // also gives it back everything
+                flushUploads();
+                detachShapeRing();
+            }
+
+            shapeRing = &ring;
+            shapeRingBuffer = importHostBuffer(ring.data(), ring.size(), shapeRingMemory);
+            if (shapeRingBuffer == VK_NULL_HANDLE) {
+                std::cerr << "can't import the shape ring, updates go through the staging ring" << std::endl;
+            }
+        }
+
+        // Nothing can be copying out of the ring any more
+        void detachShapeRing(){
+            if (shapeRingBuffer != VK_NULL_HANDLE) {
+                vkDestroyBuffer(device, shapeRingBuffer, nullptr);
+                vkFreeMemory(device, shapeRingMemory, nullptr);
+                shapeRingBuffer = VK_NULL_HANDLE;
+            }
+            shapeRing = nullptr;
+        }
+
+        // Wrap `size` bytes of host memory at `pointer` (which has to stay
+        // mapped until the buffer is destroyed) in a transfer source buffer
+        // with VK_EXT_external_memory_host. VK_NULL_HANDLE if the device
+        // can't import it.
+        VkBuffer importHostBuffer(const void* pointer, VkDeviceSize size, VkDeviceMemory& memory){
+            if (!externalMemoryHost || reinterpret_cast<uintptr_t>(pointer) % hostPointerAlignment != 0 ||
+                    size % hostPointerAlignment != 0) {
+                return VK_NULL_HANDLE;
+            }
+
+            auto getHostPointerProperties = (PFN_vkGetMemoryHostPointerPropertiesEXT) vkGetDeviceProcAddr(
+                device, "vkGetMemoryHostPointerPropertiesEXT");
+            VkMemoryHostPointerPropertiesEXT pointerProperties{};
+            pointerProperties.sType = VK_STRUCTURE_TYPE_MEMORY_HOST_POINTER_PROPERTIES_EXT;
+            if (getHostPointerProperties == nullptr ||
+                    getHostPointerProperties(device, VK_EXTERNAL_MEMORY_HANDLE_TYPE_HOST_ALLOCATION_BIT_EXT,
+                        pointer, &pointerProperties) != VK_SUCCESS) {
+                return VK_NULL_HANDLE;
+            }
+
+            VkExternalMemoryBufferCreateInfo externalInfo{};
+            externalInfo.sType = VK_STRUCTURE_TYPE_EXTERNAL_MEMORY_BUFFER_CREATE_INFO;
+            externalInfo.handleTypes = VK_EXTERNAL_MEMORY_HANDLE_TYPE_HOST_ALLOCATION_BIT_EXT;
+
+            VkBufferCreateInfo bufferInfo{};
+            bufferInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+            bufferInfo.pNext = &externalInfo;
+            bufferInfo.size = size;
+            bufferInfo.usage = VK_BUFFER_USAGE_TRANSFER_SRC_BIT;
+            bufferInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+
+            VkBuffer buffer;
+            if (vkCreateBuffer(device, &bufferInfo, nullptr, &buffer) != VK_SUCCESS) {
+                return VK_NULL_HANDLE;
+            }
+
+            // The producer writes without us flushing anything, so the
+            // memory has to be coherent
+            VkMemoryRequirements requirements;
+            vkGetBufferMemoryRequirements(device, buffer, &requirements);
+            VkPhysicalDeviceMemoryProperties memoryProperties;
+            vkGetPhysicalDeviceMemoryProperties(physicalDevice, &memoryProperties);
+            uint32_t typeBits = requirements.memoryTypeBits & pointerProperties.memoryTypeBits;
+            uint32_t memoryType = UINT32_MAX;
+            for (uint32_t i = 0; i < memoryProperties.memoryTypeCount; i++) {
+                if ((typeBits & (1u << i)) &&
+                        (memoryProperties.memoryTypes[i].propertyFlags & VK_MEMORY_PROPERTY_HOST_COHERENT_BIT)) {
+                    memoryType = i;
+                    break;
+                }
+            }
+
+            VkImportMemoryHostPointerInfoEXT importInfo{};
+            importInfo.sType = VK_STRUCTURE_TYPE_IMPORT_MEMORY_HOST_POINTER_INFO_EXT;
+            importInfo.handleType = VK_EXTERNAL_MEMORY_HANDLE_TYPE_HOST_ALLOCATION_BIT_EXT;
+            importInfo.pHostPointer = const_cast<void*>(pointer);
+
+            VkMemoryAllocateInfo allocateInfo{};
+            allocateInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+            allocateInfo.pNext = &importInfo;
+            allocateInfo.allocationSize = size;
+            allocateInfo.memoryTypeIndex = memoryType;
+
+            if (memoryType == UINT32_MAX || vkAllocateMemory(device, &allocateInfo, nullptr, &memory) != VK_SUCCESS) {
+                vkDestroyBuffer(device, buffer, nullptr);
+                return VK_NULL_HANDLE;
+            }
+            if (vkBindBufferMemory(device, buffer, memory, 0) != VK_SUCCESS) {
+                vkDestroyBuffer(device, buffer, nullptr);
+                vkFreeMemory(device, memory, nullptr);
+                return VK_NULL_HANDLE;
+            }
+            return buffer;
+        }
+
+        // Every change to the shapes comes through here, so it's also where
+        // the shape indices go out of date
+        void uploadScenarioTable(){
+            updateShapeBuffer(scenarioBuffer, 6, scenarioRanges.data(), scenarioRanges.size(), sizeof(ScenarioRange));
+            for (Frame& frame : frames) {
+                frame.indexStale = true;
+            }
+        }
+
+        // The range setCircles() and friends edit, which only make sense with
+        // a single scenario
+        ScenarioRange& singleScenarioRange(){
+            if (scenarioCount != 1) {
+                throw std::runtime_error("batch has several scenarios, use setScenarios()!");
+            }
+            return scenarioRanges[0];
+        }
+
+        // Reallocate the grids for a batch of `count` scenarios. Like a
+        // resize, the values start over from the GridManager and earlier
+        // readbacks are gone.
+        void setScenarioCount(uint32_t count){
+            if (count == 0) {
+                throw std::runtime_error("need at least one scenario!");
+            }
+            if (uint64_t(count) * gridManager.cellCount() > UINT32_MAX) {
+                throw std::runtime_error("too many scenarios for one dispatch!");
+            }
+            if (count == scenarioCount) {
+                return;
+            }
+
+            // Nothing queued or in flight can still reference the old buffers
+            flushUploads();
+
+            destroyGridBuffers();
+            scenarioCount = count;
+            createGridBuffers();
+            writeGridDescriptors();
+
+            invalidateCommandBuffers();
+            uploadGridFromManager();
+        }
+
+        void uploadGridFromManager(){
+            uploadGrid(gridManager.data());
+        }
+
+        // One scenario's layer of a grid, in bytes
+        VkDeviceSize gridLayerSize() const {
+            return gridManager.cellCount() * gridCellSize(gridFormat);
+        }
+
+        // The frame run `serial` went out on, once that run is done
+        Frame& finishedFrame(uint64_t serial){
+            auto frame = std::find_if(frames.begin(), frames.end(),
+                [&](const Frame& f) { return f.serial != 0 && f.serial == serial; });
+            if (frame == frames.end()) {
+                throw std::runtime_error("requested grid readback is not available!");
+            }
+            waitForSerial(serial);
+            return *frame;
+        }
+
+        // Same, for reading its grid
+        Frame& readbackFrame(uint64_t serial){
+            Frame& frame = finishedFrame(serial);
+            if (!frame.readsBackGrid) {
+                throw std::runtime_error("requested run didn't read back its grid!");
+            }
+            checkPlannerConverged(frame);
+
+            // Readback memory (and a host visible grid) is host cached, which
+            // may not be coherent
+            vmaInvalidateAllocation(allocator, frame.gridMapped != nullptr ? frame.gridAllocation : frame.readbackAllocation,
+                0, VK_WHOLE_SIZE);
+            return frame;
+        }
+
+        // Where a frame's runs leave their grid for the host: the grid itself
+        // if it's host visible, otherwise the copy in its readback buffer
+        static const void* readbackData(const Frame& frame) {
+            return frame.gridMapped != nullptr ? frame.gridMapped : frame.readbackMapped;
+        }
+
+        // The costs of a planner run that ran out of sweeps are still too
+        // high in places, so they don't get handed out as if they were final
+        void checkPlannerConverged(Frame& frame) {
+            if (!frame.plans) {
+                return;
+            }
+            vmaInvalidateAllocation(allocator, frame.plannerStatusAllocation, 0, VK_WHOLE_SIZE);
+            if (!static_cast<const PlannerStatus*>(frame.plannerStatusMapped)->converged) {
+                throw std::runtime_error("cost-to-go run ran out of sweeps before converging, raise the planner's maxIterations!");
+            }
+        }
+
+        // The frame query batch `ticket` went out on, while it's still there
+        Frame& queryFrame(uint64_t ticket){
+            auto frame = std::find_if(frames.begin(), frames.end(),
+                [&](const Frame& f) { return f.queryTicket != 0 && f.queryTicket == ticket; });
+            if (frame == frames.end()) {
+                throw std::runtime_error("requested query results are not available!");
+            }
+            return *frame;
+        }
+
+        void createComputePipelines(){
+            VkPushConstantRange pushConstantRange{};
+            pushConstantRange.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+            pushConstantRange.offset = 0;
+            pushConstantRange.size = sizeof(GridPushConstants);
+
+            VkPipelineLayoutCreateInfo pipelineLayoutInfo{};
+            pipelineLayoutInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+            pipelineLayoutInfo.setLayoutCount = 1;
+            pipelineLayoutInfo.pSetLayouts = &descriptorSetLayout;
+            pipelineLayoutInfo.pushConstantRangeCount = 1;
+            pipelineLayoutInfo.pPushConstantRanges = &pushConstantRange;
+
+            if (vkCreatePipelineLayout(device, &pipelineLayoutInfo, nullptr, &computePipelineLayout) != VK_SUCCESS) {
+                throw std::runtime_error("failed to create compute pipeline layout!");
+            }
+
+            bool cacheLoaded;
+            pipelineCache = vu::createPipelineCache(device, deviceProperties, pipelineCachePath, cacheLoaded);
+
+            for (const auto& shaderName : kernelShaders) {
+                pipelines[shaderName] = createComputePipeline(shaderName);
+            }
+
+            // Save a cold cache straight away rather than at exit, workers
+            // don't always get to exit cleanly
+            if (!cacheLoaded) {
+                savePipelineCache();
+            }
+        }
+
+        void savePipelineCache(){
+            if (!vu::savePipelineCache(device, pipelineCache, deviceProperties, pipelineCachePath)) {
+                std::cerr << "failed to save pipeline cache to " << pipelineCachePath << std::endl;
+            }
+        }
+
+        VkPipeline createComputePipeline(const std::string& shaderName){
+            // Create compute shader modules and associate it with the right
+            // stage in the pipeline (the only one). The SPIR-V is compiled
+            // into the binary, see cmake/embed_spirv.cmake
+            std::string moduleName = shaderName;
+            if (std::find(gridFormatShaders.begin(), gridFormatShaders.end(), shaderName) != gridFormatShaders.end()) {
+                moduleName += gridFormatSuffix(gridFormat);
+            }
+            VkShaderModule computeShaderModule = vu::createShaderModule(device, moduleName);
+
+            // Kernels with a fixed local size just don't declare these
+            WorkgroupSize workgroupSize = workgroupSizes.at(shaderName);
+            VkSpecializationMapEntry specializationEntries[2];
+            specializationEntries[0].constantID = 0;
+            specializationEntries[0].offset = offsetof(WorkgroupSize, x);
+            specializationEntries[0].size = sizeof(uint32_t);
+            specializationEntries[1].constantID = 1;
+            specializationEntries[1].offset = offsetof(WorkgroupSize, y);
+            specializationEntries[1].size = sizeof(uint32_t);
+
+            VkSpecializationInfo specializationInfo{};
+            specializationInfo.mapEntryCount = 2;
+            specializationInfo.pMapEntries = specializationEntries;
+            specializationInfo.dataSize = sizeof(workgroupSize);
+            specializationInfo.pData = &workgroupSize;
+
+            VkPipelineShaderStageCreateInfo computeShaderStageInfo{};
+            computeShaderStageInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+            computeShaderStageInfo.stage = VK_SHADER_STAGE_COMPUTE_BIT;
+            computeShaderStageInfo.module = computeShaderModule;
+            computeShaderStageInfo.pName = "main";
+            computeShaderStageInfo.pSpecializationInfo = &specializationInfo;
+
+            // Create the actual pipeline :)
+            VkComputePipelineCreateInfo pipelineInfo{};
+            pipelineInfo.sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO;
+            pipelineInfo.layout = computePipelineLayout;
+            pipelineInfo.stage = computeShaderStageInfo;
+
+            VkPipeline computePipeline;
+            if (vkCreateComputePipelines(device, pipelineCache, 1, &pipelineInfo, nullptr, &computePipeline) != VK_SUCCESS) {
+                throw std::runtime_error("failed to create compute pipeline!");
+            }
+
+            // Now that we've added the shader to the pipeline we can release it
+            // from memory
+            vkDestroyShaderModule(device, computeShaderModule, nullptr);
+
+            return computePipeline;
+        }
+
+        // Start every kernel at 32x32 (what the shaders default to) and halve
+        // until the device can actually run it, unless autotuneWorkgroupSizes()
+        // already found something better for this device and grid size
+        void chooseWorkgroupSizes(){
+            WorkgroupSize size{32, 32};
+            while (!workgroupSizeSupported(size)) {
+                if (size.y >= size.x) {
+                    size.y /= 2;
+                } else {
+                    size.x /= 2;
+                }
+            }
+
+            for (const auto& shaderName : kernelShaders) {
+                workgroupSizes[shaderName] = size;
+            }
+
+            std::string deviceUuid = vu::uuidToHex(deviceProperties.pipelineCacheUUID);
+            for (const auto& entry : tunedWorkgroupSizes) {
+                WorkgroupSize tuned{entry.x, entry.y};
+                if (entry.deviceUuid == deviceUuid && entry.gridWidth == gridManager.gridWidth &&
+                        entry.gridHeight == gridManager.gridHeight && workgroupSizes.count(entry.shaderName) &&
+                        workgroupSizeSupported(tuned)) {
+                    workgroupSizes[entry.shaderName] = tuned;
+                }
+            }
+        }
+
+        bool workgroupSizeSupported(WorkgroupSize size){
+            const VkPhysicalDeviceLimits& limits = deviceProperties.limits;
+            return size.x * size.y <= limits.maxComputeWorkGroupInvocations &&
+                   size.x <= limits.maxComputeWorkGroupSize[0] &&
+                   size.y <= limits.maxComputeWorkGroupSize[1];
+        }
+
+        // Swap in a pipeline for `shaderName` with a different workgroup size.
+        // The GPU must be idle.
+        void setWorkgroupSize(const std::string& shaderName, WorkgroupSize size){
+            workgroupSizes[shaderName] = size;
+            vkDestroyPipeline(device, pipelines.at(shaderName), nullptr);
+            pipelines[shaderName] = createComputePipeline(shaderName);
+
+            // Smaller tiles means more of them, the bins and dirty tile
+            // buffers may need to grow
+            bool tiled = std::find(tiledKernels.begin(), tiledKernels.end(), shaderName) != tiledKernels.end();
+            if (tiled && tileCount(size) > tileBinCapacity) {
+                destroyGridBuffers();
+                createGridBuffers();
+                writeGridDescriptors();
+            }
+
+            invalidateCommandBuffers();
+        }
+
+        // Average GPU time of one run of `kernel` in nanoseconds, best of a few
+        // submissions of several back to back runs each
+        double timeKernel(VkCommandBuffer cmd, VkQueryPool queryPool, GridKernel kernel, uint64_t timestampMask){
+            const uint32_t runsPerSubmission = 10;
+            const uint32_t submissions = 3;
+
+            double bestTime = std::numeric_limits<double>::max();
+            for (uint32_t submission = 0; submission < submissions; submission++) {
+                VkCommandBufferBeginInfo beginInfo{};
+                beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+                beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+
+                if (vkBeginCommandBuffer(cmd, &beginInfo) != VK_SUCCESS) {
+                    throw std::runtime_error("failed to begin recording tuning command buffer!");
+                }
+
+                // Time full runs, every tile dirty
+                std::fill_n(static_cast<uint32_t*>(frames[0].dirtyMaskMapped), dirtyMaskSize / sizeof(uint32_t), ~0u);
+                vmaFlushAllocation(allocator, frames[0].dirtyMaskAllocation, 0, VK_WHOLE_SIZE);
+
+                vkCmdResetQueryPool(cmd, queryPool, 0, 2);
+                vkCmdWriteTimestamp(cmd, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, queryPool, 0);
+                for (uint32_t run = 0; run < runsPerSubmission; run++) {
+                    recordKernel(cmd, frames[0], kernel);
+                    vu::memoryBarrier(cmd,
+                        VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT | VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT, VK_ACCESS_SHADER_WRITE_BIT,
+                        VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT | VK_PIPELINE_STAGE_TRANSFER_BIT,
+                        VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT | VK_ACCESS_TRANSFER_WRITE_BIT);
+                }
+                vkCmdWriteTimestamp(cmd, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, queryPool, 1);
+
+                if (vkEndCommandBuffer(cmd) != VK_SUCCESS) {
+                    throw std::runtime_error("failed to record tuning command buffer!");
+                }
+
+                submitCommandBuffers(computeQueues[0], {cmd});
+                waitForCompute();
+
+                uint64_t timestamps[2];
+                vkGetQueryPoolResults(device, queryPool, 0, 2, sizeof(timestamps), timestamps, sizeof(uint64_t),
+                    VK_QUERY_RESULT_64_BIT | VK_QUERY_RESULT_WAIT_BIT);
+
+                uint64_t ticks = ((timestamps[1] & timestampMask) - (timestamps[0] & timestampMask)) & timestampMask;
+                double time = double(ticks) * deviceProperties.limits.timestampPeriod / runsPerSubmission;
+                bestTime = std::min(bestTime, time);
+            }
+
+            return bestTime;
+        }
+
+        void createDescriptorSetLayout(){
+            // One storage buffer binding for the grid and each shape buffer,
+            // shared by every kernel whether it uses them or not
+            std::vector<VkDescriptorSetLayoutBinding> bufferBindings;
+            for (uint32_t binding : storageBindings) {
+                VkDescriptorSetLayoutBinding bufferBinding{};
+                bufferBinding.binding = binding; // Matches `layout(binding = N)` in the shader
+                bufferBinding.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+                bufferBinding.descriptorCount = 1;
+                bufferBinding.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+                bufferBinding.pImmutableSamplers = nullptr;
+                bufferBindings.push_back(bufferBinding);
+            }
+
+            VkDescriptorSetLayoutCreateInfo layoutInfo{};
+            layoutInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+            layoutInfo.bindingCount = static_cast<uint32_t>(bufferBindings.size());
+            layoutInfo.pBindings = bufferBindings.data();
+            layoutInfo.pNext = nullptr;
+            layoutInfo.flags = 0;
+
+            if (vkCreateDescriptorSetLayout(device, &layoutInfo, nullptr, &descriptorSetLayout) != VK_SUCCESS) {
+                throw std::runtime_error("failed to create descriptor set layout!");
+            }
+        }
+
+        void createDescriptorPool(){
+            VkDescriptorPoolSize poolSize;
+            poolSize.type = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+            poolSize.descriptorCount = static_cast<uint32_t>(storageBindings.size() * frames.size());
+
+            // One set per frame
+            VkDescriptorPoolCreateInfo poolInfo{};
+            poolInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+            poolInfo.poolSizeCount = 1;
+            poolInfo.pPoolSizes = &poolSize;
+            poolInfo.maxSets = static_cast<uint32_t>(frames.size());
+
+            if (vkCreateDescriptorPool(device, &poolInfo, nullptr, &descriptorPool) != VK_SUCCESS) {
+                throw std::runtime_error("Failed to create descriptor pool!");
+            }
+        }
+
+        // void createBuffer(VkDeviceSize size, VkBufferUsageFlags usage, VkMemoryPropertyFlags properties,
+        //     VkBuffer& buffer, VkDeviceMemory& bufferMemory) {
+            
+        //     if (vkCreateBuffer(device, &bufferInfo, nullptr, &buffer) != VK_SUCCESS) {
+        //         throw std::runtime_error("failed to create buffer!");
+        //     }
+
+        //     VkMemoryRequirements memRequirements;
+        //     vkGetBufferMemoryRequirements(device, buffer, &memRequirements);
+            
+        //     VkMemoryAllocateInfo allocInfo{};
+        //     allocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+        //     allocInfo.allocationSize = memRequirements.size;
+        //     allocInfo.memoryTypeIndex = vu::findMemoryType(
+        //         memRequirements.memoryTypeBits, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+        //         physicalDevice);
+
+        //     if (vkAllocateMemory(device, &allocInfo, nullptr, &bufferMemory) != VK_SUCCESS) {
+        //         throw std::runtime_error("failed to allocate buffer memory!");
+        //     }
+        
+        //     vkBindBufferMemory(device, buffer, bufferMemory, 0);
+        // }
+
+        void createDescriptorSets(){
+            VkDescriptorSetAllocateInfo allocInfo{};
+            allocInfo.pNext = nullptr;
+            allocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+            allocInfo.descriptorPool = descriptorPool;
+            allocInfo.descriptorSetCount = 1;
+            allocInfo.pSetLayouts = &descriptorSetLayout;
+
+            for (Frame& frame : frames) {
+                if (vkAllocateDescriptorSets(device, &allocInfo, &frame.descriptorSet) != VK_SUCCESS) {
+                    throw std::runtime_error("failed to allocate descriptor sets!");
+                }
+
+                writeStorageDescriptor(frame.descriptorSet, 1, lightBuffer.buffer, VK_WHOLE_SIZE);
+                writeStorageDescriptor(frame.descriptorSet, 2, circleBuffer.buffer, VK_WHOLE_SIZE);
+                writeStorageDescriptor(frame.descriptorSet, 3, rectBuffer.buffer, VK_WHOLE_SIZE);
+                writeStorageDescriptor(frame.descriptorSet, 6, scenarioBuffer.buffer, VK_WHOLE_SIZE);
+                writeQueryDescriptors(frame);
+                writeShapeIndexDescriptors(frame);
+            }
+            writeGridDescriptors();
+        }
+
+        void writeQueryDescriptors(Frame& frame){
+            writeStorageDescriptor(frame.descriptorSet, 13, frame.queryBuffer, VK_WHOLE_SIZE);
+            writeStorageDescriptor(frame.descriptorSet, 14, frame.queryResultBuffer, VK_WHOLE_SIZE);
+        }
+
+        void writeShapeIndexDescriptors(Frame& frame){
+            writeStorageDescriptor(frame.descriptorSet, 19, frame.indexEntryBuffer, VK_WHOLE_SIZE);
+            writeStorageDescriptor(frame.descriptorSet, 20, frame.indexCountBuffer, VK_WHOLE_SIZE);
+            writeStorageDescriptor(frame.descriptorSet, 21, frame.indexLeafBuffer, VK_WHOLE_SIZE);
+            writeStorageDescriptor(frame.descriptorSet, 22, frame.indexClusterBuffer, VK_WHOLE_SIZE);
+        }
+
+        // Bindings for everything createGridBuffers() makes
+        void writeGridDescriptors(){
+            for (Frame& frame : frames) {
+                writeStorageDescriptor(frame.descriptorSet, 0, frame.gridBuffer, gridBufferSize);
+                writeStorageDescriptor(frame.descriptorSet, 4, frame.tileBinBuffer, VK_WHOLE_SIZE);
+                writeStorageDescriptor(frame.descriptorSet, 5, frame.tileIndexBuffer, VK_WHOLE_SIZE);
+                writeStorageDescriptor(frame.descriptorSet, 7, frame.dirtyMaskBuffer, VK_WHOLE_SIZE);
+                writeStorageDescriptor(frame.descriptorSet, 8, frame.dirtyTileBuffer, VK_WHOLE_SIZE);
+                writeStorageDescriptor(frame.descriptorSet, 9, frame.reduceHistogramBuffer, VK_WHOLE_SIZE);
+                writeStorageDescriptor(frame.descriptorSet, 10, frame.reducePartialBuffer, VK_WHOLE_SIZE);
+                writeStorageDescriptor(frame.descriptorSet, 11, frame.statsBuffer, VK_WHOLE_SIZE);
+                // query.glsl has this binding whether or not there's a
+                // pyramid to read, so without one it gets the grid instead
+                if (pyramidSize > 0) {
+                    writeStorageDescriptor(frame.descriptorSet, 12, frame.gridBuffer, pyramidSize, pyramidOffset);
+                } else {
+                    writeStorageDescriptor(frame.descriptorSet, 12, frame.gridBuffer, gridBufferSize);
+                }
+                writeStorageDescriptor(frame.descriptorSet, 15, frame.distanceSeedBuffer, VK_WHOLE_SIZE);
+                writeStorageDescriptor(frame.descriptorSet, 16, frame.plannerCostBuffer, VK_WHOLE_SIZE);
+                writeStorageDescriptor(frame.descriptorSet, 17, frame.plannerStateBuffer, VK_WHOLE_SIZE);
+                writeStorageDescriptor(frame.descriptorSet, 18, frame.plannerStatusBuffer, VK_WHOLE_SIZE);
+            }
+        }
+
+        // Point `binding` of `set` at `buffer`. The set must not be in use by
+        // the GPU.
+        void writeStorageDescriptor(VkDescriptorSet set, uint32_t binding, VkBuffer buffer, VkDeviceSize range,
+                                    VkDeviceSize offset = 0){
+            VkDescriptorBufferInfo bufferInfo{};
+            bufferInfo.buffer = buffer;
+            bufferInfo.offset = offset;
+            bufferInfo.range = range;
+
+            VkWriteDescriptorSet descriptorWrite;
+            descriptorWrite.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+            descriptorWrite.dstSet = set;
+            descriptorWrite.dstBinding = binding;
+            descriptorWrite.dstArrayElement = 0;
+            descriptorWrite.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+            descriptorWrite.descriptorCount = 1;
+            descriptorWrite.pBufferInfo = &bufferInfo;
+            descriptorWrite.pImageInfo = nullptr;
+            descriptorWrite.pTexelBufferView = nullptr;
+            descriptorWrite.pNext = nullptr;
+            
+            vkUpdateDescriptorSets(device, 1, &descriptorWrite, 0, nullptr);
+        }
+
+        void initializeAppBuffers(){
+            // Staging ring for uploads, written sequentially and never read
+            VkBufferCreateInfo bufferInfo{};
+            bufferInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+            bufferInfo.size = stagingRingSize;
+            bufferInfo.usage = VK_BUFFER_USAGE_TRANSFER_SRC_BIT;
+            bufferInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+
+            VmaAllocationCreateInfo allocInfo{};
+            allocInfo.usage = VMA_MEMORY_USAGE_AUTO;
+            allocInfo.flags = VMA_ALLOCATION_CREATE_HOST_ACCESS_SEQUENTIAL_WRITE_BIT |
+                              VMA_ALLOCATION_CREATE_MAPPED_BIT;
+
+            VmaAllocationInfo stagingAllocInfo;
+            if (vmaCreateBuffer(allocator, &bufferInfo, &allocInfo, &stagingBuffer, &stagingAllocation, &stagingAllocInfo) != VK_SUCCESS) {
+                throw std::runtime_error("failed to create staging buffer!");
+            }
+            stagingMapped = stagingAllocInfo.pMappedData;
+            stagingRing.reset(stagingRingSize);
+
+            createShapeBuffer(circleBuffer, initialShapeBufferSize);
+            createShapeBuffer(rectBuffer, initialShapeBufferSize);
+            createShapeBuffer(lightBuffer, initialShapeBufferSize);
+            createShapeBuffer(scenarioBuffer, initialShapeBufferSize);
+            uploadScenarioTable();
+
+            createGridBuffers();
+            for (Frame& frame : frames) {
+                createQueryBuffers(frame, initialQueryCapacity);
+                createShapeIndexBuffers(frame, 1, 1, 1);
+            }
+        }
+
+        // Room for `capacity` queries and their results, both mapped
+        void createQueryBuffers(Frame& frame, VkDeviceSize capacity){
+            VkBufferCreateInfo bufferInfo{};
+            bufferInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+            bufferInfo.size = sizeof(vu::GridQuery) * capacity;
+            bufferInfo.usage = VK_BUFFER_USAGE_STORAGE_BUFFER_BIT;
+            bufferInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+
+            VmaAllocationCreateInfo allocInfo{};
+            allocInfo.usage = VMA_MEMORY_USAGE_AUTO;
+            allocInfo.flags = VMA_ALLOCATION_CREATE_HOST_ACCESS_SEQUENTIAL_WRITE_BIT |
+                              VMA_ALLOCATION_CREATE_MAPPED_BIT;
+
+            VmaAllocationInfo queryAllocInfo;
+            if (vmaCreateBuffer(allocator, &bufferInfo, &allocInfo, &frame.queryBuffer,
+                    &frame.queryAllocation, &queryAllocInfo) != VK_SUCCESS) {
+                throw std::runtime_error("failed to create query buffer!");
+            }
+            frame.queryMapped = queryAllocInfo.pMappedData;
+
+            bufferInfo.size = sizeof(vu::GridQueryResult) * capacity;
+            allocInfo.flags = VMA_ALLOCATION_CREATE_HOST_ACCESS_RANDOM_BIT |
+                              VMA_ALLOCATION_CREATE_MAPPED_BIT;
+
+            VmaAllocationInfo resultAllocInfo;
+            if (vmaCreateBuffer(allocator, &bufferInfo, &allocInfo, &frame.queryResultBuffer,
+                    &frame.queryResultAllocation, &resultAllocInfo) != VK_SUCCESS) {
+                throw std::runtime_error("failed to create query result buffer!");
+            }
+            frame.queryResultMapped = resultAllocInfo.pMappedData;
+            frame.queryCapacity = capacity;
+        }
+
+        void destroyQueryBuffers(Frame& frame){
+            vmaDestroyBuffer(allocator, frame.queryBuffer, frame.queryAllocation);
+            vmaDestroyBuffer(allocator, frame.queryResultBuffer, frame.queryResultAllocation);
+        }
+
+        // Room to index `shapes` circles and rectangles in `leaves` leaves and
+        // `clusters` clusters, only ever touched by the GPU. The entries are
+        // there twice for the sort, see shape_index.glsl.
+        void createShapeIndexBuffers(Frame& frame, VkDeviceSize shapes, VkDeviceSize leaves, VkDeviceSize clusters){
+            VkBufferCreateInfo bufferInfo{};
+            bufferInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+            bufferInfo.size = 2 * 2 * sizeof(uint32_t) * shapes;
+            bufferInfo.usage = VK_BUFFER_USAGE_STORAGE_BUFFER_BIT;
+            bufferInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+
+            VmaAllocationCreateInfo allocInfo{};
+            allocInfo.usage = VMA_MEMORY_USAGE_AUTO_PREFER_DEVICE;
+
+            if (vmaCreateBuffer(allocator, &bufferInfo, &allocInfo, &frame.indexEntryBuffer,
+                    &frame.indexEntryAllocation, nullptr) != VK_SUCCESS) {
+                throw std::runtime_error("failed to create shape index entry buffer!");
+            }
+
+            // A count per digit per block of the sort
+            VkDeviceSize blocks = (shapes + shapeIndexBlockSize - 1) / shapeIndexBlockSize;
+            bufferInfo.size = sizeof(uint32_t) * (1u << vu::shapeIndexDigitBits) * blocks;
+            if (vmaCreateBuffer(allocator, &bufferInfo, &allocInfo, &frame.indexCountBuffer,
+                    &frame.indexCountAllocation, nullptr) != VK_SUCCESS) {
+                throw std::runtime_error("failed to create shape index count buffer!");
+            }
+
+            bufferInfo.size = sizeof(vu::ShapeBounds) * leaves;
+            if (vmaCreateBuffer(allocator, &bufferInfo, &allocInfo, &frame.indexLeafBuffer,
+                    &frame.indexLeafAllocation, nullptr) != VK_SUCCESS) {
+                throw std::runtime_error("failed to create shape index leaf buffer!");
+            }
+
+            bufferInfo.size = sizeof(vu::ShapeBounds) * clusters;
+            if (vmaCreateBuffer(allocator, &bufferInfo, &allocInfo, &frame.indexClusterBuffer,
+                    &frame.indexClusterAllocation, nullptr) != VK_SUCCESS) {
+                throw std::runtime_error("failed to create shape index cluster buffer!");
+            }
+
+            frame.indexEntryCapacity = shapes;
+            frame.indexLeafCapacity = leaves;
+            frame.indexClusterCapacity = clusters;
+        }
+
+        void destroyShapeIndexBuffers(Frame& frame){
+            vmaDestroyBuffer(allocator, frame.indexEntryBuffer, frame.indexEntryAllocation);
+            vmaDestroyBuffer(allocator, frame.indexCountBuffer, frame.indexCountAllocation);
+            vmaDestroyBuffer(allocator, frame.indexLeafBuffer, frame.indexLeafAllocation);
+            vmaDestroyBuffer(allocator, frame.indexClusterBuffer, frame.indexClusterAllocation);
+        }
+
+        // Everything whose size depends on the grid dimensions or the number
+        // of scenarios, for every frame
+        void createGridBuffers(){
+            gridBufferSize = gridLayerSize() * scenarioCount;
+
+            if (gridBufferSize > deviceProperties.limits.maxStorageBufferRange) {
+                throw std::runtime_error("grid is too large for a storage buffer on this device!");
+            }
+
+            pyramidOffset = vu::alignUp(gridBufferSize, deviceProperties.limits.minStorageBufferOffsetAlignment);
+            pyramidSize = 0;
+            pyramidLevels.clear();
+            if (pyramidEnabled) {
+                pyramidLevels = vu::pyramidLayout(gridManager.gridWidth, gridManager.gridHeight);
+                // A 1x1 grid has no levels, but the binding still needs a range
+                size_t nodes = std::max<size_t>(vu::pyramidNodeCount(pyramidLevels), 1);
+                pyramidSize = 2 * sizeof(float) * nodes * scenarioCount;
+                if (pyramidSize > deviceProperties.limits.maxStorageBufferRange) {
+                    throw std::runtime_error("pyramid is too large for a storage buffer on this device!");
+                }
+            }
+
+            distanceFloodPasses = 0;
+            distanceSeedSize = 2 * sizeof(uint32_t);
+            if (activeKernel == GridKernel::Distance) {
+                distanceFloodPasses = vu::distanceFloodPasses(gridManager.gridWidth, gridManager.gridHeight);
+                distanceSeedSize = 4 * sizeof(uint32_t) * gridManager.cellCount() * scenarioCount;
+                if (distanceSeedSize > deviceProperties.limits.maxStorageBufferRange) {
+                    throw std::runtime_error("distance field is too large for a storage buffer on this device!");
+                }
+            }
+
+            plannerCostSize = sizeof(float);
+            plannerStateSize = plannerStateHeaderSize + sizeof(uint32_t);
+            if (activeKernel == GridKernel::CostToGo) {
+                uint64_t tiles = uint64_t((gridManager.gridWidth + plannerTileSize - 1) / plannerTileSize) *
+                                 ((gridManager.gridHeight + plannerTileSize - 1) / plannerTileSize);
+                plannerCostSize = sizeof(float) * gridManager.cellCount() * scenarioCount;
+                plannerStateSize = plannerStateHeaderSize + 2 * sizeof(uint32_t) * tiles * scenarioCount;
+                if (plannerCostSize > deviceProperties.limits.maxStorageBufferRange) {
+                    throw std::runtime_error("planner costs are too large for a storage buffer on this device!");
+                }
+            }
+
+            // Tile bins are sized for whichever tiled kernel has the most tiles
+            VkDeviceSize maxTileCount = 0;
+            for (const auto& shaderName : tiledKernels) {
+                maxTileCount = std::max<VkDeviceSize>(maxTileCount, tileCount(workgroupSizes.at(shaderName)));
+            }
+            tileBinCapacity = static_cast<uint32_t>(maxTileCount);
+            dirtyMaskSize = sizeof(uint32_t) * ((maxTileCount * scenarioCount + 31) / 32);
+
+            // Enough workgroups to keep the GPU busy, but few enough that
+            // reduce_finish.glsl has little to do
+            uint64_t cellsPerGroup = uint64_t(reduceGroupSize) * cellsPerReduceInvocation;
+            reduceGroupCount = static_cast<uint32_t>(std::min<uint64_t>(
+                (gridManager.cellCount() + cellsPerGroup - 1) / cellsPerGroup, maxReduceGroupCount));
+
+            for (Frame& frame : frames) {
+                createFrameGridBuffers(frame, maxTileCount * scenarioCount);
+            }
+        }
+
+        void createFrameGridBuffers(Frame& frame, VkDeviceSize maxTileCount){
+            VkBufferCreateInfo bufferInfo{};
+            bufferInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+            bufferInfo.size = pyramidSize > 0 ? pyramidOffset + pyramidSize : gridBufferSize;
+            bufferInfo.usage = VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT |
+                               VK_BUFFER_USAGE_TRANSFER_SRC_BIT;
+            bufferInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+
+            // Kernels keep the values of tiles nothing changed in, so an
+            // exclusive grid would have to go back and forth between the
+            // families every run
+            uint32_t gridFamilies[] = {computeQueues[0].family, transferQueue.family};
+            if (gridFamilies[0] != gridFamilies[1]) {
+                bufferInfo.sharingMode = VK_SHARING_MODE_CONCURRENT;
+                bufferInfo.queueFamilyIndexCount = 2;
+                bufferInfo.pQueueFamilyIndices = gridFamilies;
+            }
+
+            // Let VMA decide: on a discrete GPU this lands in device local
+            // memory the host can't see (so we stage), on integrated GPUs and
+            // lavapipe it's host visible and cached, so we can map it directly.
+            // See "Advanced data uploading" in the VMA docs.
+            VmaAllocationCreateInfo allocInfo{};
+            allocInfo.usage = VMA_MEMORY_USAGE_AUTO_PREFER_DEVICE;
+            allocInfo.flags = VMA_ALLOCATION_CREATE_HOST_ACCESS_RANDOM_BIT |
+                              VMA_ALLOCATION_CREATE_HOST_ACCESS_ALLOW_TRANSFER_INSTEAD_BIT |
+                              VMA_ALLOCATION_CREATE_MAPPED_BIT;
 
-            VkDescriptorSetLayoutCreateInfo layoutInfo{};
-            layoutInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
-            layoutInfo.bindingCount = 1;
-            layoutInfo.pBindings = &bufferBinding;
-            layoutInfo.pNext = nullptr;
-            layoutInfo.flags = 0;
+            VmaAllocationInfo gridAllocInfo;
+            if (vmaCreateBuffer(allocator, &bufferInfo, &allocInfo, &frame.gridBuffer, &frame.gridAllocation, &gridAllocInfo) != VK_SUCCESS) {
+                throw std::runtime_error("failed to create grid buffer!");
+            }
 
-            if (vkCreateDescriptorSetLayout(device, &layoutInfo, nullptr, &descriptorSetLayout) != VK_SUCCESS) {
-                throw std::runtime_error("failed to create descriptor set layout!");
+            VkMemoryPropertyFlags gridMemoryFlags;
+            vmaGetAllocationMemoryProperties(allocator, frame.gridAllocation, &gridMemoryFlags);
+            frame.gridMapped = nullptr;
+            if (gridMemoryFlags & VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT) {
+                frame.gridMapped = gridAllocInfo.pMappedData;
             }
-        }
 
-        void createDescriptorPool(){
-            VkDescriptorPoolSize poolSize;
-            poolSize.type = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
-            poolSize.descriptorCount = 1;
+            // Readback, read by the host so we want cached memory. A host
+            // visible grid is read in place, so it doesn't need one.
+            bufferInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+            bufferInfo.queueFamilyIndexCount = 0;
+            bufferInfo.pQueueFamilyIndices = nullptr;
+            frame.readbackBuffer = VK_NULL_HANDLE;
+            frame.readbackAllocation = VK_NULL_HANDLE;
+            frame.readbackMapped = nullptr;
+            if (frame.gridMapped == nullptr) {
+                bufferInfo.size = gridBufferSize;
+                bufferInfo.usage = VK_BUFFER_USAGE_TRANSFER_DST_BIT;
+                allocInfo.usage = VMA_MEMORY_USAGE_AUTO;
+                allocInfo.flags = VMA_ALLOCATION_CREATE_HOST_ACCESS_RANDOM_BIT |
+                                  VMA_ALLOCATION_CREATE_MAPPED_BIT;
 
-            VkDescriptorPoolCreateInfo poolInfo{};
-            poolInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
-            poolInfo.poolSizeCount = num_bindings;
-            poolInfo.pPoolSizes = &poolSize;
-            poolInfo.maxSets = 1; 
+                VmaAllocationInfo readbackAllocInfo;
+                if (vmaCreateBuffer(allocator, &bufferInfo, &allocInfo, &frame.readbackBuffer,
+                        &frame.readbackAllocation, &readbackAllocInfo) != VK_SUCCESS) {
+                    throw std::runtime_error("failed to create readback buffer!");
+                }
+                frame.readbackMapped = readbackAllocInfo.pMappedData;
+            }
 
-            if (vkCreateDescriptorPool(device, &poolInfo, nullptr, &descriptorPool) != VK_SUCCESS) {
-                throw std::runtime_error("Failed to create descriptor pool!");
+            // Tile bins, only ever touched by the GPU
+            bufferInfo.size = 4 * sizeof(uint32_t) * (maxTileCount + 1); // Pool counter + a TileBin per tile
+            bufferInfo.usage = VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT;
+            allocInfo.usage = VMA_MEMORY_USAGE_AUTO_PREFER_DEVICE;
+            allocInfo.flags = 0;
+
+            if (vmaCreateBuffer(allocator, &bufferInfo, &allocInfo, &frame.tileBinBuffer, &frame.tileBinAllocation, nullptr) != VK_SUCCESS) {
+                throw std::runtime_error("failed to create tile bin buffer!");
             }
-        }
 
-        // void createBuffer(VkDeviceSize size, VkBufferUsageFlags usage, VkMemoryPropertyFlags properties,
-        //     VkBuffer& buffer, VkDeviceMemory& bufferMemory) {
-            
-        //     if (vkCreateBuffer(device, &bufferInfo, nullptr, &buffer) != VK_SUCCESS) {
-        //         throw std::runtime_error("failed to create buffer!");
-        //     }
+            bufferInfo.size = sizeof(uint32_t) * tileIndicesPerTile * maxTileCount;
+            bufferInfo.usage = VK_BUFFER_USAGE_STORAGE_BUFFER_BIT;
 
-        //     VkMemoryRequirements memRequirements;
-        //     vkGetBufferMemoryRequirements(device, buffer, &memRequirements);
-            
-        //     VkMemoryAllocateInfo allocInfo{};
-        //     allocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
-        //     allocInfo.allocationSize = memRequirements.size;
-        //     allocInfo.memoryTypeIndex = vu::findMemoryType(
-        //         memRequirements.memoryTypeBits, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
-        //         physicalDevice);
+            if (vmaCreateBuffer(allocator, &bufferInfo, &allocInfo, &frame.tileIndexBuffer, &frame.tileIndexAllocation, nullptr) != VK_SUCCESS) {
+                throw std::runtime_error("failed to create tile index buffer!");
+            }
 
-        //     if (vkAllocateMemory(device, &allocInfo, nullptr, &bufferMemory) != VK_SUCCESS) {
-        //         throw std::runtime_error("failed to allocate buffer memory!");
-        //     }
-        
-        //     vkBindBufferMemory(device, buffer, bufferMemory, 0);
-        // }
+            // Dirty tile list: the indirect dispatch size and count, then a
+            // tile index per entry
+            bufferInfo.size = 4 * sizeof(uint32_t) + sizeof(uint32_t) * maxTileCount;
+            bufferInfo.usage = VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT;
 
-        void createDescriptorSets(){
-            VkDescriptorSetAllocateInfo allocInfo{};
-            allocInfo.pNext = nullptr;
-            allocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
-            allocInfo.descriptorPool = descriptorPool;
-            allocInfo.descriptorSetCount = 1;
-            allocInfo.pSetLayouts = &descriptorSetLayout;
+            if (vmaCreateBuffer(allocator, &bufferInfo, &allocInfo, &frame.dirtyTileBuffer, &frame.dirtyTileAllocation, nullptr) != VK_SUCCESS) {
+                throw std::runtime_error("failed to create dirty tile buffer!");
+            }
 
-            if (vkAllocateDescriptorSets(device, &allocInfo, &descriptorSet) != VK_SUCCESS) {
-                throw std::runtime_error("failed to allocate descriptor sets!");
-            }
-
-            VkDescriptorBufferInfo gridBufferInfo{};
-            gridBufferInfo.buffer = gridBuffer;
-            gridBufferInfo.offset = 0;
-            gridBufferInfo.range = gridManager.gridHeight * gridManager.gridWidth * sizeof(float);
-
-            VkWriteDescriptorSet gridDescriptorWrite;
-            gridDescriptorWrite.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
-            gridDescriptorWrite.dstSet = descriptorSet;
-            gridDescriptorWrite.dstBinding = 0;
-            gridDescriptorWrite.dstArrayElement = 0;
-            gridDescriptorWrite.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
-            gridDescriptorWrite.descriptorCount = 1;
-            gridDescriptorWrite.pBufferInfo = &gridBufferInfo;
-            gridDescriptorWrite.pImageInfo = nullptr;
-            gridDescriptorWrite.pTexelBufferView = nullptr;
-            gridDescriptorWrite.pNext = nullptr;
-            
-            vkUpdateDescriptorSets(device, 1, &gridDescriptorWrite, 0, nullptr);
-        }
+            // Dirty tile mask, written by the host before every submission
+            bufferInfo.size = dirtyMaskSize;
+            bufferInfo.usage = VK_BUFFER_USAGE_STORAGE_BUFFER_BIT;
+            allocInfo.usage = VMA_MEMORY_USAGE_AUTO;
+            allocInfo.flags = VMA_ALLOCATION_CREATE_HOST_ACCESS_SEQUENTIAL_WRITE_BIT |
+                              VMA_ALLOCATION_CREATE_MAPPED_BIT;
 
-        void initializeAppBuffers(){
-            VkDeviceSize gridBufferSize = gridManager.gridHeight * gridManager.gridWidth * sizeof(float);
-            VkBufferCreateInfo bufferInfo{};
-            bufferInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
-            bufferInfo.size = gridBufferSize; 
-            bufferInfo.usage = VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT; 
-            bufferInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+            VmaAllocationInfo dirtyMaskAllocInfo;
+            if (vmaCreateBuffer(allocator, &bufferInfo, &allocInfo, &frame.dirtyMaskBuffer,
+                    &frame.dirtyMaskAllocation, &dirtyMaskAllocInfo) != VK_SUCCESS) {
+                throw std::runtime_error("failed to create dirty tile mask buffer!");
+            }
+            frame.dirtyMaskMapped = dirtyMaskAllocInfo.pMappedData;
 
-            VmaAllocationCreateInfo allocInfo{};
+            // Reductions, small enough to always have around
+            bufferInfo.size = sizeof(uint32_t) * vu::gridHistogramBins * scenarioCount;
+            bufferInfo.usage = VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT;
+            allocInfo.usage = VMA_MEMORY_USAGE_AUTO_PREFER_DEVICE;
+            allocInfo.flags = 0;
+
+            if (vmaCreateBuffer(allocator, &bufferInfo, &allocInfo, &frame.reduceHistogramBuffer,
+                    &frame.reduceHistogramAllocation, nullptr) != VK_SUCCESS) {
+                throw std::runtime_error("failed to create reduction histogram buffer!");
+            }
+
+            bufferInfo.size = reducePartialSize * reduceGroupCount * scenarioCount;
+            bufferInfo.usage = VK_BUFFER_USAGE_STORAGE_BUFFER_BIT;
+
+            if (vmaCreateBuffer(allocator, &bufferInfo, &allocInfo, &frame.reducePartialBuffer,
+                    &frame.reducePartialAllocation, nullptr) != VK_SUCCESS) {
+                throw std::runtime_error("failed to create reduction partial buffer!");
+            }
+
+            bufferInfo.size = sizeof(vu::GridStats) * scenarioCount;
             allocInfo.usage = VMA_MEMORY_USAGE_AUTO;
+            allocInfo.flags = VMA_ALLOCATION_CREATE_HOST_ACCESS_RANDOM_BIT |
+                              VMA_ALLOCATION_CREATE_MAPPED_BIT;
 
-            vmaCreateBuffer(allocator, &bufferInfo, &allocInfo, &gridBuffer, &gridAllocation, nullptr);
-            
-            // VkBuffer gridStagingBuffer;
-            // VkDeviceMemory gsBufferMemory;
-            // createBuffer(gridBufferSize, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
-            //     gridStagingBuffer, gsBufferMemory);
-            
-            // void* gridData;
-            // vkMapMemory(device, gsBufferMemory, 0, gridBufferSize, 0, &gridData);
-            // std::vector<float> cellValues;
-            // for (auto cell : gridManager.grid) {
-            //     cellValues.push_back(cell.val);
-            // }
-            // memcpy(gridData, cellValues.data(), (size_t) gridBufferSize);
-            // vkUnmapMemory(device, gsBufferMemory);
+            VmaAllocationInfo statsAllocInfo;
+            if (vmaCreateBuffer(allocator, &bufferInfo, &allocInfo, &frame.statsBuffer,
+                    &frame.statsAllocation, &statsAllocInfo) != VK_SUCCESS) {
+                throw std::runtime_error("failed to create grid stats buffer!");
+            }
+            frame.statsMapped = statsAllocInfo.pMappedData;
+
+            // Distance field seeds, only ever touched by the GPU
+            bufferInfo.size = distanceSeedSize;
+            allocInfo.usage = VMA_MEMORY_USAGE_AUTO_PREFER_DEVICE;
+            allocInfo.flags = 0;
+
+            if (vmaCreateBuffer(allocator, &bufferInfo, &allocInfo, &frame.distanceSeedBuffer,
+                    &frame.distanceSeedAllocation, nullptr) != VK_SUCCESS) {
+                throw std::runtime_error("failed to create distance seed buffer!");
+            }
+
+            bufferInfo.size = plannerCostSize;
+            if (vmaCreateBuffer(allocator, &bufferInfo, &allocInfo, &frame.plannerCostBuffer,
+                    &frame.plannerCostAllocation, nullptr) != VK_SUCCESS) {
+                throw std::runtime_error("failed to create planner cost buffer!");
+            }
+
+            bufferInfo.size = plannerStateSize;
+            bufferInfo.usage = VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT;
+            if (vmaCreateBuffer(allocator, &bufferInfo, &allocInfo, &frame.plannerStateBuffer,
+                    &frame.plannerStateAllocation, nullptr) != VK_SUCCESS) {
+                throw std::runtime_error("failed to create planner state buffer!");
+            }
 
-            // createBuffer(gridBufferSize, VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
-            //     VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, gridBuffer, gridBufferMemory);
+            // Read by the host, like the stats
+            bufferInfo.size = sizeof(PlannerStatus);
+            bufferInfo.usage = VK_BUFFER_USAGE_STORAGE_BUFFER_BIT;
+            allocInfo.usage = VMA_MEMORY_USAGE_AUTO;
+            allocInfo.flags = VMA_ALLOCATION_CREATE_HOST_ACCESS_RANDOM_BIT |
+                              VMA_ALLOCATION_CREATE_MAPPED_BIT;
 
-            // vu::copyBuffer(device, commandPool, gridStagingBuffer, gridBuffer, gridBufferSize, computeQueue);
+            VmaAllocationInfo plannerStatusAllocInfo;
+            if (vmaCreateBuffer(allocator, &bufferInfo, &allocInfo, &frame.plannerStatusBuffer,
+                    &frame.plannerStatusAllocation, &plannerStatusAllocInfo) != VK_SUCCESS) {
+                throw std::runtime_error("failed to create planner status buffer!");
+            }
+            frame.plannerStatusMapped = plannerStatusAllocInfo.pMappedData;
+        }
 
-            // vkDestroyBuffer(device, gridStagingBuffer, nullptr);
-            // vkFreeMemory(device, gsBufferMemory, nullptr);
+        // The GPU must be done with every frame. Readbacks from before this
+        // are no longer available.
+        void destroyGridBuffers(){
+            for (Frame& frame : frames) {
+                vmaDestroyBuffer(allocator, frame.gridBuffer, frame.gridAllocation);
+                vmaDestroyBuffer(allocator, frame.readbackBuffer, frame.readbackAllocation);
+                vmaDestroyBuffer(allocator, frame.tileBinBuffer, frame.tileBinAllocation);
+                vmaDestroyBuffer(allocator, frame.tileIndexBuffer, frame.tileIndexAllocation);
+                vmaDestroyBuffer(allocator, frame.dirtyMaskBuffer, frame.dirtyMaskAllocation);
+                vmaDestroyBuffer(allocator, frame.dirtyTileBuffer, frame.dirtyTileAllocation);
+                vmaDestroyBuffer(allocator, frame.reduceHistogramBuffer, frame.reduceHistogramAllocation);
+                vmaDestroyBuffer(allocator, frame.reducePartialBuffer, frame.reducePartialAllocation);
+                vmaDestroyBuffer(allocator, frame.statsBuffer, frame.statsAllocation);
+                vmaDestroyBuffer(allocator, frame.distanceSeedBuffer, frame.distanceSeedAllocation);
+                vmaDestroyBuffer(allocator, frame.plannerCostBuffer, frame.plannerCostAllocation);
+                vmaDestroyBuffer(allocator, frame.plannerStateBuffer, frame.plannerStateAllocation);
+                vmaDestroyBuffer(allocator, frame.plannerStatusBuffer, frame.plannerStatusAllocation);
+                frame.serial = 0;
+                frame.decodedSerial = 0;
+            }
         }
 
         void cleanup(){
             // Do all the stuff to clean up Vulkan here
-            vkDestroyPipeline(device, computePipeline, nullptr);
+            // Nothing can be destroyed while a submission is still running
+            vkDeviceWaitIdle(device);
+
+            for (Queue* queue : allQueues()) {
+                vkDestroySemaphore(device, queue->timeline, nullptr);
+            }
+            profiler.destroy();
+
+            for (auto& [shaderName, pipeline] : pipelines) {
+                vkDestroyPipeline(device, pipeline, nullptr);
+            }
             vkDestroyPipelineLayout(device, computePipelineLayout, nullptr);
 
+            // Picks up anything compiled since startup (e.g. while autotuning)
+            savePipelineCache();
+            vkDestroyPipelineCache(device, pipelineCache, nullptr);
+
             vkDestroyDescriptorPool(device, descriptorPool, nullptr);
             vkDestroyDescriptorSetLayout(device, descriptorSetLayout, nullptr);
 
-            vmaDestroyBuffer(allocator, gridBuffer, gridAllocation);
+            destroyGridBuffers();
+            for (Frame& frame : frames) {
+                destroyQueryBuffers(frame);
+                destroyShapeIndexBuffers(frame);
+            }
+            detachShapeRing();
+            vmaDestroyBuffer(allocator, stagingBuffer, stagingAllocation);
+            vmaDestroyBuffer(allocator, circleBuffer.buffer, circleBuffer.allocation);
+            vmaDestroyBuffer(allocator, rectBuffer.buffer, rectBuffer.allocation);
+            vmaDestroyBuffer(allocator, lightBuffer.buffer, lightBuffer.allocation);
+            vmaDestroyBuffer(allocator, scenarioBuffer.buffer, scenarioBuffer.allocation);
             
             vmaDestroyAllocator(allocator);
 
             vkDestroyCommandPool(device, commandPool, nullptr);
+            vkDestroyCommandPool(device, transferCommandPool, nullptr);
             
             vkDestroyDevice(device, nullptr);
 
@@ -510,14 +3771,747 @@ class VulkanComputeApp {
 
 };
 
-int main() {
+// The same kernels as VulkanComputeApp, on the CPU: AVX2 when the CPU has it
+// and plain C++ otherwise (see cpu_kernels.hpp), spread over a thread pool a
+// tile at a time. It's the fallback on machines without a usable Vulkan
+// device and an oracle to check the GPU kernels against. Runs finish inside
+// runComputeShader(), but serials and frames behave like the GPU version's.
+class CpuComputeApp : public GridBackend {
+    public:
+        // `threadCount` 0 uses every hardware thread
+        CpuComputeApp(uint32_t gridWidth = 20, uint32_t gridHeight = 20, uint32_t framesInFlight = 2,
+                      uint32_t threadCount = 0)
+            : gridManager(gridWidth, gridHeight), frames(framesInFlight), pool(threadCount),
+              avx2(vu::cpuHasAvx2()) {
+            if (framesInFlight == 0) {
+                throw std::runtime_error("need at least one frame in flight!");
+            }
+            createGrids();
+            uploadGrid(gridManager.data());
+        }
+
+        uint64_t runComputeShader() override {
+            Frame& frame = frames[nextFrame];
+            nextFrame = (nextFrame + 1) % frames.size();
+
+            uint32_t gridWidth = gridManager.gridWidth;
+            uint32_t gridHeight = gridManager.gridHeight;
+            uint32_t tilesX = (gridWidth + tileWidth - 1) / tileWidth;
+            uint32_t tilesY = (gridHeight + tileHeight - 1) / tileHeight;
+            size_t tilesPerScenario = size_t(tilesX) * tilesY;
+
+            if (shapeIndexEnabled && shapeIndicesStale) {
+                buildShapeIndices();
+            }
+
+            pool.parallelFor(tilesPerScenario * scenarioRanges.size(), [&](size_t item) {
+                uint32_t scenario = static_cast<uint32_t>(item / tilesPerScenario);
+                uint32_t tileIndex = static_cast<uint32_t>(item % tilesPerScenario);
+
+                vu::CpuTile tile;
+                tile.x0 = (tileIndex % tilesX) * tileWidth;
+                tile.y0 = (tileIndex / tilesX) * tileHeight;
+                tile.x1 = std::min(tile.x0 + tileWidth, gridWidth);
+                tile.y1 = std::min(tile.y0 + tileHeight, gridHeight);
+                float* grid = frame.grid.data() + scenario * gridManager.cellCount();
+
+                // Reused by every tile this thread gets, to save reallocating
+                thread_local vu::CpuTileBin bin;
+                switch (activeKernel) {
+                    case GridKernel::Fill:
+                        vu::cpuFillTile(tile, grid, gridWidth);
+                        break;
+                    case GridKernel::Occupancy:
+                    case GridKernel::Distance:
+                    case GridKernel::CostToGo:
+                        vu::cpuOccupancyTile(scene(scenario), tile, grid, gridWidth, avx2, bin);
+                        break;
+                    case GridKernel::Lighting:
+                        vu::cpuLightingTile(scene(scenario), tile, grid, gridWidth, avx2, bin);
+                        break;
+                }
+
+                // Round the tile through the storage format so results match
+                // what the GPU reads back. Occupancy comes through that as is.
+                if (gridFormat != GridFormat::Float32) {
+                    thread_local std::vector<char> encoded;
+                    encoded.resize((tile.x1 - tile.x0) * gridCellSize(gridFormat));
+                    for (uint32_t y = tile.y0; y < tile.y1; y++) {
+                        float* row = grid + tile.x0 + size_t(y) * gridWidth;
+                        encodeGridValues(gridFormat, row, encoded.data(), tile.x1 - tile.x0);
+                        decodeGridValues(gridFormat, encoded.data(), row, tile.x1 - tile.x0);
+                    }
+                }
+            });
+
+            // Every layer at once rather than per tile, and then rounded like
+            // the tiles are
+            frame.plans = activeKernel == GridKernel::CostToGo;
+            if (activeKernel == GridKernel::Distance || frame.plans) {
+                pool.parallelFor(scenarioRanges.size(), [&](size_t scenario) {
+                    float* layer = frame.grid.data() + scenario * gridManager.cellCount();
+                    if (frame.plans) {
+                        vu::buildCostToGo(layer, gridWidth, gridHeight, planner.goalX, planner.goalY);
+                    } else {
+                        thread_local std::vector<uint32_t> seeds;
+                        vu::buildDistanceField(layer, gridWidth, gridHeight, seeds);
+                    }
+                    if (gridFormat != GridFormat::Float32) {
+                        thread_local std::vector<char> encoded;
+                        encoded.resize(gridManager.cellCount() * gridCellSize(gridFormat));
+                        encodeGridValues(gridFormat, layer, encoded.data(), gridManager.cellCount());
+                        decodeGridValues(gridFormat, encoded.data(), layer, gridManager.cellCount());
+                    }
+                });
+            }
+
+            frame.pyramid.clear();
+            if (pyramidEnabled) {
+                std::vector<vu::PyramidLevel> levels = vu::pyramidLayout(gridWidth, gridHeight);
+                size_t nodes = vu::pyramidNodeCount(levels);
+                frame.pyramid.resize(2 * nodes * scenarioRanges.size());
+                pool.parallelFor(scenarioRanges.size(), [&](size_t scenario) {
+                    vu::buildPyramid(frame.grid.data() + scenario * gridManager.cellCount(), gridWidth, gridHeight,
+                                     levels, frame.pyramid.data() + 2 * nodes * scenario);
+                });
+            }
+
+            frame.reduces = reduction.enabled;
+            if (frame.reduces) {
+                frame.stats.resize(scenarioRanges.size());
+                float scale = histogramScale(reduction);
+                pool.parallelFor(scenarioRanges.size(), [&](size_t scenario) {
+                    frame.stats[scenario] = vu::reduceGridLayer(frame.grid.data() + scenario * gridManager.cellCount(),
+                        gridWidth, gridHeight, reduction.threshold, reduction.histogramMin, scale);
+                });
+            }
+
+            frame.serial = ++submittedSerial;
+            return frame.serial;
+        }
+
+        // Nothing is ever left running
+        void waitForCompute() override {
+        }
+
+        const float* readbackGrid(uint64_t serial) override {
+            return finishedFrame(serial).grid.data();
+        }
+
+        const vu::GridStats* readbackStats(uint64_t serial) override {
+            Frame& frame = finishedFrame(serial);
+            if (!frame.reduces) {
+                throw std::runtime_error("requested run had no reduction enabled!");
+            }
+            return frame.stats.data();
+        }
+
+        // Dijkstra always finishes
+        const PlannerStatus* readbackPlannerStatus(uint64_t serial) override {
+            Frame& frame = finishedFrame(serial);
+            if (!frame.plans) {
+                throw std::runtime_error("requested run was not of the cost-to-go kernel!");
+            }
+            return &plannerStatus;
+        }
+
+        // Answered on the spot, a chunk of queries per piece of work
+        uint64_t submitQueries(uint64_t serial, const std::vector<vu::GridQuery>& queries) override {
+            Frame& frame = finishedFrame(serial);
+            uint32_t gridWidth = gridManager.gridWidth;
+            uint32_t gridHeight = gridManager.gridHeight;
+            std::vector<vu::PyramidLevel> levels;
+            size_t nodes = 0;
+            if (!frame.pyramid.empty()) {
+                levels = vu::pyramidLayout(gridWidth, gridHeight);
+                nodes = vu::pyramidNodeCount(levels);
+            }
+
+            const size_t chunkSize = 1024;
+            frame.queryResults.resize(queries.size());
+            pool.parallelFor((queries.size() + chunkSize - 1) / chunkSize, [&](size_t chunk) {
+                size_t end = std::min(queries.size(), (chunk + 1) * chunkSize);
+                for (size_t i = chunk * chunkSize; i < end; i++) {
+                    const vu::GridQuery& query = queries[i];
+                    if (query.scenario >= scenarioRanges.size()) {
+                        frame.queryResults[i] = {0.0f, 0};
+                        continue;
+                    }
+                    const float* layer = frame.grid.data() + query.scenario * gridManager.cellCount();
+                    const float* pyramid = frame.pyramid.empty() ? nullptr : frame.pyramid.data() + 2 * nodes * query.scenario;
+                    frame.queryResults[i] = vu::evaluateQuery(layer, gridWidth, gridHeight, levels, pyramid, query);
+                }
+            });
+
+            frame.queryTicket = ++lastQueryTicket;
+            return frame.queryTicket;
+        }
+
+        bool queriesFinished(uint64_t ticket) override {
+            queryFrame(ticket);
+            return true;
+        }
+
+        const vu::GridQueryResult* readbackQueries(uint64_t ticket) override {
+            return queryFrame(ticket).queryResults.data();
+        }
+
+        void uploadGrid(const float* values) override {
+            for (Frame& frame : frames) {
+                for (size_t scenario = 0; scenario < scenarioRanges.size(); scenario++) {
+                    std::copy_n(values, gridManager.cellCount(), frame.grid.data() + scenario * gridManager.cellCount());
+                }
+            }
+        }
+
+        void resizeGrid(uint32_t width, uint32_t height) override {
+            checkKernelFormat(activeKernel, gridFormat, width, height);
+            gridManager.resize(width, height);
+            shapeIndicesStale = true;
+            createGrids();
+            uploadGrid(gridManager.data());
+        }
+
+        const GridManager& getGridManager() const override {
+            return gridManager;
+        }
+
+        void setKernel(GridKernel kernel) override {
+            checkKernelFormat(kernel, gridFormat, gridManager.gridWidth, gridManager.gridHeight);
+            activeKernel = kernel;
+        }
+
+        // The grids stay floats here, only the values are rounded to what
+        // `format` can hold
+        void setGridFormat(GridFormat format) override {
+            checkKernelFormat(activeKernel, format, gridManager.gridWidth, gridManager.gridHeight);
+            gridFormat = format;
+        }
+
+        GridFormat getGridFormat() const override {
+            return gridFormat;
+        }
+
+        void setReduction(const ReductionSettings& settings) override {
+            if (settings.enabled) {
+                histogramScale(settings);
+            }
+            reduction = settings;
+        }
+
+        // The grids are in host memory already, there's no copy to skip
+        void setGridReadback(bool) override {
+        }
+
+        void setPlanner(const PlannerSettings& settings) override {
+            planner = settings;
+        }
+
+        void setPyramid(bool enabled) override {
+            pyramidEnabled = enabled;
+        }
+
+        void setShapeIndex(bool enabled) override {
+            shapeIndexEnabled = enabled;
+        }
+
+        void setCircles(const std::vector<Circle>& circles) override {
+            singleScenarioRange().circleCount = static_cast<uint32_t>(circles.size());
+            this->circles = circles;
+            shapeIndicesStale = true;
+        }
+
+        void setRectangles(const std::vector<Rectangle>& rectangles) override {
+            singleScenarioRange().rectCount = static_cast<uint32_t>(rectangles.size());
+            this->rectangles = rectangles;
+            shapeIndicesStale = true;
+        }
+
+        void setLights(const std::vector<LightSource>& lights) override {
+            singleScenarioRange().lightCount = static_cast<uint32_t>(lights.size());
+            this->lights = lights;
+        }
+
+        void setScenarios(const std::vector<Scenario>& scenarios) override {
+            if (scenarios.empty()) {
+                throw std::runtime_error("need at least one scenario!");
+            }
+
+            size_t previousCount = scenarioRanges.size();
+            circles.clear();
+            rectangles.clear();
+            lights.clear();
+            scenarioRanges.clear();
+            packScenarios(scenarios, circles, rectangles, lights, scenarioRanges);
+            shapeIndicesStale = true;
+
+            if (scenarioRanges.size() != previousCount) {
+                createGrids();
+                uploadGrid(gridManager.data());
+            }
+        }
+
+        uint32_t getScenarioCount() const override {
+            return static_cast<uint32_t>(scenarioRanges.size());
+        }
+
+        // Nothing to upload here, the shapes are copied out and the ring
+        // space handed straight back
+        void ingestShapeUpdates(vu::ShmRing& ring) override {
+            ShapeUpdates updates = readShapeUpdates(ring);
+            if (updates.circles) {
+                setCircles(shapeUpdatePayload<Circle>(*updates.circles));
+            }
+            if (updates.rectangles) {
+                setRectangles(shapeUpdatePayload<Rectangle>(*updates.rectangles));
+            }
+            if (updates.lights) {
+                setLights(shapeUpdatePayload<LightSource>(*updates.lights));
+            }
+            ring.release(ring.position());
+        }
+
+    private:
+        GridManager gridManager;
+
+        // One grid (every scenario's layer) per frame, like the GPU readbacks
+        struct Frame {
+            uint64_t serial = 0;
+            std::vector<float> grid;
+            bool reduces = false;
+            std::vector<vu::GridStats> stats; // Per scenario, if `reduces`
+            bool plans = false;
+            // Every scenario's pyramid, laid out like the GPU's
+            std::vector<float> pyramid;
+            uint64_t queryTicket = 0;
+            std::vector<vu::GridQueryResult> queryResults;
+        };
+        std::vector<Frame> frames;
+        uint32_t nextFrame = 0;
+        uint64_t submittedSerial = 0;
+        uint64_t lastQueryTicket = 0;
+
+        // Tiles are the unit of work for the pool, and wide enough for a few
+        // 8 cell AVX2 steps per row
+        static constexpr uint32_t tileWidth = 64;
+        static constexpr uint32_t tileHeight = 16;
+        vu::ThreadPool pool;
+        bool avx2;
+
+        GridKernel activeKernel = GridKernel::Fill;
+        GridFormat gridFormat = GridFormat::Float32;
+        ReductionSettings reduction;
+        PlannerSettings planner;
+        const PlannerStatus plannerStatus = {0, 1, 0, 0};
+        bool pyramidEnabled = false;
+        // Packed like the GPU shape buffers
+        std::vector<Circle> circles;
+        std::vector<Rectangle> rectangles;
+        std::vector<LightSource> lights;
+        std::vector<ScenarioRange> scenarioRanges = {ScenarioRange{}};
+        // One per scenario when enabled, rebuilt on the first run after the
+        // shapes change
+        bool shapeIndexEnabled = false;
+        bool shapeIndicesStale = true;
+        std::vector<vu::ShapeIndex> shapeIndices;
+
+        void buildShapeIndices(){
+            shapeIndices.resize(scenarioRanges.size());
+            pool.parallelFor(scenarioRanges.size(), [&](size_t scenario) {
+                vu::CpuScene shapes = sceneView(scenarioRanges[scenario], circles, rectangles, lights);
+                vu::buildShapeIndex(shapes.circles, shapes.circleCount, shapes.rects, shapes.rectCount,
+                                    gridManager.gridWidth, gridManager.gridHeight, shapeIndices[scenario]);
+            });
+            shapeIndicesStale = false;
+        }
+
+        // Readbacks from before this are no longer available
+        void createGrids(){
+            for (Frame& frame : frames) {
+                frame.grid.assign(gridManager.cellCount() * scenarioRanges.size(), 0.0f);
+                frame.serial = 0;
+            }
+        }
+
+        Frame& finishedFrame(uint64_t serial){
+            auto frame = std::find_if(frames.begin(), frames.end(),
+                [&](const Frame& f) { return f.serial != 0 && f.serial == serial; });
+            if (frame == frames.end()) {
+                throw std::runtime_error("requested grid readback is not available!");
+            }
+            return *frame;
+        }
+
+        Frame& queryFrame(uint64_t ticket){
+            auto frame = std::find_if(frames.begin(), frames.end(),
+                [&](const Frame& f) { return f.queryTicket != 0 && f.queryTicket == ticket; });
+            if (frame == frames.end()) {
+                throw std::runtime_error("requested query results are not available!");
+            }
+            return *frame;
+        }
+
+        ScenarioRange& singleScenarioRange(){
+            if (scenarioRanges.size() != 1) {
+                throw std::runtime_error("batch has several scenarios, use setScenarios()!");
+            }
+            return scenarioRanges[0];
+        }
+
+        vu::CpuScene scene(uint32_t scenario) const {
+            vu::CpuScene scene = sceneView(scenarioRanges[scenario], circles, rectangles, lights);
+            if (shapeIndexEnabled) {
+                scene.index = &shapeIndices[scenario];
+            }
+            return scene;
+        }
+};
+
+// The demo scene, optionally as a batch of `scenarioCount` variations
+void setDemoScene(GridBackend& app, uint32_t scenarioCount) {
+    if (scenarioCount > 1) {
+        // The same scene with the circle swept across the grid, like a
+        // batch of candidate poses
+        std::vector<Scenario> scenarios(scenarioCount);
+        for (uint32_t i = 0; i < scenarioCount; i++) {
+            float x = 2.5f + 15.0f * float(i) / float(scenarioCount - 1);
+            scenarios[i].circles = {{glm::vec3(x, 5.0f, 2.5f)}};
+            scenarios[i].rectangles = {{glm::vec4(14.0f, 12.0f, 4.0f, 6.0f)}};
+            scenarios[i].lights = {{glm::vec4(10.0f, 2.0f, 4.0f, 0.05f)}};
+        }
+        app.setScenarios(scenarios);
+    } else {
+        app.setCircles({{glm::vec3(5.0f, 5.0f, 2.5f)}});
+        app.setRectangles({{glm::vec4(14.0f, 12.0f, 4.0f, 6.0f)}});
+        app.setLights({{glm::vec4(10.0f, 2.0f, 4.0f, 0.05f)}});
+    }
+    app.setKernel(GridKernel::Lighting);
+}
+
+// `count` queries spread over the grid and every scenario, cycling through
+// points, rectangles, segments and rays
+std::vector<vu::GridQuery> demoQueries(uint32_t count, uint32_t scenarioCount, uint32_t gridWidth, uint32_t gridHeight) {
+    std::vector<vu::GridQuery> queries(count);
+    for (uint32_t i = 0; i < count; i++) {
+        vu::GridQuery& query = queries[i];
+        query.type = static_cast<vu::GridQueryType>(i % 4);
+        query.scenario = i % scenarioCount;
+        query.threshold = 0.5f;
+        // Golden ratio steps, so the positions don't line up with the grid
+        float u = std::fmod(float(i) * 0.618034f, 1.0f);
+        float v = std::fmod(float(i) * 0.381966f + 0.5f, 1.0f);
+        query.x0 = u * gridWidth;
+        query.y0 = v * gridHeight;
+        if (query.type == vu::GridQueryType::Rect) {
+            query.x1 = query.x0 + 3.0f;
+            query.y1 = query.y0 + 2.0f;
+        } else if (query.type == vu::GridQueryType::Ray) {
+            // Like a LiDAR sweeping around, reaching a quarter of the grid
+            float angle = float(i) * 0.0245437f;
+            query.x1 = std::cos(angle);
+            query.y1 = std::sin(angle);
+            query.range = 0.25f * std::max(gridWidth, gridHeight);
+        } else {
+            query.x1 = query.x0 + 4.0f - 8.0f * v;
+            query.y1 = query.y0 + 3.0f - 6.0f * u;
+        }
+    }
+    return queries;
+}
+
+// Stand in for the sensor stack: create the shape update ring `name` and
+// sweep the demo circle across the grid through it, `count` updates about
+// 2 ms apart, writing each straight into the ring. Waits whenever the ring
+// is full, i.e. nothing is ingesting.
+void feedDemoUpdates(const std::string& name, uint32_t count) {
+    vu::ShmRing ring(name, 1 << 20);
+    for (uint32_t i = 0; i < count; i++) {
+        void* payload;
+        while ((payload = ring.reserve(static_cast<uint32_t>(ShapeUpdateType::Circles), sizeof(Circle))) == nullptr) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+        float x = 2.5f + 15.0f * float(i % 100) / 99.0f;
+        Circle circle{glm::vec3(x, 5.0f, 2.5f)};
+        memcpy(payload, &circle, sizeof(circle));
+        ring.commit();
+        std::this_thread::sleep_for(std::chrono::milliseconds(2));
+    }
+}
+
+int main(int argc, char** argv) {
+    bool autotune = false;
+    bool check = false;
+    bool checkFailed = false; // --check found the GPU disagreeing with the CPU
+    bool stats = false;
+    bool pyramid = false;
+    bool shapeIndex = false;
+    bool distance = false;
+    bool plan = false;
+    PlannerSettings planner;
+    uint32_t queryCount = 0;
+    std::string tracePath;
+    std::string ingestName; // Shape update ring to follow, see ShapeUpdateType
+    std::string feedName;
+    std::string backend = "auto"; // auto, vulkan or cpu
+    uint32_t framesInFlight = 2;
+    uint32_t scenarioCount = 1;
+    uint32_t threadCount = 0;
+    std::string gridFormatName = "fp32"; // fp32, fp16 or unorm8
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        if (arg == "--autotune") {
+            autotune = true;
+        } else if (arg == "--check") {
+            check = true;
+        } else if (arg == "--stats") {
+            stats = true;
+        } else if (arg == "--pyramid") {
+            pyramid = true;
+        } else if (arg == "--index") {
+            shapeIndex = true;
+        } else if (arg == "--distance") {
+            distance = true;
+        } else if (arg == "--goal" && i + 2 < argc) {
+            plan = true;
+            planner.goalX = static_cast<uint32_t>(std::stoul(argv[++i]));
+            planner.goalY = static_cast<uint32_t>(std::stoul(argv[++i]));
+        } else if (arg == "--queries" && i + 1 < argc) {
+            queryCount = static_cast<uint32_t>(std::stoul(argv[++i]));
+        } else if (arg == "--ingest" && i + 1 < argc) {
+            ingestName = argv[++i];
+        } else if (arg == "--feed" && i + 1 < argc) {
+            feedName = argv[++i];
+        } else if (arg == "--trace" && i + 1 < argc) {
+            tracePath = argv[++i];
+        } else if (arg == "--backend" && i + 1 < argc) {
+            backend = argv[++i];
+        } else if (arg == "--frames" && i + 1 < argc) {
+            framesInFlight = static_cast<uint32_t>(std::stoul(argv[++i]));
+        } else if (arg == "--scenarios" && i + 1 < argc) {
+            scenarioCount = static_cast<uint32_t>(std::stoul(argv[++i]));
+        } else if (arg == "--threads" && i + 1 < argc) {
+            threadCount = static_cast<uint32_t>(std::stoul(argv[++i]));
+        } else if (arg == "--format" && i + 1 < argc) {
+            gridFormatName = argv[++i];
+        }
+    }
+
     try {
-        VulkanComputeApp app;
+        GridFormat gridFormat = parseGridFormat(gridFormatName);
+        if (!feedName.empty()) {
+            feedDemoUpdates(feedName, 1000);
+            return EXIT_SUCCESS;
+        }
+        if (check && !ingestName.empty()) {
+            throw std::runtime_error("--check compares against the demo scene, it can't follow --ingest!");
+        }
+
+        // Opened first, since the backend may import it and has to go first
+        std::unique_ptr<vu::ShmRing> shapeRing;
+        if (!ingestName.empty()) {
+            shapeRing = std::make_unique<vu::ShmRing>(ingestName);
+        }
+
+        // "auto" falls back to the CPU when there's no usable Vulkan device
+        std::unique_ptr<GridBackend> app;
+        VulkanComputeApp* vulkanApp = nullptr;
+        if (backend == "auto" || backend == "vulkan") {
+            try {
+                auto vulkan = std::make_unique<VulkanComputeApp>(20, 20, framesInFlight);
+                vulkanApp = vulkan.get();
+                app = std::move(vulkan);
+            } catch (const std::exception& e) {
+                if (backend == "vulkan") {
+                    throw;
+                }
+                std::cerr << "no usable Vulkan device (" << e.what() << "), running on the CPU" << std::endl;
+            }
+        } else if (backend != "cpu") {
+            throw std::runtime_error("unknown backend " + backend + "!");
+        }
+        if (!app) {
+            app = std::make_unique<CpuComputeApp>(20, 20, framesInFlight, threadCount);
+        }
+
+        app->setGridFormat(gridFormat);
+        app->setPyramid(pyramid);
+        app->setShapeIndex(shapeIndex);
+        setDemoScene(*app, scenarioCount);
+        if (distance) {
+            app->setKernel(GridKernel::Distance);
+        }
+        if (plan) {
+            app->setPlanner(planner);
+            app->setKernel(GridKernel::CostToGo);
+        }
+
+        // With --stats the loop below only looks at the reduced stats, so
+        // the grid itself only has to come back for --check
+        ReductionSettings reduction;
+        reduction.enabled = stats;
+        app->setReduction(reduction);
+        app->setGridReadback(!stats || check);
+
+        if (autotune && vulkanApp != nullptr) {
+            vulkanApp->autotuneWorkgroupSizes();
+        }
+
+        // Consume each result once the frames after it are queued, so the
+        // GPU always has work while we read
+        std::deque<uint64_t> inFlight;
+        uint64_t lastSerial = 0;
+        for (int i = 0; i < 1000; i++) {
+            if (shapeRing) {
+                app->ingestShapeUpdates(*shapeRing);
+            }
+            lastSerial = app->runComputeShader();
+            inFlight.push_back(lastSerial);
+            if (inFlight.size() == framesInFlight) {
+                if (stats) {
+                    const vu::GridStats* gridStats = app->readbackStats(inFlight.front());
+                    (void) gridStats;
+                } else {
+                    const float* grid = app->readbackGrid(inFlight.front());
+                    (void) grid;
+                }
+                inFlight.pop_front();
+            }
+        }
+        app->waitForCompute();
+
+        if (stats) {
+            const vu::GridStats& s = app->readbackStats(lastSerial)[0];
+            std::cout << "stats: sum " << s.sum << ", min " << s.min << ", max " << s.max << ", "
+                      << s.countAbove << " cells above " << reduction.threshold;
+            if (s.countAbove > 0) {
+                std::cout << " in (" << s.bboxMinX << ", " << s.bboxMinY << ")-("
+                          << s.bboxMaxX << ", " << s.bboxMaxY << ")";
+            }
+            std::cout << std::endl;
+        }
+
+        if (plan) {
+            const PlannerStatus* status = app->readbackPlannerStatus(lastSerial);
+            std::cout << "planner: " << (status->converged ? "converged" : "out of sweeps")
+                      << " after " << status->iterations << " sweeps" << std::endl;
+        }
+
+        // Query the last run without waiting, then pick up the answers
+        std::vector<vu::GridQuery> queries = demoQueries(queryCount, app->getScenarioCount(),
+            app->getGridManager().gridWidth, app->getGridManager().gridHeight);
+        uint64_t queryTicket = 0;
+        if (queryCount > 0) {
+            queryTicket = app->submitQueries(lastSerial, queries);
+            const vu::GridQueryResult* results = app->readbackQueries(queryTicket);
+            uint32_t hits = 0;
+            for (uint32_t i = 0; i < queryCount; i++) {
+                hits += results[i].hit;
+            }
+            std::cout << "queries: " << hits << " of " << queryCount << " hit" << std::endl;
+        }
+
+        // Compare the last run against the CPU kernels, cell by cell. The
+        // reference bins without the shape index, which mustn't change a
+        // thing.
+        if (check && vulkanApp != nullptr) {
+            CpuComputeApp reference(20, 20, 1, threadCount);
+            reference.setGridFormat(gridFormat);
+            reference.setPyramid(pyramid);
+            setDemoScene(reference, scenarioCount);
+            if (distance) {
+                reference.setKernel(GridKernel::Distance);
+            }
+            if (plan) {
+                reference.setPlanner(planner);
+                reference.setKernel(GridKernel::CostToGo);
+            }
+            reference.setReduction(reduction);
+            uint64_t referenceSerial = reference.runComputeShader();
+            const float* expected = reference.readbackGrid(referenceSerial);
+            const float* actual = app->readbackGrid(lastSerial);
+
+            // The shaders' arithmetic is precise, but Vulkan lets divisions
+            // be off by a couple of ulps, which the lighting sums pick up.
+            // Infinities (unreachable cells) have to match exactly.
+            size_t cells = app->getGridManager().cellCount() * app->getScenarioCount();
+            size_t mismatches = 0;
+            size_t inexact = 0;
+            float maxError = 0.0f;
+            for (size_t i = 0; i < cells; i++) {
+                if (memcmp(&expected[i], &actual[i], sizeof(float)) == 0) {
+                    continue;
+                }
+                inexact++;
+                float error = std::fabs(expected[i] - actual[i]);
+                if (!(error <= 1e-5f * std::max(1.0f, std::fabs(expected[i])))) {
+                    mismatches++;
+                }
+                maxError = std::max(maxError, error);
+            }
+            std::cout << "check: " << mismatches << " of " << cells << " cells differ from the CPU, "
+                      << inexact << " not bit for bit (max error " << maxError << ")" << std::endl;
+            checkFailed = checkFailed || mismatches > 0;
+
+            // Everything but the sums should match exactly, those are added
+            // up in a different order
+            if (stats) {
+                const vu::GridStats* expectedStats = reference.readbackStats(referenceSerial);
+                const vu::GridStats* actualStats = app->readbackStats(lastSerial);
+                size_t statMismatches = 0;
+                for (uint32_t s = 0; s < app->getScenarioCount(); s++) {
+                    const vu::GridStats& e = expectedStats[s];
+                    const vu::GridStats& a = actualStats[s];
+                    bool sumClose = std::fabs(e.sum - a.sum) <= 1e-4f * std::max(1.0f, std::fabs(e.sum));
+                    bool exact = e.min == a.min && e.max == a.max && e.countAbove == a.countAbove &&
+                                 e.bboxMinX == a.bboxMinX && e.bboxMinY == a.bboxMinY &&
+                                 e.bboxMaxX == a.bboxMaxX && e.bboxMaxY == a.bboxMaxY &&
+                                 memcmp(e.histogram, a.histogram, sizeof(e.histogram)) == 0;
+                    if (!sumClose || !exact) {
+                        statMismatches++;
+                    }
+                }
+                std::cout << "check: stats of " << statMismatches << " of " << app->getScenarioCount()
+                          << " scenarios differ from the CPU" << std::endl;
+                checkFailed = checkFailed || statMismatches > 0;
+            }
+
+            // Segments and rays can come out a hair different where one
+            // grazes a cell corner, and ray distances are in cells. One that
+            // only just reaches (or just misses) a cell at its far end can hit
+            // on one side and not the other, the distance still has to match.
+            if (queryCount > 0) {
+                const vu::GridQueryResult* expectedResults = reference.readbackQueries(reference.submitQueries(referenceSerial, queries));
+                const vu::GridQueryResult* actualResults = app->readbackQueries(queryTicket);
+                size_t queryMismatches = 0;
+                for (uint32_t i = 0; i < queryCount; i++) {
+                    const vu::GridQueryResult& e = expectedResults[i];
+                    const vu::GridQueryResult& a = actualResults[i];
+                    bool walks = queries[i].type == vu::GridQueryType::Segment || queries[i].type == vu::GridQueryType::Ray;
+                    bool close = std::fabs(e.value - a.value) <= 1e-5f * std::max(1.0f, std::fabs(e.value));
+                    if (!close || (e.hit != a.hit && !walks)) {
+                        queryMismatches++;
+                    }
+                }
+                std::cout << "check: " << queryMismatches << " of " << queryCount
+                          << " query results differ from the CPU" << std::endl;
+                checkFailed = checkFailed || queryMismatches > 0;
+            }
+        }
+
+        if (vulkanApp != nullptr) {
+            const vu::GpuProfiler& profiler = vulkanApp->getProfiler();
+            for (const auto& name : profiler.scopeNames()) {
+                std::cout << name << ": p50 " << profiler.percentile(name, 0.5) << " ms, p99 "
+                          << profiler.percentile(name, 0.99) << " ms" << std::endl;
+            }
+            if (!tracePath.empty()) {
+                profiler.writeChromeTrace(tracePath);
+            }
+        }
     } catch (const std::exception& e) {
         std::cerr << e.what() << std::endl;
         return EXIT_FAILURE;
     }
-    std::cout << "hello" << std::endl;
 
-    return EXIT_SUCCESS;
+    return checkFailed ? EXIT_FAILURE : EXIT_SUCCESS;
 }
\ No newline at end of file
@@ -0,0 +1,136 @@
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include <unistd.h>
+#include <vulkan/vulkan.h>
+
+#ifndef KLINGON__PIPELINE_UTILS_HPP
+#define KLINGON__PIPELINE_UTILS_HPP
+
+namespace vu {
+    // Written in front of the driver's cache blob. The driver's own header has
+    // no driver version, and a driver update can keep the same UUID while
+    // still choking on old data, so we check both.
+    struct PipelineCacheFileHeader {
+        uint32_t magic;
+        uint32_t vendorID;
+        uint32_t deviceID;
+        uint32_t driverVersion;
+        uint8_t pipelineCacheUUID[VK_UUID_SIZE];
+        uint64_t dataSize;
+    };
+
+    const uint32_t pipelineCacheMagic = 0x4b504331; // "KPC1"
+
+    // Returns the cached pipeline data in `path` if it was written by this
+    // exact device and driver, otherwise nothing
+    std::vector<char> loadPipelineCacheData(const std::string& path, const VkPhysicalDeviceProperties& properties) {
+        std::ifstream file(path, std::ios::binary | std::ios::ate);
+        if (!file.is_open()) {
+            return {};
+        }
+        std::streamoff fileSize = file.tellg();
+        file.seekg(0);
+
+        PipelineCacheFileHeader header{};
+        if (fileSize < std::streamoff(sizeof(header)) ||
+                !file.read(reinterpret_cast<char*>(&header), sizeof(header)) ||
+                header.magic != pipelineCacheMagic ||
+                header.vendorID != properties.vendorID ||
+                header.deviceID != properties.deviceID ||
+                header.driverVersion != properties.driverVersion ||
+                memcmp(header.pipelineCacheUUID, properties.pipelineCacheUUID, VK_UUID_SIZE) != 0 ||
+                header.dataSize < sizeof(VkPipelineCacheHeaderVersionOne) ||
+                // A truncated or corrupt file, don't try to allocate whatever it claims
+                header.dataSize > uint64_t(fileSize) - sizeof(header)) {
+            return {};
+        }
+
+        std::vector<char> data(header.dataSize);
+        if (!file.read(data.data(), data.size())) {
+            return {};
+        }
+
+        // And the driver's header should agree with ours
+        VkPipelineCacheHeaderVersionOne driverHeader;
+        memcpy(&driverHeader, data.data(), sizeof(driverHeader));
+        if (driverHeader.headerVersion != VK_PIPELINE_CACHE_HEADER_VERSION_ONE ||
+                driverHeader.vendorID != properties.vendorID ||
+                driverHeader.deviceID != properties.deviceID ||
+                memcmp(driverHeader.pipelineCacheUUID, properties.pipelineCacheUUID, VK_UUID_SIZE) != 0) {
+            return {};
+        }
+
+        return data;
+    }
+
+    // Seeds the cache from `path` when it's valid for this device, `loaded`
+    // says whether it was
+    VkPipelineCache createPipelineCache(VkDevice device, const VkPhysicalDeviceProperties& properties,
+                                        const std::string& path, bool& loaded) {
+        std::vector<char> data = loadPipelineCacheData(path, properties);
+        loaded = !data.empty();
+
+        VkPipelineCacheCreateInfo cacheInfo{};
+        cacheInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_CACHE_CREATE_INFO;
+        cacheInfo.initialDataSize = data.size();
+        cacheInfo.pInitialData = data.empty() ? nullptr : data.data();
+
+        VkPipelineCache pipelineCache;
+        if (vkCreatePipelineCache(device, &cacheInfo, nullptr, &pipelineCache) != VK_SUCCESS) {
+            throw std::runtime_error("failed to create pipeline cache!");
+        }
+
+        return pipelineCache;
+    }
+
+    // Writes to a temporary file and renames it over `path`, so another
+    // process starting up never sees half a cache. The temporary file is per
+    // process, so two saving at once don't write into the same one. Returns
+    // false on failure, a missing cache only costs startup time.
+    bool savePipelineCache(VkDevice device, VkPipelineCache pipelineCache,
+                           const VkPhysicalDeviceProperties& properties, const std::string& path) {
+        size_t dataSize = 0;
+        if (vkGetPipelineCacheData(device, pipelineCache, &dataSize, nullptr) != VK_SUCCESS || dataSize == 0) {
+            return false;
+        }
+
+        std::vector<char> data(dataSize);
+        if (vkGetPipelineCacheData(device, pipelineCache, &dataSize, data.data()) != VK_SUCCESS) {
+            return false;
+        }
+
+        PipelineCacheFileHeader header{};
+        header.magic = pipelineCacheMagic;
+        header.vendorID = properties.vendorID;
+        header.deviceID = properties.deviceID;
+        header.driverVersion = properties.driverVersion;
+        memcpy(header.pipelineCacheUUID, properties.pipelineCacheUUID, VK_UUID_SIZE);
+        header.dataSize = dataSize;
+
+        std::string temporaryPath = path + "." + std::to_string(getpid()) + ".tmp";
+        {
+            std::ofstream file(temporaryPath, std::ios::binary | std::ios::trunc);
+            if (!file.is_open() ||
+                    !file.write(reinterpret_cast<const char*>(&header), sizeof(header)) ||
+                    !file.write(data.data(), dataSize)) {
+                file.close();
+                std::remove(temporaryPath.c_str());
+                return false;
+            }
+        }
+
+        if (std::rename(temporaryPath.c_str(), path.c_str()) != 0) {
+            std::remove(temporaryPath.c_str());
+            return false;
+        }
+        return true;
+    }
+} // namespace vu
+
+#endif // KLINGON__PIPELINE_UTILS_HPP
@@ -0,0 +1,82 @@
+#include <cstdint>
+#include <functional>
+#include <limits>
+#include <queue>
+#include <utility>
+#include <vector>
+
+#ifndef KLINGON__PLANNER_UTILS_HPP
+#define KLINGON__PLANNER_UTILS_HPP
+
+namespace vu {
+    // Cost-to-go on the host, by Dijkstra from the goal. Same moves and
+    // costs as shaders/planner.glsl: 8 neighbours, 1 straight and sqrt(2)
+    // diagonally, no cutting the corner of an obstacle. Every cost is the
+    // cheapest neighbour's plus the move, added up in floats the same way
+    // the sweeps do, so a converged GPU run comes out the same bits.
+
+    constexpr float plannerDiagonalCost = 1.41421356f;
+
+    // No finite cost on a gridWidth x gridHeight grid can be higher: a
+    // cheapest path never visits a cell twice, and no move costs more than a
+    // diagonal one
+    float plannerCostBound(uint32_t gridWidth, uint32_t gridHeight) {
+        size_t cells = size_t(gridWidth) * gridHeight;
+        return cells > 0 ? float(cells - 1) * plannerDiagonalCost : 0.0f;
+    }
+
+    // Replace the occupancy in `layer` (obstacles at 0.5 or above) with the
+    // cost-to-go to (goalX, goalY), infinity for obstacles and cells that
+    // can't get there
+    void buildCostToGo(float* layer, uint32_t gridWidth, uint32_t gridHeight, uint32_t goalX, uint32_t goalY) {
+        const float infinity = std::numeric_limits<float>::infinity();
+        size_t cells = size_t(gridWidth) * gridHeight;
+        std::vector<bool> obstacle(cells);
+        for (size_t i = 0; i < cells; i++) {
+            obstacle[i] = layer[i] >= 0.5f;
+            layer[i] = infinity;
+        }
+
+        auto blocked = [&](int64_t x, int64_t y) {
+            return x < 0 || y < 0 || x >= gridWidth || y >= gridHeight || obstacle[size_t(x) + size_t(y) * gridWidth];
+        };
+        if (blocked(goalX, goalY)) {
+            return;
+        }
+
+        using Entry = std::pair<float, size_t>;
+        std::priority_queue<Entry, std::vector<Entry>, std::greater<Entry>> open;
+        size_t goal = goalX + size_t(goalY) * gridWidth;
+        layer[goal] = 0.0f;
+        open.push({0.0f, goal});
+        while (!open.empty()) {
+            auto [cost, index] = open.top();
+            open.pop();
+            if (cost > layer[index]) {
+                continue;
+            }
+
+            int64_t x = int64_t(index % gridWidth);
+            int64_t y = int64_t(index / gridWidth);
+            for (int64_t dy = -1; dy <= 1; dy++) {
+                for (int64_t dx = -1; dx <= 1; dx++) {
+                    if ((dx == 0 && dy == 0) || blocked(x + dx, y + dy)) {
+                        continue;
+                    }
+                    // The corner cells are the same whichever way the move goes
+                    if (dx != 0 && dy != 0 && (blocked(x + dx, y) || blocked(x, y + dy))) {
+                        continue;
+                    }
+                    float next = cost + (dx != 0 && dy != 0 ? plannerDiagonalCost : 1.0f);
+                    size_t neighbour = size_t(x + dx) + size_t(y + dy) * gridWidth;
+                    if (next < layer[neighbour]) {
+                        layer[neighbour] = next;
+                        open.push({next, neighbour});
+                    }
+                }
+            }
+        }
+    }
+} // namespace vu
+
+#endif // KLINGON__PLANNER_UTILS_HPP
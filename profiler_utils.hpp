@@ -0,0 +1,301 @@
+#include <algorithm>
+#include <cstdint>
+#include <deque>
+#include <fstream>
+#include <map>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include <vulkan/vulkan.h>
+
+#ifndef KLINGON__PROFILER_UTILS_HPP
+#define KLINGON__PROFILER_UTILS_HPP
+
+namespace vu {
+    // GPU timings for named passes. Every command buffer that wants timing
+    // gets a region of the query pool, claimed by beginRegion() at the start
+    // of the command buffer, and each beginScope()/endScope() pair writes two
+    // timestamps into it (and a debug label, for RenderDoc and friends). Since
+    // pre-recorded command buffers are resubmitted as is, the scopes a region
+    // holds are only known at record time, so the profiler remembers which
+    // command buffer owns which region and reads back whatever was submitted
+    // once the submission completes. Regions are reset from the host (needs
+    // hostQueryReset) because transfer queues can't reset queries themselves.
+    class GpuProfiler {
+        public:
+            // How many samples per scope the percentiles are taken over
+            static constexpr size_t historySize = 512;
+
+            // The Chrome trace is capped so a long running worker doesn't
+            // grow forever, later events are dropped
+            static constexpr size_t maxTraceEvents = 1 << 20;
+
+            void init(VkInstance instance, VkDevice device, const VkPhysicalDeviceProperties& properties,
+                      uint32_t timestampValidBits, bool debugLabels, uint32_t regionCount, uint32_t scopesPerRegion) {
+                this->device = device;
+                timestampPeriod = properties.limits.timestampPeriod;
+                timestampMask = timestampValidBits >= 64 ? UINT64_MAX : (uint64_t(1) << timestampValidBits) - 1;
+                this->scopesPerRegion = scopesPerRegion;
+
+                if (debugLabels) {
+                    cmdBeginLabel = reinterpret_cast<PFN_vkCmdBeginDebugUtilsLabelEXT>(
+                        vkGetInstanceProcAddr(instance, "vkCmdBeginDebugUtilsLabelEXT"));
+                    cmdEndLabel = reinterpret_cast<PFN_vkCmdEndDebugUtilsLabelEXT>(
+                        vkGetInstanceProcAddr(instance, "vkCmdEndDebugUtilsLabelEXT"));
+                }
+
+                // No timestamps on this queue, labels still work
+                if (timestampValidBits == 0) {
+                    return;
+                }
+
+                VkQueryPoolCreateInfo queryPoolInfo{};
+                queryPoolInfo.sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO;
+                queryPoolInfo.queryType = VK_QUERY_TYPE_TIMESTAMP;
+                queryPoolInfo.queryCount = regionCount * scopesPerRegion * 2;
+
+                if (vkCreateQueryPool(device, &queryPoolInfo, nullptr, &queryPool) != VK_SUCCESS) {
+                    throw std::runtime_error("failed to create profiler query pool!");
+                }
+                regions.resize(regionCount);
+            }
+
+            void destroy() {
+                if (queryPool != VK_NULL_HANDLE) {
+                    vkDestroyQueryPool(device, queryPool, nullptr);
+                    queryPool = VK_NULL_HANDLE;
+                }
+            }
+
+            bool enabled() const {
+                return queryPool != VK_NULL_HANDLE;
+            }
+
+            // Call right after vkBeginCommandBuffer(). Forgets whatever the
+            // region held before.
+            void beginRegion(VkCommandBuffer cmd, uint32_t region) {
+                if (!enabled()) {
+                    return;
+                }
+
+                Region& r = regions.at(region);
+                r.scopes.clear();
+                r.open.clear();
+                regionOfCommandBuffer[cmd] = region;
+            }
+
+            // Call before every vkQueueSubmit() of `commandBuffers`, once the
+            // previous submission of them has been collected
+            void reset(const std::vector<VkCommandBuffer>& commandBuffers) {
+                if (!enabled()) {
+                    return;
+                }
+
+                for (VkCommandBuffer cmd : commandBuffers) {
+                    auto it = regionOfCommandBuffer.find(cmd);
+                    if (it != regionOfCommandBuffer.end()) {
+                        vkResetQueryPool(device, queryPool, firstQuery(it->second), scopesPerRegion * 2);
+                    }
+                }
+            }
+
+            void beginScope(VkCommandBuffer cmd, uint32_t region, const std::string& name) {
+                if (cmdBeginLabel != nullptr) {
+                    VkDebugUtilsLabelEXT label{};
+                    label.sType = VK_STRUCTURE_TYPE_DEBUG_UTILS_LABEL_EXT;
+                    label.pLabelName = name.c_str();
+                    cmdBeginLabel(cmd, &label);
+                }
+
+                if (!enabled()) {
+                    return;
+                }
+
+                Region& r = regions.at(region);
+                if (r.scopes.size() == scopesPerRegion) {
+                    throw std::runtime_error("too many profiler scopes in one command buffer!");
+                }
+
+                uint32_t scope = static_cast<uint32_t>(r.scopes.size());
+                r.scopes.push_back({name, static_cast<uint32_t>(r.open.size()) + 1});
+                r.open.push_back(scope);
+                vkCmdWriteTimestamp(cmd, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, queryPool, firstQuery(region) + scope * 2);
+            }
+
+            void endScope(VkCommandBuffer cmd, uint32_t region) {
+                if (cmdEndLabel != nullptr) {
+                    cmdEndLabel(cmd);
+                }
+
+                if (!enabled()) {
+                    return;
+                }
+
+                Region& r = regions.at(region);
+                uint32_t scope = r.open.back();
+                r.open.pop_back();
+                vkCmdWriteTimestamp(cmd, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, queryPool, firstQuery(region) + scope * 2 + 1);
+            }
+
+            // Note which regions went out with submission `serial`
+            void submitted(uint64_t serial, const std::vector<VkCommandBuffer>& commandBuffers) {
+                if (!enabled()) {
+                    return;
+                }
+
+                std::vector<uint32_t> submittedRegions;
+                for (VkCommandBuffer cmd : commandBuffers) {
+                    auto it = regionOfCommandBuffer.find(cmd);
+                    if (it != regionOfCommandBuffer.end()) {
+                        submittedRegions.push_back(it->second);
+                    }
+                }
+                if (!submittedRegions.empty()) {
+                    pending.push_back({serial, submittedRegions});
+                }
+            }
+
+            // Read back every submission up to `completedSerial`, which must
+            // have finished on the GPU
+            void collect(uint64_t completedSerial) {
+                while (!pending.empty() && pending.front().serial <= completedSerial) {
+                    uint64_t submissionBegin = UINT64_MAX;
+                    uint64_t submissionEnd = 0;
+
+                    for (uint32_t region : pending.front().regions) {
+                        const Region& r = regions[region];
+                        if (r.scopes.empty()) {
+                            continue;
+                        }
+
+                        std::vector<uint64_t> timestamps(r.scopes.size() * 2);
+                        vkGetQueryPoolResults(device, queryPool, firstQuery(region), static_cast<uint32_t>(timestamps.size()),
+                            timestamps.size() * sizeof(uint64_t), timestamps.data(), sizeof(uint64_t),
+                            VK_QUERY_RESULT_64_BIT | VK_QUERY_RESULT_WAIT_BIT);
+
+                        for (size_t scope = 0; scope < r.scopes.size(); scope++) {
+                            uint64_t begin = timestamps[scope * 2] & timestampMask;
+                            uint64_t end = timestamps[scope * 2 + 1] & timestampMask;
+                            record(r.scopes[scope], begin, end);
+                            submissionBegin = std::min(submissionBegin, begin);
+                            submissionEnd = std::max(submissionEnd, end);
+                        }
+                    }
+
+                    if (submissionBegin <= submissionEnd) {
+                        record({"submission", 0}, submissionBegin, submissionEnd);
+                    }
+                    pending.pop_front();
+                }
+            }
+
+            // p in [0, 1] over the last `historySize` samples of `name`, in
+            // milliseconds. 0 if there are none yet.
+            double percentile(const std::string& name, double p) const {
+                auto it = history.find(name);
+                if (it == history.end() || it->second.empty()) {
+                    return 0.0;
+                }
+
+                std::vector<double> sorted(it->second.begin(), it->second.end());
+                std::sort(sorted.begin(), sorted.end());
+                size_t index = static_cast<size_t>(p * (sorted.size() - 1) + 0.5);
+                return sorted[std::min(index, sorted.size() - 1)];
+            }
+
+            std::vector<std::string> scopeNames() const {
+                std::vector<std::string> names;
+                for (const auto& [name, samples] : history) {
+                    names.push_back(name);
+                }
+                return names;
+            }
+
+            // Chrome's trace_event format, load it in chrome://tracing or
+            // ui.perfetto.dev
+            void writeChromeTrace(const std::string& path) const {
+                std::ofstream file(path, std::ios::trunc);
+                if (!file.is_open()) {
+                    throw std::runtime_error("failed to open trace file!");
+                }
+
+                file << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[";
+                for (size_t i = 0; i < traceEvents.size(); i++) {
+                    const TraceEvent& event = traceEvents[i];
+                    file << (i == 0 ? "\n" : ",\n")
+                         << "{\"name\":\"" << event.name << "\",\"cat\":\"gpu\",\"ph\":\"X\",\"pid\":0,\"tid\":"
+                         << event.depth << ",\"ts\":" << event.beginUs << ",\"dur\":" << event.durationUs << "}";
+                }
+                file << "\n]}\n";
+            }
+
+        private:
+            struct Scope {
+                std::string name;
+                uint32_t depth; // Nesting level, 0 is the whole submission
+            };
+
+            struct Region {
+                std::vector<Scope> scopes;
+                std::vector<uint32_t> open;
+            };
+
+            struct Submission {
+                uint64_t serial;
+                std::vector<uint32_t> regions;
+            };
+
+            struct TraceEvent {
+                std::string name;
+                uint32_t depth;
+                double beginUs;
+                double durationUs;
+            };
+
+            VkDevice device = VK_NULL_HANDLE;
+            VkQueryPool queryPool = VK_NULL_HANDLE;
+            float timestampPeriod = 1.0f; // Nanoseconds per tick
+            uint64_t timestampMask = 0;
+            uint32_t scopesPerRegion = 0;
+
+            PFN_vkCmdBeginDebugUtilsLabelEXT cmdBeginLabel = nullptr;
+            PFN_vkCmdEndDebugUtilsLabelEXT cmdEndLabel = nullptr;
+
+            std::vector<Region> regions;
+            std::map<VkCommandBuffer, uint32_t> regionOfCommandBuffer;
+            std::deque<Submission> pending;
+
+            std::map<std::string, std::deque<double>> history;
+            std::vector<TraceEvent> traceEvents;
+            bool haveTraceOrigin = false;
+            uint64_t traceOrigin = 0;
+
+            uint32_t firstQuery(uint32_t region) const {
+                return region * scopesPerRegion * 2;
+            }
+
+            void record(const Scope& scope, uint64_t begin, uint64_t end) {
+                // Timestamps wrap at the valid bits
+                uint64_t ticks = (end - begin) & timestampMask;
+                double durationMs = double(ticks) * timestampPeriod / 1e6;
+
+                std::deque<double>& samples = history[scope.name];
+                samples.push_back(durationMs);
+                if (samples.size() > historySize) {
+                    samples.pop_front();
+                }
+
+                if (!haveTraceOrigin) {
+                    traceOrigin = begin;
+                    haveTraceOrigin = true;
+                }
+                if (traceEvents.size() < maxTraceEvents) {
+                    double beginUs = double((begin - traceOrigin) & timestampMask) * timestampPeriod / 1e3;
+                    traceEvents.push_back({scope.name, scope.depth, beginUs, durationMs * 1e3});
+                }
+            }
+    };
+} // namespace vu
+
+#endif // KLINGON__PROFILER_UTILS_HPP
@@ -0,0 +1,160 @@
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <stdexcept>
+#include <vector>
+
+#ifndef KLINGON__PYRAMID_UTILS_HPP
+#define KLINGON__PYRAMID_UTILS_HPP
+
+namespace vu {
+    // Min/max pyramid over one layer of the grid, see shaders/pyramid.glsl.
+    // Level 0 is the grid itself (not stored), and every node of level l
+    // holds the min and max of the (up to) 2x2 nodes of level l - 1 under
+    // it, so the top level is a single node covering the whole grid. The
+    // stored levels 1 to top go back to back, row major, as (min, max)
+    // float pairs.
+
+    struct PyramidLevel {
+        uint32_t width;
+        uint32_t height;
+        size_t offset; // In nodes, from the start of level 1
+    };
+
+    // Levels 1 and up, so empty for a 1x1 grid. Keeps the cell coordinates
+    // of every node's corners within 32 bits, like the shaders need.
+    std::vector<PyramidLevel> pyramidLayout(uint32_t gridWidth, uint32_t gridHeight) {
+        if (gridWidth > (1u << 31) || gridHeight > (1u << 31)) {
+            throw std::runtime_error("grid is too large for a pyramid!");
+        }
+
+        std::vector<PyramidLevel> levels;
+        uint32_t width = gridWidth;
+        uint32_t height = gridHeight;
+        size_t offset = 0;
+        while (width > 1 || height > 1) {
+            width = (width + 1) / 2;
+            height = (height + 1) / 2;
+            levels.push_back({width, height, offset});
+            offset += size_t(width) * height;
+        }
+        return levels;
+    }
+
+    size_t pyramidNodeCount(const std::vector<PyramidLevel>& levels) {
+        return levels.empty() ? 0 : levels.back().offset + size_t(levels.back().width) * levels.back().height;
+    }
+
+    // Fill `nodes` (pyramidNodeCount() pairs) from a grid layer
+    void buildPyramid(const float* layer, uint32_t gridWidth, uint32_t gridHeight,
+                      const std::vector<PyramidLevel>& levels, float* nodes) {
+        uint32_t belowWidth = gridWidth;
+        uint32_t belowHeight = gridHeight;
+        for (size_t l = 0; l < levels.size(); l++) {
+            const PyramidLevel& level = levels[l];
+            float* out = nodes + 2 * level.offset;
+            const float* below = l == 0 ? nullptr : nodes + 2 * levels[l - 1].offset;
+
+            for (uint32_t y = 0; y < level.height; y++) {
+                for (uint32_t x = 0; x < level.width; x++) {
+                    float lo = below == nullptr ? layer[2 * x + size_t(2 * y) * gridWidth] : below[2 * (2 * x + size_t(2 * y) * belowWidth)];
+                    float hi = below == nullptr ? lo : below[2 * (2 * x + size_t(2 * y) * belowWidth) + 1];
+                    for (uint32_t dy = 0; dy < 2; dy++) {
+                        for (uint32_t dx = 0; dx < 2; dx++) {
+                            uint32_t cx = 2 * x + dx;
+                            uint32_t cy = 2 * y + dy;
+                            if (cx >= belowWidth || cy >= belowHeight) {
+                                continue;
+                            }
+                            size_t child = cx + size_t(cy) * belowWidth;
+                            lo = std::min(lo, below == nullptr ? layer[child] : below[2 * child]);
+                            hi = std::max(hi, below == nullptr ? layer[child] : below[2 * child + 1]);
+                        }
+                    }
+                    out[2 * (x + size_t(y) * level.width)] = lo;
+                    out[2 * (x + size_t(y) * level.width) + 1] = hi;
+                }
+            }
+            belowWidth = level.width;
+            belowHeight = level.height;
+        }
+    }
+
+    // True if any cell of [x0, x1] x [y0, y1] (inclusive, clamped to the
+    // grid) is above `threshold`, or below it with `below` set. Walks down
+    // from the top level, skipping every node whose min/max rules it out and
+    // stopping at the first node that's entirely inside the region and has a
+    // cell that qualifies, so it only visits nodes along the region's edges.
+    // Same walk as regionAny() in shaders/pyramid_common.glsl.
+    bool pyramidRegionAny(const float* layer, uint32_t gridWidth, uint32_t gridHeight,
+                          const std::vector<PyramidLevel>& levels, const float* nodes,
+                          uint32_t x0, uint32_t y0, uint32_t x1, uint32_t y1, float threshold, bool below) {
+        x1 = std::min(x1, gridWidth - 1);
+        y1 = std::min(y1, gridHeight - 1);
+        if (x0 > x1 || y0 > y1) {
+            return false;
+        }
+
+        uint32_t top = static_cast<uint32_t>(levels.size());
+        uint32_t level = top;
+        uint32_t nodeX = 0;
+        uint32_t nodeY = 0;
+        while (true) {
+            // The cells under the node, which can hang off the grid
+            uint32_t minX = nodeX << level;
+            uint32_t minY = nodeY << level;
+            uint32_t maxX = ((nodeX + 1) << level) - 1;
+            uint32_t maxY = ((nodeY + 1) << level) - 1;
+
+            bool descend = false;
+            if (minX <= x1 && maxX >= x0 && minY <= y1 && maxY >= y0) {
+                float lo;
+                float hi;
+                if (level == 0) {
+                    lo = hi = layer[nodeX + size_t(nodeY) * gridWidth];
+                } else {
+                    const PyramidLevel& l = levels[level - 1];
+                    size_t node = l.offset + nodeX + size_t(nodeY) * l.width;
+                    lo = nodes[2 * node];
+                    hi = nodes[2 * node + 1];
+                }
+
+                if (below ? lo < threshold : hi > threshold) {
+                    if (level == 0 || (minX >= x0 && maxX <= x1 && minY >= y0 && maxY <= y1)) {
+                        return true;
+                    }
+                    descend = true;
+                }
+            }
+
+            if (descend) {
+                level--;
+                nodeX *= 2;
+                nodeY *= 2;
+                continue;
+            }
+
+            // On to the next sibling, climbing out of finished parents.
+            // Children go (0, 0), (1, 0), (0, 1), (1, 1).
+            while (true) {
+                if (level == top) {
+                    return false;
+                }
+                if ((nodeX & 1) == 0) {
+                    nodeX++;
+                    break;
+                }
+                if ((nodeY & 1) == 0) {
+                    nodeX--;
+                    nodeY++;
+                    break;
+                }
+                nodeX >>= 1;
+                nodeY >>= 1;
+                level++;
+            }
+        }
+    }
+} // namespace vu
+
+#endif // KLINGON__PYRAMID_UTILS_HPP
@@ -0,0 +1,215 @@
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "pyramid_utils.hpp"
+
+#ifndef KLINGON__QUERY_UTILS_HPP
+#define KLINGON__QUERY_UTILS_HPP
+
+namespace vu {
+    // Host side of the grid queries, see shaders/query.glsl
+
+    // One query of a batch, see GridBackend::submitQueries() in main.cpp.
+    // Coordinates are in grid units, like the shapes. Must match `GridQuery` in
+    // shaders/query.glsl.
+    enum class GridQueryType : uint32_t {
+        Point,   // The cell under (x0, y0): its value, and whether it's above the threshold
+        Rect,    // Whether any cell [x0, x1] x [y0, y1] touches is above the threshold
+        Segment, // Whether any cell (x0, y0) -> (x1, y1) passes through is, and
+                 // how far along (0 to 1) the segment reaches the first one
+        Ray,     // Same from (x0, y0) in direction (x1, y1) (any length), up to
+                 // `range`: how far the ray gets before it hits, `range` if it
+                 // doesn't
+    };
+
+    struct GridQuery {
+        GridQueryType type;
+        uint32_t scenario;
+        float threshold;
+        float range; // Ray only, in grid units
+        float x0;
+        float y0;
+        float x1;
+        float y1;
+    };
+
+    // Must match `GridQueryResult` in shaders/query.glsl
+    struct GridQueryResult {
+        float value; // Point: the cell's value (0 off the grid). Segment, ray: see above.
+        uint32_t hit;
+    };
+
+    // Walks the cells along p + d * t for t in [0, tEnd] (Amanatides & Woo),
+    // clipped to the grid first so rays reaching far off it cost no more than
+    // ones inside. Returns the t where it enters the first cell above
+    // `threshold`, or -1 if there's none. With a pyramid (see
+    // pyramid_utils.hpp), every step crosses the biggest node around the current
+    // cell with nothing above the threshold rather than a single cell. Same walk
+    // as castRay() in shaders/query.glsl.
+    float castGridRay(const float* layer, uint32_t width, uint32_t height,
+                      const std::vector<PyramidLevel>& levels, const float* pyramid,
+                      float px, float py, float dx, float dy, float tEnd, float threshold) {
+        float p[2] = {px, py};
+        float d[2] = {dx, dy};
+        int32_t size[2] = {static_cast<int32_t>(width), static_cast<int32_t>(height)};
+
+        float tEnter = 0.0f;
+        float tExit = tEnd;
+        for (int axis = 0; axis < 2; axis++) {
+            if (d[axis] == 0.0f) {
+                if (p[axis] < 0.0f || p[axis] >= float(size[axis])) {
+                    return -1.0f;
+                }
+                continue;
+            }
+            float t0 = (0.0f - p[axis]) / d[axis];
+            float t1 = (float(size[axis]) - p[axis]) / d[axis];
+            tEnter = std::max(tEnter, std::min(t0, t1));
+            tExit = std::min(tExit, std::max(t0, t1));
+        }
+        if (tEnter > tExit) {
+            return -1.0f;
+        }
+
+        int32_t cell[2];
+        int32_t step[2];
+        for (int axis = 0; axis < 2; axis++) {
+            cell[axis] = std::clamp(static_cast<int32_t>(std::floor(p[axis] + d[axis] * tEnter)), 0, size[axis] - 1);
+            step[axis] = d[axis] > 0.0f ? 1 : (d[axis] < 0.0f ? -1 : 0);
+        }
+
+        // Max of the node of `level` (1 and up) over the current cell
+        auto nodeMax = [&](uint32_t level) {
+            const PyramidLevel& l = levels[level - 1];
+            size_t node = l.offset + (uint32_t(cell[0]) >> level) + size_t(uint32_t(cell[1]) >> level) * l.width;
+            return pyramid[2 * node + 1];
+        };
+        uint32_t top = pyramid != nullptr ? static_cast<uint32_t>(levels.size()) : 0;
+        uint32_t level = 0;
+
+        float t = tEnter;
+        // Every step leaves at least one cell behind
+        for (uint32_t i = 0; i < width + height + 2; i++) {
+            if (layer[cell[0] + size_t(cell[1]) * width] > threshold) {
+                return t;
+            }
+
+            // Neighbouring cells tend to sit under the same empty nodes, so
+            // start from the last step's level
+            while (level > 0 && nodeMax(level) > threshold) {
+                level--;
+            }
+            while (level < top && nodeMax(level + 1) <= threshold) {
+                level++;
+            }
+
+            int32_t boxMin[2];
+            int32_t boxMax[2];
+            float tLeave[2];
+            for (int axis = 0; axis < 2; axis++) {
+                boxMin[axis] = (cell[axis] >> level) << level;
+                boxMax[axis] = boxMin[axis] + (1 << level) - 1;
+                if (step[axis] == 0) {
+                    tLeave[axis] = 3.0e38f;
+                } else {
+                    float boundary = float(step[axis] > 0 ? boxMax[axis] + 1 : boxMin[axis]);
+                    tLeave[axis] = (boundary - p[axis]) / d[axis];
+                }
+            }
+
+            int axis = tLeave[0] < tLeave[1] ? 0 : 1;
+            int other = 1 - axis;
+            t = tLeave[axis];
+            if (t > tExit) {
+                break;
+            }
+            cell[axis] = step[axis] > 0 ? boxMax[axis] + 1 : boxMin[axis] - 1;
+            // Where the ray is on the other axis, settled with the comparisons a
+            // walk cell by cell would have made so rays through a corner go the
+            // same way: y crosses first on a tie
+            int32_t c = std::clamp(static_cast<int32_t>(std::floor(p[other] + d[other] * t)), boxMin[other], boxMax[other]);
+            if (step[other] != 0) {
+                auto crossed = [&](int32_t boundary) {
+                    float tBoundary = (float(boundary) - p[other]) / d[other];
+                    return other == 1 ? tBoundary <= t : tBoundary < t;
+                };
+                int32_t entry = step[other] > 0 ? c : c + 1;
+                if (!crossed(entry)) {
+                    c -= step[other];
+                } else if (crossed(entry + step[other])) {
+                    c += step[other];
+                }
+            }
+            cell[other] = std::clamp(c, boxMin[other], boxMax[other]);
+            if (cell[axis] < 0 || cell[axis] >= size[axis]) {
+                break;
+            }
+        }
+        return -1.0f;
+    }
+
+    // What query.glsl computes for `query` against one layer, on the host. Uses
+    // the layer's pyramid if `pyramid` isn't null.
+    GridQueryResult evaluateQuery(const float* layer, uint32_t width, uint32_t height,
+                                  const std::vector<PyramidLevel>& levels, const float* pyramid,
+                                  const GridQuery& query) {
+        int32_t gridWidth = static_cast<int32_t>(width);
+        int32_t gridHeight = static_cast<int32_t>(height);
+        auto cellValue = [&](int32_t x, int32_t y) { return layer[x + size_t(y) * width]; };
+        auto inGrid = [&](int32_t x, int32_t y) { return x >= 0 && y >= 0 && x < gridWidth && y < gridHeight; };
+
+        switch (query.type) {
+            case GridQueryType::Point: {
+                int32_t x = static_cast<int32_t>(std::floor(query.x0));
+                int32_t y = static_cast<int32_t>(std::floor(query.y0));
+                if (!inGrid(x, y)) {
+                    return {0.0f, 0};
+                }
+                float value = cellValue(x, y);
+                return {value, value > query.threshold ? 1u : 0u};
+            }
+            case GridQueryType::Rect: {
+                int32_t x0 = std::max(static_cast<int32_t>(std::floor(query.x0)), 0);
+                int32_t y0 = std::max(static_cast<int32_t>(std::floor(query.y0)), 0);
+                int32_t x1 = std::min(static_cast<int32_t>(std::floor(query.x1)), gridWidth - 1);
+                int32_t y1 = std::min(static_cast<int32_t>(std::floor(query.y1)), gridHeight - 1);
+                if (x0 > x1 || y0 > y1) {
+                    return {0.0f, 0};
+                }
+
+                bool hit = false;
+                if (pyramid != nullptr) {
+                    hit = pyramidRegionAny(layer, width, height, levels, pyramid, x0, y0, x1, y1, query.threshold, false);
+                } else {
+                    for (int32_t y = y0; y <= y1 && !hit; y++) {
+                        for (int32_t x = x0; x <= x1 && !hit; x++) {
+                            hit = cellValue(x, y) > query.threshold;
+                        }
+                    }
+                }
+                return {0.0f, hit ? 1u : 0u};
+            }
+            default:
+                break;
+        }
+
+        // Segments walk d = p1 - p0 for t in [0, 1], rays a unit direction for
+        // t up to their range
+        float dx = query.x1 - query.x0;
+        float dy = query.y1 - query.y0;
+        float tEnd = 1.0f;
+        if (query.type == GridQueryType::Ray) {
+            float magnitude = std::sqrt(query.x1 * query.x1 + query.y1 * query.y1);
+            dx = magnitude > 0.0f ? query.x1 / magnitude : 0.0f;
+            dy = magnitude > 0.0f ? query.y1 / magnitude : 0.0f;
+            tEnd = query.range;
+        }
+        float t = castGridRay(layer, width, height, levels, pyramid, query.x0, query.y0, dx, dy, tEnd, query.threshold);
+        return t < 0.0f ? GridQueryResult{tEnd, 0} : GridQueryResult{t, 1};
+    }
+} // namespace vu
+
+#endif // KLINGON__QUERY_UTILS_HPP
@@ -0,0 +1,67 @@
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+
+#ifndef KLINGON__REDUCE_UTILS_HPP
+#define KLINGON__REDUCE_UTILS_HPP
+
+namespace vu {
+    // Host side of the grid reductions, see shaders/reduce.glsl
+
+    constexpr uint32_t gridHistogramBins = 256;
+
+    // Aggregates of one scenario's layer, must match `GridStats` in
+    // shaders/reduce_common.glsl. Values are as stored, i.e. after rounding
+    // to the grid format.
+    struct GridStats {
+        float sum;
+        float min;
+        float max;
+        uint32_t countAbove;
+        // Inclusive, empty (min > max) if no cell is above the threshold
+        uint32_t bboxMinX;
+        uint32_t bboxMinY;
+        uint32_t bboxMaxX;
+        uint32_t bboxMaxY;
+        uint32_t histogram[gridHistogramBins];
+    };
+    static_assert(sizeof(GridStats) == 32 + 4 * gridHistogramBins, "GridStats must match the shader layout");
+
+    // Same arithmetic as histogramBin() in shaders/reduce.glsl, `scale`
+    // being bins per unit
+    uint32_t histogramBin(float value, float histogramMin, float scale) {
+        return static_cast<uint32_t>(std::clamp((value - histogramMin) * scale, 0.0f, float(gridHistogramBins - 1)));
+    }
+
+    // What the reduction kernels compute for one layer. countAbove and the
+    // bounding box are of the cells above `threshold`. Sums come out in a
+    // different order, so they only match the GPU's approximately.
+    GridStats reduceGridLayer(const float* layer, uint32_t width, uint32_t height,
+                              float threshold, float histogramMin, float histogramScale) {
+        GridStats stats{};
+        stats.min = std::numeric_limits<float>::infinity();
+        stats.max = -std::numeric_limits<float>::infinity();
+        stats.bboxMinX = UINT32_MAX;
+        stats.bboxMinY = UINT32_MAX;
+        for (uint32_t y = 0; y < height; y++) {
+            for (uint32_t x = 0; x < width; x++) {
+                float value = layer[x + size_t(y) * width];
+                stats.sum += value;
+                stats.min = std::min(stats.min, value);
+                stats.max = std::max(stats.max, value);
+                if (value > threshold) {
+                    stats.countAbove++;
+                    stats.bboxMinX = std::min(stats.bboxMinX, x);
+                    stats.bboxMinY = std::min(stats.bboxMinY, y);
+                    stats.bboxMaxX = std::max(stats.bboxMaxX, x);
+                    stats.bboxMaxY = std::max(stats.bboxMaxY, y);
+                }
+                stats.histogram[histogramBin(value, histogramMin, histogramScale)]++;
+            }
+        }
+        return stats;
+    }
+} // namespace vu
+
+#endif // KLINGON__REDUCE_UTILS_HPP
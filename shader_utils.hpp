@@ -0,0 +1,41 @@
+#include <cstring>
+#include <stdexcept>
+#include <string>
+
+#include <vulkan/vulkan.h>
+
+#include "embedded_shaders.hpp"
+
+#ifndef KLINGON__SHADER_UTILS_HPP
+#define KLINGON__SHADER_UTILS_HPP
+
+namespace vu {
+    // Looks a shader up by the stem of its source file (shaders/grid.glsl is
+    // "grid") among the ones baked in at build time
+    const EmbeddedShader& findEmbeddedShader(const std::string& name) {
+        for (const auto& shader : embeddedShaders) {
+            if (name == shader.name) {
+                return shader;
+            }
+        }
+        throw std::runtime_error("failed to find embedded shader " + name + "!");
+    }
+
+    VkShaderModule createShaderModule(VkDevice device, const std::string& name) {
+        const EmbeddedShader& shader = findEmbeddedShader(name);
+
+        VkShaderModuleCreateInfo createInfo{};
+        createInfo.sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO;
+        createInfo.codeSize = shader.size;
+        createInfo.pCode = shader.code;
+
+        VkShaderModule shaderModule;
+        if (vkCreateShaderModule(device, &createInfo, nullptr, &shaderModule) != VK_SUCCESS) {
+            throw std::runtime_error("failed to create shader module!");
+        }
+
+        return shaderModule;
+    }
+} // namespace vu
+
+#endif // KLINGON__SHADER_UTILS_HPP
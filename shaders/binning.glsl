@@ -0,0 +1,279 @@
+#version 450
+#extension GL_GOOGLE_include_directive : enable
+
+#include "common.glsl"
+#include "shape_index_common.glsl"
+
+// Builds the per tile primitive lists (see TileBin in common.glsl) that the
+// occupancy and lighting kernels work from, so their inner loops only see the
+// handful of primitives near their tile rather than all of them. Tiles are
+// pc.tileWidth x pc.tileHeight cells, the workgroup size of the kernel the
+// bins are for, and one workgroup per dirty tile finds:
+//   - the lights that reach any cell of the tile
+//   - the circles and rectangles overlapping the box around the tile and all
+//     of those lights, i.e. anything that could touch or shadow the tile
+// and appends their indices to the shared index pool in their original
+// order, so results don't depend on scheduling. Only the primitives of the
+// tile's own scenario are considered.
+//
+// With pc.shapeIndex set, circles and rectangles are found through the shape
+// index (see shape_index_common.glsl) instead: only the clusters and leaves
+// whose boxes overlap the occluder box are opened, and their shapes come out
+// in Morton order rather than their original order. Shapes only ever decide
+// whether a cell is covered or a light blocked, never the order anything is
+// added up in, so that makes no difference to the results.
+
+// The most any device is guaranteed to support
+layout(local_size_x = 128) in;
+
+const uint scanSize = 128; // Must match local_size_x
+
+const uint kindLight = 0;
+const uint kindCircle = 1;
+const uint kindRect = 2;
+
+shared uint kindCounts[3];
+shared uint scan[scanSize];
+shared uint tileOffset;
+// The clusters of the current chunk that overlap the occluder box, and the
+// leaves of the cluster being opened that do
+shared uint clusterList[scanSize];
+shared uint leafMask;
+// Occluder box, as order preserving ints so we can use atomicMin/Max
+shared int occluderMinX;
+shared int occluderMinY;
+shared int occluderMaxX;
+shared int occluderMaxY;
+
+vec2 tileMin;
+vec2 tileMax;
+vec2 occluderMin;
+vec2 occluderMax;
+
+// Maps floats to ints with the same ordering (negative floats sort backwards
+// as raw bits). It's its own inverse.
+int orderedInt(float f) {
+    int i = floatBitsToInt(f);
+    return i >= 0 ? i : i ^ 0x7FFFFFFF;
+}
+
+float orderedFloat(int i) {
+    return intBitsToFloat(i >= 0 ? i : i ^ 0x7FFFFFFF);
+}
+
+bool lightRelevant(uint i) {
+    vec4 light = lights[i];
+    vec2 d = clamp(light.xy, tileMin, tileMax) - light.xy;
+    return dot(d, d) <= lightRadiusSq(light);
+}
+
+bool circleRelevant(uint i) {
+    Circle c = circles[i];
+    vec2 d = clamp(vec2(c.cx, c.cy), occluderMin, occluderMax) - vec2(c.cx, c.cy);
+    return dot(d, d) <= c.r * c.r;
+}
+
+bool rectRelevant(uint i) {
+    vec4 rect = rectangles[i];
+    vec2 boxCentre = (occluderMin + occluderMax) * 0.5;
+    vec2 boxHalfExtent = (occluderMax - occluderMin) * 0.5;
+    return all(lessThanEqual(abs(rect.xy - boxCentre), rect.zw * 0.5 + boxHalfExtent));
+}
+
+bool relevant(uint kind, uint i) {
+    switch (kind) {
+        case kindLight: return lightRelevant(i);
+        case kindCircle: return circleRelevant(i);
+        default: return rectRelevant(i);
+    }
+}
+
+// Inclusive Hillis-Steele scan of `flag` over the workgroup, the total ends
+// up in scan[scanSize - 1]. Everyone has to be done reading `scan` from the
+// last call before the next.
+uint inclusiveScan(uint flag) {
+    uint local = gl_LocalInvocationIndex;
+    scan[local] = flag;
+    barrier();
+    for (uint stride = 1; stride < scanSize; stride <<= 1) {
+        uint addend = local >= stride ? scan[local - stride] : 0;
+        barrier();
+        scan[local] += addend;
+        barrier();
+    }
+    return scan[local];
+}
+
+// Write the indices of every relevant primitive of `kind` in [first, first +
+// total) starting at `base`, keeping them in order with a prefix sum over each
+// chunk. Returns the index after the last one written.
+uint writeIndices(uint kind, uint first, uint total, uint base) {
+    uint local = gl_LocalInvocationIndex;
+    for (uint chunkStart = 0; chunkStart < total; chunkStart += scanSize) {
+        uint i = first + chunkStart + local;
+        uint flag = (chunkStart + local < total && relevant(kind, i)) ? 1 : 0;
+
+        uint position = inclusiveScan(flag);
+        if (flag != 0) {
+            tileIndices[base + position - 1] = i;
+        }
+        base += scan[scanSize - 1];
+        // Everyone has to be done reading `scan` before the next chunk
+        barrier();
+    }
+    return base;
+}
+
+// Like writeIndices() for the circles or rectangles of `scenario`, but
+// through the shape index, the way vu::visitShapeIndex() walks it. Only
+// counts them if `write` is false. Returns `base` plus the number found.
+uint indexedIndices(uint kind, Scenario scenario, uint base, bool write) {
+    uint local = gl_LocalInvocationIndex;
+    IndexSegment segment = indexSegment(scenario, kind == kindCircle ? 0u : 1u);
+    uint leaves = indexLeafCount(segment.count);
+    uint clusters = indexClusterCount(segment.count);
+
+    for (uint clusterStart = 0; clusterStart < clusters; clusterStart += scanSize) {
+        uint c = clusterStart + local;
+        uint flag = (c < clusters && boundsOverlap(clusterBounds[segment.clusterOffset + c], occluderMin, occluderMax)) ? 1 : 0;
+        uint position = inclusiveScan(flag);
+        if (flag != 0) {
+            clusterList[position - 1] = c;
+        }
+        uint found = scan[scanSize - 1];
+        barrier();
+
+        for (uint n = 0; n < found; n++) {
+            uint cluster = clusterList[n];
+            if (local == 0) {
+                leafMask = 0;
+            }
+            barrier();
+            uint leaf = cluster * indexClusterSize + local;
+            if (local < indexClusterSize && leaf < leaves &&
+                    boundsOverlap(leafBounds[segment.leafOffset + leaf], occluderMin, occluderMax)) {
+                atomicOr(leafMask, 1u << local);
+            }
+            barrier();
+            uint mask = leafMask;
+
+            // A chunk at a time, skipping chunks with no leaf to look at
+            const uint leavesPerChunk = scanSize / indexLeafSize;
+            for (uint chunkStart = 0; chunkStart < indexClusterSize * indexLeafSize; chunkStart += scanSize) {
+                if (((mask >> (chunkStart / indexLeafSize)) & ((1u << leavesPerChunk) - 1)) == 0) {
+                    continue;
+                }
+                uint inCluster = chunkStart + local;
+                uint i = cluster * indexClusterSize * indexLeafSize + inCluster;
+                uint shape = 0;
+                uint flag = 0;
+                if (i < segment.count && (mask & (1u << (inCluster / indexLeafSize))) != 0) {
+                    shape = indexEntries[segment.start + i].y;
+                    flag = relevant(kind, shape) ? 1 : 0;
+                }
+
+                uint position = inclusiveScan(flag);
+                if (write && flag != 0) {
+                    tileIndices[base + position - 1] = shape;
+                }
+                base += scan[scanSize - 1];
+                barrier();
+            }
+            // Everyone has to be done with `leafMask` before the next cluster
+            barrier();
+        }
+    }
+    return base;
+}
+
+void main() {
+    uvec3 tileId;
+    if (!currentTile(tileId)) {
+        return;
+    }
+
+    uint tile = tileBinIndex(tileId);
+    uint local = gl_LocalInvocationIndex;
+    Scenario scenario = scenarios[tileId.z];
+    uint lightCount = pc.binLights != 0 ? scenario.lightCount : 0;
+    uint lightEnd = scenario.lightOffset + lightCount;
+    uint circleEnd = scenario.circleOffset + scenario.circleCount;
+    uint rectEnd = scenario.rectOffset + scenario.rectCount;
+
+    vec2 tileSize = vec2(pc.tileWidth, pc.tileHeight);
+    tileMin = vec2(tileId.xy) * tileSize;
+    tileMax = min(tileMin + tileSize, vec2(pc.gridWidth, pc.gridHeight));
+
+    if (local == 0) {
+        kindCounts[kindLight] = 0;
+        kindCounts[kindCircle] = 0;
+        kindCounts[kindRect] = 0;
+        occluderMinX = orderedInt(tileMin.x);
+        occluderMinY = orderedInt(tileMin.y);
+        occluderMaxX = orderedInt(tileMax.x);
+        occluderMaxY = orderedInt(tileMax.y);
+    }
+    barrier();
+
+    // Lights first, since every light that reaches the tile grows the region
+    // occluders can sit in
+    for (uint i = scenario.lightOffset + local; i < lightEnd; i += gl_WorkGroupSize.x) {
+        if (lightRelevant(i)) {
+            atomicAdd(kindCounts[kindLight], 1);
+            vec2 p = lights[i].xy;
+            atomicMin(occluderMinX, orderedInt(p.x));
+            atomicMin(occluderMinY, orderedInt(p.y));
+            atomicMax(occluderMaxX, orderedInt(p.x));
+            atomicMax(occluderMaxY, orderedInt(p.y));
+        }
+    }
+    barrier();
+
+    occluderMin = vec2(orderedFloat(occluderMinX), orderedFloat(occluderMinY));
+    occluderMax = vec2(orderedFloat(occluderMaxX), orderedFloat(occluderMaxY));
+
+    if (pc.shapeIndex != 0) {
+        uint circles = indexedIndices(kindCircle, scenario, 0, false);
+        uint rects = indexedIndices(kindRect, scenario, 0, false);
+        if (local == 0) {
+            kindCounts[kindCircle] = circles;
+            kindCounts[kindRect] = rects;
+        }
+    } else {
+        for (uint i = scenario.circleOffset + local; i < circleEnd; i += gl_WorkGroupSize.x) {
+            if (circleRelevant(i)) {
+                atomicAdd(kindCounts[kindCircle], 1);
+            }
+        }
+        for (uint i = scenario.rectOffset + local; i < rectEnd; i += gl_WorkGroupSize.x) {
+            if (rectRelevant(i)) {
+                atomicAdd(kindCounts[kindRect], 1);
+            }
+        }
+    }
+    barrier();
+
+    // Grab room for the whole tile in one go
+    if (local == 0) {
+        uint total = kindCounts[kindLight] + kindCounts[kindCircle] + kindCounts[kindRect];
+        uint offset = total > 0 ? atomicAdd(binPoolUsed, total) : 0;
+        tileOffset = offset + total > uint(tileIndices.length()) ? binOverflow : offset;
+
+        bins[tile] = TileBin(tileOffset, kindCounts[kindLight], kindCounts[kindCircle], kindCounts[kindRect]);
+    }
+    barrier();
+
+    if (tileOffset == binOverflow) {
+        return;
+    }
+
+    uint base = tileOffset;
+    base = writeIndices(kindLight, scenario.lightOffset, lightCount, base);
+    if (pc.shapeIndex != 0) {
+        base = indexedIndices(kindCircle, scenario, base, true);
+        indexedIndices(kindRect, scenario, base, true);
+    } else {
+        base = writeIndices(kindCircle, scenario.circleOffset, scenario.circleCount, base);
+        writeIndices(kindRect, scenario.rectOffset, scenario.rectCount, base);
+    }
+}
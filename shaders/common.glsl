@@ -0,0 +1,255 @@
+// Declarations shared by every grid kernel. The bindings have to match
+// createDescriptorSetLayout() and the push constants have to match
+// GridPushConstants in main.cpp.
+
+// Grid values are floats unless the kernel is built with GRID_FORMAT_FP16
+// (half floats) or GRID_FORMAT_UNORM8 ([0, 1] in 8 bits) defined, see
+// GRID_FORMAT_SHADERS in CMakeLists.txt. Kernels go through storeCell() and
+// loadCell() so they don't need to care which.
+#if defined(GRID_FORMAT_FP16)
+#extension GL_EXT_shader_16bit_storage : require
+#define GridValue float16_t
+#elif defined(GRID_FORMAT_UNORM8)
+#extension GL_EXT_shader_8bit_storage : require
+#define GridValue uint8_t
+#else
+#define GridValue float
+#endif
+
+// Every dispatch evaluates a batch of independent scenarios. Each scenario
+// has its own slice of the light/circle/rectangle arrays and its own layer of
+// the grid. Grids are split into tiles, one workgroup each, and only the
+// tiles something changed in are dispatched (see dirty_tiles.glsl).
+layout(binding = 0) buffer GridBuffer {
+    GridValue grid[]; // One flattened 2D grid per scenario, row major, back to back
+};
+
+// Must round the same way as the host side conversions in format_utils.hpp
+void storeCell(uint index, float value) {
+#if defined(GRID_FORMAT_FP16)
+    grid[index] = float16_t(value);
+#elif defined(GRID_FORMAT_UNORM8)
+    // Clamped, so lighting saturates at 1
+    grid[index] = uint8_t(uint(floor(clamp(value, 0.0, 1.0) * 255.0 + 0.5)));
+#else
+    grid[index] = value;
+#endif
+}
+
+float loadCell(uint index) {
+#if defined(GRID_FORMAT_FP16)
+    return float(grid[index]);
+#elif defined(GRID_FORMAT_UNORM8)
+    return float(uint(grid[index])) * (1.0 / 255.0);
+#else
+    return grid[index];
+#endif
+}
+
+layout(binding = 1) readonly buffer LightSources {
+    vec4 lights[]; // Each vec4: (x, y, intensity, attenuation)
+};
+
+// Three floats rather than a vec3 so the array stride is 12 bytes like the
+// host side `Circle`, a vec3 array would be padded out to 16
+struct Circle {
+    float cx;
+    float cy;
+    float r;
+};
+
+layout(binding = 2) readonly buffer Circles {
+    Circle circles[];
+};
+
+layout(binding = 3) readonly buffer Rectangles {
+    vec4 rectangles[]; // (cx, cy, w, h)
+};
+
+// Per tile lists of the primitives that matter to that tile, built by
+// binning.glsl. A tile is the tileWidth x tileHeight block of cells one
+// workgroup of the occupancy/lighting kernels covers. The indices for a tile are stored
+// back to back in `tileIndices` starting at `offset`: lights, then circles,
+// then rectangles.
+struct TileBin {
+    uint offset;
+    uint lightCount;
+    uint circleCount;
+    uint rectCount;
+};
+
+// `offset` of a tile that didn't fit in the index pool
+const uint binOverflow = 0xFFFFFFFFu;
+
+layout(binding = 4) buffer TileBins {
+    uint binPoolUsed; // Reset to 0 before every binning pass
+    uint binPoolPad0;
+    uint binPoolPad1;
+    uint binPoolPad2;
+    TileBin bins[];
+};
+
+layout(binding = 5) buffer TileIndices {
+    uint tileIndices[];
+};
+
+// Where each scenario's primitives are in the arrays above. Must match
+// ScenarioRange in main.cpp.
+struct Scenario {
+    uint lightOffset;
+    uint lightCount;
+    uint circleOffset;
+    uint circleCount;
+    uint rectOffset;
+    uint rectCount;
+    // Where the scenario's nodes start in the shape index, see
+    // shape_index_common.glsl
+    uint indexLeafOffset;
+    uint indexClusterOffset;
+};
+
+layout(binding = 6) readonly buffer Scenarios {
+    Scenario scenarios[];
+};
+
+// One bit per tile, set if the tile has to be recomputed this run. Written
+// by the host.
+layout(binding = 7) readonly buffer DirtyTileMask {
+    uint dirtyMask[];
+};
+
+// The dirty tiles as a list, plus the dispatch size for one workgroup per
+// entry, built from `dirtyMask` by dirty_tiles.glsl. The first three words
+// are a VkDispatchIndirectCommand.
+layout(binding = 8) buffer DirtyTileList {
+    uint dispatchX;
+    uint dispatchY;
+    uint dispatchZ;
+    uint dirtyTileCount;
+    uint dirtyTiles[];
+};
+
+layout(push_constant) uniform PushConstants {
+    uint gridWidth;
+    uint gridHeight;
+    uint binLights; // 0 keeps lights out of the tile bins
+    // Tile size of the kernel being run, which is its workgroup size (for
+    // binning.glsl, that of the kernel the bins are for)
+    uint tileWidth;
+    uint tileHeight;
+    uint scenarioCount;
+    // Only used by the reductions, see reduce_common.glsl
+    float reduceThreshold;
+    float histogramMin;
+    float histogramScale;
+    uint reduceGroupCount;
+    // Only used by pyramid.glsl, the level being built
+    uint pyramidLevel;
+    // Only used by query.glsl
+    uint queryCount;
+    uint queryPyramid; // 1 if the pyramid is there to use
+    // Only used by distance.glsl, the number of flood passes and the pass
+    // being run
+    uint distancePasses;
+    uint distancePass;
+    // Only used by planner.glsl
+    uint goalX;
+    uint goalY;
+    uint plannerPass;
+    uint plannerIteration;
+    // 1 if binning.glsl should go through the shape index
+    uint shapeIndex;
+    // Only used by shape_index.glsl
+    uint indexPass;
+    uint indexShift;
+    uint indexEntryCount;
+} pc;
+
+// Tiles are numbered row major within a scenario, one scenario after another
+uint tilesPerRow() {
+    return (pc.gridWidth + pc.tileWidth - 1) / pc.tileWidth;
+}
+
+uint tilesPerScenario() {
+    return tilesPerRow() * ((pc.gridHeight + pc.tileHeight - 1) / pc.tileHeight);
+}
+
+// The tile the current workgroup works on as (x, y, scenario). False for the
+// spare workgroups past the end of the dirty tile list, which have nothing
+// to do.
+bool currentTile(out uvec3 tile) {
+    uint slot = gl_WorkGroupID.x + gl_WorkGroupID.y * gl_NumWorkGroups.x;
+    if (slot >= dirtyTileCount) {
+        return false;
+    }
+
+    uint index = dirtyTiles[slot];
+    uint inScenario = index % tilesPerScenario();
+    tile = uvec3(inScenario % tilesPerRow(), inScenario / tilesPerRow(), index / tilesPerScenario());
+    return true;
+}
+
+// The cell of `tile` the current invocation works on, for the 2D kernels
+uvec2 tileCell(uvec3 tile) {
+    return tile.xy * uvec2(pc.tileWidth, pc.tileHeight) + gl_LocalInvocationID.xy;
+}
+
+// Index of `cell` in the grid layer of `scenario`
+uint gridIndex(uvec2 cell, uint scenario) {
+    return cell.x + cell.y * pc.gridWidth + scenario * pc.gridWidth * pc.gridHeight;
+}
+
+// Anything a light contributes below this is treated as nothing, which is
+// what gives every light a finite radius we can cull against
+const float lightCutoff = 1.0 / 256.0;
+
+// Inverse square falloff: intensity / (1 + attenuation * d^2). Precise, so
+// nothing gets fused and the CPU backend can do the same operations.
+float lightContribution(vec4 light, vec2 p) {
+    precise vec2 d = light.xy - p;
+    precise float contribution = light.z / (1.0 + light.w * dot(d, d));
+    return contribution;
+}
+
+// Square of the distance past which lightContribution() is below lightCutoff
+float lightRadiusSq(vec4 light) {
+    if (light.z < lightCutoff) {
+        return -1.0;
+    }
+    if (light.w <= 0.0) {
+        return 3.0e38; // Never falls off
+    }
+    precise float radiusSq = (light.z / lightCutoff - 1.0) / light.w;
+    return radiusSq;
+}
+
+// Bins are numbered like the tiles
+uint tileBinIndex(uvec3 tile) {
+    return tile.x + tile.y * tilesPerRow() + tile.z * tilesPerScenario();
+}
+
+// The bin for `tile`. A tile that overflowed the index pool gets every
+// primitive of its scenario instead, which is slow but correct.
+TileBin loadTileBin(uvec3 tile, Scenario scenario) {
+    TileBin bin = bins[tileBinIndex(tile)];
+    if (bin.offset == binOverflow) {
+        bin.lightCount = pc.binLights != 0 ? scenario.lightCount : 0;
+        bin.circleCount = scenario.circleCount;
+        bin.rectCount = scenario.rectCount;
+    }
+    return bin;
+}
+
+// Global index of the i-th light/circle/rectangle in a tile's bin
+uint tileLight(TileBin bin, Scenario scenario, uint i) {
+    return bin.offset == binOverflow ? scenario.lightOffset + i : tileIndices[bin.offset + i];
+}
+
+uint tileCircle(TileBin bin, Scenario scenario, uint i) {
+    return bin.offset == binOverflow ? scenario.circleOffset + i : tileIndices[bin.offset + bin.lightCount + i];
+}
+
+uint tileRect(TileBin bin, Scenario scenario, uint i) {
+    return bin.offset == binOverflow ? scenario.rectOffset + i :
+           tileIndices[bin.offset + bin.lightCount + bin.circleCount + i];
+}
@@ -0,0 +1,51 @@
+#version 450
+#extension GL_GOOGLE_include_directive : enable
+
+#include "common.glsl"
+
+// Turns the dirty tile bitmask the host wrote into the list of dirty tiles
+// the other kernels are dispatched over (with vkCmdDispatchIndirect), so
+// tiles nothing changed in cost nothing. Runs as a single workgroup: even a
+// big batch is only a few thousand words of mask.
+
+layout(local_size_x = 128) in;
+
+// Indirect dispatches are split into rows of this many workgroups, the
+// smallest maxComputeWorkGroupCount[0] a device can have
+const uint maxDispatchWidth = 65535;
+
+shared uint listCount;
+
+void main() {
+    uint local = gl_LocalInvocationIndex;
+    uint tileCount = tilesPerScenario() * pc.scenarioCount;
+    uint wordCount = (tileCount + 31) / 32;
+
+    if (local == 0) {
+        listCount = 0;
+    }
+    barrier();
+
+    for (uint word = local; word < wordCount; word += gl_WorkGroupSize.x) {
+        uint bits = dirtyMask[word];
+        // The last word can have bits past the last tile
+        if (word == wordCount - 1 && tileCount % 32 != 0) {
+            bits &= (1u << (tileCount % 32)) - 1;
+        }
+
+        uint slot = atomicAdd(listCount, bitCount(bits));
+        while (bits != 0) {
+            int bit = findLSB(bits);
+            bits &= bits - 1;
+            dirtyTiles[slot++] = word * 32 + uint(bit);
+        }
+    }
+    barrier();
+
+    if (local == 0) {
+        dirtyTileCount = listCount;
+        dispatchX = min(listCount, maxDispatchWidth);
+        dispatchY = (listCount + maxDispatchWidth - 1) / maxDispatchWidth;
+        dispatchZ = 1;
+    }
+}
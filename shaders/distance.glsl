@@ -0,0 +1,111 @@
+#version 450
+#extension GL_GOOGLE_include_directive : enable
+
+#include "common.glsl"
+
+// Turns the occupancy occupancy.glsl left in the grid into a signed distance
+// field by jump flooding. The algorithm (and the CPU version this has to
+// match) is in distance_utils.hpp. Dispatched pc.distancePasses + 2 times
+// over the whole grid with gl_WorkGroupID.z the scenario, pc.distancePass
+// going 0 (seeding), 1 to pc.distancePasses (flooding), then
+// pc.distancePasses + 1 (writing the distances into the grid). Grids too big
+// for one dispatch are covered with a grid-stride loop.
+
+layout(local_size_x = 16, local_size_y = 16) in;
+
+// (nearest obstacle, nearest free cell) seeds of every cell of every
+// scenario, twice over: flood pass p reads copy (p - 1) & 1 and writes copy
+// p & 1. Seeds are packed as x | y << 16.
+layout(binding = 15) buffer DistanceSeeds {
+    uvec2 distanceSeeds[];
+};
+
+const uint noSeed = 0xFFFFFFFFu;
+
+uint seedIndex(uint copy, uvec2 cell, uint scenario) {
+    return copy * pc.gridWidth * pc.gridHeight * pc.scenarioCount + gridIndex(cell, scenario);
+}
+
+uint packSeed(uvec2 cell) {
+    return cell.x | (cell.y << 16);
+}
+
+uint seedDistanceSq(uint seed, uvec2 cell) {
+    uvec2 d = uvec2(abs(ivec2(seed & 0xFFFFu, seed >> 16) - ivec2(cell)));
+    return d.x * d.x + d.y * d.y;
+}
+
+// Ties go to the smaller seed, like closerSeed() on the host
+void closerSeed(uint candidate, uvec2 cell, inout uint best, inout uint bestDistanceSq) {
+    if (candidate == noSeed) {
+        return;
+    }
+    uint distanceSq = seedDistanceSq(candidate, cell);
+    if (best == noSeed || distanceSq < bestDistanceSq || (distanceSq == bestDistanceSq && candidate < best)) {
+        best = candidate;
+        bestDistanceSq = distanceSq;
+    }
+}
+
+bool tileDirty(uvec2 cell, uint scenario) {
+    uint tile = tileBinIndex(uvec3(cell / uvec2(pc.tileWidth, pc.tileHeight), scenario));
+    return (dirtyMask[tile / 32] & (1u << (tile % 32))) != 0;
+}
+
+// Only the dirty tiles got fresh occupancy this run, everywhere else the
+// grid still holds the last run's distances. A cell there is an obstacle if
+// it was its own nearest obstacle last run, which is where the last flood
+// pass left it.
+bool isObstacle(uvec2 cell, uint scenario) {
+    if (tileDirty(cell, scenario)) {
+        return loadCell(gridIndex(cell, scenario)) >= 0.5;
+    }
+    return distanceSeeds[seedIndex(pc.distancePasses & 1, cell, scenario)].x == packSeed(cell);
+}
+
+uvec2 floodCell(uvec2 cell, uint scenario, uint srcCopy, int jump) {
+    uint best[2] = uint[2](noSeed, noSeed);
+    uint bestDistanceSq[2] = uint[2](0, 0);
+    for (int dy = -jump; dy <= jump; dy += jump) {
+        for (int dx = -jump; dx <= jump; dx += jump) {
+            ivec2 neighbour = ivec2(cell) + ivec2(dx, dy);
+            if (any(lessThan(neighbour, ivec2(0))) || neighbour.x >= int(pc.gridWidth) || neighbour.y >= int(pc.gridHeight)) {
+                continue;
+            }
+            uvec2 seeds = distanceSeeds[seedIndex(srcCopy, uvec2(neighbour), scenario)];
+            closerSeed(seeds.x, cell, best[0], bestDistanceSq[0]);
+            closerSeed(seeds.y, cell, best[1], bestDistanceSq[1]);
+        }
+    }
+    return uvec2(best[0], best[1]);
+}
+
+float seedDistance(uint seed, uvec2 cell) {
+    // Further than anything on the grid, see missingSeedDistance()
+    return seed == noSeed ? float(pc.gridWidth) + float(pc.gridHeight) : sqrt(float(seedDistanceSq(seed, cell)));
+}
+
+void main() {
+    uint scenario = gl_WorkGroupID.z;
+    uint pass = pc.distancePass;
+    uvec2 stride = gl_NumWorkGroups.xy * gl_WorkGroupSize.xy;
+    // Step of this pass when flooding, see distanceFloodStep()
+    int jump = pass < pc.distancePasses ? 1 << (pc.distancePasses - 1 - pass) : 1;
+
+    for (uint y = gl_GlobalInvocationID.y; y < pc.gridHeight; y += stride.y) {
+        for (uint x = gl_GlobalInvocationID.x; x < pc.gridWidth; x += stride.x) {
+            uvec2 cell = uvec2(x, y);
+            if (pass == 0) {
+                // Reads and writes the same entry when the last flood pass
+                // was even, which is fine since only this invocation uses it
+                uint self = packSeed(cell);
+                distanceSeeds[seedIndex(0, cell, scenario)] = isObstacle(cell, scenario) ? uvec2(self, noSeed) : uvec2(noSeed, self);
+            } else if (pass <= pc.distancePasses) {
+                distanceSeeds[seedIndex(pass & 1, cell, scenario)] = floodCell(cell, scenario, (pass - 1) & 1, jump);
+            } else {
+                uvec2 seeds = distanceSeeds[seedIndex(pc.distancePasses & 1, cell, scenario)];
+                storeCell(gridIndex(cell, scenario), seedDistance(seeds.x, cell) - seedDistance(seeds.y, cell));
+            }
+        }
+    }
+}
@@ -1,30 +1,28 @@
 #version 450
+#extension GL_GOOGLE_include_directive : enable
 
-layout(binding = 0) buffer GridBuffer {
-    float grid[]; // Flattened 2D grid
-};
-
-// layout(binding = 1) buffer LightSources {
-//     vec4 lights[]; // Each vec4: (x, y, intensity, attenuation)
-// };
-
-// layout(binding = 2) buffer Circles {
-//     vec3 circles[]; // (cx, cy, r)
-// };
-
-// layout(binding = 3) buffer Rectangles {
-//     vec4 rectangles[]; // (cx, cy, w, h)
-// };
-
-// TODO: Take every grid cell in the buffer (which starts at 0) and set it to 1
+#include "common.glsl"
 
+// Take every grid cell in the buffer (which starts at 0) and set it to 1, in
+// every scenario's layer
 
+// Workgroup size is picked per device at pipeline creation
 layout(local_size_x = 32, local_size_y = 32) in;
+layout(local_size_x_id = 0, local_size_y_id = 1) in;
 
 void main() {
-    // Compute the flattened index based on the workgroup and local IDs
-    uint idx = gl_GlobalInvocationID.x + gl_GlobalInvocationID.y * gl_NumWorkGroups.x * gl_WorkGroupSize.x;
+    uvec3 tile;
+    if (!currentTile(tile)) {
+        return;
+    }
+
+    // The grid is rarely a multiple of the workgroup size, so the last row
+    // and column of tiles hang off the edge
+    uvec2 cell = tileCell(tile);
+    if (cell.x >= pc.gridWidth || cell.y >= pc.gridHeight) {
+        return;
+    }
 
     // Set the value to 1.0
-    grid[idx] = 1.0;
-}
\ No newline at end of file
+    storeCell(gridIndex(cell, tile.z), 1.0);
+}
@@ -0,0 +1,143 @@
+#version 450
+#extension GL_GOOGLE_include_directive : enable
+
+#include "common.glsl"
+
+// Per cell illumination: the sum of every light's attenuated intensity, where
+// a light only counts if the segment from the cell centre to the light doesn't
+// cross any circle or rectangle.
+//
+// Each workgroup only looks at the lights and shapes binning.glsl found for
+// its tile. Lights are handled 32 at a time with one visibility bit each, so
+// every shape is fetched once per batch instead of once per light. Both the
+// batch of lights and each chunk of shapes are loaded once per workgroup into
+// shared memory, so the inner loops never touch global memory.
+//
+// The arithmetic is precise throughout so the CPU backend, which does the
+// same operations in the same order, can check it.
+
+// Workgroup size is picked per device at pipeline creation
+layout(local_size_x = 32, local_size_y = 32) in;
+layout(local_size_x_id = 0, local_size_y_id = 1) in;
+
+const uint lightBatchSize = 32; // One bit per light in a uint
+const uint shapeChunkSize = 256;
+
+shared vec4 batchLights[lightBatchSize];
+shared vec4 chunkShapes[shapeChunkSize];
+
+// Does the segment p -> p + d pass through the circle (cx, cy, r)?
+bool segmentHitsCircle(vec2 p, vec2 d, vec4 circle) {
+    precise vec2 toCentre = circle.xy - p;
+    precise float t = clamp(dot(toCentre, d) / max(dot(d, d), 1e-12), 0.0, 1.0);
+    precise vec2 offset = toCentre - t * d;
+    precise float distanceSq = dot(offset, offset);
+    precise float radiusSq = circle.z * circle.z;
+    return distanceSq < radiusSq;
+}
+
+// Slab test of the segment p -> p + d against the rectangle (cx, cy, w, h)
+bool segmentHitsRect(vec2 p, vec2 d, vec4 rect) {
+    precise vec2 halfExtent = rect.zw * 0.5;
+    // Nudge axis aligned segments off zero so the slabs stay finite
+    vec2 safeD = mix(d, vec2(1e-12), lessThan(abs(d), vec2(1e-12)));
+    precise vec2 t0 = (rect.xy - halfExtent - p) / safeD;
+    precise vec2 t1 = (rect.xy + halfExtent - p) / safeD;
+    vec2 tNear = min(t0, t1);
+    vec2 tFar = max(t0, t1);
+    float enter = max(max(tNear.x, tNear.y), 0.0);
+    float exit = min(min(tFar.x, tFar.y), 1.0);
+    return enter < exit;
+}
+
+void main() {
+    // Whole workgroups bail out together, so this is safe with barrier()
+    uvec3 tile;
+    if (!currentTile(tile)) {
+        return;
+    }
+
+    uvec2 cell = tileCell(tile);
+    uint localIndex = gl_LocalInvocationIndex;
+    uint workgroupInvocations = gl_WorkGroupSize.x * gl_WorkGroupSize.y;
+    // Threads outside the grid still have to take part in the shared loads
+    bool inGrid = cell.x < pc.gridWidth && cell.y < pc.gridHeight;
+    precise vec2 p = vec2(cell) + 0.5;
+    Scenario scenario = scenarios[tile.z];
+    TileBin bin = loadTileBin(tile, scenario);
+
+    precise float illumination = 0.0;
+    for (uint batchStart = 0; batchStart < bin.lightCount; batchStart += lightBatchSize) {
+        uint batchCount = min(lightBatchSize, bin.lightCount - batchStart);
+
+        barrier();
+        for (uint i = localIndex; i < batchCount; i += workgroupInvocations) {
+            batchLights[i] = lights[tileLight(bin, scenario, batchStart + i)];
+        }
+        barrier();
+
+        // Bit i stays set while light i can still reach this cell. Lights that
+        // are too far away to matter never get a bit in the first place.
+        uint visible = 0;
+        if (inGrid) {
+            for (uint i = 0; i < batchCount; i++) {
+                if (lightContribution(batchLights[i], p) >= lightCutoff) {
+                    visible |= 1u << i;
+                }
+            }
+        }
+
+        for (uint chunkStart = 0; chunkStart < bin.circleCount; chunkStart += shapeChunkSize) {
+            uint chunkCount = min(shapeChunkSize, bin.circleCount - chunkStart);
+
+            barrier();
+            for (uint i = localIndex; i < chunkCount; i += workgroupInvocations) {
+                Circle c = circles[tileCircle(bin, scenario, chunkStart + i)];
+                chunkShapes[i] = vec4(c.cx, c.cy, c.r, 0.0);
+            }
+            barrier();
+
+            for (uint s = 0; s < chunkCount && visible != 0; s++) {
+                uint remaining = visible;
+                while (remaining != 0) {
+                    int i = findLSB(remaining);
+                    remaining &= remaining - 1;
+                    if (segmentHitsCircle(p, batchLights[i].xy - p, chunkShapes[s])) {
+                        visible &= ~(1u << i);
+                    }
+                }
+            }
+        }
+
+        for (uint chunkStart = 0; chunkStart < bin.rectCount; chunkStart += shapeChunkSize) {
+            uint chunkCount = min(shapeChunkSize, bin.rectCount - chunkStart);
+
+            barrier();
+            for (uint i = localIndex; i < chunkCount; i += workgroupInvocations) {
+                chunkShapes[i] = rectangles[tileRect(bin, scenario, chunkStart + i)];
+            }
+            barrier();
+
+            for (uint s = 0; s < chunkCount && visible != 0; s++) {
+                uint remaining = visible;
+                while (remaining != 0) {
+                    int i = findLSB(remaining);
+                    remaining &= remaining - 1;
+                    if (segmentHitsRect(p, batchLights[i].xy - p, chunkShapes[s])) {
+                        visible &= ~(1u << i);
+                    }
+                }
+            }
+        }
+
+        while (visible != 0) {
+            int i = findLSB(visible);
+            visible &= visible - 1;
+            illumination += lightContribution(batchLights[i], p);
+        }
+    }
+
+    if (inGrid) {
+        storeCell(gridIndex(cell, tile.z), illumination);
+    }
+}
@@ -0,0 +1,89 @@
+#version 450
+#extension GL_GOOGLE_include_directive : enable
+
+#include "common.glsl"
+
+// Mark every cell touched by any circle or rectangle with 1, everything else
+// with 0. Cell (x, y) covers [x, x + 1) x [y, y + 1) in grid units, and a cell
+// counts as covered if the shape overlaps any part of it (not just its centre)
+// so thin obstacles never fall through the gaps.
+//
+// Each workgroup only looks at the shapes binning.glsl found for its tile,
+// loaded a chunk at a time into shared memory. The tests are precise so the
+// CPU backend can repeat them exactly.
+
+// Workgroup size is picked per device at pipeline creation
+layout(local_size_x = 32, local_size_y = 32) in;
+layout(local_size_x_id = 0, local_size_y_id = 1) in;
+
+const uint shapeChunkSize = 256;
+
+shared vec4 chunkShapes[shapeChunkSize];
+
+bool circleOverlapsCell(vec4 circle, vec2 cellMin) {
+    // Distance from the centre to the closest point of the cell
+    vec2 closest = clamp(circle.xy, cellMin, cellMin + 1.0);
+    precise vec2 d = closest - circle.xy;
+    precise float distanceSq = dot(d, d);
+    precise float radiusSq = circle.z * circle.z;
+    return distanceSq < radiusSq;
+}
+
+bool rectangleOverlapsCell(vec4 rect, vec2 cellCentre) {
+    precise vec2 halfExtent = rect.zw * 0.5 + 0.5;
+    precise vec2 offset = abs(rect.xy - cellCentre);
+    return all(lessThan(offset, halfExtent));
+}
+
+void main() {
+    // Whole workgroups bail out together, so this is safe with barrier()
+    uvec3 tile;
+    if (!currentTile(tile)) {
+        return;
+    }
+
+    uvec2 cell = tileCell(tile);
+    uint localIndex = gl_LocalInvocationIndex;
+    uint workgroupInvocations = gl_WorkGroupSize.x * gl_WorkGroupSize.y;
+    // Threads outside the grid still have to take part in the shared loads
+    bool inGrid = cell.x < pc.gridWidth && cell.y < pc.gridHeight;
+
+    vec2 cellMin = vec2(cell);
+    vec2 cellCentre = cellMin + 0.5;
+    Scenario scenario = scenarios[tile.z];
+    TileBin bin = loadTileBin(tile, scenario);
+
+    bool occupied = false;
+    for (uint chunkStart = 0; chunkStart < bin.circleCount; chunkStart += shapeChunkSize) {
+        uint chunkCount = min(shapeChunkSize, bin.circleCount - chunkStart);
+
+        barrier();
+        for (uint i = localIndex; i < chunkCount; i += workgroupInvocations) {
+            Circle c = circles[tileCircle(bin, scenario, chunkStart + i)];
+            chunkShapes[i] = vec4(c.cx, c.cy, c.r, 0.0);
+        }
+        barrier();
+
+        for (uint s = 0; s < chunkCount && !occupied; s++) {
+            occupied = circleOverlapsCell(chunkShapes[s], cellMin);
+        }
+    }
+
+    for (uint chunkStart = 0; chunkStart < bin.rectCount; chunkStart += shapeChunkSize) {
+        uint chunkCount = min(shapeChunkSize, bin.rectCount - chunkStart);
+
+        barrier();
+        for (uint i = localIndex; i < chunkCount; i += workgroupInvocations) {
+            chunkShapes[i] = rectangles[tileRect(bin, scenario, chunkStart + i)];
+        }
+        barrier();
+
+        for (uint s = 0; s < chunkCount && !occupied; s++) {
+            occupied = rectangleOverlapsCell(chunkShapes[s], cellCentre);
+        }
+    }
+
+    if (inGrid) {
+        storeCell(gridIndex(cell, tile.z), occupied ? 1.0 : 0.0);
+    }
+}
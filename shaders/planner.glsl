@@ -0,0 +1,281 @@
+#version 450
+#extension GL_GOOGLE_include_directive : enable
+
+#include "common.glsl"
+
+// Cost-to-go from every cell to the goal cell (pc.goalX, pc.goalY) over the
+// occupancy occupancy.glsl left in the grid, by Bellman-Ford. Moves go to
+// any of the 8 neighbours that isn't an obstacle, 1 straight and sqrt(2)
+// diagonally, and a diagonal move can't cut the corner of an obstacle.
+// Obstacles and cells that can't reach the goal end up at infinity.
+//
+// One shader for every pass, picked by pc.plannerPass:
+//   0: seeding, over the whole grid (grid-stride)
+//   1: a sweep, one workgroup per 16x16 tile (indirect, see below)
+//   2: the convergence check after each sweep, one invocation
+//   3: writing the costs into the grid, over the whole grid (grid-stride)
+// A run records pc.plannerIteration going 0 to maxIterations - 1 of the
+// sweep/check pair. Once a sweep changes nothing the check zeroes the
+// indirect dispatch of the sweeps after it, so a converged planner costs a
+// handful of empty dispatches rather than a round trip to the host.
+//
+// Each sweep workgroup loads its tile plus a cell of border into shared
+// memory, relaxes it until nothing in it changes, and writes back what did.
+// Costs only ever go down and any tile that changed flags another sweep, so
+// reading a neighbouring tile while it's being written just means its new
+// values are picked up a sweep later. Tiles whose 3x3 neighbourhood didn't
+// change in the last sweep have nothing to learn and skip straight out.
+
+layout(local_size_x = 16, local_size_y = 16) in;
+
+const uint plannerTileSize = 16;
+const float diagonalCost = 1.41421356;
+// Cost of an obstacle in `plannerCosts`, so the next run can tell where they
+// were in tiles it doesn't recompute
+const float obstacleCost = -1.0;
+
+// The cost field being worked on, laid out like the grid
+layout(binding = 16) coherent buffer PlannerCosts {
+    float plannerCosts[];
+};
+
+// The sweeps' indirect dispatch and convergence bookkeeping, then a flag per
+// tile for each of the last two sweeps (sweep i writes copy i & 1)
+layout(binding = 17) coherent buffer PlannerState {
+    uint sweepDispatchX;
+    uint sweepDispatchY;
+    uint sweepDispatchZ;
+    uint changedTiles; // Tiles the last sweep changed, reset by the check
+    uint sweepCount;   // Sweeps that actually ran
+    uint converged;
+    uint statePad0;
+    uint statePad1;
+    uint tileChanged[];
+};
+
+// Must match PlannerStatus in main.cpp. Written at the end of the run for
+// the host.
+layout(binding = 18) writeonly buffer PlannerStatusBuffer {
+    uint statusIterations;
+    uint statusConverged;
+    uint statusPad0;
+    uint statusPad1;
+};
+
+shared float tileCosts[plannerTileSize + 2][plannerTileSize + 2];
+shared bool tileRelaxed;
+shared bool anyRelaxed;
+
+uint plannerTilesPerRow() {
+    return (pc.gridWidth + plannerTileSize - 1) / plannerTileSize;
+}
+
+uint plannerTilesPerScenario() {
+    return plannerTilesPerRow() * ((pc.gridHeight + plannerTileSize - 1) / plannerTileSize);
+}
+
+uint tileFlagIndex(uint copy, uvec2 tile, uint scenario) {
+    return copy * plannerTilesPerScenario() * pc.scenarioCount +
+           scenario * plannerTilesPerScenario() + tile.x + tile.y * plannerTilesPerRow();
+}
+
+bool tileDirty(uvec2 cell, uint scenario) {
+    uint tile = tileBinIndex(uvec3(cell / uvec2(pc.tileWidth, pc.tileHeight), scenario));
+    return (dirtyMask[tile / 32] & (1u << (tile % 32))) != 0;
+}
+
+// Only the dirty tiles got fresh occupancy this run, everywhere else the
+// grid still holds the last run's costs, but `plannerCosts` still has the
+// obstacles
+bool isObstacle(uvec2 cell, uint scenario) {
+    if (tileDirty(cell, scenario)) {
+        return loadCell(gridIndex(cell, scenario)) >= 0.5;
+    }
+    return plannerCosts[gridIndex(cell, scenario)] == obstacleCost;
+}
+
+void seed(uint scenario) {
+    uvec2 stride = gl_NumWorkGroups.xy * gl_WorkGroupSize.xy;
+    for (uint y = gl_GlobalInvocationID.y; y < pc.gridHeight; y += stride.y) {
+        for (uint x = gl_GlobalInvocationID.x; x < pc.gridWidth; x += stride.x) {
+            uvec2 cell = uvec2(x, y);
+            float cost = uintBitsToFloat(0x7F800000u);
+            if (isObstacle(cell, scenario)) {
+                cost = obstacleCost;
+            } else if (x == pc.goalX && y == pc.goalY) {
+                cost = 0.0;
+            }
+            plannerCosts[gridIndex(cell, scenario)] = cost;
+        }
+    }
+
+    if (gl_GlobalInvocationID == uvec3(0)) {
+        sweepDispatchX = plannerTilesPerRow();
+        sweepDispatchY = (pc.gridHeight + plannerTileSize - 1) / plannerTileSize;
+        sweepDispatchZ = pc.scenarioCount;
+        changedTiles = 0;
+        sweepCount = 0;
+        converged = 0;
+    }
+}
+
+bool neighbourhoodChanged(uvec2 tile, uint scenario) {
+    if (pc.plannerIteration == 0) {
+        return true;
+    }
+    uvec2 tiles = uvec2(plannerTilesPerRow(), (pc.gridHeight + plannerTileSize - 1) / plannerTileSize);
+    uint copy = (pc.plannerIteration - 1) & 1;
+    for (int dy = -1; dy <= 1; dy++) {
+        for (int dx = -1; dx <= 1; dx++) {
+            ivec2 neighbour = ivec2(tile) + ivec2(dx, dy);
+            if (all(greaterThanEqual(neighbour, ivec2(0))) && all(lessThan(neighbour, ivec2(tiles))) &&
+                    tileChanged[tileFlagIndex(copy, uvec2(neighbour), scenario)] != 0) {
+                return true;
+            }
+        }
+    }
+    return false;
+}
+
+// What a cell costs through its neighbours in shared memory, `cost` if none
+// of them is any better
+float relaxCell(ivec2 local, float cost) {
+    float best = cost;
+    for (int dy = -1; dy <= 1; dy++) {
+        for (int dx = -1; dx <= 1; dx++) {
+            if (dx == 0 && dy == 0) {
+                continue;
+            }
+            float neighbour = tileCosts[local.y + dy][local.x + dx];
+            if (neighbour < 0.0) {
+                continue;
+            }
+            if (dx != 0 && dy != 0) {
+                if (tileCosts[local.y][local.x + dx] < 0.0 || tileCosts[local.y + dy][local.x] < 0.0) {
+                    continue;
+                }
+                best = min(best, neighbour + diagonalCost);
+            } else {
+                best = min(best, neighbour + 1.0);
+            }
+        }
+    }
+    return best;
+}
+
+void sweep(uint scenario) {
+    uvec2 tile = gl_WorkGroupID.xy;
+    uint localIndex = gl_LocalInvocationIndex;
+    bool active = neighbourhoodChanged(tile, scenario);
+    if (!active) {
+        if (localIndex == 0) {
+            tileChanged[tileFlagIndex(pc.plannerIteration & 1, tile, scenario)] = 0;
+        }
+        return;
+    }
+
+    // The tile and its border, anything off the grid counts as an obstacle
+    ivec2 origin = ivec2(tile * plannerTileSize) - 1;
+    for (uint i = localIndex; i < (plannerTileSize + 2) * (plannerTileSize + 2); i += plannerTileSize * plannerTileSize) {
+        ivec2 local = ivec2(i % (plannerTileSize + 2), i / (plannerTileSize + 2));
+        ivec2 cell = origin + local;
+        bool inGrid = all(greaterThanEqual(cell, ivec2(0))) && cell.x < int(pc.gridWidth) && cell.y < int(pc.gridHeight);
+        tileCosts[local.y][local.x] = inGrid ? plannerCosts[gridIndex(uvec2(cell), scenario)] : obstacleCost;
+    }
+    if (localIndex == 0) {
+        anyRelaxed = false;
+    }
+    barrier();
+
+    // A path within the tile can't be longer than the tile has cells, so
+    // this always settles the tile
+    ivec2 local = ivec2(gl_LocalInvocationID.xy) + 1;
+    float initial = tileCosts[local.y][local.x];
+    for (uint i = 0; i < plannerTileSize * plannerTileSize; i++) {
+        if (localIndex == 0) {
+            tileRelaxed = false;
+        }
+        barrier();
+
+        float cost = tileCosts[local.y][local.x];
+        float relaxed = cost < 0.0 ? cost : relaxCell(local, cost);
+        barrier();
+
+        if (relaxed < cost) {
+            tileCosts[local.y][local.x] = relaxed;
+            tileRelaxed = true;
+            anyRelaxed = true;
+        }
+        barrier();
+
+        bool again = tileRelaxed;
+        barrier();
+        if (!again) {
+            break;
+        }
+    }
+
+    uvec2 cell = tile * plannerTileSize + gl_LocalInvocationID.xy;
+    float cost = tileCosts[local.y][local.x];
+    if (cell.x < pc.gridWidth && cell.y < pc.gridHeight && cost < initial) {
+        plannerCosts[gridIndex(cell, scenario)] = cost;
+    }
+
+    if (localIndex == 0) {
+        tileChanged[tileFlagIndex(pc.plannerIteration & 1, tile, scenario)] = anyRelaxed ? 1 : 0;
+        if (anyRelaxed) {
+            atomicAdd(changedTiles, 1);
+        }
+    }
+}
+
+// The first sweep that changes nothing means every cost is final
+void check() {
+    if (gl_GlobalInvocationID != uvec3(0) || sweepDispatchX == 0) {
+        return;
+    }
+    sweepCount++;
+    if (changedTiles == 0) {
+        sweepDispatchX = 0;
+        sweepDispatchY = 0;
+        sweepDispatchZ = 0;
+        converged = 1;
+    }
+    changedTiles = 0;
+}
+
+// Half float grids round costs above 2048 to even steps, checkKernelFormat()
+// in main.cpp keeps them off grids where a cost could round up to infinity
+void finish(uint scenario) {
+    uvec2 stride = gl_NumWorkGroups.xy * gl_WorkGroupSize.xy;
+    for (uint y = gl_GlobalInvocationID.y; y < pc.gridHeight; y += stride.y) {
+        for (uint x = gl_GlobalInvocationID.x; x < pc.gridWidth; x += stride.x) {
+            uint index = gridIndex(uvec2(x, y), scenario);
+            float cost = plannerCosts[index];
+            storeCell(index, cost < 0.0 ? uintBitsToFloat(0x7F800000u) : cost);
+        }
+    }
+
+    if (gl_GlobalInvocationID == uvec3(0)) {
+        statusIterations = sweepCount;
+        statusConverged = converged;
+    }
+}
+
+void main() {
+    uint scenario = gl_WorkGroupID.z;
+    switch (pc.plannerPass) {
+        case 0:
+            seed(scenario);
+            break;
+        case 1:
+            sweep(scenario);
+            break;
+        case 2:
+            check();
+            break;
+        default:
+            finish(scenario);
+            break;
+    }
+}
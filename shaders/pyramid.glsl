@@ -0,0 +1,39 @@
+#version 450
+#extension GL_GOOGLE_include_directive : enable
+
+#include "common.glsl"
+#include "pyramid_common.glsl"
+
+// Builds level pc.pyramidLevel of the min/max pyramid (see
+// pyramid_common.glsl) from the level below it, or from the grid for level
+// 1. Dispatched once per level, bottom up, with gl_WorkGroupID.z the
+// scenario. Levels too big for one dispatch are covered with a grid-stride
+// loop.
+
+layout(local_size_x = 16, local_size_y = 16) in;
+
+void main() {
+    uint scenario = gl_WorkGroupID.z;
+    uint level = pc.pyramidLevel;
+    uvec2 size = pyramidLevelSize(level);
+    uvec2 belowSize = pyramidLevelSize(level - 1);
+    uvec2 stride = gl_NumWorkGroups.xy * gl_WorkGroupSize.xy;
+
+    for (uint y = gl_GlobalInvocationID.y; y < size.y; y += stride.y) {
+        for (uint x = gl_GlobalInvocationID.x; x < size.x; x += stride.x) {
+            vec2 range = vec2(uintBitsToFloat(0x7F800000u), -uintBitsToFloat(0x7F800000u));
+            for (uint dy = 0; dy < 2; dy++) {
+                for (uint dx = 0; dx < 2; dx++) {
+                    uvec2 child = uvec2(2 * x + dx, 2 * y + dy);
+                    if (any(greaterThanEqual(child, belowSize))) {
+                        continue;
+                    }
+                    vec2 childRange = level == 1 ? vec2(loadCell(gridIndex(child, scenario))) :
+                                                   pyramid[pyramidIndex(level - 1, child, scenario)];
+                    range = vec2(min(range.x, childRange.x), max(range.y, childRange.y));
+                }
+            }
+            pyramid[pyramidIndex(level, uvec2(x, y), scenario)] = range;
+        }
+    }
+}
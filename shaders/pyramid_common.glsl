@@ -0,0 +1,105 @@
+// The min/max pyramid pyramid.glsl builds over the grid, included after
+// common.glsl by anything that reads or writes it. Laid out like
+// vu::pyramidLayout() in pyramid_utils.hpp: level 0 is the grid itself, and
+// each scenario has levels 1 to top back to back, row major, one
+// (min, max) pair per node.
+layout(binding = 12) buffer GridPyramid {
+    vec2 pyramid[];
+};
+
+uvec2 pyramidLevelSize(uint level) {
+    uvec2 size = uvec2(pc.gridWidth, pc.gridHeight);
+    for (uint l = 0; l < level; l++) {
+        size = (size + 1) / 2;
+    }
+    return size;
+}
+
+// Levels above the grid, 0 for a 1x1 grid
+uint pyramidTopLevel() {
+    uvec2 size = uvec2(pc.gridWidth, pc.gridHeight);
+    uint level = 0;
+    while (size.x > 1 || size.y > 1) {
+        size = (size + 1) / 2;
+        level++;
+    }
+    return level;
+}
+
+// Where `level` starts within a scenario's pyramid, in nodes. One past the
+// top level gives the size of a whole scenario's pyramid.
+uint pyramidLevelOffset(uint level) {
+    uvec2 size = uvec2(pc.gridWidth, pc.gridHeight);
+    uint offset = 0;
+    for (uint l = 1; l < level; l++) {
+        size = (size + 1) / 2;
+        offset += size.x * size.y;
+    }
+    return offset;
+}
+
+uint pyramidIndex(uint level, uvec2 node, uint scenario) {
+    uvec2 size = pyramidLevelSize(level);
+    return scenario * pyramidLevelOffset(pyramidTopLevel() + 1) + pyramidLevelOffset(level) + node.x + node.y * size.x;
+}
+
+// True if any cell of [cellMin, cellMax] (inclusive, clamped to the grid)
+// of `scenario` is above `threshold`, or below it with `below` set. Walks
+// down from the top level without a stack, skipping every node whose
+// min/max rules it out and stopping at the first node that's entirely
+// inside the region and has a cell that qualifies, so only nodes along the
+// region's edges get visited. Same walk as vu::pyramidRegionAny().
+bool regionAny(uint scenario, uvec2 cellMin, uvec2 cellMax, float threshold, bool below) {
+    cellMax = min(cellMax, uvec2(pc.gridWidth, pc.gridHeight) - 1);
+    if (any(greaterThan(cellMin, cellMax))) {
+        return false;
+    }
+
+    uint top = pyramidTopLevel();
+    uint level = top;
+    uvec2 node = uvec2(0);
+    while (true) {
+        // The cells under the node, which can hang off the grid
+        uvec2 nodeMin = node << level;
+        uvec2 nodeMax = ((node + 1) << level) - 1;
+
+        bool descend = false;
+        if (all(lessThanEqual(nodeMin, cellMax)) && all(greaterThanEqual(nodeMax, cellMin))) {
+            vec2 range = level == 0 ? vec2(loadCell(gridIndex(node, scenario))) :
+                                      pyramid[pyramidIndex(level, node, scenario)];
+            if (below ? range.x < threshold : range.y > threshold) {
+                bool inside = all(greaterThanEqual(nodeMin, cellMin)) && all(lessThanEqual(nodeMax, cellMax));
+                if (level == 0 || inside) {
+                    return true;
+                }
+                descend = true;
+            }
+        }
+
+        if (descend) {
+            level--;
+            node *= 2;
+            continue;
+        }
+
+        // On to the next sibling, climbing out of finished parents.
+        // Children go (0, 0), (1, 0), (0, 1), (1, 1).
+        while (true) {
+            if (level == top) {
+                return false;
+            }
+            if ((node.x & 1) == 0) {
+                node.x++;
+                break;
+            }
+            if ((node.y & 1) == 0) {
+                node.x--;
+                node.y++;
+                break;
+            }
+            node >>= 1;
+            level++;
+        }
+    }
+    return false;
+}
@@ -0,0 +1,213 @@
+#version 450
+#extension GL_GOOGLE_include_directive : enable
+
+#include "common.glsl"
+#include "pyramid_common.glsl"
+
+// Answers a batch of point, rectangle, segment and ray queries against a frame's
+// grid, one invocation per query, so consumers get a few bytes per query
+// instead of reading the grid back. Must give the same answers as
+// evaluateQuery() in main.cpp. Coordinates are in grid units, i.e. cell
+// (x, y) covers [x, x + 1) x [y, y + 1).
+
+layout(local_size_x = 64) in;
+
+const uint queryPoint = 0;   // The cell under (x0, y0)
+const uint queryRect = 1;    // Every cell [x0, x1] x [y0, y1] touches
+const uint querySegment = 2; // Every cell the segment (x0, y0) -> (x1, y1) passes through
+const uint queryRay = 3;     // Every cell from (x0, y0) in direction (x1, y1) up to `range`
+
+// Must match GridQuery in main.cpp
+struct GridQuery {
+    uint type;
+    uint scenario;
+    float threshold;
+    float range; // Ray only
+    vec4 coords; // (x0, y0, x1, y1)
+};
+
+// Must match GridQueryResult in main.cpp
+struct GridQueryResult {
+    float value;
+    uint hit;
+};
+
+layout(binding = 13) readonly buffer Queries {
+    GridQuery queries[];
+};
+
+layout(binding = 14) writeonly buffer QueryResults {
+    GridQueryResult results[];
+};
+
+ivec2 gridSize() {
+    return ivec2(pc.gridWidth, pc.gridHeight);
+}
+
+GridQueryResult pointQuery(GridQuery q) {
+    ivec2 cell = ivec2(floor(q.coords.xy));
+    if (any(lessThan(cell, ivec2(0))) || any(greaterThanEqual(cell, gridSize()))) {
+        return GridQueryResult(0.0, 0);
+    }
+    float value = loadCell(gridIndex(uvec2(cell), q.scenario));
+    return GridQueryResult(value, value > q.threshold ? 1 : 0);
+}
+
+// Through the pyramid when there is one, otherwise cell by cell
+GridQueryResult rectQuery(GridQuery q) {
+    ivec2 lo = max(ivec2(floor(q.coords.xy)), ivec2(0));
+    ivec2 hi = min(ivec2(floor(q.coords.zw)), gridSize() - 1);
+    if (any(greaterThan(lo, hi))) {
+        return GridQueryResult(0.0, 0);
+    }
+
+    bool hit = false;
+    if (pc.queryPyramid != 0) {
+        hit = regionAny(q.scenario, uvec2(lo), uvec2(hi), q.threshold, false);
+    } else {
+        for (int y = lo.y; y <= hi.y && !hit; y++) {
+            for (int x = lo.x; x <= hi.x && !hit; x++) {
+                hit = loadCell(gridIndex(uvec2(x, y), q.scenario)) > q.threshold;
+            }
+        }
+    }
+    return GridQueryResult(0.0, hit ? 1 : 0);
+}
+
+// Whether a ray along one axis crossed `boundary` by t, or at t if it
+// wins ties
+bool boundaryCrossed(float p, float d, int boundary, float t, bool winsTies) {
+    float tBoundary = (float(boundary) - p) / d;
+    return winsTies ? tBoundary <= t : tBoundary < t;
+}
+
+// Walks the cells along p + d * t for t in [0, tEnd] (Amanatides & Woo),
+// clipped to the grid first so rays reaching far off it cost no more than
+// ones inside. Returns the t where it enters the first cell above
+// `threshold`, or -1 if there's none. With the pyramid, every step crosses
+// the biggest node around the current cell with nothing above the threshold
+// rather than a single cell, so open space goes by in a few steps. Same walk
+// as castGridRay() in main.cpp.
+float castRay(uint scenario, vec2 p, vec2 d, float tEnd, float threshold) {
+    vec2 size = vec2(gridSize());
+
+    float tEnter = 0.0;
+    float tExit = tEnd;
+    for (int axis = 0; axis < 2; axis++) {
+        if (d[axis] == 0.0) {
+            if (p[axis] < 0.0 || p[axis] >= size[axis]) {
+                return -1.0;
+            }
+            continue;
+        }
+        float t0 = (0.0 - p[axis]) / d[axis];
+        float t1 = (size[axis] - p[axis]) / d[axis];
+        tEnter = max(tEnter, min(t0, t1));
+        tExit = min(tExit, max(t0, t1));
+    }
+    if (tEnter > tExit) {
+        return -1.0;
+    }
+
+    ivec2 cell = clamp(ivec2(floor(p + d * tEnter)), ivec2(0), gridSize() - 1);
+    ivec2 step = ivec2(sign(d));
+    uint top = pc.queryPyramid != 0 ? pyramidTopLevel() : 0;
+    uint level = 0;
+
+    float t = tEnter;
+    // Every step leaves at least one cell behind
+    for (uint i = 0; i < pc.gridWidth + pc.gridHeight + 2; i++) {
+        if (loadCell(gridIndex(uvec2(cell), scenario)) > threshold) {
+            return t;
+        }
+
+        // Neighbouring cells tend to sit under the same empty nodes, so
+        // start from the last step's level
+        while (level > 0 && pyramid[pyramidIndex(level, uvec2(cell) >> level, scenario)].y > threshold) {
+            level--;
+        }
+        while (level < top && pyramid[pyramidIndex(level + 1, uvec2(cell) >> (level + 1), scenario)].y <= threshold) {
+            level++;
+        }
+
+        ivec2 boxMin = (cell >> level) << level;
+        ivec2 boxMax = boxMin + (1 << level) - 1;
+        vec2 tLeave;
+        for (int axis = 0; axis < 2; axis++) {
+            if (step[axis] == 0) {
+                tLeave[axis] = 3.0e38;
+            } else {
+                float boundary = float(step[axis] > 0 ? boxMax[axis] + 1 : boxMin[axis]);
+                tLeave[axis] = (boundary - p[axis]) / d[axis];
+            }
+        }
+
+        int axis = tLeave.x < tLeave.y ? 0 : 1;
+        int other = 1 - axis;
+        t = tLeave[axis];
+        if (t > tExit) {
+            break;
+        }
+        cell[axis] = step[axis] > 0 ? boxMax[axis] + 1 : boxMin[axis] - 1;
+        // Where the ray is on the other axis, settled with the comparisons a
+        // walk cell by cell would have made so rays through a corner go the
+        // same way: y crosses first on a tie
+        int c = clamp(int(floor(p[other] + d[other] * t)), boxMin[other], boxMax[other]);
+        if (step[other] != 0) {
+            int entry = step[other] > 0 ? c : c + 1;
+            if (!boundaryCrossed(p[other], d[other], entry, t, other == 1)) {
+                c -= step[other];
+            } else if (boundaryCrossed(p[other], d[other], entry + step[other], t, other == 1)) {
+                c += step[other];
+            }
+        }
+        cell[other] = clamp(c, boxMin[other], boxMax[other]);
+        if (cell[axis] < 0 || cell[axis] >= int(size[axis])) {
+            break;
+        }
+    }
+    return -1.0;
+}
+
+// How far along the segment (0 to 1) it enters the first cell above the
+// threshold, 1 if there's none
+GridQueryResult segmentQuery(GridQuery q) {
+    float t = castRay(q.scenario, q.coords.xy, q.coords.zw - q.coords.xy, 1.0, q.threshold);
+    return t < 0.0 ? GridQueryResult(1.0, 0) : GridQueryResult(t, 1);
+}
+
+// How far (in cells) the ray gets before it hits, its range if it doesn't.
+// A zero direction only ever hits at its origin.
+GridQueryResult rayQuery(GridQuery q) {
+    vec2 d = q.coords.zw;
+    float magnitude = sqrt(dot(d, d));
+    d = magnitude > 0.0 ? d / magnitude : vec2(0.0);
+    float t = castRay(q.scenario, q.coords.xy, d, q.range, q.threshold);
+    return t < 0.0 ? GridQueryResult(q.range, 0) : GridQueryResult(t, 1);
+}
+
+void main() {
+    uint stride = gl_NumWorkGroups.x * gl_WorkGroupSize.x;
+    for (uint i = gl_GlobalInvocationID.x; i < pc.queryCount; i += stride) {
+        GridQuery q = queries[i];
+        if (q.scenario >= pc.scenarioCount) {
+            results[i] = GridQueryResult(0.0, 0);
+            continue;
+        }
+
+        switch (q.type) {
+            case queryPoint:
+                results[i] = pointQuery(q);
+                break;
+            case queryRect:
+                results[i] = rectQuery(q);
+                break;
+            case querySegment:
+                results[i] = segmentQuery(q);
+                break;
+            default:
+                results[i] = rayQuery(q);
+                break;
+        }
+    }
+}
@@ -0,0 +1,61 @@
+#version 450
+#extension GL_GOOGLE_include_directive : enable
+
+#include "common.glsl"
+#include "reduce_common.glsl"
+
+// First half of a reduction: pc.reduceGroupCount workgroups per scenario
+// (gl_WorkGroupID.y) stride over the layer's cells, each writing a
+// ReducePartial that reduce_finish.glsl combines. The group count is fixed
+// per grid size, so every cell always lands in the same partial and the sum
+// comes out the same run to run. Histograms are counted in shared memory and
+// only the bins a workgroup touched are added to the global counters.
+
+layout(local_size_x = 256) in;
+
+shared uint localHistogram[histogramBins];
+
+// Same arithmetic as histogramBin() in main.cpp
+uint histogramBin(float value) {
+    return uint(clamp((value - pc.histogramMin) * pc.histogramScale, 0.0, float(histogramBins - 1)));
+}
+
+void main() {
+    uint local = gl_LocalInvocationIndex;
+    uint scenario = gl_WorkGroupID.y;
+    uint cellCount = pc.gridWidth * pc.gridHeight;
+    uint layerStart = scenario * cellCount;
+
+    for (uint i = local; i < histogramBins; i += reduceGroupSize) {
+        localHistogram[i] = 0;
+    }
+    barrier();
+
+    ReducePartial partial = identityPartial();
+    uint stride = pc.reduceGroupCount * reduceGroupSize;
+    for (uint i = gl_WorkGroupID.x * reduceGroupSize + local; i < cellCount; i += stride) {
+        float value = loadCell(layerStart + i);
+        partial.sum += value;
+        partial.minValue = min(partial.minValue, value);
+        partial.maxValue = max(partial.maxValue, value);
+        if (value > pc.reduceThreshold) {
+            uvec2 cell = uvec2(i % pc.gridWidth, i / pc.gridWidth);
+            partial.countAbove++;
+            partial.boxMin = min(partial.boxMin, cell);
+            partial.boxMax = max(partial.boxMax, cell);
+        }
+        atomicAdd(localHistogram[histogramBin(value)], 1);
+    }
+
+    // Also the barrier between the shared histogram updates and the flush
+    partial = workgroupCombine(partial);
+
+    for (uint i = local; i < histogramBins; i += reduceGroupSize) {
+        if (localHistogram[i] != 0) {
+            atomicAdd(reduceHistograms[scenario * histogramBins + i], localHistogram[i]);
+        }
+    }
+    if (local == 0) {
+        partials[scenario * pc.reduceGroupCount + gl_WorkGroupID.x] = partial;
+    }
+}
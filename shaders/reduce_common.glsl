@@ -0,0 +1,88 @@
+// Declarations shared by the reduction kernels (reduce.glsl and
+// reduce_finish.glsl), included after common.glsl. They boil every layer of
+// the grid down to a GridStats, so the host can read a few hundred bytes per
+// scenario instead of the whole grid.
+#extension GL_KHR_shader_subgroup_basic : require
+#extension GL_KHR_shader_subgroup_arithmetic : require
+
+const uint histogramBins = 256;
+
+// What one workgroup of reduce.glsl found in its share of a layer. Must stay
+// 32 bytes, see reducePartialSize in main.cpp.
+struct ReducePartial {
+    float sum;
+    float minValue;
+    float maxValue;
+    uint countAbove; // Cells above pc.reduceThreshold
+    uvec2 boxMin;    // Bounding box of those cells, inclusive. Empty if
+    uvec2 boxMax;    // boxMin > boxMax.
+};
+
+// Must match GridStats in main.cpp
+struct GridStats {
+    float sum;
+    float minValue;
+    float maxValue;
+    uint countAbove;
+    uvec2 boxMin;
+    uvec2 boxMax;
+    uint histogram[histogramBins];
+};
+
+// histogramBins counters per scenario, zeroed before every reduction
+layout(binding = 9) buffer ReduceHistograms {
+    uint reduceHistograms[];
+};
+
+// pc.reduceGroupCount partials per scenario
+layout(binding = 10) buffer ReducePartials {
+    ReducePartial partials[];
+};
+
+// One per scenario, read by the host
+layout(binding = 11) writeonly buffer GridStatsBuffer {
+    GridStats stats[];
+};
+
+// Both kernels run 256 invocations per workgroup
+const uint reduceGroupSize = 256;
+
+// One entry per subgroup, and no subgroup is smaller than one invocation
+shared ReducePartial subgroupPartials[reduceGroupSize];
+
+ReducePartial identityPartial() {
+    float infinity = uintBitsToFloat(0x7F800000u);
+    return ReducePartial(0.0, infinity, -infinity, 0, uvec2(0xFFFFFFFFu), uvec2(0));
+}
+
+ReducePartial combine(ReducePartial a, ReducePartial b) {
+    return ReducePartial(a.sum + b.sum, min(a.minValue, b.minValue), max(a.maxValue, b.maxValue),
+                         a.countAbove + b.countAbove, min(a.boxMin, b.boxMin), max(a.boxMax, b.boxMax));
+}
+
+// Identity values take care of any inactive invocations
+ReducePartial subgroupCombine(ReducePartial p) {
+    return ReducePartial(subgroupAdd(p.sum), subgroupMin(p.minValue), subgroupMax(p.maxValue),
+                         subgroupAdd(p.countAbove), subgroupMin(p.boxMin), subgroupMax(p.boxMax));
+}
+
+// Combine `p` over the whole workgroup: a subgroup operation each, then one
+// invocation adds up the subgroups in order. Only invocation 0's result is
+// the total. Has to be called from uniform control flow.
+ReducePartial workgroupCombine(ReducePartial p) {
+    p = subgroupCombine(p);
+    if (subgroupElect()) {
+        subgroupPartials[gl_SubgroupID] = p;
+    }
+    barrier();
+
+    ReducePartial total = p;
+    if (gl_LocalInvocationIndex == 0) {
+        total = identityPartial();
+        for (uint i = 0; i < gl_NumSubgroups; i++) {
+            total = combine(total, subgroupPartials[i]);
+        }
+    }
+    barrier();
+    return total;
+}
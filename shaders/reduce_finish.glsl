@@ -0,0 +1,35 @@
+#version 450
+#extension GL_GOOGLE_include_directive : enable
+
+#include "common.glsl"
+#include "reduce_common.glsl"
+
+// Second half of a reduction: one workgroup per scenario (gl_WorkGroupID.y)
+// combines the partials reduce.glsl left, always in the same order, and
+// writes the scenario's GridStats along with its histogram.
+
+layout(local_size_x = 256) in;
+
+void main() {
+    uint local = gl_LocalInvocationIndex;
+    uint scenario = gl_WorkGroupID.y;
+    uint first = scenario * pc.reduceGroupCount;
+
+    ReducePartial partial = identityPartial();
+    for (uint i = local; i < pc.reduceGroupCount; i += reduceGroupSize) {
+        partial = combine(partial, partials[first + i]);
+    }
+    partial = workgroupCombine(partial);
+
+    for (uint i = local; i < histogramBins; i += reduceGroupSize) {
+        stats[scenario].histogram[i] = reduceHistograms[scenario * histogramBins + i];
+    }
+    if (local == 0) {
+        stats[scenario].sum = partial.sum;
+        stats[scenario].minValue = partial.minValue;
+        stats[scenario].maxValue = partial.maxValue;
+        stats[scenario].countAbove = partial.countAbove;
+        stats[scenario].boxMin = partial.boxMin;
+        stats[scenario].boxMax = partial.boxMax;
+    }
+}
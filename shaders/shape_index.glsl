@@ -0,0 +1,256 @@
+#version 450
+#extension GL_GOOGLE_include_directive : enable
+
+#include "common.glsl"
+#include "shape_index_common.glsl"
+
+// Builds the shape index (see shape_index_utils.hpp) over every scenario's
+// circles and rectangles. One shader for every pass, picked by pc.indexPass:
+//   0: sort keys for every shape, gl_WorkGroupID.z the scenario (grid-stride)
+//   1 to 3: one pass of the radix sort, over the digit at pc.indexShift
+//   4: leaf bounds, one invocation per leaf, gl_WorkGroupID.z the scenario
+//   5: cluster bounds, the same per cluster
+// A key is the Morton code of the cell the shape's centre is in, with
+// (scenario, kind) above it. Sorting every key at once then sorts each
+// scenario's circles and rectangles on their own, and since the entries go
+// in grouped the same way each group stays where it started.
+//
+// The sort goes least significant digit first, pc.indexShift stepping 4
+// bits a pass, pass k reading copy k & 1 of the entries and writing the
+// other. Each pass is three dispatches over blocks of 256 entries:
+//   1: how many entries of each digit every block has
+//   2: one workgroup scans those into where each block's entries of each
+//      digit start (they're stored digit major, so it's a single scan)
+//   3: every block sorts itself by digit in shared memory, stably with four
+//      one bit splits, and writes each entry to its place
+
+layout(local_size_x = 256) in;
+
+const uint blockSize = 256; // Must match local_size_x
+const uint digitBits = 4;   // Matches shapeIndexDigitBits
+const uint digitCount = 1 << digitBits;
+const uint mortonBits = 10; // Matches shapeIndexMortonBits
+const float margin = 1.0 / 16.0; // Matches shapeIndexMargin
+// The shape of the padding past the last entry in a block
+const uint noShape = 0xFFFFFFFFu;
+
+// Entries of each digit in each block, digit major, then where they go
+layout(binding = 20) buffer SortBlockCounts {
+    uint blockCounts[];
+};
+
+shared uint scan[blockSize];
+shared uint digitTotals[digitCount];
+shared uint digitStarts[digitCount];
+shared uvec2 splitEntries[blockSize];
+
+// Inclusive prefix sum of `value` over the workgroup, the total ends up in
+// scan[blockSize - 1]. Starts with a barrier, so whatever the last call
+// left can be read right up to the next.
+uint inclusiveScan(uint value) {
+    uint local = gl_LocalInvocationIndex;
+    barrier();
+    scan[local] = value;
+    barrier();
+    for (uint stride = 1; stride < blockSize; stride <<= 1) {
+        uint addend = local >= stride ? scan[local - stride] : 0;
+        barrier();
+        scan[local] += addend;
+        barrier();
+    }
+    return scan[local];
+}
+
+// Same as the host side in shape_index_utils.hpp
+uint mortonSpread(uint v) {
+    v &= 0xFFFFu;
+    v = (v | (v << 8)) & 0x00FF00FFu;
+    v = (v | (v << 4)) & 0x0F0F0F0Fu;
+    v = (v | (v << 2)) & 0x33333333u;
+    v = (v | (v << 1)) & 0x55555555u;
+    return v;
+}
+
+uint mortonCode(vec2 centre) {
+    uint size = max(pc.gridWidth, pc.gridHeight);
+    uint bits = size > 1 ? uint(findMSB(size - 1)) + 1 : 0;
+    uint shift = bits > mortonBits ? bits - mortonBits : 0;
+    uvec2 cell = uvec2(clamp(floor(centre), vec2(0.0), vec2(pc.gridWidth - 1, pc.gridHeight - 1))) >> shift;
+    return mortonSpread(cell.x) | (mortonSpread(cell.y) << 1);
+}
+
+void writeKeys(uint s) {
+    Scenario scenario = scenarios[s];
+    uint start = scenario.circleOffset + scenario.rectOffset;
+    uint total = scenario.circleCount + scenario.rectCount;
+    uint stride = gl_NumWorkGroups.x * gl_WorkGroupSize.x;
+    for (uint i = gl_GlobalInvocationID.x; i < total; i += stride) {
+        uint kind = i < scenario.circleCount ? 0 : 1;
+        uint shape;
+        vec2 centre;
+        if (kind == 0) {
+            shape = scenario.circleOffset + i;
+            centre = vec2(circles[shape].cx, circles[shape].cy);
+        } else {
+            shape = scenario.rectOffset + i - scenario.circleCount;
+            centre = rectangles[shape].xy;
+        }
+        uint segment = 2 * s + kind;
+        indexEntries[start + i] = uvec2((segment << (2 * mortonBits)) | mortonCode(centre), shape);
+    }
+}
+
+uint sortCopy(uint pass) {
+    return (pass & 1) * pc.indexEntryCount;
+}
+
+uint digitOf(uvec2 entry) {
+    return (entry.x >> pc.indexShift) & (digitCount - 1);
+}
+
+void countDigits() {
+    uint block = gl_WorkGroupID.x;
+    uint local = gl_LocalInvocationIndex;
+    if (local < digitCount) {
+        digitTotals[local] = 0;
+    }
+    barrier();
+
+    uint i = block * blockSize + local;
+    if (i < pc.indexEntryCount) {
+        atomicAdd(digitTotals[digitOf(indexEntries[sortCopy(pc.indexShift / digitBits) + i])], 1);
+    }
+    barrier();
+
+    if (local < digitCount) {
+        blockCounts[local * gl_NumWorkGroups.x + block] = digitTotals[local];
+    }
+}
+
+void scanCounts() {
+    uint local = gl_LocalInvocationIndex;
+    uint total = (pc.indexEntryCount + blockSize - 1) / blockSize * digitCount;
+    uint running = 0;
+    for (uint chunk = 0; chunk < total; chunk += blockSize) {
+        uint i = chunk + local;
+        uint count = i < total ? blockCounts[i] : 0;
+        uint inclusive = inclusiveScan(count);
+        if (i < total) {
+            blockCounts[i] = running + inclusive - count;
+        }
+        running += scan[blockSize - 1];
+    }
+}
+
+void scatter() {
+    uint block = gl_WorkGroupID.x;
+    uint local = gl_LocalInvocationIndex;
+    uint pass = pc.indexShift / digitBits;
+
+    // The padding sorts after every real entry, they all come before it
+    uint i = block * blockSize + local;
+    uvec2 entry = i < pc.indexEntryCount ? indexEntries[sortCopy(pass) + i] : uvec2(0xFFFFFFFFu, noShape);
+    if (local < digitCount) {
+        digitTotals[local] = 0;
+    }
+    barrier();
+    if (entry.y != noShape) {
+        atomicAdd(digitTotals[digitOf(entry)], 1);
+    }
+
+    // Zeros first, keeping their order, one bit of the digit at a time
+    for (uint bit = 0; bit < digitBits; bit++) {
+        uint zero = 1 - ((digitOf(entry) >> bit) & 1);
+        uint zerosBefore = inclusiveScan(zero) - zero;
+        uint zeros = scan[blockSize - 1];
+        splitEntries[zero != 0 ? zerosBefore : zeros + local - zerosBefore] = entry;
+        barrier();
+        entry = splitEntries[local];
+    }
+
+    if (local == 0) {
+        uint start = 0;
+        for (uint d = 0; d < digitCount; d++) {
+            digitStarts[d] = start;
+            start += digitTotals[d];
+        }
+    }
+    barrier();
+
+    if (entry.y != noShape) {
+        uint digit = digitOf(entry);
+        uint destination = blockCounts[digit * gl_NumWorkGroups.x + block] + local - digitStarts[digit];
+        indexEntries[sortCopy(pass + 1) + destination] = entry;
+    }
+}
+
+void buildLeaves(uint s) {
+    Scenario scenario = scenarios[s];
+    uint circleLeaves = indexLeafCount(scenario.circleCount);
+    uint leaves = circleLeaves + indexLeafCount(scenario.rectCount);
+    uint stride = gl_NumWorkGroups.x * gl_WorkGroupSize.x;
+    for (uint l = gl_GlobalInvocationID.x; l < leaves; l += stride) {
+        uint kind = l < circleLeaves ? 0 : 1;
+        IndexSegment segment = indexSegment(scenario, kind);
+        uint leaf = kind == 0 ? l : l - circleLeaves;
+
+        vec4 bounds = vec4(3.0e38, 3.0e38, -3.0e38, -3.0e38);
+        uint end = min(segment.count, (leaf + 1) * indexLeafSize);
+        for (uint i = leaf * indexLeafSize; i < end; i++) {
+            uint shape = indexEntries[segment.start + i].y;
+            vec4 box;
+            if (kind == 0) {
+                Circle c = circles[shape];
+                box = vec4(c.cx - c.r, c.cy - c.r, c.cx + c.r, c.cy + c.r);
+            } else {
+                vec4 rect = rectangles[shape];
+                box = vec4(rect.xy - rect.zw * 0.5, rect.xy + rect.zw * 0.5);
+            }
+            bounds = vec4(min(bounds.xy, box.xy), max(bounds.zw, box.zw));
+        }
+        leafBounds[segment.leafOffset + leaf] = bounds + vec4(-margin, -margin, margin, margin);
+    }
+}
+
+void buildClusters(uint s) {
+    Scenario scenario = scenarios[s];
+    uint circleClusters = indexClusterCount(scenario.circleCount);
+    uint clusters = circleClusters + indexClusterCount(scenario.rectCount);
+    uint stride = gl_NumWorkGroups.x * gl_WorkGroupSize.x;
+    for (uint c = gl_GlobalInvocationID.x; c < clusters; c += stride) {
+        uint kind = c < circleClusters ? 0 : 1;
+        IndexSegment segment = indexSegment(scenario, kind);
+        uint cluster = kind == 0 ? c : c - circleClusters;
+
+        vec4 bounds = vec4(3.0e38, 3.0e38, -3.0e38, -3.0e38);
+        uint end = min(indexLeafCount(segment.count), (cluster + 1) * indexClusterSize);
+        for (uint l = cluster * indexClusterSize; l < end; l++) {
+            vec4 leaf = leafBounds[segment.leafOffset + l];
+            bounds = vec4(min(bounds.xy, leaf.xy), max(bounds.zw, leaf.zw));
+        }
+        clusterBounds[segment.clusterOffset + cluster] = bounds;
+    }
+}
+
+void main() {
+    switch (pc.indexPass) {
+        case 0:
+            writeKeys(gl_WorkGroupID.z);
+            break;
+        case 1:
+            countDigits();
+            break;
+        case 2:
+            scanCounts();
+            break;
+        case 3:
+            scatter();
+            break;
+        case 4:
+            buildLeaves(gl_WorkGroupID.z);
+            break;
+        default:
+            buildClusters(gl_WorkGroupID.z);
+            break;
+    }
+}
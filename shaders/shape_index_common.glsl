@@ -0,0 +1,57 @@
+// The shape index shape_index.glsl builds and binning.glsl walks, included
+// after common.glsl. Laid out like vu::ShapeIndex in shape_index_utils.hpp,
+// except that every scenario's circles and then rectangles share the same
+// buffers: a scenario's entries start at circleOffset + rectOffset (shapes
+// are packed one scenario after another, see packScenarios() in main.cpp)
+// and its leaves and clusters at the offsets in its Scenario.
+
+const uint indexLeafSize = 32;    // Shapes per leaf, matches shapeIndexLeafSize
+const uint indexClusterSize = 32; // Leaves per cluster, matches shapeIndexClusterSize
+
+// (sort key, shape index) for every shape, twice over for the radix sort to
+// go back and forth between. The first copy is the sorted one.
+layout(binding = 19) buffer ShapeIndexEntries {
+    uvec2 indexEntries[];
+};
+
+// Bounding boxes as (minX, minY, maxX, maxY)
+layout(binding = 21) buffer ShapeIndexLeaves {
+    vec4 leafBounds[];
+};
+
+layout(binding = 22) buffer ShapeIndexClusters {
+    vec4 clusterBounds[];
+};
+
+// One kind of shape of one scenario in the index
+struct IndexSegment {
+    uint start;         // First entry
+    uint count;
+    uint leafOffset;    // First leaf
+    uint clusterOffset; // First cluster
+};
+
+uint indexLeafCount(uint count) {
+    return (count + indexLeafSize - 1) / indexLeafSize;
+}
+
+uint indexClusterCount(uint count) {
+    return (indexLeafCount(count) + indexClusterSize - 1) / indexClusterSize;
+}
+
+// `kind` 0 for circles, 1 for rectangles
+IndexSegment indexSegment(Scenario scenario, uint kind) {
+    IndexSegment segment = IndexSegment(scenario.circleOffset + scenario.rectOffset, scenario.circleCount,
+                                        scenario.indexLeafOffset, scenario.indexClusterOffset);
+    if (kind != 0) {
+        segment.start += scenario.circleCount;
+        segment.count = scenario.rectCount;
+        segment.leafOffset += indexLeafCount(scenario.circleCount);
+        segment.clusterOffset += indexClusterCount(scenario.circleCount);
+    }
+    return segment;
+}
+
+bool boundsOverlap(vec4 bounds, vec2 boxMin, vec2 boxMax) {
+    return all(lessThanEqual(bounds.xy, boxMax)) && all(greaterThanEqual(bounds.zw, boxMin));
+}
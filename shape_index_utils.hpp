@@ -0,0 +1,187 @@
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <stdexcept>
+#include <vector>
+
+#ifndef KLINGON__SHAPE_INDEX_UTILS_HPP
+#define KLINGON__SHAPE_INDEX_UTILS_HPP
+
+namespace vu {
+    // Spatial index over a scenario's circles and rectangles, so binning a
+    // tile doesn't have to look at every shape of the scene. Built on the
+    // GPU by shaders/shape_index.glsl, this is the host side of it that the
+    // CPU backend uses and the shaders have to agree with.
+    //
+    // Each kind of shape is sorted by the Morton code of the cell its centre
+    // is in (ties keeping their order), then cut into leaves of
+    // shapeIndexLeafSize shapes and the leaves into clusters of
+    // shapeIndexClusterSize leaves, each with the bounding box of what's in
+    // it. Shapes next to each other in Morton order are close together, so
+    // the boxes stay tight and a query only opens the few clusters and
+    // leaves around it: a shallow BVH whose shape is implied by the counts.
+
+    constexpr uint32_t shapeIndexLeafSize = 32;    // Shapes per leaf, matches shape_index.glsl
+    constexpr uint32_t shapeIndexClusterSize = 32; // Leaves per cluster, matches shape_index.glsl
+    // Morton codes of cell coordinates cut down to this many bits each,
+    // which leaves the high bits of a 32 bit sort key to keep scenarios
+    // and kinds apart on the GPU
+    constexpr uint32_t shapeIndexMortonBits = 10;
+    constexpr uint32_t shapeIndexDigitBits = 4; // Per radix sort pass
+    // Added around every node's box, so rounding in the box tests never
+    // drops a shape the exact per-shape tests would keep
+    constexpr float shapeIndexMargin = 1.0f / 16.0f;
+
+    struct ShapeBounds {
+        float minX;
+        float minY;
+        float maxX;
+        float maxY;
+    };
+
+    // One kind of shape (circles or rectangles) of one scenario
+    struct ShapeIndexTree {
+        std::vector<uint32_t> order; // Shape indices, in Morton order
+        std::vector<ShapeBounds> leaves;
+        std::vector<ShapeBounds> clusters;
+    };
+
+    struct ShapeIndex {
+        ShapeIndexTree circles;
+        ShapeIndexTree rects;
+    };
+
+    // How far cell coordinates are shifted down to fit shapeIndexMortonBits
+    uint32_t shapeIndexMortonShift(uint32_t gridWidth, uint32_t gridHeight) {
+        uint32_t bits = 0;
+        while ((1u << bits) < std::max(gridWidth, gridHeight)) {
+            bits++;
+        }
+        return bits > shapeIndexMortonBits ? bits - shapeIndexMortonBits : 0;
+    }
+
+    // Spread the low 16 bits of `v` out to the even bits
+    uint32_t mortonSpread(uint32_t v) {
+        v &= 0xFFFFu;
+        v = (v | (v << 8)) & 0x00FF00FFu;
+        v = (v | (v << 4)) & 0x0F0F0F0Fu;
+        v = (v | (v << 2)) & 0x33333333u;
+        v = (v | (v << 1)) & 0x55555555u;
+        return v;
+    }
+
+    // Morton code of the cell (clamped to the grid) a shape centred on
+    // (x, y) is in
+    uint32_t shapeMortonCode(float x, float y, uint32_t gridWidth, uint32_t gridHeight) {
+        uint32_t shift = shapeIndexMortonShift(gridWidth, gridHeight);
+        uint32_t cellX = static_cast<uint32_t>(std::min(std::max(std::floor(x), 0.0f), float(gridWidth - 1)));
+        uint32_t cellY = static_cast<uint32_t>(std::min(std::max(std::floor(y), 0.0f), float(gridHeight - 1)));
+        return mortonSpread(cellX >> shift) | (mortonSpread(cellY >> shift) << 1);
+    }
+
+    // Radix sort passes the GPU needs for `scenarioCount` scenarios: the
+    // Morton code plus (scenario, kind) above it, rounded up to an even
+    // number of passes so the sorted copy ends up where it started
+    uint32_t shapeIndexSortPasses(uint32_t scenarioCount) {
+        uint32_t segmentBits = 0;
+        while ((1u << segmentBits) < 2 * scenarioCount) {
+            segmentBits++;
+        }
+        uint32_t keyBits = 2 * shapeIndexMortonBits + segmentBits;
+        if (keyBits > 32) {
+            throw std::runtime_error("too many scenarios for the shape index!");
+        }
+        uint32_t passes = (keyBits + shapeIndexDigitBits - 1) / shapeIndexDigitBits;
+        return (passes + 1) & ~1u;
+    }
+
+    uint32_t shapeIndexLeafCount(uint32_t shapeCount) {
+        return (shapeCount + shapeIndexLeafSize - 1) / shapeIndexLeafSize;
+    }
+
+    uint32_t shapeIndexClusterCount(uint32_t shapeCount) {
+        return (shapeIndexLeafCount(shapeCount) + shapeIndexClusterSize - 1) / shapeIndexClusterSize;
+    }
+
+    ShapeBounds emptyShapeBounds() {
+        return {3.0e38f, 3.0e38f, -3.0e38f, -3.0e38f};
+    }
+
+    void growShapeBounds(ShapeBounds& bounds, const ShapeBounds& other) {
+        bounds.minX = std::min(bounds.minX, other.minX);
+        bounds.minY = std::min(bounds.minY, other.minY);
+        bounds.maxX = std::max(bounds.maxX, other.maxX);
+        bounds.maxY = std::max(bounds.maxY, other.maxY);
+    }
+
+    bool shapeBoundsOverlap(const ShapeBounds& bounds, float minX, float minY, float maxX, float maxY) {
+        return bounds.minX <= maxX && bounds.maxX >= minX && bounds.minY <= maxY && bounds.maxY >= minY;
+    }
+
+    // `count` shapes of `stride` floats, centred on their first two.
+    // `extent` gives a shape's bounds.
+    template <typename Extent>
+    void buildShapeIndexTree(const float* shapes, uint32_t count, uint32_t stride, uint32_t gridWidth,
+                             uint32_t gridHeight, Extent extent, ShapeIndexTree& tree) {
+        std::vector<uint32_t> codes(count);
+        tree.order.resize(count);
+        for (uint32_t i = 0; i < count; i++) {
+            codes[i] = shapeMortonCode(shapes[stride * i], shapes[stride * i + 1], gridWidth, gridHeight);
+            tree.order[i] = i;
+        }
+        std::stable_sort(tree.order.begin(), tree.order.end(),
+            [&](uint32_t a, uint32_t b) { return codes[a] < codes[b]; });
+
+        tree.leaves.assign(shapeIndexLeafCount(count), emptyShapeBounds());
+        for (uint32_t i = 0; i < count; i++) {
+            growShapeBounds(tree.leaves[i / shapeIndexLeafSize], extent(shapes + stride * size_t(tree.order[i])));
+        }
+        for (ShapeBounds& leaf : tree.leaves) {
+            leaf.minX -= shapeIndexMargin;
+            leaf.minY -= shapeIndexMargin;
+            leaf.maxX += shapeIndexMargin;
+            leaf.maxY += shapeIndexMargin;
+        }
+
+        tree.clusters.assign(shapeIndexClusterCount(count), emptyShapeBounds());
+        for (size_t i = 0; i < tree.leaves.size(); i++) {
+            growShapeBounds(tree.clusters[i / shapeIndexClusterSize], tree.leaves[i]);
+        }
+    }
+
+    // Circles are (cx, cy, r), rectangles (cx, cy, w, h), like the shape
+    // buffers
+    void buildShapeIndex(const float* circles, uint32_t circleCount, const float* rects, uint32_t rectCount,
+                         uint32_t gridWidth, uint32_t gridHeight, ShapeIndex& index) {
+        buildShapeIndexTree(circles, circleCount, 3, gridWidth, gridHeight, [](const float* c) {
+            return ShapeBounds{c[0] - c[2], c[1] - c[2], c[0] + c[2], c[1] + c[2]};
+        }, index.circles);
+        buildShapeIndexTree(rects, rectCount, 4, gridWidth, gridHeight, [](const float* r) {
+            return ShapeBounds{r[0] - r[2] * 0.5f, r[1] - r[3] * 0.5f, r[0] + r[2] * 0.5f, r[1] + r[3] * 0.5f};
+        }, index.rects);
+    }
+
+    // Call `visit` with every shape (in Morton order) under a leaf that
+    // overlaps [minX, maxX] x [minY, maxY], the way binning.glsl walks the
+    // index. What's visited is a superset of the shapes overlapping the box.
+    template <typename Visit>
+    void visitShapeIndex(const ShapeIndexTree& tree, float minX, float minY, float maxX, float maxY, Visit visit) {
+        for (size_t c = 0; c < tree.clusters.size(); c++) {
+            if (!shapeBoundsOverlap(tree.clusters[c], minX, minY, maxX, maxY)) {
+                continue;
+            }
+            size_t leafEnd = std::min(tree.leaves.size(), (c + 1) * shapeIndexClusterSize);
+            for (size_t l = c * shapeIndexClusterSize; l < leafEnd; l++) {
+                if (!shapeBoundsOverlap(tree.leaves[l], minX, minY, maxX, maxY)) {
+                    continue;
+                }
+                size_t end = std::min(tree.order.size(), (l + 1) * shapeIndexLeafSize);
+                for (size_t i = l * shapeIndexLeafSize; i < end; i++) {
+                    visit(tree.order[i]);
+                }
+            }
+        }
+    }
+} // namespace vu
+
+#endif // KLINGON__SHAPE_INDEX_UTILS_HPP
@@ -0,0 +1,282 @@
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#ifndef KLINGON__SHM_RING_UTILS_HPP
+#define KLINGON__SHM_RING_UTILS_HPP
+
+namespace vu {
+    // Lock-free single producer, single consumer ring of variable sized
+    // records in POSIX shared memory, for feeding updates in from another
+    // local process without a socket or any serialization in between.
+    //
+    // The mapping is a ShmRingHeader in the first shmRingHeaderSize bytes,
+    // then the records. Positions count bytes ever written (`head`, only
+    // stored by the producer) and ever released (`tail`, only stored by the
+    // consumer), so they never wrap and full and empty can't be confused.
+    // A record is a ShmRecordHeader and its payload, padded to
+    // shmRingRecordAlignment, and never wraps: when it doesn't fit before
+    // the end, the producer pads the end with a skip record and starts over
+    // at the beginning. The consumer can read records in place for as long
+    // as it likes (the GPU can even copy straight out of them) and only
+    // hands the space back with release().
+
+    // Big enough that the records start (and, with the capacity rounded to
+    // it, end) on an import boundary for VK_EXT_external_memory_host
+    constexpr size_t shmRingHeaderSize = 64 * 1024;
+    constexpr size_t shmRingRecordAlignment = 16;
+    constexpr uint32_t shmRingMagic = 0x4B524E47; // "KRNG"
+    constexpr uint32_t shmRingVersion = 1;
+    constexpr uint32_t shmRecordSkip = 0; // Padding up to the end of the ring
+
+    // Shared between processes, so it has to work without a lock
+    static_assert(std::atomic<uint32_t>::is_always_lock_free, "shared memory ring needs lock-free 32 bit atomics");
+    static_assert(std::atomic<uint64_t>::is_always_lock_free, "shared memory ring needs lock-free 64 bit atomics");
+
+    struct ShmRingHeader {
+        // Published last, version and capacity are only valid once it's set
+        std::atomic<uint32_t> magic;
+        uint32_t version;
+        uint64_t capacity; // Of the records, in bytes
+        // On their own cache lines, each side only ever writes its own
+        alignas(64) std::atomic<uint64_t> head;
+        alignas(64) std::atomic<uint64_t> tail;
+    };
+
+    struct ShmRecordHeader {
+        uint32_t type; // Up to the two sides, except shmRecordSkip
+        uint32_t size; // Of the payload, without padding
+        uint64_t sequence; // Counts records written, skips excluded
+    };
+
+    // A record as the consumer sees it, still in the ring
+    struct ShmRecord {
+        uint32_t type;
+        uint32_t size;
+        uint64_t sequence;
+        const void* payload;
+        size_t offset; // Of the payload in the mapping
+    };
+
+    class ShmRing {
+        public:
+            // Producer side: create the shared memory object `ringName` (e.g.
+            // "/klingon-shapes") with room for `capacity` bytes of records,
+            // rounded up to shmRingHeaderSize. Replaces any ring left over
+            // under that name, and unlinks it again when destroyed.
+            ShmRing(const std::string& ringName, size_t capacity) : name(ringName), owner(true) {
+                capacity = (capacity + shmRingHeaderSize - 1) / shmRingHeaderSize * shmRingHeaderSize;
+                if (capacity == 0) {
+                    throw std::runtime_error("shared memory ring needs some capacity!");
+                }
+
+                shm_unlink(name.c_str());
+                int fd = shm_open(name.c_str(), O_CREAT | O_EXCL | O_RDWR, 0600);
+                if (fd < 0) {
+                    throw std::runtime_error("failed to create shared memory ring " + name + "!");
+                }
+                mappedSize = shmRingHeaderSize + capacity;
+                if (ftruncate(fd, static_cast<off_t>(mappedSize)) != 0) {
+                    close(fd);
+                    shm_unlink(name.c_str());
+                    throw std::runtime_error("failed to size shared memory ring " + name + "!");
+                }
+                map(fd);
+
+                // Fresh from ftruncate, i.e. zeroed. The magic goes in last
+                // with a release store, a consumer opening the ring early
+                // just fails.
+                header->capacity = capacity;
+                header->version = shmRingVersion;
+                header->head.store(0, std::memory_order_relaxed);
+                header->tail.store(0, std::memory_order_relaxed);
+                header->magic.store(shmRingMagic, std::memory_order_release);
+            }
+
+            // Consumer side: open the ring a producer created under `ringName`
+            explicit ShmRing(const std::string& ringName) : name(ringName), owner(false) {
+                int fd = shm_open(name.c_str(), O_RDWR, 0);
+                if (fd < 0) {
+                    throw std::runtime_error("failed to open shared memory ring " + name + "!");
+                }
+                struct stat info;
+                if (fstat(fd, &info) != 0 || size_t(info.st_size) <= shmRingHeaderSize) {
+                    close(fd);
+                    throw std::runtime_error("shared memory ring " + name + " isn't set up!");
+                }
+                mappedSize = size_t(info.st_size);
+                map(fd);
+
+                // Acquire pairs with the producer's release, only after it are
+                // version and capacity safe to look at
+                if (header->magic.load(std::memory_order_acquire) != shmRingMagic || header->version != shmRingVersion ||
+                        shmRingHeaderSize + header->capacity != mappedSize) {
+                    munmap(mapping, mappedSize);
+                    throw std::runtime_error("shared memory ring " + name + " isn't a compatible ring!");
+                }
+                // Picks up where the last consumer left off
+                readPosition = header->tail.load(std::memory_order_acquire);
+            }
+
+            ~ShmRing() {
+                munmap(mapping, mappedSize);
+                if (owner) {
+                    shm_unlink(name.c_str());
+                }
+            }
+
+            ShmRing(const ShmRing&) = delete;
+            ShmRing& operator=(const ShmRing&) = delete;
+
+            // Producer: reserve room for a `size` byte payload of `type` and
+            // return where to write it, or nullptr if the consumer hasn't
+            // released enough yet. Nothing is visible until commit().
+            void* reserve(uint32_t type, uint32_t size) {
+                if (type == shmRecordSkip) {
+                    throw std::runtime_error("shared memory ring record type 0 is reserved!");
+                }
+                uint64_t capacity = header->capacity;
+                uint64_t bytes = recordBytes(size);
+                if (bytes > capacity) {
+                    throw std::runtime_error("record is too large for the shared memory ring!");
+                }
+
+                uint64_t position = header->head.load(std::memory_order_relaxed);
+                uint64_t offset = position % capacity;
+                uint64_t skip = offset + bytes > capacity ? capacity - offset : 0;
+                uint64_t used = position - header->tail.load(std::memory_order_acquire);
+                if (used + skip + bytes > capacity) {
+                    // Publish the skip on its own if there's room for it,
+                    // otherwise a record too big for the space left after
+                    // it could never go in, however much got released
+                    if (skip > 0 && used + skip <= capacity) {
+                        ShmRecordHeader padding{shmRecordSkip, static_cast<uint32_t>(skip - sizeof(ShmRecordHeader)), 0};
+                        memcpy(records() + offset, &padding, sizeof(padding));
+                        header->head.store(position + skip, std::memory_order_release);
+                    }
+                    return nullptr;
+                }
+
+                if (skip > 0) {
+                    ShmRecordHeader padding{shmRecordSkip, static_cast<uint32_t>(skip - sizeof(ShmRecordHeader)), 0};
+                    memcpy(records() + offset, &padding, sizeof(padding));
+                    position += skip;
+                }
+                ShmRecordHeader record{type, size, writeSequence};
+                memcpy(records() + position % capacity, &record, sizeof(record));
+                reserved = position + bytes;
+                return records() + position % capacity + sizeof(ShmRecordHeader);
+            }
+
+            // Producer: publish the record from the last reserve()
+            void commit() {
+                writeSequence++;
+                header->head.store(reserved, std::memory_order_release);
+            }
+
+            // Producer: reserve(), copy `data` in and commit() in one go.
+            // Returns false if the ring is full.
+            bool write(uint32_t type, const void* data, uint32_t size) {
+                void* payload = reserve(type, size);
+                if (payload == nullptr) {
+                    return false;
+                }
+                memcpy(payload, data, size);
+                commit();
+                return true;
+            }
+
+            // Consumer: the next record after the ones already read, if the
+            // producer has committed one. It stays valid (and in place) until
+            // released.
+            bool read(ShmRecord& record) {
+                uint64_t capacity = header->capacity;
+                uint64_t head = header->head.load(std::memory_order_acquire);
+                while (readPosition < head) {
+                    uint64_t offset = readPosition % capacity;
+                    if (head - readPosition < sizeof(ShmRecordHeader) || capacity - offset < sizeof(ShmRecordHeader)) {
+                        throw std::runtime_error("shared memory ring is corrupt!");
+                    }
+                    ShmRecordHeader entry;
+                    memcpy(&entry, records() + offset, sizeof(entry));
+                    uint64_t bytes = recordBytes(entry.size);
+                    if (bytes > head - readPosition || bytes > capacity - offset) {
+                        throw std::runtime_error("shared memory ring is corrupt!");
+                    }
+                    readPosition += bytes;
+                    if (entry.type == shmRecordSkip) {
+                        continue;
+                    }
+
+                    record.type = entry.type;
+                    record.size = entry.size;
+                    record.sequence = entry.sequence;
+                    record.offset = shmRingHeaderSize + offset + sizeof(ShmRecordHeader);
+                    record.payload = static_cast<const char*>(mapping) + record.offset;
+                    return true;
+                }
+                return false;
+            }
+
+            // Consumer: where read() has got to, to release() up to later
+            uint64_t position() const {
+                return readPosition;
+            }
+
+            // Consumer: hand everything before `position` back to the
+            // producer. Records before it mustn't be touched after this.
+            void release(uint64_t position) {
+                header->tail.store(position, std::memory_order_release);
+            }
+
+            // The whole mapping, header included, page aligned
+            const void* data() const {
+                return mapping;
+            }
+
+            size_t size() const {
+                return mappedSize;
+            }
+
+        private:
+            std::string name;
+            bool owner;
+            void* mapping = nullptr;
+            size_t mappedSize = 0;
+            ShmRingHeader* header = nullptr;
+            uint64_t readPosition = 0; // Consumer
+            uint64_t reserved = 0;     // Producer, head after the reserved record
+            uint64_t writeSequence = 0;
+
+            void map(int fd) {
+                mapping = mmap(nullptr, mappedSize, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+                close(fd);
+                if (mapping == MAP_FAILED) {
+                    if (owner) {
+                        shm_unlink(name.c_str());
+                    }
+                    throw std::runtime_error("failed to map shared memory ring " + name + "!");
+                }
+                header = static_cast<ShmRingHeader*>(mapping);
+            }
+
+            char* records() const {
+                return static_cast<char*>(mapping) + shmRingHeaderSize;
+            }
+
+            static uint64_t recordBytes(uint32_t size) {
+                return (sizeof(ShmRecordHeader) + uint64_t(size) + shmRingRecordAlignment - 1) /
+                       shmRingRecordAlignment * shmRingRecordAlignment;
+            }
+    };
+} // namespace vu
+
+#endif // KLINGON__SHM_RING_UTILS_HPP
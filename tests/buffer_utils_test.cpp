@@ -0,0 +1,102 @@
+#include "buffer_utils.hpp"
+#include "test_utils.hpp"
+
+#include <deque>
+#include <vector>
+
+// vu::RingAllocator, the staging ring's bookkeeping: ranges come out aligned,
+// in bounds and never overlapping anything still in flight, wrapping round
+// as serials retire
+
+struct Range {
+    uint64_t serial;
+    VkDeviceSize offset;
+    VkDeviceSize size;
+};
+
+bool overlaps(const Range& a, VkDeviceSize offset, VkDeviceSize size) {
+    return offset < a.offset + a.size && a.offset < offset + size;
+}
+
+int main() {
+    CHECK(vu::alignUp(0, 16) == 0);
+    CHECK(vu::alignUp(1, 16) == 16);
+    CHECK(vu::alignUp(32, 16) == 32);
+    CHECK(vu::alignUp(33, 4) == 36);
+
+    vu::RingAllocator ring;
+    ring.reset(1024);
+    CHECK(ring.size() == 1024);
+
+    VkDeviceSize offset = 0;
+    CHECK(!ring.allocate(0, 4, offset));
+    CHECK(!ring.allocate(1025, 4, offset));
+
+    // Fill it in one submission, nothing more fits until that retires
+    CHECK(ring.allocate(1000, 4, offset) && offset == 0);
+    CHECK(!ring.allocate(100, 4, offset));
+    ring.submit(1);
+    CHECK(!ring.allocate(100, 4, offset));
+    ring.retire(0);
+    CHECK(!ring.allocate(100, 4, offset));
+    ring.retire(1);
+
+    // Once everything's retired it starts over from the beginning
+    CHECK(ring.allocate(1024, 4, offset) && offset == 0);
+    ring.submit(2);
+    ring.retire(2);
+
+    // A range that doesn't fit at the end wraps to the start, if that's free
+    CHECK(ring.allocate(600, 4, offset) && offset == 0);
+    ring.submit(3);
+    CHECK(ring.allocate(300, 4, offset) && offset == 600);
+    ring.submit(4);
+    ring.retire(3);
+    CHECK(ring.allocate(200, 4, offset) && offset == 0);
+    CHECK(!ring.allocate(500, 4, offset));
+    ring.submit(5);
+
+    // Random sizes and alignments, submitted and retired with some lag
+    ring.reset(4096);
+    std::deque<Range> live;
+    std::vector<Range> pending;
+    uint64_t serial = 10;
+    uint64_t failures = 0;
+    for (int i = 0; i < 20000; i++) {
+        VkDeviceSize size = test::uniform(1u, 700u);
+        VkDeviceSize alignment = VkDeviceSize(1) << test::uniform(0u, 8u);
+        if (ring.allocate(size, alignment, offset)) {
+            CHECK(offset % alignment == 0);
+            CHECK(offset + size <= ring.size());
+            bool clear = true;
+            for (const Range& range : live) {
+                clear = clear && !overlaps(range, offset, size);
+            }
+            for (const Range& range : pending) {
+                clear = clear && !overlaps(range, offset, size);
+            }
+            CHECK(clear);
+            pending.push_back({serial, offset, size});
+        } else {
+            failures++;
+        }
+
+        if (test::uniform(0u, 3u) == 0) {
+            ring.submit(serial);
+            live.insert(live.end(), pending.begin(), pending.end());
+            pending.clear();
+            serial++;
+        }
+        if (test::uniform(0u, 4u) == 0 && serial > 12) {
+            uint64_t completed = serial - test::uniform(1u, 3u);
+            ring.retire(completed);
+            while (!live.empty() && live.front().serial <= completed) {
+                live.pop_front();
+            }
+        }
+    }
+    // It has to have been full some of the time, and not all of it
+    CHECK(failures > 0 && failures < 20000);
+
+    return test::testResult();
+}
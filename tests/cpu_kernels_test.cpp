@@ -0,0 +1,121 @@
+#include "cpu_kernels.hpp"
+#include "test_utils.hpp"
+
+#include <cmath>
+#include <cstring>
+#include <vector>
+
+// The CPU kernels: the AVX2 paths against the scalar ones bit for bit (on
+// CPUs that have AVX2), tiles of every width so the scalar tail of each row
+// gets used too, and binning never changing a cell
+
+struct Scene {
+    std::vector<float> lights;
+    std::vector<float> circles;
+    std::vector<float> rects;
+
+    vu::CpuScene view() const {
+        vu::CpuScene scene{};
+        scene.lights = lights.data();
+        scene.lightCount = static_cast<uint32_t>(lights.size() / 4);
+        scene.circles = circles.data();
+        scene.circleCount = static_cast<uint32_t>(circles.size() / 3);
+        scene.rects = rects.data();
+        scene.rectCount = static_cast<uint32_t>(rects.size() / 4);
+        return scene;
+    }
+};
+
+Scene randomScene(uint32_t width, uint32_t height, uint32_t lights, uint32_t shapes) {
+    Scene scene;
+    for (uint32_t i = 0; i < lights; i++) {
+        scene.lights.insert(scene.lights.end(), {test::uniform(0.0f, float(width)), test::uniform(0.0f, float(height)),
+                                                 test::uniform(0.5f, 4.0f), test::uniform(0.0f, 0.2f)});
+    }
+    for (uint32_t i = 0; i < shapes; i++) {
+        scene.circles.insert(scene.circles.end(), {test::uniform(0.0f, float(width)),
+                                                   test::uniform(0.0f, float(height)), test::uniform(0.2f, 3.0f)});
+        scene.rects.insert(scene.rects.end(), {test::uniform(0.0f, float(width)), test::uniform(0.0f, float(height)),
+                                               test::uniform(0.2f, 5.0f), test::uniform(0.2f, 5.0f)});
+    }
+    return scene;
+}
+
+using TileKernel = void (*)(const vu::CpuScene&, vu::CpuTile, float*, uint32_t, bool, vu::CpuTileBin&);
+
+// The whole grid through `kernel` in tiles of tileWidth x tileHeight
+std::vector<float> runKernel(TileKernel kernel, const vu::CpuScene& scene, uint32_t width, uint32_t height,
+                             uint32_t tileWidth, uint32_t tileHeight, bool avx2) {
+    std::vector<float> grid(size_t(width) * height, -1.0f);
+    vu::CpuTileBin bin;
+    for (uint32_t y = 0; y < height; y += tileHeight) {
+        for (uint32_t x = 0; x < width; x += tileWidth) {
+            vu::CpuTile tile{x, y, std::min(x + tileWidth, width), std::min(y + tileHeight, height)};
+            kernel(scene, tile, grid.data(), width, avx2, bin);
+        }
+    }
+    return grid;
+}
+
+bool sameBits(const std::vector<float>& a, const std::vector<float>& b) {
+    return a.size() == b.size() && memcmp(a.data(), b.data(), a.size() * sizeof(float)) == 0;
+}
+
+int main() {
+    // A lone light with nothing in the way is just its falloff
+    {
+        Scene scene;
+        scene.lights = {5.5f, 5.5f, 2.0f, 0.1f};
+        std::vector<float> grid = runKernel(vu::cpuLightingTile, scene.view(), 11, 11, 11, 11, false);
+        CHECK(grid[5 + 5 * 11] == 2.0f);
+        CHECK(grid[8 + 5 * 11] == vu::cpuLightContribution(scene.lights.data(), 8.5f, 5.5f));
+    }
+
+    // A circle covers the cells it overlaps, and a rectangle casts a shadow
+    {
+        Scene scene;
+        scene.circles = {2.0f, 2.0f, 1.0f};
+        scene.rects = {6.0f, 5.0f, 1.0f, 6.0f};
+        scene.lights = {8.5f, 5.5f, 1.0f, 0.0f};
+        std::vector<float> occupancy = runKernel(vu::cpuOccupancyTile, scene.view(), 10, 10, 10, 10, false);
+        CHECK(occupancy[1 + 1 * 10] == 1.0f);
+        CHECK(occupancy[4 + 4 * 10] == 0.0f);
+        CHECK(occupancy[5 + 5 * 10] == 1.0f);
+        std::vector<float> lighting = runKernel(vu::cpuLightingTile, scene.view(), 10, 10, 10, 10, false);
+        CHECK(lighting[8 + 5 * 10] == 1.0f);
+        CHECK(lighting[3 + 5 * 10] == 0.0f);
+    }
+
+    bool avx2 = vu::cpuHasAvx2();
+    if (!avx2) {
+        std::fprintf(stderr, "no AVX2 here, only checking the scalar paths\n");
+    }
+
+    const uint32_t sizes[][2] = {{1, 1}, {7, 3}, {33, 20}, {64, 16}, {100, 41}};
+    const uint32_t tiles[][2] = {{1, 1}, {5, 3}, {8, 8}, {13, 7}, {64, 16}};
+    for (const auto& size : sizes) {
+        uint32_t width = size[0];
+        uint32_t height = size[1];
+        Scene scene = randomScene(width, height, 6, 10);
+        vu::CpuScene view = scene.view();
+
+        // Binning per tile only ever leaves out shapes that can't matter, so
+        // how the grid is cut up doesn't change occupancy at all
+        std::vector<float> occupancy = runKernel(vu::cpuOccupancyTile, view, width, height, width, height, false);
+        std::vector<float> lighting = runKernel(vu::cpuLightingTile, view, width, height, width, height, false);
+        for (const auto& tile : tiles) {
+            CHECK(sameBits(runKernel(vu::cpuOccupancyTile, view, width, height, tile[0], tile[1], false), occupancy));
+            if (avx2) {
+                std::vector<float> expected = runKernel(vu::cpuLightingTile, view, width, height, tile[0], tile[1], false);
+                CHECK(sameBits(runKernel(vu::cpuOccupancyTile, view, width, height, tile[0], tile[1], true), occupancy));
+                CHECK(sameBits(runKernel(vu::cpuLightingTile, view, width, height, tile[0], tile[1], true), expected));
+            }
+        }
+
+        for (float value : lighting) {
+            CHECK(value >= 0.0f && std::isfinite(value));
+        }
+    }
+
+    return test::testResult();
+}
@@ -0,0 +1,170 @@
+#include "dirty_utils.hpp"
+#include "test_utils.hpp"
+
+#include <cstring>
+#include <vector>
+
+// The change boxes against what actually changes: move, add or drop a few
+// shapes and lights, run the kernels on the whole grid before and after, and
+// every cell that came out different has to be under a box (with the cell
+// of slack markDirty() in main.cpp gives them)
+
+struct Scene {
+    std::vector<float> lights;
+    std::vector<float> circles;
+    std::vector<float> rects;
+
+    vu::CpuScene view() const {
+        vu::CpuScene scene{};
+        scene.lights = lights.data();
+        scene.lightCount = static_cast<uint32_t>(lights.size() / 4);
+        scene.circles = circles.data();
+        scene.circleCount = static_cast<uint32_t>(circles.size() / 3);
+        scene.rects = rects.data();
+        scene.rectCount = static_cast<uint32_t>(rects.size() / 4);
+        return scene;
+    }
+};
+
+void addLight(Scene& scene, uint32_t width, uint32_t height) {
+    scene.lights.insert(scene.lights.end(), {test::uniform(0.0f, float(width)), test::uniform(0.0f, float(height)),
+                                             test::uniform(0.5f, 3.0f), test::uniform(0.05f, 0.5f)});
+}
+
+void addCircle(Scene& scene, uint32_t width, uint32_t height) {
+    scene.circles.insert(scene.circles.end(), {test::uniform(0.0f, float(width)),
+                                               test::uniform(0.0f, float(height)), test::uniform(0.2f, 2.5f)});
+}
+
+void addRect(Scene& scene, uint32_t width, uint32_t height) {
+    scene.rects.insert(scene.rects.end(), {test::uniform(0.0f, float(width)), test::uniform(0.0f, float(height)),
+                                           test::uniform(0.2f, 4.0f), test::uniform(0.2f, 4.0f)});
+}
+
+using TileKernel = void (*)(const vu::CpuScene&, vu::CpuTile, float*, uint32_t, bool, vu::CpuTileBin&);
+
+std::vector<float> runKernel(TileKernel kernel, const Scene& scene, uint32_t width, uint32_t height) {
+    std::vector<float> grid(size_t(width) * height);
+    vu::CpuTileBin bin;
+    kernel(scene.view(), {0, 0, width, height}, grid.data(), width, false, bin);
+    return grid;
+}
+
+bool covered(const std::vector<vu::GridBox>& boxes, uint32_t x, uint32_t y) {
+    for (const vu::GridBox& box : boxes) {
+        if (float(x) >= box.x0 - 1.0f && float(x) <= box.x1 + 1.0f &&
+                float(y) >= box.y0 - 1.0f && float(y) <= box.y1 + 1.0f) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// Returns how many cells changed, so the caller can tell the test did something
+size_t checkChange(const Scene& before, const Scene& after, uint32_t width, uint32_t height) {
+    std::vector<vu::GridBox> occupancyBoxes;
+    vu::occupancyChanges(before.view(), after.view(), occupancyBoxes);
+    std::vector<vu::GridBox> lightingBoxes;
+    vu::lightingChanges(before.view(), after.view(), lightingBoxes);
+
+    size_t changed = 0;
+    std::vector<float> occupancyBefore = runKernel(vu::cpuOccupancyTile, before, width, height);
+    std::vector<float> occupancyAfter = runKernel(vu::cpuOccupancyTile, after, width, height);
+    std::vector<float> lightingBefore = runKernel(vu::cpuLightingTile, before, width, height);
+    std::vector<float> lightingAfter = runKernel(vu::cpuLightingTile, after, width, height);
+    for (uint32_t y = 0; y < height; y++) {
+        for (uint32_t x = 0; x < width; x++) {
+            size_t i = x + size_t(y) * width;
+            if (occupancyBefore[i] != occupancyAfter[i]) {
+                CHECK(covered(occupancyBoxes, x, y));
+                changed++;
+            }
+            if (lightingBefore[i] != lightingAfter[i]) {
+                CHECK(covered(lightingBoxes, x, y));
+                changed++;
+            }
+        }
+    }
+    return changed;
+}
+
+int main() {
+    // Boxes of each kind of primitive
+    {
+        float circle[] = {3.0f, 4.0f, 1.5f};
+        vu::GridBox box = vu::circleBounds(circle);
+        CHECK(box.x0 == 1.5f && box.y0 == 2.5f && box.x1 == 4.5f && box.y1 == 5.5f);
+
+        float rect[] = {3.0f, 4.0f, 2.0f, 1.0f};
+        box = vu::rectBounds(rect);
+        CHECK(box.x0 == 2.0f && box.y0 == 3.5f && box.x1 == 4.0f && box.y1 == 4.5f);
+
+        // Too dim to ever pass the cutoff: nothing
+        float dim[] = {3.0f, 4.0f, vu::cpuLightCutoff * 0.5f, 1.0f};
+        box = vu::lightBounds(dim);
+        CHECK(box.x1 < box.x0);
+
+        // No falloff: everything
+        float flat[] = {3.0f, 4.0f, 1.0f, 0.0f};
+        box = vu::lightBounds(flat);
+        CHECK(box.x0 < -1.0e6f && box.x1 > 1.0e6f);
+
+        CHECK(vu::boxesOverlap({0, 0, 2, 2}, {2, 2, 3, 3}));
+        CHECK(!vu::boxesOverlap({0, 0, 2, 2}, {2.5f, 0, 3, 3}));
+    }
+
+    // Identical scenes have nothing to redo
+    {
+        Scene scene;
+        for (int i = 0; i < 5; i++) {
+            addLight(scene, 30, 30);
+            addCircle(scene, 30, 30);
+            addRect(scene, 30, 30);
+        }
+        std::vector<vu::GridBox> boxes;
+        vu::occupancyChanges(scene.view(), scene.view(), boxes);
+        vu::lightingChanges(scene.view(), scene.view(), boxes);
+        CHECK(boxes.empty());
+    }
+
+    size_t changed = 0;
+    const uint32_t sizes[][2] = {{16, 16}, {40, 23}, {64, 64}};
+    for (const auto& size : sizes) {
+        uint32_t width = size[0];
+        uint32_t height = size[1];
+        for (int round = 0; round < 40; round++) {
+            Scene before;
+            for (int i = 0; i < 4; i++) {
+                addLight(before, width, height);
+                addCircle(before, width, height);
+                addRect(before, width, height);
+            }
+
+            Scene after = before;
+            switch (round % 5) {
+                case 0: // Move a circle
+                    after.circles[0] += test::uniform(-3.0f, 3.0f);
+                    after.circles[1] += test::uniform(-3.0f, 3.0f);
+                    break;
+                case 1: // Resize a rectangle
+                    after.rects[6] = test::uniform(0.2f, 6.0f);
+                    break;
+                case 2: // Move and dim a light
+                    after.lights[4] += test::uniform(-5.0f, 5.0f);
+                    after.lights[6] *= 0.5f;
+                    break;
+                case 3: // A new shape and light on the end
+                    addCircle(after, width, height);
+                    addLight(after, width, height);
+                    break;
+                case 4: // Drop the last rectangle
+                    after.rects.resize(after.rects.size() - 4);
+                    break;
+            }
+            changed += checkChange(before, after, width, height);
+        }
+    }
+    CHECK(changed > 0);
+
+    return test::testResult();
+}
@@ -0,0 +1,83 @@
+#include "distance_utils.hpp"
+#include "test_utils.hpp"
+
+#include <cmath>
+#include <vector>
+
+// buildDistanceField() against the exact signed distance field, found by
+// looking at every cell from every cell
+
+std::vector<float> exactDistanceField(const std::vector<float>& occupancy, uint32_t width, uint32_t height) {
+    float missing = vu::missingSeedDistance(width, height);
+    std::vector<float> field(occupancy.size());
+    for (uint32_t y = 0; y < height; y++) {
+        for (uint32_t x = 0; x < width; x++) {
+            float nearest[2] = {missing, missing}; // Obstacle, free
+            for (uint32_t sy = 0; sy < height; sy++) {
+                for (uint32_t sx = 0; sx < width; sx++) {
+                    float dx = float(sx) - float(x);
+                    float dy = float(sy) - float(y);
+                    int kind = occupancy[sx + size_t(sy) * width] >= 0.5f ? 0 : 1;
+                    nearest[kind] = std::min(nearest[kind], std::sqrt(dx * dx + dy * dy));
+                }
+            }
+            field[x + size_t(y) * width] = nearest[0] - nearest[1];
+        }
+    }
+    return field;
+}
+
+void checkGrid(uint32_t width, uint32_t height, float density) {
+    std::vector<float> occupancy(size_t(width) * height);
+    for (float& value : occupancy) {
+        value = test::uniform(0.0f, 1.0f) < density ? 1.0f : 0.0f;
+    }
+    std::vector<float> expected = exactDistanceField(occupancy, width, height);
+
+    std::vector<float> field = occupancy;
+    std::vector<uint32_t> seeds;
+    vu::buildDistanceField(field.data(), width, height, seeds);
+
+    // Jump flooding can miss the nearest seed, but only for one that's
+    // barely any closer, and never gets the sign wrong
+    size_t inexact = 0;
+    for (size_t i = 0; i < field.size(); i++) {
+        bool obstacle = occupancy[i] >= 0.5f;
+        CHECK(obstacle ? field[i] < 0.0f || expected[i] == 0.0f : field[i] > 0.0f);
+        CHECK(std::fabs(field[i] - expected[i]) <= 0.5f);
+        if (field[i] != expected[i]) {
+            inexact++;
+        }
+    }
+    CHECK(inexact * 100 <= field.size());
+}
+
+int main() {
+    // A single obstacle, which jump flooding always gets exactly
+    {
+        std::vector<float> field(31 * 17, 0.0f);
+        field[12 + 5 * 31] = 1.0f;
+        std::vector<float> expected = exactDistanceField(field, 31, 17);
+        std::vector<uint32_t> seeds;
+        vu::buildDistanceField(field.data(), 31, 17, seeds);
+        CHECK(field == expected);
+    }
+
+    // Nothing but free cells is the missing seed distance everywhere
+    {
+        std::vector<float> field(9 * 12, 0.0f);
+        std::vector<uint32_t> seeds;
+        vu::buildDistanceField(field.data(), 9, 12, seeds);
+        for (float value : field) {
+            CHECK(value == vu::missingSeedDistance(9, 12));
+        }
+    }
+
+    const uint32_t sizes[][2] = {{1, 1}, {1, 40}, {20, 20}, {33, 7}, {64, 48}, {57, 61}};
+    for (const auto& size : sizes) {
+        for (float density : {0.002f, 0.02f, 0.3f, 0.9f}) {
+            checkGrid(size[0], size[1], density);
+        }
+    }
+    return test::testResult();
+}
@@ -0,0 +1,104 @@
+#include "format_utils.hpp"
+#include "test_utils.hpp"
+
+#include <cmath>
+#include <cstring>
+#include <limits>
+#include <vector>
+
+// The half float conversions at their edges, and the bulk (F16C) paths
+// against the scalar ones
+
+uint32_t floatBits(float value) {
+    uint32_t bits;
+    memcpy(&bits, &value, sizeof(bits));
+    return bits;
+}
+
+float bitsFloat(uint32_t bits) {
+    float value;
+    memcpy(&value, &bits, sizeof(value));
+    return value;
+}
+
+int main() {
+    const float infinity = std::numeric_limits<float>::infinity();
+    const float largestHalf = 65504.0f;
+
+    // Zeros keep their sign
+    CHECK(vu::floatToHalf(0.0f) == 0x0000);
+    CHECK(vu::floatToHalf(-0.0f) == 0x8000);
+    CHECK(floatBits(vu::halfToFloat(0x8000)) == 0x80000000u);
+
+    CHECK(vu::floatToHalf(1.0f) == 0x3c00);
+    CHECK(vu::floatToHalf(-2.0f) == 0xc000);
+
+    // The largest half, and where rounding tips over into infinity
+    CHECK(vu::floatToHalf(largestHalf) == 0x7bff);
+    CHECK(vu::halfToFloat(0x7bff) == largestHalf);
+    CHECK(vu::floatToHalf(65519.0f) == 0x7bff);
+    CHECK(vu::floatToHalf(65520.0f) == 0x7c00);
+    CHECK(vu::floatToHalf(1.0e6f) == 0x7c00);
+    CHECK(vu::floatToHalf(-1.0e6f) == 0xfc00);
+    CHECK(vu::floatToHalf(infinity) == 0x7c00);
+    CHECK(vu::floatToHalf(-infinity) == 0xfc00);
+    CHECK(vu::halfToFloat(0x7c00) == infinity);
+
+    // NaN stays NaN, even one whose payload is all in the low bits
+    CHECK(std::isnan(vu::halfToFloat(vu::floatToHalf(std::numeric_limits<float>::quiet_NaN()))));
+    CHECK(std::isnan(vu::halfToFloat(vu::floatToHalf(bitsFloat(0x7f800001u)))));
+
+    // Subnormals: the smallest one, ties to even on the way down to it, and
+    // rounding up out of them into the smallest normal
+    const float smallest = std::ldexp(1.0f, -24);
+    CHECK(vu::floatToHalf(smallest) == 0x0001);
+    CHECK(vu::halfToFloat(0x0001) == smallest);
+    CHECK(vu::floatToHalf(smallest * 0.5f) == 0x0000);
+    CHECK(vu::floatToHalf(smallest * 0.75f) == 0x0001);
+    CHECK(vu::floatToHalf(smallest * 1.5f) == 0x0002);
+    CHECK(vu::floatToHalf(smallest * 2.5f) == 0x0002);
+    CHECK(vu::floatToHalf(std::ldexp(1.0f, -40)) == 0x0000);
+    CHECK(vu::floatToHalf(-std::ldexp(1.0f, -40)) == 0x8000);
+    CHECK(vu::floatToHalf(std::ldexp(1.0f, -14) - smallest * 0.5f) == 0x0400);
+    CHECK(vu::halfToFloat(0x03ff) == std::ldexp(1023.0f, -24));
+
+    // Ties to even between normals: 2049 sits between 2048 and 2050
+    CHECK(vu::halfToFloat(vu::floatToHalf(2049.0f)) == 2048.0f);
+    CHECK(vu::halfToFloat(vu::floatToHalf(2051.0f)) == 2052.0f);
+
+    // Every half survives the round trip
+    for (uint32_t half = 0; half <= 0xffff; half++) {
+        bool nan = (half & 0x7c00) == 0x7c00 && (half & 0x3ff) != 0;
+        if (!nan) {
+            CHECK(vu::floatToHalf(vu::halfToFloat(static_cast<uint16_t>(half))) == half);
+        }
+    }
+
+    // The bulk conversions match the scalar ones bit for bit, tail included
+    std::vector<float> values(1001);
+    for (size_t i = 0; i < values.size(); i++) {
+        values[i] = std::ldexp(test::uniform(-1.0f, 1.0f), static_cast<int>(test::uniform(0u, 60u)) - 30);
+    }
+    values[0] = infinity;
+    values[1] = -0.0f;
+    values[2] = 65520.0f;
+    values[3] = smallest * 2.5f;
+    std::vector<uint16_t> halves(values.size());
+    vu::floatsToHalves(values.data(), halves.data(), values.size());
+    std::vector<float> decoded(values.size());
+    vu::halvesToFloats(halves.data(), decoded.data(), halves.size());
+    for (size_t i = 0; i < values.size(); i++) {
+        CHECK(halves[i] == vu::floatToHalf(values[i]));
+        CHECK(floatBits(decoded[i]) == floatBits(vu::halfToFloat(halves[i])));
+    }
+
+    // Unorm8 clamps and rounds to the nearest step
+    CHECK(vu::floatToUnorm8(-1.0f) == 0);
+    CHECK(vu::floatToUnorm8(2.0f) == 255);
+    CHECK(vu::floatToUnorm8(0.5f) == 128);
+    for (uint32_t value = 0; value <= 255; value++) {
+        CHECK(vu::floatToUnorm8(vu::unorm8ToFloat(static_cast<uint8_t>(value))) == value);
+    }
+
+    return test::testResult();
+}
@@ -0,0 +1,138 @@
+#include "format_utils.hpp"
+#include "planner_utils.hpp"
+#include "test_utils.hpp"
+
+#include <cmath>
+#include <cstring>
+#include <limits>
+#include <vector>
+
+// buildCostToGo() against plain Bellman-Ford, relaxing every cell until
+// nothing changes, which is what the GPU's tiled sweeps converge to. The two
+// add up costs the same way, so they have to agree bit for bit.
+
+std::vector<float> bellmanFord(const std::vector<float>& occupancy, uint32_t width, uint32_t height,
+                               uint32_t goalX, uint32_t goalY) {
+    const float infinity = std::numeric_limits<float>::infinity();
+    auto blocked = [&](int64_t x, int64_t y) {
+        return x < 0 || y < 0 || x >= width || y >= height || occupancy[size_t(x) + size_t(y) * width] >= 0.5f;
+    };
+
+    std::vector<float> costs(occupancy.size(), infinity);
+    if (blocked(goalX, goalY)) {
+        return costs;
+    }
+    costs[goalX + size_t(goalY) * width] = 0.0f;
+
+    bool changed = true;
+    while (changed) {
+        changed = false;
+        for (int64_t y = 0; y < height; y++) {
+            for (int64_t x = 0; x < width; x++) {
+                if (blocked(x, y)) {
+                    continue;
+                }
+                float& cost = costs[size_t(x) + size_t(y) * width];
+                for (int64_t dy = -1; dy <= 1; dy++) {
+                    for (int64_t dx = -1; dx <= 1; dx++) {
+                        if ((dx == 0 && dy == 0) || blocked(x + dx, y + dy)) {
+                            continue;
+                        }
+                        if (dx != 0 && dy != 0 && (blocked(x + dx, y) || blocked(x, y + dy))) {
+                            continue;
+                        }
+                        float next = costs[size_t(x + dx) + size_t(y + dy) * width] +
+                                     (dx != 0 && dy != 0 ? vu::plannerDiagonalCost : 1.0f);
+                        if (next < cost) {
+                            cost = next;
+                            changed = true;
+                        }
+                    }
+                }
+            }
+        }
+    }
+    return costs;
+}
+
+void checkGrid(uint32_t width, uint32_t height, float density) {
+    std::vector<float> occupancy(size_t(width) * height);
+    for (float& value : occupancy) {
+        value = test::uniform(0.0f, 1.0f) < density ? 1.0f : 0.0f;
+    }
+    uint32_t goalX = test::uniform(0u, width - 1);
+    uint32_t goalY = test::uniform(0u, height - 1);
+
+    std::vector<float> expected = bellmanFord(occupancy, width, height, goalX, goalY);
+    std::vector<float> costs = occupancy;
+    vu::buildCostToGo(costs.data(), width, height, goalX, goalY);
+    CHECK(memcmp(costs.data(), expected.data(), costs.size() * sizeof(float)) == 0);
+
+    for (float cost : costs) {
+        CHECK(std::isinf(cost) || cost <= vu::plannerCostBound(width, height));
+    }
+}
+
+// Walls every other row with a gap at alternating ends, so the only way from
+// the goal in one corner to the far end winds through every row
+void checkMaze(uint32_t width, uint32_t height) {
+    std::vector<float> costs(size_t(width) * height, 0.0f);
+    for (uint32_t y = 1; y < height; y += 2) {
+        uint32_t gap = (y / 2) % 2 == 0 ? width - 1 : 0;
+        for (uint32_t x = 0; x < width; x++) {
+            costs[x + size_t(y) * width] = x == gap ? 0.0f : 1.0f;
+        }
+    }
+    std::vector<float> expected = bellmanFord(costs, width, height, 0, 0);
+    vu::buildCostToGo(costs.data(), width, height, 0, 0);
+    CHECK(memcmp(costs.data(), expected.data(), costs.size() * sizeof(float)) == 0);
+
+    // Every corridor but the last is walked end to end, which is way more
+    // than the open map default of sweeps would get through
+    uint32_t lastRow = (height - 1) / 2 * 2;
+    float farEnd = costs[((lastRow / 2) % 2 == 0 ? width - 1 : 0) + size_t(lastRow) * width];
+    CHECK(farEnd >= float(lastRow / 2 * (width - 1)));
+    CHECK(farEnd <= vu::plannerCostBound(width, height));
+}
+
+int main() {
+    // Goal in an obstacle, everything's unreachable
+    {
+        std::vector<float> costs(10 * 10, 0.0f);
+        costs[3 + 4 * 10] = 1.0f;
+        vu::buildCostToGo(costs.data(), 10, 10, 3, 4);
+        for (float cost : costs) {
+            CHECK(std::isinf(cost));
+        }
+    }
+
+    // Diagonals can't cut an obstacle's corner
+    {
+        std::vector<float> costs(2 * 2, 0.0f);
+        costs[1] = 1.0f;
+        vu::buildCostToGo(costs.data(), 2, 2, 0, 0);
+        CHECK(costs[0] == 0.0f);
+        CHECK(costs[2] == 1.0f);
+        CHECK(costs[3] == 2.0f);
+    }
+
+    const uint32_t sizes[][2] = {{1, 1}, {1, 30}, {20, 20}, {33, 7}, {48, 40}};
+    for (const auto& size : sizes) {
+        for (float density : {0.0f, 0.1f, 0.35f}) {
+            checkGrid(size[0], size[1], density);
+        }
+    }
+    checkMaze(40, 41);
+    checkMaze(17, 64);
+
+    // What checkKernelFormat() in main.cpp relies on to keep fp16 costs
+    // finite: the bound stays within half floats up to 215x215
+    CHECK(vu::plannerCostBound(215, 215) <= vu::halfMax);
+    CHECK(vu::plannerCostBound(216, 216) > vu::halfMax);
+    CHECK(!std::isinf(vu::halfToFloat(vu::floatToHalf(vu::plannerCostBound(215, 215)))));
+    // Costs are whole cells exactly up to halfIntegerMax, not beyond
+    CHECK(vu::halfToFloat(vu::floatToHalf(vu::halfIntegerMax - 1.0f)) == vu::halfIntegerMax - 1.0f);
+    CHECK(vu::halfToFloat(vu::floatToHalf(vu::halfIntegerMax + 1.0f)) != vu::halfIntegerMax + 1.0f);
+
+    return test::testResult();
+}
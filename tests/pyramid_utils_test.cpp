@@ -0,0 +1,71 @@
+#include "pyramid_utils.hpp"
+#include "test_utils.hpp"
+
+#include <vector>
+
+// pyramidRegionAny() against scanning every cell of the region, on random
+// grids (including ones that aren't powers of two and single rows/columns)
+// and random regions, some hanging off the grid
+
+bool bruteForceRegionAny(const std::vector<float>& layer, uint32_t width, uint32_t height,
+                         uint32_t x0, uint32_t y0, uint32_t x1, uint32_t y1, float threshold, bool below) {
+    for (uint32_t y = y0; y <= y1 && y < height; y++) {
+        for (uint32_t x = x0; x <= x1 && x < width; x++) {
+            float value = layer[x + size_t(y) * width];
+            if (below ? value < threshold : value > threshold) {
+                return true;
+            }
+        }
+    }
+    return false;
+}
+
+void checkGrid(uint32_t width, uint32_t height, float density) {
+    std::vector<float> layer(size_t(width) * height);
+    for (float& value : layer) {
+        value = test::uniform(0.0f, 1.0f) < density ? test::uniform(0.5f, 1.0f) : test::uniform(0.0f, 0.5f);
+    }
+
+    std::vector<vu::PyramidLevel> levels = vu::pyramidLayout(width, height);
+    CHECK(levels.empty() == (width == 1 && height == 1));
+    if (!levels.empty()) {
+        CHECK(levels.back().width == 1 && levels.back().height == 1);
+    }
+    std::vector<float> nodes(2 * vu::pyramidNodeCount(levels));
+    vu::buildPyramid(layer.data(), width, height, levels, nodes.data());
+
+    // The top node covers the whole grid
+    if (!levels.empty()) {
+        float lo = layer[0];
+        float hi = layer[0];
+        for (float value : layer) {
+            lo = std::min(lo, value);
+            hi = std::max(hi, value);
+        }
+        CHECK(nodes[2 * levels.back().offset] == lo);
+        CHECK(nodes[2 * levels.back().offset + 1] == hi);
+    }
+
+    for (int i = 0; i < 500; i++) {
+        uint32_t x0 = test::uniform(0u, width + 2);
+        uint32_t y0 = test::uniform(0u, height + 2);
+        uint32_t x1 = x0 + test::uniform(0u, width);
+        uint32_t y1 = y0 + test::uniform(0u, height);
+        float threshold = test::uniform(0.0f, 1.0f);
+        bool below = i % 2 == 1;
+        bool expected = bruteForceRegionAny(layer, width, height, x0, y0, x1, y1, threshold, below);
+        bool actual = vu::pyramidRegionAny(layer.data(), width, height, levels, nodes.data(),
+                                           x0, y0, x1, y1, threshold, below);
+        CHECK(expected == actual);
+    }
+}
+
+int main() {
+    const uint32_t sizes[][2] = {{1, 1}, {1, 17}, {23, 1}, {2, 2}, {16, 16}, {20, 20}, {33, 7}, {64, 65}, {100, 37}};
+    for (const auto& size : sizes) {
+        for (float density : {0.0f, 0.01f, 0.2f}) {
+            checkGrid(size[0], size[1], density);
+        }
+    }
+    return test::testResult();
+}
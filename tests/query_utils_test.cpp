@@ -0,0 +1,176 @@
+#include "query_utils.hpp"
+#include "test_utils.hpp"
+
+#include <cmath>
+#include <vector>
+
+// evaluateQuery() on random grids: points and rectangles against scanning
+// the cells, segments and rays against points sampled along them, and every
+// query coming out the same with the pyramid as without
+
+struct Grid {
+    uint32_t width;
+    uint32_t height;
+    std::vector<float> layer;
+    std::vector<vu::PyramidLevel> levels;
+    std::vector<float> nodes;
+};
+
+Grid randomGrid(uint32_t width, uint32_t height, float density) {
+    Grid grid{width, height, std::vector<float>(size_t(width) * height), vu::pyramidLayout(width, height), {}};
+    for (float& value : grid.layer) {
+        value = test::uniform(0.0f, 1.0f) < density ? test::uniform(0.5f, 1.0f) : test::uniform(0.0f, 0.5f);
+    }
+    grid.nodes.resize(2 * vu::pyramidNodeCount(grid.levels));
+    vu::buildPyramid(grid.layer.data(), width, height, grid.levels, grid.nodes.data());
+    return grid;
+}
+
+vu::GridQueryResult evaluate(const Grid& grid, const vu::GridQuery& query, bool pyramid) {
+    return vu::evaluateQuery(grid.layer.data(), grid.width, grid.height, grid.levels,
+                             pyramid ? grid.nodes.data() : nullptr, query);
+}
+
+vu::GridQuery makeQuery(vu::GridQueryType type, float threshold, float x0, float y0, float x1, float y1,
+                        float range = 0.0f) {
+    vu::GridQuery query{};
+    query.type = type;
+    query.threshold = threshold;
+    query.range = range;
+    query.x0 = x0;
+    query.y0 = y0;
+    query.x1 = x1;
+    query.y1 = y1;
+    return query;
+}
+
+// Whether the point is in a cell above the threshold, -1 if it's too close to
+// a cell edge (or off the grid) to say which cell it's in
+int sampleAbove(const Grid& grid, float x, float y, float threshold) {
+    const float margin = 1e-3f;
+    if (x < 0.0f || y < 0.0f || x >= float(grid.width) || y >= float(grid.height) ||
+            x - std::floor(x) < margin || std::ceil(x) - x < margin ||
+            y - std::floor(y) < margin || std::ceil(y) - y < margin) {
+        return -1;
+    }
+    return grid.layer[uint32_t(x) + size_t(uint32_t(y)) * grid.width] > threshold ? 1 : 0;
+}
+
+// Walks (px, py) + (dx, dy) * t for t in [0, tEnd] in small steps: nothing
+// before where the query says it hit can be above the threshold, and if it
+// didn't hit, nothing at all
+void checkWalk(const Grid& grid, float px, float py, float dx, float dy, float tEnd, float threshold,
+               const vu::GridQueryResult& result) {
+    CHECK(result.value >= 0.0f && result.value <= tEnd);
+    if (!result.hit) {
+        CHECK(result.value == tEnd);
+    }
+    const int samples = 2000;
+    for (int i = 0; i <= samples; i++) {
+        float t = tEnd * float(i) / float(samples);
+        if (result.hit && t >= result.value - 1e-4f * std::max(1.0f, tEnd)) {
+            break;
+        }
+        CHECK(sampleAbove(grid, px + dx * t, py + dy * t, threshold) != 1);
+    }
+}
+
+void checkGrid(uint32_t width, uint32_t height, float density) {
+    Grid grid = randomGrid(width, height, density);
+
+    for (int i = 0; i < 300; i++) {
+        float threshold = test::uniform(0.3f, 0.9f);
+        float x0 = test::uniform(-3.0f, float(width) + 3.0f);
+        float y0 = test::uniform(-3.0f, float(height) + 3.0f);
+        float x1 = test::uniform(-3.0f, float(width) + 3.0f);
+        float y1 = test::uniform(-3.0f, float(height) + 3.0f);
+
+        // Points
+        vu::GridQuery point = makeQuery(vu::GridQueryType::Point, threshold, x0, y0, 0.0f, 0.0f);
+        vu::GridQueryResult result = evaluate(grid, point, false);
+        int32_t cellX = static_cast<int32_t>(std::floor(x0));
+        int32_t cellY = static_cast<int32_t>(std::floor(y0));
+        if (cellX >= 0 && cellY >= 0 && cellX < int32_t(width) && cellY < int32_t(height)) {
+            float value = grid.layer[cellX + size_t(cellY) * width];
+            CHECK(result.value == value);
+            CHECK(result.hit == (value > threshold ? 1u : 0u));
+        } else {
+            CHECK(result.value == 0.0f && result.hit == 0);
+        }
+
+        // Rectangles, including inverted and off the grid ones
+        vu::GridQuery rect = makeQuery(vu::GridQueryType::Rect, threshold, x0, y0, x1, y1);
+        bool expected = false;
+        for (int32_t y = std::max(int32_t(std::floor(y0)), 0); y <= std::min(int32_t(std::floor(y1)), int32_t(height) - 1); y++) {
+            for (int32_t x = std::max(int32_t(std::floor(x0)), 0); x <= std::min(int32_t(std::floor(x1)), int32_t(width) - 1); x++) {
+                expected = expected || grid.layer[x + size_t(y) * width] > threshold;
+            }
+        }
+        CHECK(evaluate(grid, rect, false).hit == (expected ? 1u : 0u));
+        CHECK(evaluate(grid, rect, true).hit == (expected ? 1u : 0u));
+
+        // Segments, which can start and end off the grid
+        vu::GridQuery segment = makeQuery(vu::GridQueryType::Segment, threshold, x0, y0, x1, y1);
+        result = evaluate(grid, segment, false);
+        checkWalk(grid, x0, y0, x1 - x0, y1 - y0, 1.0f, threshold, result);
+        vu::GridQueryResult pyramidResult = evaluate(grid, segment, true);
+        CHECK(pyramidResult.hit == result.hit && pyramidResult.value == result.value);
+
+        // Rays, unit direction and a range that may or may not reach past
+        // the grid, plus the odd axis aligned one
+        float angle = test::uniform(0.0f, 6.2831853f);
+        float dx = i % 7 == 0 ? 0.0f : std::cos(angle);
+        float dy = i % 11 == 0 ? 0.0f : std::sin(angle);
+        if (dx == 0.0f && dy == 0.0f) {
+            dx = 1.0f;
+        }
+        float range = test::uniform(0.0f, float(width + height));
+        vu::GridQuery ray = makeQuery(vu::GridQueryType::Ray, threshold, x0, y0, dx * 3.0f, dy * 3.0f, range);
+        result = evaluate(grid, ray, false);
+        float magnitude = std::sqrt(dx * 3.0f * dx * 3.0f + dy * 3.0f * dy * 3.0f);
+        checkWalk(grid, x0, y0, dx * 3.0f / magnitude, dy * 3.0f / magnitude, range, threshold, result);
+        pyramidResult = evaluate(grid, ray, true);
+        CHECK(pyramidResult.hit == result.hit && pyramidResult.value == result.value);
+    }
+}
+
+int main() {
+    // A wall across x = 5 of an otherwise empty grid
+    {
+        Grid grid = randomGrid(10, 8, 0.0f);
+        for (uint32_t y = 0; y < 8; y++) {
+            grid.layer[5 + y * 10] = 1.0f;
+        }
+        vu::buildPyramid(grid.layer.data(), 10, 8, grid.levels, grid.nodes.data());
+
+        for (bool pyramid : {false, true}) {
+            vu::GridQueryResult result = evaluate(grid, makeQuery(vu::GridQueryType::Segment, 0.5f, 1.5f, 2.5f, 9.5f, 2.5f), pyramid);
+            CHECK(result.hit == 1 && result.value == 0.4375f);
+            result = evaluate(grid, makeQuery(vu::GridQueryType::Segment, 0.5f, 1.5f, 2.5f, 4.5f, 6.5f), pyramid);
+            CHECK(result.hit == 0 && result.value == 1.0f);
+            // Starting inside the wall hits straight away
+            result = evaluate(grid, makeQuery(vu::GridQueryType::Segment, 0.5f, 5.5f, 2.5f, 0.5f, 2.5f), pyramid);
+            CHECK(result.hit == 1 && result.value == 0.0f);
+
+            // Rays measure in cells whatever length their direction is, and
+            // stop at their range
+            result = evaluate(grid, makeQuery(vu::GridQueryType::Ray, 0.5f, 1.5f, 2.5f, 0.25f, 0.0f, 100.0f), pyramid);
+            CHECK(result.hit == 1 && result.value == 3.5f);
+            result = evaluate(grid, makeQuery(vu::GridQueryType::Ray, 0.5f, 1.5f, 2.5f, 7.0f, 0.0f, 3.0f), pyramid);
+            CHECK(result.hit == 0 && result.value == 3.0f);
+            result = evaluate(grid, makeQuery(vu::GridQueryType::Ray, 0.5f, 1.5f, 2.5f, -1.0f, 0.0f, 100.0f), pyramid);
+            CHECK(result.hit == 0 && result.value == 100.0f);
+            // Coming in from off the grid
+            result = evaluate(grid, makeQuery(vu::GridQueryType::Ray, 0.5f, 20.5f, 2.5f, -1.0f, 0.0f, 100.0f), pyramid);
+            CHECK(result.hit == 1 && result.value == 14.5f);
+        }
+    }
+
+    const uint32_t sizes[][2] = {{1, 1}, {1, 20}, {17, 1}, {16, 16}, {33, 20}, {64, 61}};
+    for (const auto& size : sizes) {
+        for (float density : {0.0f, 0.02f, 0.2f}) {
+            checkGrid(size[0], size[1], density);
+        }
+    }
+    return test::testResult();
+}
@@ -0,0 +1,97 @@
+#include "reduce_utils.hpp"
+#include "test_utils.hpp"
+
+#include <cmath>
+#include <vector>
+
+// reduceGridLayer() on grids where the answers are known, and its histogram
+// and counts adding up on random ones
+
+int main() {
+    // A ramp: cell (x, y) holds x + y * width, i.e. its index
+    {
+        const uint32_t width = 16;
+        const uint32_t height = 16;
+        std::vector<float> layer(width * height);
+        for (size_t i = 0; i < layer.size(); i++) {
+            layer[i] = float(i);
+        }
+
+        // One bin per value
+        vu::GridStats stats = vu::reduceGridLayer(layer.data(), width, height, 200.0f, 0.0f, 1.0f);
+        CHECK(stats.sum == 255.0f * 256.0f / 2.0f);
+        CHECK(stats.min == 0.0f);
+        CHECK(stats.max == 255.0f);
+        CHECK(stats.countAbove == 55);
+        // 201 is (9, 12), everything from there on is above
+        CHECK(stats.bboxMinX == 0 && stats.bboxMaxX == 15);
+        CHECK(stats.bboxMinY == 12 && stats.bboxMaxY == 15);
+        bool oneEach = true;
+        for (uint32_t bin = 0; bin < vu::gridHistogramBins; bin++) {
+            oneEach = oneEach && stats.histogram[bin] == 1;
+        }
+        CHECK(oneEach);
+    }
+
+    // Nothing above the threshold leaves the box empty
+    {
+        std::vector<float> layer(5 * 3, 0.25f);
+        vu::GridStats stats = vu::reduceGridLayer(layer.data(), 5, 3, 0.5f, 0.0f, 256.0f);
+        CHECK(stats.countAbove == 0);
+        CHECK(stats.bboxMinX > stats.bboxMaxX && stats.bboxMinY > stats.bboxMaxY);
+        CHECK(stats.histogram[64] == 15);
+    }
+
+    // Values off either end of the histogram go in its first and last bins
+    CHECK(vu::histogramBin(-5.0f, 0.0f, 256.0f) == 0);
+    CHECK(vu::histogramBin(2.0f, 0.0f, 256.0f) == vu::gridHistogramBins - 1);
+    CHECK(vu::histogramBin(1.0f, -1.0f, 128.0f) == vu::gridHistogramBins - 1);
+    CHECK(vu::histogramBin(0.0f, -1.0f, 128.0f) == 128);
+    CHECK(vu::histogramBin(INFINITY, 0.0f, 1.0f) == vu::gridHistogramBins - 1);
+
+    // Random grids: the bins hold every cell, the box holds every cell above
+    // the threshold and each of its edges touches one
+    const uint32_t sizes[][2] = {{1, 1}, {1, 50}, {31, 17}, {100, 100}};
+    for (const auto& size : sizes) {
+        uint32_t width = size[0];
+        uint32_t height = size[1];
+        std::vector<float> layer(size_t(width) * height);
+        for (float& value : layer) {
+            value = test::uniform(0.0f, 1.0f) < 0.1f ? test::uniform(0.5f, 2.0f) : test::uniform(-1.0f, 0.5f);
+        }
+        float threshold = 0.5f;
+        vu::GridStats stats = vu::reduceGridLayer(layer.data(), width, height, threshold, -1.0f, 128.0f);
+
+        uint64_t binned = 0;
+        for (uint32_t bin = 0; bin < vu::gridHistogramBins; bin++) {
+            binned += stats.histogram[bin];
+        }
+        CHECK(binned == layer.size());
+
+        uint32_t above = 0;
+        bool inside = true;
+        bool touches[4] = {false, false, false, false};
+        for (uint32_t y = 0; y < height; y++) {
+            for (uint32_t x = 0; x < width; x++) {
+                float value = layer[x + size_t(y) * width];
+                CHECK(value >= stats.min && value <= stats.max);
+                if (value > threshold) {
+                    above++;
+                    inside = inside && x >= stats.bboxMinX && x <= stats.bboxMaxX &&
+                                       y >= stats.bboxMinY && y <= stats.bboxMaxY;
+                    touches[0] = touches[0] || x == stats.bboxMinX;
+                    touches[1] = touches[1] || x == stats.bboxMaxX;
+                    touches[2] = touches[2] || y == stats.bboxMinY;
+                    touches[3] = touches[3] || y == stats.bboxMaxY;
+                }
+            }
+        }
+        CHECK(above == stats.countAbove);
+        CHECK(inside);
+        if (above > 0) {
+            CHECK(touches[0] && touches[1] && touches[2] && touches[3]);
+        }
+    }
+
+    return test::testResult();
+}
@@ -0,0 +1,146 @@
+#include "cpu_kernels.hpp"
+#include "shape_index_utils.hpp"
+#include "test_utils.hpp"
+
+#include <algorithm>
+#include <cstring>
+#include <vector>
+
+// The shape index: its layout helpers, visitShapeIndex() finding every shape
+// that overlaps a box, and the CPU kernels coming out bit for bit the same
+// with it as without
+
+void checkTree(const vu::ShapeIndexTree& tree, uint32_t count) {
+    std::vector<uint32_t> sorted = tree.order;
+    std::sort(sorted.begin(), sorted.end());
+    bool permutation = sorted.size() == count;
+    for (uint32_t i = 0; permutation && i < count; i++) {
+        permutation = sorted[i] == i;
+    }
+    CHECK(permutation);
+    CHECK(tree.leaves.size() == vu::shapeIndexLeafCount(count));
+    CHECK(tree.clusters.size() == vu::shapeIndexClusterCount(count));
+}
+
+int main() {
+    CHECK(vu::shapeIndexLeafCount(0) == 0);
+    CHECK(vu::shapeIndexLeafCount(1) == 1);
+    CHECK(vu::shapeIndexLeafCount(vu::shapeIndexLeafSize) == 1);
+    CHECK(vu::shapeIndexLeafCount(vu::shapeIndexLeafSize + 1) == 2);
+    CHECK(vu::shapeIndexClusterCount(vu::shapeIndexLeafSize * vu::shapeIndexClusterSize) == 1);
+    CHECK(vu::shapeIndexClusterCount(vu::shapeIndexLeafSize * vu::shapeIndexClusterSize + 1) == 2);
+
+    // Morton codes interleave x into the even bits and y into the odd ones,
+    // clamping to the grid and shifting big grids down to the bits there are
+    CHECK(vu::mortonSpread(0xFFFFu) == 0x55555555u);
+    CHECK(vu::shapeMortonCode(3.5f, 0.5f, 16, 16) == 0x5u);
+    CHECK(vu::shapeMortonCode(0.5f, 3.5f, 16, 16) == 0xAu);
+    CHECK(vu::shapeMortonCode(-10.0f, 100.0f, 16, 16) == vu::shapeMortonCode(0.0f, 15.0f, 16, 16));
+    CHECK(vu::shapeIndexMortonShift(1024, 1000) == 0);
+    CHECK(vu::shapeIndexMortonShift(4096, 16) == 2);
+
+    // Passes always come out even, and there's only so much key to go round
+    CHECK(vu::shapeIndexSortPasses(1) % 2 == 0);
+    CHECK(vu::shapeIndexSortPasses(1000) % 2 == 0);
+    CHECK(vu::shapeIndexSortPasses(1000) >= vu::shapeIndexSortPasses(1));
+    bool threw = false;
+    try {
+        vu::shapeIndexSortPasses(1u << 12);
+    } catch (const std::runtime_error&) {
+        threw = true;
+    }
+    CHECK(threw);
+
+    const uint32_t width = 200;
+    const uint32_t height = 150;
+    for (uint32_t count : {0u, 1u, 31u, 32u, 33u, 1500u}) {
+        std::vector<float> circles;
+        std::vector<float> rects;
+        for (uint32_t i = 0; i < count; i++) {
+            circles.insert(circles.end(), {test::uniform(-5.0f, float(width) + 5.0f),
+                                           test::uniform(-5.0f, float(height) + 5.0f), test::uniform(0.1f, 4.0f)});
+            rects.insert(rects.end(), {test::uniform(-5.0f, float(width) + 5.0f), test::uniform(-5.0f, float(height) + 5.0f),
+                                       test::uniform(0.1f, 8.0f), test::uniform(0.1f, 8.0f)});
+        }
+        vu::ShapeIndex index;
+        vu::buildShapeIndex(circles.data(), count, rects.data(), count, width, height, index);
+        checkTree(index.circles, count);
+        checkTree(index.rects, count);
+
+        // Sorted by Morton code
+        bool ordered = true;
+        for (uint32_t i = 1; i < count; i++) {
+            const float* a = circles.data() + 3 * size_t(index.circles.order[i - 1]);
+            const float* b = circles.data() + 3 * size_t(index.circles.order[i]);
+            ordered = ordered && vu::shapeMortonCode(a[0], a[1], width, height) <= vu::shapeMortonCode(b[0], b[1], width, height);
+        }
+        CHECK(ordered);
+
+        // Every shape overlapping a box is visited, each at most once
+        for (int query = 0; query < 200; query++) {
+            float minX = test::uniform(-10.0f, float(width));
+            float minY = test::uniform(-10.0f, float(height));
+            float maxX = minX + test::uniform(0.0f, 40.0f);
+            float maxY = minY + test::uniform(0.0f, 40.0f);
+
+            std::vector<uint32_t> visits(count, 0);
+            vu::visitShapeIndex(index.circles, minX, minY, maxX, maxY, [&](uint32_t i) { visits[i]++; });
+            bool found = true;
+            for (uint32_t i = 0; i < count; i++) {
+                const float* c = circles.data() + 3 * size_t(i);
+                bool overlaps = c[0] - c[2] <= maxX && c[0] + c[2] >= minX && c[1] - c[2] <= maxY && c[1] + c[2] >= minY;
+                found = found && visits[i] <= 1 && (!overlaps || visits[i] == 1);
+            }
+            CHECK(found);
+
+            std::fill(visits.begin(), visits.end(), 0);
+            vu::visitShapeIndex(index.rects, minX, minY, maxX, maxY, [&](uint32_t i) { visits[i]++; });
+            found = true;
+            for (uint32_t i = 0; i < count; i++) {
+                const float* r = rects.data() + 4 * size_t(i);
+                bool overlaps = r[0] - r[2] * 0.5f <= maxX && r[0] + r[2] * 0.5f >= minX &&
+                                r[1] - r[3] * 0.5f <= maxY && r[1] + r[3] * 0.5f >= minY;
+                found = found && visits[i] <= 1 && (!overlaps || visits[i] == 1);
+            }
+            CHECK(found);
+        }
+
+        // Binning through the index changes nothing the kernels compute
+        std::vector<float> lights;
+        for (int i = 0; i < 8; i++) {
+            lights.insert(lights.end(), {test::uniform(0.0f, float(width)), test::uniform(0.0f, float(height)),
+                                         test::uniform(0.5f, 3.0f), test::uniform(0.01f, 0.3f)});
+        }
+        vu::CpuScene scene{};
+        scene.lights = lights.data();
+        scene.lightCount = static_cast<uint32_t>(lights.size() / 4);
+        scene.circles = circles.data();
+        scene.circleCount = count;
+        scene.rects = rects.data();
+        scene.rectCount = count;
+        vu::CpuScene indexed = scene;
+        indexed.index = &index;
+
+        vu::CpuTileBin bin;
+        std::vector<float> plain(size_t(width) * height);
+        std::vector<float> through(size_t(width) * height);
+        for (uint32_t y = 0; y < height; y += 16) {
+            for (uint32_t x = 0; x < width; x += 64) {
+                vu::CpuTile tile{x, y, std::min(x + 64, width), std::min(y + 16, height)};
+                vu::cpuOccupancyTile(scene, tile, plain.data(), width, false, bin);
+                vu::cpuOccupancyTile(indexed, tile, through.data(), width, false, bin);
+            }
+        }
+        CHECK(memcmp(plain.data(), through.data(), plain.size() * sizeof(float)) == 0);
+        for (uint32_t y = 0; y < height; y += 16) {
+            for (uint32_t x = 0; x < width; x += 64) {
+                vu::CpuTile tile{x, y, std::min(x + 64, width), std::min(y + 16, height)};
+                vu::cpuLightingTile(scene, tile, plain.data(), width, false, bin);
+                vu::cpuLightingTile(indexed, tile, through.data(), width, false, bin);
+            }
+        }
+        CHECK(memcmp(plain.data(), through.data(), plain.size() * sizeof(float)) == 0);
+    }
+
+    return test::testResult();
+}
@@ -0,0 +1,131 @@
+#include "shm_ring_utils.hpp"
+#include "test_utils.hpp"
+
+#include <string>
+#include <vector>
+
+#include <unistd.h>
+
+// vu::ShmRing with both ends in this process: records going round the ring
+// many times (so wrapping and skip records get exercised), a full ring, and
+// opening things that aren't a ring
+
+template <typename F>
+bool throws(F f) {
+    try {
+        f();
+    } catch (const std::runtime_error&) {
+        return true;
+    }
+    return false;
+}
+
+uint8_t payloadByte(uint64_t sequence, uint32_t i) {
+    return static_cast<uint8_t>(sequence * 31 + i);
+}
+
+int main() {
+    const std::string name = "/klingon-test-" + std::to_string(getpid());
+
+    CHECK(throws([&] { vu::ShmRing missing(name); }));
+
+    // A zeroed object of the right size has no magic, so it isn't a ring
+    {
+        int fd = shm_open(name.c_str(), O_CREAT | O_RDWR, 0600);
+        CHECK(fd >= 0);
+        CHECK(ftruncate(fd, vu::shmRingHeaderSize * 2) == 0);
+        close(fd);
+        CHECK(throws([&] { vu::ShmRing notARing(name); }));
+        shm_unlink(name.c_str());
+    }
+
+    vu::ShmRing producer(name, 1000);
+    CHECK(producer.size() == 2 * vu::shmRingHeaderSize);
+    const size_t capacity = producer.size() - vu::shmRingHeaderSize;
+    vu::ShmRing consumer(name);
+    CHECK(consumer.size() == producer.size());
+
+    vu::ShmRecord record;
+    CHECK(!consumer.read(record));
+    CHECK(throws([&] { producer.reserve(vu::shmRecordSkip, 4); }));
+    CHECK(throws([&] { producer.reserve(1, static_cast<uint32_t>(capacity)); }));
+
+    // Sizes that don't divide the capacity, so records regularly land too
+    // close to the end and the producer has to skip to the start
+    std::vector<uint8_t> payload(5000);
+    uint64_t written = 0;
+    uint64_t read = 0;
+    uint64_t wraps = 0;
+    size_t lastOffset = 0;
+    for (int round = 0; round < 400; round++) {
+        // Fill it up until it's full, then read and release most of it
+        while (true) {
+            uint32_t size = 1 + static_cast<uint32_t>((written * 977) % payload.size());
+            for (uint32_t i = 0; i < size; i++) {
+                payload[i] = payloadByte(written, i);
+            }
+            if (!producer.write(1 + written % 3, payload.data(), size)) {
+                break;
+            }
+            written++;
+        }
+        CHECK(written > read);
+
+        uint64_t keep = round % 5 == 0 ? 0 : 1;
+        while (read + keep < written && consumer.read(record)) {
+            uint32_t size = 1 + static_cast<uint32_t>((read * 977) % payload.size());
+            CHECK(record.sequence == read);
+            CHECK(record.type == 1 + read % 3);
+            CHECK(record.size == size);
+            CHECK(record.offset % vu::shmRingRecordAlignment == 0);
+            CHECK(record.offset + record.size <= consumer.size());
+            CHECK(record.payload == static_cast<const char*>(consumer.data()) + record.offset);
+            const uint8_t* bytes = static_cast<const uint8_t*>(record.payload);
+            bool intact = true;
+            for (uint32_t i = 0; i < size; i++) {
+                intact = intact && bytes[i] == payloadByte(read, i);
+            }
+            CHECK(intact);
+
+            if (record.offset < lastOffset) {
+                wraps++;
+            }
+            lastOffset = record.offset;
+            read++;
+        }
+        consumer.release(consumer.position());
+    }
+    CHECK(wraps > 100);
+
+    // Nothing is lost when a new consumer takes over, it starts at the
+    // last release
+    {
+        vu::ShmRing takeover(name);
+        uint64_t next = read;
+        while (takeover.read(record)) {
+            CHECK(record.sequence == next);
+            next++;
+        }
+        CHECK(next == written);
+    }
+
+    // A record filling the whole ring only fits at the start. Asking for it
+    // midway publishes the skip to there, and once that's released it goes in.
+    while (consumer.read(record)) {
+    }
+    consumer.release(consumer.position());
+    uint32_t whole = static_cast<uint32_t>(capacity - sizeof(vu::ShmRecordHeader));
+    CHECK(producer.reserve(1, whole) == nullptr);
+    CHECK(!consumer.read(record));
+    consumer.release(consumer.position());
+    CHECK(producer.reserve(1, whole) != nullptr);
+    producer.commit();
+    CHECK(consumer.read(record));
+    CHECK(record.size == whole);
+    CHECK(record.offset == vu::shmRingHeaderSize + sizeof(vu::ShmRecordHeader));
+    CHECK(!producer.write(1, payload.data(), 1));
+    consumer.release(consumer.position());
+    CHECK(producer.write(1, payload.data(), 1));
+
+    return test::testResult();
+}
@@ -0,0 +1,48 @@
+#include <cstdio>
+#include <random>
+
+#ifndef KLINGON__TEST_UTILS_HPP
+#define KLINGON__TEST_UTILS_HPP
+
+// Just enough for the header tests, no framework. A failed CHECK prints where
+// it was and the test carries on, main() returns testResult() at the end.
+
+namespace test {
+    inline int failures = 0;
+
+    inline void fail(const char* file, int line, const char* condition) {
+        std::fprintf(stderr, "%s:%d: CHECK(%s) failed\n", file, line, condition);
+        failures++;
+    }
+
+    // Same sequence every run, so failures can be reproduced
+    inline std::mt19937& random() {
+        static std::mt19937 generator(12345);
+        return generator;
+    }
+
+    inline float uniform(float lo, float hi) {
+        return std::uniform_real_distribution<float>(lo, hi)(random());
+    }
+
+    inline uint32_t uniform(uint32_t lo, uint32_t hi) {
+        return std::uniform_int_distribution<uint32_t>(lo, hi)(random());
+    }
+
+    inline int testResult() {
+        if (failures > 0) {
+            std::fprintf(stderr, "%d checks failed\n", failures);
+            return 1;
+        }
+        return 0;
+    }
+} // namespace test
+
+#define CHECK(condition) \
+    do { \
+        if (!(condition)) { \
+            test::fail(__FILE__, __LINE__, #condition); \
+        } \
+    } while (false)
+
+#endif // KLINGON__TEST_UTILS_HPP
@@ -0,0 +1,67 @@
+#include "thread_utils.hpp"
+#include "test_utils.hpp"
+
+#include <atomic>
+#include <stdexcept>
+#include <vector>
+
+// vu::ThreadPool: every piece runs exactly once however the pool is sized,
+// jobs back to back reuse the same workers, and exceptions get back to the
+// caller
+
+void checkPool(vu::ThreadPool& pool) {
+    for (size_t count : {size_t(0), size_t(1), size_t(3), size_t(64), size_t(1000), size_t(10007)}) {
+        std::vector<std::atomic<uint32_t>> runs(count);
+        pool.parallelFor(count, [&](size_t i) { runs[i]++; });
+        bool once = true;
+        for (const auto& run : runs) {
+            once = once && run == 1;
+        }
+        CHECK(once);
+    }
+
+    // Lots of tiny jobs in a row, which is how the CPU backend uses it
+    std::atomic<uint64_t> sum{0};
+    for (int job = 0; job < 500; job++) {
+        pool.parallelFor(17, [&](size_t i) { sum += i; });
+    }
+    CHECK(sum == 500 * (16 * 17 / 2));
+
+    // Whichever piece throws, the rest still run and the caller gets it
+    std::atomic<uint32_t> ran{0};
+    bool caught = false;
+    try {
+        pool.parallelFor(100, [&](size_t i) {
+            ran++;
+            if (i % 10 == 3) {
+                throw std::runtime_error("piece failed!");
+            }
+        });
+    } catch (const std::runtime_error&) {
+        caught = true;
+    }
+    CHECK(caught);
+    CHECK(ran == 100);
+
+    // And the pool is fine afterwards
+    std::atomic<uint32_t> after{0};
+    pool.parallelFor(50, [&](size_t) { after++; });
+    CHECK(after == 50);
+}
+
+int main() {
+    // The caller works too, so a pool of 1 has no workers of its own
+    vu::ThreadPool single(1);
+    CHECK(single.size() == 1);
+    checkPool(single);
+
+    vu::ThreadPool four(4);
+    CHECK(four.size() == 4);
+    checkPool(four);
+
+    vu::ThreadPool hardware;
+    CHECK(hardware.size() >= 1);
+    checkPool(hardware);
+
+    return test::testResult();
+}
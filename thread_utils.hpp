@@ -0,0 +1,133 @@
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <exception>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#ifndef KLINGON__THREAD_UTILS_HPP
+#define KLINGON__THREAD_UTILS_HPP
+
+namespace vu {
+    // Fixed set of worker threads for splitting one job into many small
+    // independent pieces (e.g. grid tiles). The thread calling parallelFor()
+    // works through pieces as well, so a pool of 1 has no workers at all.
+    class ThreadPool {
+        public:
+            // 0 means one thread per hardware thread
+            explicit ThreadPool(uint32_t threadCount = 0) {
+                if (threadCount == 0) {
+                    threadCount = std::max(1u, std::thread::hardware_concurrency());
+                }
+                for (uint32_t i = 1; i < threadCount; i++) {
+                    workers.emplace_back([this] { workerLoop(); });
+                }
+            }
+
+            ~ThreadPool() {
+                {
+                    std::lock_guard<std::mutex> lock(mutex);
+                    stopping = true;
+                }
+                wake.notify_all();
+                for (std::thread& worker : workers) {
+                    worker.join();
+                }
+            }
+
+            ThreadPool(const ThreadPool&) = delete;
+            ThreadPool& operator=(const ThreadPool&) = delete;
+
+            uint32_t size() const {
+                return static_cast<uint32_t>(workers.size()) + 1;
+            }
+
+            // Call fn(i) for every i in [0, count), in no particular order,
+            // and return once they're all done. The first exception thrown by
+            // any of them is rethrown here.
+            void parallelFor(size_t count, const std::function<void(size_t)>& fn) {
+                if (count == 0) {
+                    return;
+                }
+
+                {
+                    std::lock_guard<std::mutex> lock(mutex);
+                    job = &fn;
+                    jobCount = count;
+                    next = 0;
+                    busyWorkers = static_cast<uint32_t>(workers.size());
+                    error = nullptr;
+                    generation++;
+                }
+                wake.notify_all();
+
+                drain(fn, count);
+
+                std::unique_lock<std::mutex> lock(mutex);
+                done.wait(lock, [this] { return busyWorkers == 0; });
+                job = nullptr;
+                if (error) {
+                    std::rethrow_exception(error);
+                }
+            }
+
+        private:
+            std::vector<std::thread> workers;
+            std::mutex mutex;
+            std::condition_variable wake;
+            std::condition_variable done;
+
+            // The current job, guarded by `mutex` apart from `next`
+            const std::function<void(size_t)>* job = nullptr;
+            size_t jobCount = 0;
+            std::atomic<size_t> next{0};
+            uint32_t busyWorkers = 0;
+            uint64_t generation = 0;
+            std::exception_ptr error;
+            bool stopping = false;
+
+            void workerLoop() {
+                uint64_t seenGeneration = 0;
+                while (true) {
+                    const std::function<void(size_t)>* fn;
+                    size_t count;
+                    {
+                        std::unique_lock<std::mutex> lock(mutex);
+                        wake.wait(lock, [&] { return stopping || generation != seenGeneration; });
+                        if (stopping) {
+                            return;
+                        }
+                        seenGeneration = generation;
+                        fn = job;
+                        count = jobCount;
+                    }
+
+                    drain(*fn, count);
+
+                    std::lock_guard<std::mutex> lock(mutex);
+                    if (--busyWorkers == 0) {
+                        done.notify_one();
+                    }
+                }
+            }
+
+            // Take pieces until there are none left
+            void drain(const std::function<void(size_t)>& fn, size_t count) {
+                for (size_t i = next++; i < count; i = next++) {
+                    try {
+                        fn(i);
+                    } catch (...) {
+                        std::lock_guard<std::mutex> lock(mutex);
+                        if (!error) {
+                            error = std::current_exception();
+                        }
+                    }
+                }
+            }
+    };
+} // namespace vu
+
+#endif // KLINGON__THREAD_UTILS_HPP
@@ -0,0 +1,73 @@
+#include <cstdint>
+#include <cstdio>
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include <vulkan/vulkan.h>
+
+#ifndef KLINGON__TUNING_UTILS_HPP
+#define KLINGON__TUNING_UTILS_HPP
+
+namespace vu {
+    // The fastest workgroup size found for one kernel on one device (keyed by
+    // its pipelineCacheUUID) at one grid size
+    struct TunedWorkgroupSize {
+        std::string deviceUuid;
+        uint32_t gridWidth;
+        uint32_t gridHeight;
+        std::string shaderName;
+        uint32_t x;
+        uint32_t y;
+    };
+
+    std::string uuidToHex(const uint8_t uuid[VK_UUID_SIZE]) {
+        std::string hex;
+        char byte[3];
+        for (uint32_t i = 0; i < VK_UUID_SIZE; i++) {
+            snprintf(byte, sizeof(byte), "%02x", uuid[i]);
+            hex += byte;
+        }
+        return hex;
+    }
+
+    // One entry per line: uuid width height shader x y. A missing file just
+    // means nothing has been tuned yet.
+    std::vector<TunedWorkgroupSize> loadWorkgroupTuning(const std::string& path) {
+        std::vector<TunedWorkgroupSize> entries;
+        std::ifstream file(path);
+
+        std::string line;
+        while (std::getline(file, line)) {
+            if (line.empty() || line[0] == '#') {
+                continue;
+            }
+
+            std::istringstream fields(line);
+            TunedWorkgroupSize entry;
+            if (fields >> entry.deviceUuid >> entry.gridWidth >> entry.gridHeight
+                    >> entry.shaderName >> entry.x >> entry.y) {
+                entries.push_back(entry);
+            }
+        }
+
+        return entries;
+    }
+
+    void saveWorkgroupTuning(const std::string& path, const std::vector<TunedWorkgroupSize>& entries) {
+        std::ofstream file(path, std::ios::trunc);
+        if (!file.is_open()) {
+            throw std::runtime_error("failed to open workgroup tuning file!");
+        }
+
+        file << "# device-uuid grid-width grid-height shader local-size-x local-size-y\n";
+        for (const auto& entry : entries) {
+            file << entry.deviceUuid << ' ' << entry.gridWidth << ' ' << entry.gridHeight << ' '
+                 << entry.shaderName << ' ' << entry.x << ' ' << entry.y << '\n';
+        }
+    }
+} // namespace vu
+
+#endif // KLINGON__TUNING_UTILS_HPP